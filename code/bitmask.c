@@ -11,11 +11,16 @@
 #include "bitmask.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 
 /** Create one BITMASK with N bits */
-BITMASK *new_bitmask(BITMASK *mask, int N) {
+BITMASK *new_bitmask(BITMASK *mask, long long N) {
 	assert(N > 0);
 	BITMASK *nova;
 	if (mask == NULL)
@@ -24,11 +29,47 @@ BITMASK *new_bitmask(BITMASK *mask, int N) {
 		nova = mask;
 	nova->b_len = N;
 	nova->B_len = ((N - 1) / 8) + 1;
+	nova->fd = -1;
 	nova->mask = (char *) malloc(nova->B_len);
 	clear_bits(nova);
 	return nova;
 }
 
+/** Create one BITMASK with N bits; masks longer than BITMASK_MMAP_BYTES are mapped
+ *  from the file 'path'. The file is unlinked after being opened: it only gives the
+ *  kernel somewhere to write the mask's pages back, so memory use stays bounded */
+BITMASK *new_bitmask_mapped(BITMASK *mask, long long N, const char *path) {
+	assert((N > 0) && (path != NULL));
+	long long B_len = ((N - 1) / 8) + 1;
+	if (B_len <= BITMASK_MMAP_BYTES)
+		return new_bitmask(mask, N);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror("open bitmask file");
+		return NULL;
+	}
+	unlink(path);
+	// A new file reads as zeros: no need to clear the bits
+	if (ftruncate(fd, B_len)) {
+		perror("ftruncate bitmask file");
+		close(fd);
+		return NULL;
+	}
+	char *m = (char *) mmap(NULL, B_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (m == MAP_FAILED) {
+		perror("mmap bitmask file");
+		close(fd);
+		return NULL;
+	}
+	BITMASK *nova = (mask == NULL) ? (BITMASK *) malloc(sizeof(BITMASK)) : mask;
+	nova->b_len = N;
+	nova->B_len = B_len;
+	nova->fd = fd;
+	nova->mask = m;
+	return nova;
+}
+
 /** Create a copy of bitmask src */
 BITMASK *clone_bitmask(BITMASK *dest, BITMASK *src) {
 	assert(src != NULL);
@@ -36,6 +77,7 @@ BITMASK *clone_bitmask(BITMASK *dest, BITMASK *src) {
 		dest = (BITMASK *) malloc(sizeof(BITMASK));
 	dest->b_len = src->b_len;
 	dest->B_len = src->B_len;
+	dest->fd = -1;
 	dest->mask = (char *) malloc(src->B_len);
 	memcpy(dest->mask, src->mask, src->B_len);
 	return dest;
@@ -45,6 +87,7 @@ BITMASK *clone_bitmask(BITMASK *dest, BITMASK *src) {
 void new_empty_bitmask(BITMASK *mask) {
 	assert(mask != NULL);
 	mask->B_len = mask->b_len = 0;
+	mask->fd = -1;
 	mask->mask = NULL;
 }
 
@@ -52,7 +95,12 @@ void new_empty_bitmask(BITMASK *mask) {
 void free_bitmask(BITMASK *mask) {
 	assert(mask != NULL);
 	if (mask->mask != NULL) {
-		free(mask->mask);
+		if (mask->fd >= 0) {
+			munmap(mask->mask, mask->B_len);
+			close(mask->fd);
+			mask->fd = -1;
+		} else
+			free(mask->mask);
 		mask->mask = NULL;
 		mask->B_len = 0;
 		mask->b_len = 0;
@@ -66,28 +114,43 @@ gboolean bitmask_isempty(BITMASK *mask) {
 }
 
 /** Return the value of bit 'n' */
-gboolean bit_isset(BITMASK *mask, int n) {
+gboolean bit_isset(BITMASK *mask, long long n) {
 	assert(mask != NULL);
 	assert((n < mask->b_len) && (n>=0));
 	return (mask->mask[n / 8] & (1 << (n % 8))) != 0;
 }
 
 /** Set bit 'n' to 1 */
-BITMASK *set_bit(BITMASK *mask, int n) {
+BITMASK *set_bit(BITMASK *mask, long long n) {
 	assert(mask != NULL);
 	assert((n < mask->b_len) && (n>=0));
 	mask->mask[n / 8] |= (1 << (n % 8));
 	return mask;
 }
 
+/** Atomically set bit 'n' to 1 and return its previous value */
+gboolean test_and_set_bit(BITMASK *mask, long long n) {
+	assert(mask != NULL);
+	assert((n < mask->b_len) && (n>=0));
+	char bit = (char) (1 << (n % 8));
+	return (__atomic_fetch_or(&mask->mask[n / 8], bit, __ATOMIC_ACQ_REL) & bit) != 0;
+}
+
 /** Set bit 'n' to 0 */
-BITMASK *unset_bit(BITMASK *mask, int n) {
+BITMASK *unset_bit(BITMASK *mask, long long n) {
 	assert(mask != NULL);
 	assert((n < mask->b_len) && (n>=0));
 	mask->mask[n / 8] &= ~(1 << (n % 8));
 	return mask;
 }
 
+/** Atomically set bit 'n' to 0 - safe with concurrent writers */
+void atomic_unset_bit(BITMASK *mask, long long n) {
+	assert(mask != NULL);
+	assert((n < mask->b_len) && (n>=0));
+	__atomic_fetch_and(&mask->mask[n / 8], (char) ~(1 << (n % 8)), __ATOMIC_ACQ_REL);
+}
+
 /** Set all bits to 0 */
 BITMASK *clear_bits(BITMASK *mask) {
 	assert(mask != NULL);
@@ -98,7 +161,7 @@ BITMASK *clear_bits(BITMASK *mask) {
 
 /** Set all bits to 1 */
 BITMASK *set_allbits(BITMASK *mask) {
-	int i;
+	long long i;
 	assert(mask != NULL);
 	for (i = 0; i < mask->B_len; i++)
 		mask->mask[i] = 0xFF;
@@ -107,7 +170,7 @@ BITMASK *set_allbits(BITMASK *mask) {
 
 /** Calculate NOT of all bits */
 BITMASK *not_bits(BITMASK *mask) {
-	int i;
+	long long i;
 	assert(mask != NULL);
 	for (i = 0; i < mask->B_len; i++)
 		mask->mask[i] = ~mask->mask[i];
@@ -116,7 +179,7 @@ BITMASK *not_bits(BITMASK *mask) {
 
 /** Calculate the OR of two masks */
 BITMASK *or_bitmasks(BITMASK *mask1, BITMASK *mask2) {
-	int i;
+	long long i;
 	assert(mask1 != NULL);
 	assert(mask2 != NULL);
 	assert(mask1->b_len == mask2->b_len);
@@ -127,7 +190,7 @@ BITMASK *or_bitmasks(BITMASK *mask1, BITMASK *mask2) {
 
 /** Calculate the AND of two masks */
 BITMASK *and_bitmasks(BITMASK *mask1, BITMASK *mask2) {
-	int i;
+	long long i;
 	assert(mask1 != NULL);
 	assert(mask2 != NULL);
 	assert(mask1->b_len == mask2->b_len);
@@ -136,11 +199,17 @@ BITMASK *and_bitmasks(BITMASK *mask1, BITMASK *mask2) {
 	return mask1;
 }
 
-/** Count the number of bits set to 1 in the mask */
-int count_bits(BITMASK *mask) {
-	int i, cnt = 0;
+/** Count the number of bits set to 1 in the mask; whole 64-bit words first */
+long long count_bits(BITMASK *mask) {
+	long long i, cnt = 0, words;
+	uint64_t w;
 	assert(mask != NULL);
-	for (i = 0; i < mask->b_len; i++)
+	words = mask->b_len / 64;
+	for (i = 0; i < words; i++) {
+		memcpy(&w, mask->mask + i * 8, sizeof(w));
+		cnt += __builtin_popcountll(w);
+	}
+	for (i = words * 64; i < mask->b_len; i++)
 		if (bit_isset(mask, i))
 			cnt++;
 	return cnt;
@@ -152,20 +221,34 @@ gboolean all_bits(BITMASK *mask) {
 	return (count_bits(mask) == mask->b_len);
 }
 
+/** Return the first bit set to 0 at or after bit 'from', or b_len if there is none;
+ *  skips the full bytes without testing each bit */
+long long first_unset_bit(BITMASK *mask, long long from) {
+	assert(mask != NULL);
+	long long n = (from < 0) ? 0 : from;
+	while ((n < mask->b_len) && (n % 8 != 0) && bit_isset(mask, n))
+		n++;
+	while ((n % 8 == 0) && (n + 8 <= mask->b_len) && ((unsigned char) mask->mask[n / 8] == 0xFF))
+		n += 8;
+	while ((n < mask->b_len) && bit_isset(mask, n))
+		n++;
+	return n;
+}
+
 /** Return a string showing VISIBLE_BITS(20) of the bitmask */
 const char *bitmask_to_string(BITMASK *mask) {
 #define VISIBLE_BITS	20
-	static char buf[100];
+	static __thread char buf[100];
 	assert(mask != NULL);
 	int i, min = (mask->b_len > VISIBLE_BITS ? VISIBLE_BITS : mask->b_len);
-	int cnt = 0, todos = count_bits(mask);
+	long long cnt = 0, todos = count_bits(mask);
 	for (i = 0; i < min; i++) {
 		buf[i] = bit_isset(mask, i) ? '1' : '0';
 		if (bit_isset(mask, i))
 			cnt++;
 	}
 	if (mask->b_len > VISIBLE_BITS)
-		sprintf(buf + VISIBLE_BITS, "+(%d)", (todos - cnt));
+		sprintf(buf + VISIBLE_BITS, "+(%lld)", (todos - cnt));
 	else
 		buf[i] = '\0';
 	return buf;
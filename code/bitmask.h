@@ -11,19 +11,27 @@
 #ifndef HAVE_BITMASK_H
 #define HAVE_BITMASK_H
 
-#include <gtk/gtk.h>
+#include <glib.h>
+
+// Masks longer than this (bytes) are mapped from a file by new_bitmask_mapped
+#define BITMASK_MMAP_BYTES	(1 << 20)
 
 // Definition of BITMASK type
 typedef struct BITMASK {
     char *mask;		// bit mask
-    int b_len;		// bit length
-    int B_len;		// Byte length
+    long long b_len;	// bit length
+    long long B_len;	// Byte length
+    int fd;			// Backing file of a mapped mask; -1 if the mask is in the heap
 } BITMASK;
 
 
 
 // Create one BITMASK with N bits
-BITMASK *new_bitmask(BITMASK *mask, int N);
+BITMASK *new_bitmask(BITMASK *mask, long long N);
+
+// Create one BITMASK with N bits; large masks are mapped from the file 'path',
+//   which is unlinked at once, so the kernel can write the mask back instead of keeping it in memory
+BITMASK *new_bitmask_mapped(BITMASK *mask, long long N, const char *path);
 
 // Create a copy of a bitmask
 BITMASK *clone_bitmask(BITMASK *dest, BITMASK *src);
@@ -38,13 +46,19 @@ void free_bitmask(BITMASK *mask);
 gboolean bitmask_isempty(BITMASK *mask);
 
 // Return the value of bit 'n' - 0(FALSE) or 1(TRUE)
-gboolean bit_isset(BITMASK *mask, int n);
+gboolean bit_isset(BITMASK *mask, long long n);
 
 // Set bit 'n' to 1
-BITMASK *set_bit(BITMASK *mask, int n);
+BITMASK *set_bit(BITMASK *mask, long long n);
+
+// Atomically set bit 'n' to 1; returns the previous value - safe with concurrent writers
+gboolean test_and_set_bit(BITMASK *mask, long long n);
 
 // Set bit 'n' to 0
-BITMASK *unset_bit(BITMASK *mask, int n);
+BITMASK *unset_bit(BITMASK *mask, long long n);
+
+// Atomically set bit 'n' to 0 - safe with concurrent writers
+void atomic_unset_bit(BITMASK *mask, long long n);
 
 // Set all bits to 0
 BITMASK *clear_bits(BITMASK *mask);
@@ -62,11 +76,14 @@ BITMASK *or_bitmasks(BITMASK *mask1, BITMASK *mask2);
 BITMASK *and_bitmasks(BITMASK *mask1, BITMASK *mask2);
 
 // Count the number of bits set to 1 in the mask
-int count_bits(BITMASK *mask);
+long long count_bits(BITMASK *mask);
 
 // TRUE if all bits are 1
 gboolean all_bits(BITMASK *mask);
 
+// Return the first bit set to 0 at or after bit 'from', or b_len if there is none
+long long first_unset_bit(BITMASK *mask, long long from);
+
 // Return a string showing 20 bits of the bitmask
 const char *bitmask_to_string(BITMASK *mask);
 
@@ -24,6 +24,10 @@
 #include "file.h"
 #include "sock.h"
 #include "gui.h"
+#include "workers.h"
+#include "taskpool.h"
+#include "scheduler.h"
+#include "metrics.h"
 
 // To set DEBUG globally modify the Makefile
 //#define DEBUG 1
@@ -34,16 +38,74 @@
 #define debugstr(x)
 #endif
 
-// Parameters for file transmission
-const int receiver_SRR_timeout=2000;  // Waiting time to generate SRR at the receiver (2 seg)
-const int OK_timeout= 1000; // Maximum waiting time for an OK at the sender (1 seg)
+// Parameters for the GUI log
+int gui_log_lines= 2000;	// Lines kept in the log window; older lines are dropped
+const char *gui_log_spill= NULL;	// File keeping every line shown in the log window (NULL= none)
 
-gboolean active= FALSE;	// TRUE if server if active
+// Timer that refreshes the file transfer progress in the GUI
+static guint progress_timer= 0;
 
-char *path_dir;		// Directory where the received files are stored
 
-// Temporary buffer for writing messages
-char tmp_buf[MAX_MESSAGE_LEN>8000 ? MAX_MESSAGE_LEN : 8000];
+/*****************************************************\
+|* Engine hooks: show the file transfers in the GUI  *|
+ \*****************************************************/
+
+// Row of a new transfer, added by an idle callback
+typedef struct {
+	unsigned tid;
+	char *ip;
+	int port;
+	char *f_name;
+} NewTransfer;
+
+/** Idle callback that adds the row of a new transfer; runs with the GDK lock */
+static gboolean add_transfer_idle(gpointer data) {
+	NewTransfer *nt= (NewTransfer *)data;
+	// The transfer may have ended before the main loop got here
+	if (locate_receiverTh(nt->tid, FALSE) != NULL)
+		GUI_add_Ftrans(nt->tid, nt->ip, nt->port, nt->f_name, FALSE);
+	g_free(nt->ip);
+	g_free(nt->f_name);
+	g_free(nt);
+	return FALSE;
+}
+
+/** A transfer started; called from its thread, which must not wait for the GDK lock */
+static void gui_add_transfer(unsigned tid, const char *ip, int port, const char *f_name) {
+	NewTransfer *nt= g_new(NewTransfer, 1);
+	nt->tid= tid;
+	nt->ip= g_strdup(ip);
+	nt->port= port;
+	nt->f_name= g_strdup(f_name);
+	gdk_threads_add_idle(add_transfer_idle, nt);
+}
+
+/** Idle callback that deletes the row of a transfer; runs with the GDK lock */
+static gboolean del_transfer_idle(gpointer data) {
+	GUI_del_Ftrans(GPOINTER_TO_UINT(data), FALSE);
+	return FALSE;
+}
+
+/** A transfer ended; rows are only changed in the GTK main loop, in order */
+static void gui_del_transfer(unsigned tid, gboolean from_thread) {
+	if (from_thread)
+		gdk_threads_add_idle(del_transfer_idle, GUINT_TO_POINTER(tid));
+	else
+		GUI_del_Ftrans(tid, FALSE);
+}
+
+/** Progress of a transfer; called by the progress timer, with the GDK lock */
+static void gui_update_transfer(unsigned tid, long long trans, long long total) {
+	GUI_update_Ftrans_tx(tid, trans, total, FALSE);
+}
+
+// Engine hooks that show the transfers in the GUI
+const ENGINE_UI GUI_engine_ui= {
+	.log= Log,
+	.add_transfer= gui_add_transfer,
+	.del_transfer= gui_del_transfer,
+	.update_transfer= gui_update_transfer
+};
 
 
 /**********************************************************************\
@@ -52,10 +114,17 @@ char tmp_buf[MAX_MESSAGE_LEN>8000 ? MAX_MESSAGE_LEN : 8000];
 
 /** Close all active streams */
 void close_all(gboolean lock_gdb) {
+	sched_clear();
 	stop_receivers(lock_gdb);
 	GUI_block_entrys(FALSE);
 }
 
+/** Timer callback: samples the transfer progress counters; runs with the GDK lock */
+static gboolean on_progress_timer(gpointer user_data) {
+	publish_receivers_progress();
+	return TRUE;	// keep the timer
+}
+
 /** Handle active/stop application button */
 void on_togglebutton1_toggled(GtkToggleButton *togglebutton, gpointer user_data) {
 	if (gtk_toggle_button_get_active(togglebutton)) { // If program is starting
@@ -79,10 +148,21 @@ void on_togglebutton1_toggled(GtkToggleButton *togglebutton, gpointer user_data)
 		GUI_block_entrys(TRUE);
 		GUI_set_PID((int) getpid());
 		active = TRUE;
+		progress_timer = gdk_threads_add_timeout(1000 / GUI_PROGRESS_HZ, on_progress_timer, NULL);
+		if (receiver_workers > 0)
+			workers_start(receiver_workers, receiver_worker_cpus, receiver_nic_dev);
+		if (receiver_task_threads >= 0)
+			taskpool_start(receiver_task_threads);
+		if (receiver_metrics_port > 0)
+			metrics_start(receiver_metrics_port);
 		Log("FileMulticast client is active\n");
 
 	} else {
 		/* Turn application off */
+		if (progress_timer) {
+			g_source_remove(progress_timer);
+			progress_timer = 0;
+		}
 		close_all(FALSE);
 
 		GUI_set_PID(0);
@@ -131,8 +211,9 @@ void on_buttonRequest_clicked(GtkButton *button, gpointer user_data) {
 		return;
 	}
 
-	// Start query
-	start_file_download(name, ip, port);
+	// Start query, or queue it when the scheduler limits the transfers
+	if (!sched_submit(name, ip, port, 0, 1))
+		Log("ERROR: failed to start the request\n");
 }
 
 
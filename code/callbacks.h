@@ -15,52 +15,24 @@
 #include <gtk/gtk.h>
 #include <netinet/in.h>
 #include "bitmask.h"
+#include "engine.h"
 #include "gui.h"
 
 #define CONFIG_FILENAME		"filelist.txt"
 
-// Auxiliary functions
-#define min(x,y)		((x)>(y) ? (y) : (x))
-#define max(x,y)		((x)>(y) ? (x) : (y))
+// Frame rate (updates per second) of the file transfer progress in the GUI
+#define GUI_PROGRESS_HZ	10
 
-// Auxiliar definitions
-#ifndef TRUE
-#define TRUE 1
-#endif
-#ifndef FALSE
-#define FALSE 0
-#endif
-
-
-
-// Maximum length of a message
-#define MAX_MESSAGE_LEN	9000
-
-/* Packet types */
-// Data packet; sent by the senders
-#define PKT_DATA		1
-// Source Receiver Report; sent by the receivers
-#define PKT_SRR			2
-// Stops a transmission; sent by the senders to the receivers
-#define PKT_STOP		3
-// Leave receivers group; sent by the receiver to the senders
-#define PKT_EXIT		4
-
-
-// Parameters for file transmission
-extern const int receiver_SRR_timeout;  // Waiting time to generate SRR at the receiver
-extern const int OK_timeout; // Maximum waiting time for an OK at the sender
+// Parameters for the GUI log
+extern int gui_log_lines;	// Lines kept in the log window
+extern const char *gui_log_spill;	// File keeping every line shown in the log window (NULL= none)
 
 /* Global variables - main.c */
 extern GUI_WindowElements *main_window;
 
 /* Global variables - callbacks.c */
-extern gboolean active;	// TRUE if server if active
-
-extern char *path_dir;		// Directory where the received files are stored
-
-// Temporary buffer for writing messages
-extern char tmp_buf[];
+// Engine hooks that show the transfers in the GUI
+extern const ENGINE_UI GUI_engine_ui;
 
 
 /* Functions to handle the activation/deactivation of the application */
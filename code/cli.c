@@ -0,0 +1,241 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * cli.c
+ *
+ * Headless front end: downloads the files given in the command line or in a
+ *   manifest, optionally as a daemon. Uses the transfer engine without GTK
+ *
+ *   fmulticast_cli [-d] [-C] [-o dir] [-l logfile] [-m manifest] [-t rx_threads]
+ *                  [-w workers] [-z task_threads] [-T blocks[:rounds]] [-K stripes]
+ *                  [-L loss%] [-n max_transfers] [-M metrics_port] [file ip port] ...
+ *
+ *   The manifest has one transfer per line: "file ip port [priority [weight]]";
+ *   '#' starts a comment. With -n, at most max_transfers slots run at the same
+ *   time and the others are queued by priority. With -C the requests carry the
+ *   receiver capabilities (path MTU, preferred block sizes, codecs), for senders
+ *   that negotiate the block size and compress the blocks; -z sets the threads
+ *   of the task pool that decompresses them (0= one per CPU, -1= the receive
+ *   threads). With -C and -T the last missing blocks (at most 'blocks', or all
+ *   of them after 'rounds' SRR timeouts) are asked on the TCP connection;
+ *   -K accepts sessions striped over up to 'stripes' multicast groups; -L accepts
+ *   layered sessions, joining a layer while the loss stays low and leaving it when
+ *   the loss goes above loss%
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include "engine.h"
+#include "sock.h"
+#include "file.h"
+#include "bitmask.h"
+#include "receiver_th.h"
+#include "registry.h"
+#include "logger.h"
+#include "workers.h"
+#include "taskpool.h"
+#include "scheduler.h"
+#include "metrics.h"
+
+// Interval (ms) between progress reports
+#define CLI_PROGRESS_MS	1000
+
+static volatile sig_atomic_t stop_req= 0;	// Set by SIGINT/SIGTERM
+static int n_started= 0;	// Transfers started
+static int n_ended= 0;		// Transfers ended (atomic)
+static int n_failed= 0;		// Transfers that ended without the whole file (atomic)
+
+
+/** Signal handler: asks the main loop to stop the transfers */
+static void on_signal(int sig) {
+	stop_req= 1;
+}
+
+/** Engine hook: messages go through the logger, to stdout or the log file */
+static void cli_log(const char *str) {
+	log_text(LOG_LVL_INFO, FALSE, "CLI> ", str);
+}
+
+/** Engine hook: a transfer started */
+static void cli_add_transfer(unsigned tid, const char *ip, int port, const char *f_name) {
+	LOG_INFO("CLI> ", "transfer %ld started", tid, 0, 0, 0);
+}
+
+/** Engine hook: a transfer ended */
+static void cli_del_transfer(unsigned tid, gboolean from_thread) {
+	__atomic_add_fetch(&n_ended, 1, __ATOMIC_RELAXED);
+	LOG_INFO("CLI> ", "transfer %ld ended", tid, 0, 0, 0);
+}
+
+/** Engine hook: a transfer left the engine, with the whole file or not */
+static void cli_end_transfer(unsigned tid, gboolean completed) {
+	if (completed)
+		return;
+	__atomic_add_fetch(&n_failed, 1, __ATOMIC_RELAXED);
+	LOG_INFO("CLI> ", "transfer %ld failed", tid, 0, 0, 0);
+}
+
+/** Engine hook: progress of a transfer */
+static void cli_update_transfer(unsigned tid, long long trans, long long total) {
+	LOG_INFO("CLI> ", "transfer %ld: %ld of %ld blocks", tid, trans, total, 0);
+}
+
+static const ENGINE_UI cli_ui= {
+	.log= cli_log,
+	.add_transfer= cli_add_transfer,
+	.del_transfer= cli_del_transfer,
+	.end_transfer= cli_end_transfer,
+	.update_transfer= cli_update_transfer
+};
+
+
+/** Start or queue one transfer; returns FALSE if the arguments are invalid */
+static gboolean request_file(const char *name, const char *ip, const char *port_str, int prio, int weight) {
+	int port= atoi(port_str);
+	if ((port <= 0) || (port > 65535)) {
+		fprintf(stderr, "invalid port '%s'\n", port_str);
+		return FALSE;
+	}
+	if (strcmp(name, get_trunc_filename(name))) {
+		fprintf(stderr, "the filename '%s' must not include the pathname\n", name);
+		return FALSE;
+	}
+	if (!sched_submit(name, ip, port, prio, weight))
+		return FALSE;
+	n_started++;
+	return TRUE;
+}
+
+
+/** Start the transfers listed in the manifest 'path'; returns the number of errors */
+static int read_manifest(const char *path) {
+	char line[512], name[256], ip[128], port[16];
+	int prio, weight;
+	int errors= 0, n_line= 0;
+	FILE *f= fopen(path, "r");
+	if (f == NULL) {
+		perror("opening manifest");
+		return 1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *pt= strchr(line, '#');
+		n_line++;
+		if (pt != NULL)
+			*pt= '\0';
+		prio= 0;
+		weight= 1;
+		int n= sscanf(line, "%255s %127s %15s %d %d", name, ip, port, &prio, &weight);
+		if (n <= 0)
+			continue;	// empty line
+		if ((n < 3) || !request_file(name, ip, port, prio, weight)) {
+			fprintf(stderr, "%s:%d: invalid transfer\n", path, n_line);
+			errors++;
+		}
+	}
+	fclose(f);
+	return errors;
+}
+
+
+/** Print the command line syntax */
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-d] [-C] [-o dir] [-l logfile] [-m manifest] [-t rx_threads] "
+			"[-w workers] [-z task_threads] [-T blocks[:rounds]] [-K stripes] [-L loss%%] [-n max_transfers] "
+			"[-M metrics_port] [file ip port] ...\n", prog);
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *manifest= NULL, *logfile= NULL;
+	gboolean daemonize= FALSE;
+	int opt, errors= 0, i;
+
+	while ((opt= getopt(argc, argv, "dCo:l:m:t:w:z:T:K:L:n:M:h")) != -1) {
+		switch (opt) {
+		case 'd': daemonize= TRUE; break;
+		case 'C': receiver_send_caps= TRUE; break;
+		case 'o': path_dir= optarg; break;
+		case 'l': logfile= optarg; break;
+		case 'm': manifest= optarg; break;
+		case 't': receiver_rx_threads= atoi(optarg); break;
+		case 'w': receiver_workers= atoi(optarg); break;
+		case 'z': receiver_task_threads= atoi(optarg); break;
+		case 'T': sscanf(optarg, "%d:%d", &receiver_tail_blocks, &receiver_tail_rounds); break;
+		case 'K': receiver_max_stripes= atoi(optarg); break;
+		case 'L': receiver_layer_loss= atoi(optarg); break;
+		case 'n': receiver_max_transfers= atoi(optarg); break;
+		case 'M': receiver_metrics_port= atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (((argc - optind) % 3 != 0) || ((manifest == NULL) && (optind == argc))) {
+		usage(argv[0]);
+		return 1;
+	}
+	// Remove a final '/'
+	if ((strlen(path_dir) > 1) && (path_dir[strlen(path_dir) - 1] == '/'))
+		path_dir= g_strndup(path_dir, strlen(path_dir) - 1);
+	if ((strlen(path_dir) > 0) && !make_directory(path_dir)) {
+		perror("creating the output directory");
+		return 1;
+	}
+
+	// Fork before creating any thread; keep the working directory for relative paths
+	if (daemonize && daemon(1, 0)) {
+		perror("daemon");
+		return 1;
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	log_init();
+	if ((logfile != NULL) && !log_open_file(logfile))
+		fprintf(stderr, "failed to open log file '%s'\n", logfile);
+	engine_set_ui(&cli_ui);
+	active= TRUE;
+	set_local_IP();
+	if (receiver_workers > 0)
+		workers_start(receiver_workers, receiver_worker_cpus, receiver_nic_dev);
+	if (receiver_task_threads >= 0)
+		taskpool_start(receiver_task_threads);
+	if (receiver_metrics_port > 0)
+		metrics_start(receiver_metrics_port);
+
+	for (i= optind; i + 2 < argc; i+= 3) {
+		if (!request_file(argv[i], argv[i + 1], argv[i + 2], 0, 1))
+			errors++;
+	}
+	if (manifest != NULL)
+		errors+= read_manifest(manifest);
+
+	// Wait for the transfers, reporting their progress
+	while (((registry_size() > 0) || (sched_pending() > 0)) && !stop_req) {
+		usleep(CLI_PROGRESS_MS * 1000);
+		publish_receivers_progress();
+	}
+	if (stop_req) {
+		LOG_INFO("CLI> ", "stopping %ld transfers, dropping %ld queued", registry_size(), sched_pending(), 0, 0);
+		active= FALSE;
+		sched_clear();
+		stop_receivers(FALSE);
+	}
+	sched_stop();
+	metrics_stop();
+	int failed= __atomic_load_n(&n_failed, __ATOMIC_RELAXED);
+	LOG_INFO("CLI> ", "%ld transfers started, %ld ended, %ld failed, %ld errors", n_started,
+			__atomic_load_n(&n_ended, __ATOMIC_RELAXED), failed, errors);
+	workers_stop();
+	taskpool_stop();
+	log_close();
+	return (errors > 0) || (failed > 0) || stop_req;
+}
@@ -0,0 +1,62 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * decomp.c
+ *
+ * Block codecs of compressed sessions. The receive threads queue each new
+ *   compressed block in the task pool (taskpool.c), whose task decompresses
+ *   it and writes it at its uncompressed offset. LZ4 and zstd are only
+ *   compiled in with HAVE_LZ4 and HAVE_ZSTD
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "decomp.h"
+
+/** Codecs compiled in, as a mask of 1<<codec */
+int decomp_codecs(void) {
+	int m= 1 << Z_NONE;
+#ifdef HAVE_LZ4
+	m|= 1 << Z_LZ4;
+#endif
+#ifdef HAVE_ZSTD
+	m|= 1 << Z_ZSTD;
+#endif
+	return m;
+}
+
+
+/** Decompress 'len' bytes of 'src' to 'dst'; returns the output length or -1 */
+int decomp_block(int codec, const char *src, int len, char *dst, int dst_len) {
+	switch (codec) {
+	case Z_NONE:
+		if (len > dst_len)
+			return -1;
+		memcpy(dst, src, len);
+		return len;
+#ifdef HAVE_LZ4
+	case Z_LZ4: {
+		int n= LZ4_decompress_safe(src, dst, len, dst_len);
+		return (n < 0) ? -1 : n;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case Z_ZSTD: {
+		size_t n= ZSTD_decompress(dst, dst_len, src, len);
+		return ZSTD_isError(n) ? -1 : (int)n;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
@@ -0,0 +1,28 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * decomp.h
+ *
+ * Header file of the block codecs of compressed sessions (PKT_DATAZ)
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_DECOMP_H
+#define HAVE_DECOMP_H
+
+#include <glib.h>
+
+// Codecs of the PKT_DATAZ blocks, in the low bits of the flags
+#define Z_NONE			0	// Block stored without compression
+#define Z_LZ4			1	// LZ4 block format
+#define Z_ZSTD			2	// zstd frame
+#define Z_CODEC_MASK	0x0f
+
+// Codecs compiled in (HAVE_LZ4, HAVE_ZSTD), as a mask of 1<<codec; Z_NONE is always there
+int decomp_codecs(void);
+// Decompress 'len' bytes of 'src' to 'dst'; returns the output length, or -1 if the
+//   codec is not available or the data is corrupt
+int decomp_block(int codec, const char *src, int len, char *dst, int dst_len);
+
+#endif
@@ -0,0 +1,98 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * engine.c
+ *
+ * Transfer engine parameters and front end hooks. The engine (this file,
+ *   receiver_th.c, sock.c, bitmask.c, file.c and the modules they use) only
+ *   depends on glib; the front ends set the hooks with engine_set_ui
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "engine.h"
+
+// Parameters for file transmission
+const int receiver_SRR_timeout=2000;  // Waiting time to generate SRR at the receiver (2 seg)
+const int OK_timeout= 1000; // Maximum waiting time for an OK at the sender (1 seg)
+
+// Parameters for the receive path
+int receiver_rx_threads= 1;	// Threads draining the multicast socket of one transfer (1= only the transfer thread)
+int receiver_rx_cpu0= -1;	// First CPU where the receive threads are pinned (-1= no pinning)
+int receiver_use_ring= 0;	// Capture multicast data with a TPACKET_V3 ring (needs CAP_NET_RAW)
+const char *receiver_ring_dev= NULL;	// Interface captured by the ring (NULL= all)
+int receiver_busy_poll= 0;	// Time (us) spinning on the socket before blocking in select (0= off)
+int receiver_pool_slots= 64;	// Packet buffers (of one DATA datagram) per receive thread
+int receiver_pool_hugepages= 0;	// Back the packet buffers with hugepages when available
+int receiver_workers= 0;	// Pinned workers that run the transfers, a hard limit on the concurrent ones (0= a new thread per transfer)
+const char *receiver_worker_cpus= NULL;	// CPUs of the workers, e.g. "2-5,8" (NULL= CPUs of the NIC's NUMA node)
+const char *receiver_nic_dev= NULL;	// Interface receiving the multicast data, used to find its NUMA node
+
+// Parameters for the download scheduler
+int receiver_max_transfers= 0;	// Slots for transfers running at the same time (0= no limit and no queue)
+int receiver_max_dirty_mb= 512;	// New transfers wait while the kernel holds more dirty data (MB; 0= ignore)
+int receiver_prefetch_pct= 90;	// Handshake of the next queued file starts when a transfer has this % of its blocks
+
+int receiver_metrics_port= 0;	// TCP port of the metrics endpoint on 127.0.0.1 (0= off)
+int receiver_trace= 0;		// Trace the receive events of each thread to "<file>.trace<k>"
+int receiver_trace_events= 1<<18;	// Events kept in each thread's trace ring (24 bytes each)
+int receiver_send_caps= 0;	// Send the capabilities (CAP_*) after the requested name
+int receiver_task_threads= 0;	// Task pool threads running the per-block work (0= one per CPU; -1= in the receive threads)
+int receiver_tail_blocks= 0;	// Ask the last missing blocks on the TCP connection (PKT_TAIL) below this count (0= off); needs receiver_send_caps
+int receiver_tail_rounds= 3;	// ... or after this many SRR timeouts
+int receiver_max_stripes= 1;	// Stripes (multicast groups) accepted per session (<= 1: one group); needs receiver_send_caps
+int receiver_layer_loss= 0;		// Accept layered sessions, leaving a layer above this loss (%) (0= off); needs receiver_send_caps
+
+char *path_dir= "";		// Directory where the received files are stored
+
+gboolean active= FALSE;	// TRUE if server if active; the transfers stop when cleared
+
+// Temporary buffer for writing messages
+char tmp_buf[MAX_MESSAGE_LEN>8000 ? MAX_MESSAGE_LEN : 8000];
+
+// Front end hooks
+static ENGINE_UI ui;
+
+
+/** Set the front end hooks; the structure is copied */
+void engine_set_ui(const ENGINE_UI *new_ui) {
+	if (new_ui == NULL)
+		memset(&ui, 0, sizeof(ui));
+	else
+		ui= *new_ui;
+}
+
+/** Show a message in the front end (stdout when there is no log hook) */
+void engine_log(const char *str) {
+	if (ui.log != NULL)
+		ui.log(str);
+	else
+		fputs(str, stdout);
+}
+
+/** Report a new transfer */
+void engine_add_transfer(unsigned tid, const char *ip, int port, const char *f_name) {
+	if (ui.add_transfer != NULL)
+		ui.add_transfer(tid, ip, port, f_name);
+}
+
+/** Report the end of a transfer */
+void engine_del_transfer(unsigned tid, gboolean from_thread) {
+	if (ui.del_transfer != NULL)
+		ui.del_transfer(tid, from_thread);
+}
+
+/** Report the outcome of a transfer */
+void engine_end_transfer(unsigned tid, gboolean completed) {
+	if (ui.end_transfer != NULL)
+		ui.end_transfer(tid, completed);
+}
+
+/** Report the progress of a transfer */
+void engine_update_transfer(unsigned tid, long long trans, long long total) {
+	if (ui.update_transfer != NULL)
+		ui.update_transfer(tid, trans, total);
+}
@@ -0,0 +1,173 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * engine.h
+ *
+ * Header file of the transfer engine (libfmcast): protocol definitions,
+ *   reception parameters and the hooks used to report to a front end
+ *   (the GTK window or the command line)
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_ENGINE_H
+#define HAVE_ENGINE_H
+
+#include <glib.h>
+#include <netinet/in.h>
+
+// Auxiliary functions
+#define min(x,y)		((x)>(y) ? (y) : (x))
+#define max(x,y)		((x)>(y) ? (x) : (y))
+
+// Auxiliar definitions
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+
+// Maximum length of a message sent by the receiver (SRR)
+#define MAX_MESSAGE_LEN	9000
+// Maximum length of a DATA datagram (UDP payload over IPv4); blocks are limited to this minus the header
+#define MAX_DATAGRAM_LEN	65507
+
+/* Packet types */
+// Data packet; sent by the senders
+#define PKT_DATA		1
+// Source Receiver Report; sent by the receivers
+#define PKT_SRR			2
+// Stops a transmission; sent by the senders to the receivers
+#define PKT_STOP		3
+// Leave receivers group; sent by the receiver to the senders
+#define PKT_EXIT		4
+// Data packet with a 64-bit block number; sent in sessions with more than 2^31-1 blocks
+#define PKT_DATA64		5
+// SRR with a window of the bitmask; sent when the whole bitmask does not fit in one datagram
+#define PKT_SRR64		6
+// Data packet of a compressed session: type, sid, seq (64 bits), len, orig_len, flags (codec);
+//   the block is decompressed to orig_len bytes at offset seq * block_size
+#define PKT_DATAZ		7
+// Tail repair request; sent by the receiver on the TCP connection: type, sid, cid, n_ranges (int),
+//   then n_ranges times first block (64 bits) and count (int). The sender answers on the same
+//   connection with one PKT_DATA64 or PKT_DATAZ record per block
+#define PKT_TAIL		8
+// Maximum number of ranges in one PKT_TAIL
+#define MAX_TAIL_RANGES	1024
+
+// Length of the DATA packet header: type, sid, seq, len
+#define DATA_HDR_LEN	(sizeof(char) + sizeof(short int) + 2 * sizeof(int))
+// Length of the DATA64 packet header: type, sid, seq (64 bits), len
+#define DATA64_HDR_LEN	(sizeof(char) + sizeof(short int) + sizeof(long long) + sizeof(int))
+// Length of the DATAZ packet header: type, sid, seq (64 bits), len, orig_len, flags
+#define DATAZ_HDR_LEN	(DATA64_HDR_LEN + sizeof(int) + sizeof(char))
+// Length of the SRR packet header: type, sid, cid; the bitmask follows
+#define SRR_HDR_LEN		(sizeof(char) + 2 * sizeof(short int))
+// Length of the SRR64 packet header: type, sid, cid, first block (64 bits), window length
+#define SRR64_HDR_LEN	(SRR_HDR_LEN + sizeof(long long) + sizeof(int))
+
+// Value of n_blocks in the reply header announcing that a 64-bit block count follows
+#define N_BLOCKS_64		-1
+
+/* Striped sessions - when the request carried CAP_STRIPES, CAP_LAYERS or both, the reply
+ * header ends with n_stripes (int), stripe_map (int, STRIPE_*) and, for stripes
+ * 1..n_stripes-1, the multicast address and port of each one; stripe 0 is the group and
+ * port of the header. A request with CAP_LAYERS alone gets the trailer too, even when the
+ * sender answers with a single stripe.
+ * Each block is sent on one stripe and the receiver drains every stripe on its own socket */
+#define MAX_STRIPES		8
+// Block 'seq' goes to stripe seq % n_stripes
+#define STRIPE_BLOCK_RR	0
+// Stripe k carries the k-th of n_stripes consecutive ranges of blocks
+#define STRIPE_RANGES	1
+// Cumulative layers: stripe k is layer k, a carousel of every block at a rate that grows with k;
+//   the receiver starts with layer 0 and joins or leaves the others (receiver_layer_loss)
+#define STRIPE_LAYERS	2
+
+/* Receiver capabilities - TLVs sent after the NUL of the requested name when
+ * receiver_send_caps is set: type (1 byte), length (1 byte), value (host order).
+ * The list ends with CAP_END; the sender chooses block_size from them */
+#define CAP_END				0
+// int: largest UDP payload that crosses the receiver's path without fragmentation
+#define CAP_MAX_DATAGRAM	1
+// int[]: block sizes preferred by the receiver, best first
+#define CAP_BLOCK_SIZES		2
+// int: largest block the receiver accepts
+#define CAP_MAX_BLOCK		3
+// int: bytes queued in the receiver's UDP socket buffer
+#define CAP_RCV_BUFFER		4
+// int: codecs the receiver decompresses in PKT_DATAZ blocks, as a mask of 1<<codec (decomp.h)
+#define CAP_CODECS			5
+// int: missing blocks below which the receiver asks them with PKT_TAIL; sent when the tail repair is on
+#define CAP_TAIL_REPAIR		6
+// int: most multicast groups (stripes) the receiver joins for one session
+#define CAP_STRIPES			7
+// int: loss (%) above which the receiver leaves a layer; sent when it accepts layered sessions
+#define CAP_LAYERS			8
+
+
+// Parameters for file transmission
+extern const int receiver_SRR_timeout;  // Waiting time to generate SRR at the receiver
+extern const int OK_timeout; // Maximum waiting time for an OK at the sender
+extern int receiver_rx_threads;	// Threads draining the multicast socket of one transfer
+extern int receiver_rx_cpu0;	// First CPU where the receive threads are pinned (-1= no pinning)
+extern int receiver_use_ring;	// Capture multicast data with a TPACKET_V3 ring
+extern const char *receiver_ring_dev;	// Interface captured by the ring (NULL= all)
+extern int receiver_busy_poll;	// Time (us) spinning on the socket before blocking (0= off)
+extern int receiver_pool_slots;	// Packet buffers per receive thread
+extern int receiver_pool_hugepages;	// Back the packet buffers with hugepages when available
+extern int receiver_workers;	// Pinned workers that run the transfers, a hard limit on the concurrent ones (0= a new thread per transfer)
+extern const char *receiver_worker_cpus;	// CPUs of the workers (NULL= CPUs of the NIC's NUMA node)
+extern const char *receiver_nic_dev;	// Interface receiving the multicast data
+extern int receiver_max_transfers;	// Slots for transfers running at the same time (0= no limit and no queue)
+extern int receiver_max_dirty_mb;	// New transfers wait while the kernel holds more dirty data (MB; 0= ignore)
+extern int receiver_prefetch_pct;	// Handshake of the next queued file starts at this % of a running transfer
+extern int receiver_metrics_port;	// TCP port of the metrics endpoint on 127.0.0.1 (0= off)
+extern int receiver_trace;		// Trace the receive events of each thread to "<file>.trace<k>"
+extern int receiver_trace_events;	// Events kept in each thread's trace ring
+extern int receiver_send_caps;	// Send the capabilities (CAP_*) in the request; needs a sender that reads them
+extern int receiver_task_threads;	// Task pool threads running the per-block work (0= one per CPU; -1= in the receive threads)
+extern int receiver_tail_blocks;	// Ask the last missing blocks on the TCP connection (PKT_TAIL) below this count (0= off)
+extern int receiver_tail_rounds;	// ... or after this many SRR timeouts
+extern int receiver_max_stripes;	// Stripes (multicast groups) accepted per session (<= 1: one group)
+extern int receiver_layer_loss;	// Accept layered sessions, leaving a layer above this loss (%) (0= off)
+
+extern char *path_dir;		// Directory where the received files are stored
+
+extern gboolean active;	// TRUE if server if active; the transfers stop when cleared
+
+// Temporary buffer for writing messages
+extern char tmp_buf[];
+
+
+/* Front end hooks; any of them may be NULL.
+ * 'from_thread' is TRUE when the engine calls from a transfer thread, FALSE when it
+ * calls from the front end's own thread (e.g. stopping a transfer on user request) */
+typedef struct ENGINE_UI {
+	void (*log)(const char *str);	// Shows a message
+	// A transfer started; called from its thread
+	void (*add_transfer)(unsigned tid, const char *ip, int port, const char *f_name);
+	// A transfer ended
+	void (*del_transfer)(unsigned tid, gboolean from_thread);
+	// Outcome of a transfer, TRUE if every block was written; called once, before it leaves the registry
+	void (*end_transfer)(unsigned tid, gboolean completed);
+	// Progress of a transfer; called by publish_receivers_progress
+	void (*update_transfer)(unsigned tid, long long trans, long long total);
+} ENGINE_UI;
+
+// Set the front end hooks; the structure is copied
+void engine_set_ui(const ENGINE_UI *ui);
+// Show a message in the front end (stdout when there is no log hook)
+void engine_log(const char *str);
+// Report a new transfer
+void engine_add_transfer(unsigned tid, const char *ip, int port, const char *f_name);
+// Report the end of a transfer
+void engine_del_transfer(unsigned tid, gboolean from_thread);
+// Report the outcome of a transfer
+void engine_end_transfer(unsigned tid, gboolean completed);
+// Report the progress of a transfer
+void engine_update_transfer(unsigned tid, long long trans, long long total);
+
+#endif
@@ -13,13 +13,13 @@
 #  include <config.h>
 #endif
 
-#include <gtk/gtk.h>
+#include <glib.h>
 #include <assert.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
-#include "gui.h"
+#include <stdio.h>
 
 
 
@@ -0,0 +1,720 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * fmbench.c
+ *
+ * Microbenchmarks of the receiver's hot paths:
+ *   - bitmask/...: the bitmask operations, for masks of 1 Kbit to 16 Mbit;
+ *   - hash/...: fhash (file.c) and other hashes over the same data;
+ *   - parse/...: parsing the DATA header with READ_BUF and with memcpy;
+ *   - srr/...: send_SRR, encoding the SRR of masks of several sizes (the
+ *     datagrams are discarded by a transport that replaces sendto);
+ *   - write/...: storing blocks with fseek+fwrite, pwrite and a mapped file;
+ *   - wakeup/...: round trip of a datagram through a loopback echo thread,
+ *     waiting in select or spinning on the non-blocking socket, as the
+ *     receiver does with receiver_busy_poll.
+ *   Each benchmark is calibrated to run for about -m ms and reports the best
+ *   of three runs. The results are written in JSON; with -c they are
+ *   compared with a saved baseline and the slowdowns above -t percent are
+ *   reported as regressions (exit status 1).
+ *
+ *   fmbench [-o out.json] [-c baseline.json] [-t pct] [-m ms] [-f filter] [-d dir]
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include "engine.h"
+#include "sock.h"
+#include "bitmask.h"
+#include "file.h"
+#include "receiver_th.h"
+#include "transport.h"
+
+#define BENCH_RUNS		3		// Runs of each benchmark; the best one is reported
+#define MAX_RESULTS		128
+#define HASH_BYTES		(16 << 20)	// Data hashed by the hash benchmarks
+#define N_PKTS			256		// DATA packets parsed in turn
+#define WRITE_BLOCK		1400	// Block written by the write benchmarks
+#define WRITE_BYTES		(64LL << 20)	// Length of the file written
+
+typedef struct BENCH_RESULT {
+	char name[64];
+	double ns_per_op;
+	double mb_per_s;		// 0 when the operation has no data size
+	long long ops;			// Operations of the best run
+} BENCH_RESULT;
+
+// Body of a benchmark: runs 'n' operations
+typedef void (*BENCH_FN)(void *arg, long long n);
+
+static BENCH_RESULT results[MAX_RESULTS];
+static int n_results= 0;
+static long long min_ns= 300000000LL;	// Time of the BENCH_RUNS runs of one benchmark
+static const char *filter= NULL;
+static volatile unsigned long long sink;	// Keeps the results of the operations alive
+
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long time_run(BENCH_FN fn, void *arg, long long n) {
+	long long t0= now_ns();
+	fn(arg, n);
+	return now_ns() - t0;
+}
+
+/** Run benchmark 'name'; each operation processes 'bytes' bytes (0= not a throughput) */
+static void bench(const char *name, BENCH_FN fn, void *arg, double bytes) {
+	long long n= 1, t, target= min_ns / BENCH_RUNS, best= -1;
+	int r;
+	if (((filter != NULL) && (strstr(name, filter) == NULL)) || (n_results == MAX_RESULTS))
+		return;
+	// Grow the run until it takes a tenth of the target, then scale it to the target
+	while (((t= time_run(fn, arg, n)) < target / 10) && (n < (1LL << 40)))
+		n*= 2;
+	if (t > 0)
+		n= (long long)((double)n * target / t) + 1;
+	for (r= 0; r < BENCH_RUNS; r++) {
+		t= time_run(fn, arg, n);
+		if ((best < 0) || (t < best))
+			best= t;
+	}
+	BENCH_RESULT *res= &results[n_results++];
+	snprintf(res->name, sizeof(res->name), "%s", name);
+	res->ops= n;
+	res->ns_per_op= (double)best / n;
+	res->mb_per_s= (bytes > 0) ? bytes * n / (best / 1e9) / 1e6 : 0;
+	fprintf(stderr, "%-32s %12.2f ns/op", name, res->ns_per_op);
+	if (bytes > 0)
+		fprintf(stderr, " %10.1f MB/s", res->mb_per_s);
+	fprintf(stderr, "\n");
+}
+
+
+/* Bitmask */
+
+typedef struct BM_ARG {
+	BITMASK m, full, other;
+	long long bits;			// Power of 2
+} BM_ARG;
+
+// Bits visited in a scattered order, as the blocks of the repairs
+#define SCATTER(i, bits)	(((unsigned long long)(i) * 0x9E3779B1ULL) & ((bits) - 1))
+
+static void bm_set_bit(void *arg, long long n) {
+	BM_ARG *a= (BM_ARG *)arg;
+	long long i;
+	for (i= 0; i < n; i++)
+		set_bit(&a->m, SCATTER(i, a->bits));
+	sink+= a->m.mask[0];
+}
+
+static void bm_bit_isset(void *arg, long long n) {
+	BM_ARG *a= (BM_ARG *)arg;
+	long long i, cnt= 0;
+	for (i= 0; i < n; i++)
+		cnt+= bit_isset(&a->other, SCATTER(i, a->bits));
+	sink+= cnt;
+}
+
+static void bm_test_and_set_bit(void *arg, long long n) {
+	BM_ARG *a= (BM_ARG *)arg;
+	long long i, cnt= 0;
+	for (i= 0; i < n; i++)
+		cnt+= test_and_set_bit(&a->m, SCATTER(i, a->bits));
+	sink+= cnt;
+}
+
+static void bm_count_bits(void *arg, long long n) {
+	BM_ARG *a= (BM_ARG *)arg;
+	long long i, cnt= 0;
+	for (i= 0; i < n; i++)
+		cnt+= count_bits(&a->other);
+	sink+= cnt;
+}
+
+static void bm_all_bits(void *arg, long long n) {
+	BM_ARG *a= (BM_ARG *)arg;
+	long long i, cnt= 0;
+	for (i= 0; i < n; i++)
+		cnt+= all_bits(&a->full);
+	sink+= cnt;
+}
+
+static void bm_or_bitmasks(void *arg, long long n) {
+	BM_ARG *a= (BM_ARG *)arg;
+	long long i;
+	for (i= 0; i < n; i++)
+		or_bitmasks(&a->m, &a->other);
+	sink+= a->m.mask[0];
+}
+
+static void bm_first_unset_bit(void *arg, long long n) {
+	BM_ARG *a= (BM_ARG *)arg;
+	long long i, cnt= 0;
+	for (i= 0; i < n; i++)
+		cnt+= first_unset_bit(&a->full, 0);
+	sink+= cnt;
+}
+
+static void bench_bitmask(void) {
+	static const int log_bits[]= { 10, 16, 20, 24 };
+	char name[64];
+	BM_ARG a;
+	unsigned k;
+	long long i;
+	for (k= 0; k < sizeof(log_bits) / sizeof(log_bits[0]); k++) {
+		a.bits= 1LL << log_bits[k];
+		if (!new_bitmask(&a.m, a.bits) || !new_bitmask(&a.full, a.bits) || !new_bitmask(&a.other, a.bits)) {
+			fprintf(stderr, "bitmask of %lld bits: out of memory\n", a.bits);
+			return;
+		}
+		// 'full' has only the last bit missing; 'other' has one bit in three set
+		set_allbits(&a.full);
+		unset_bit(&a.full, a.bits - 1);
+		for (i= 0; i < a.bits; i+= 3)
+			set_bit(&a.other, i);
+		double bytes= a.m.B_len;
+#define BM(fn, b)	do { snprintf(name, sizeof(name), "bitmask/%s/%lld", #fn, a.bits); \
+						bench(name, bm_##fn, &a, (b)); } while (0)
+		BM(set_bit, 0);
+		BM(bit_isset, 0);
+		BM(test_and_set_bit, 0);
+		BM(count_bits, bytes);
+		BM(all_bits, bytes);
+		BM(or_bitmasks, bytes);
+		BM(first_unset_bit, bytes);
+#undef BM
+		free_bitmask(&a.m);
+		free_bitmask(&a.full);
+		free_bitmask(&a.other);
+	}
+}
+
+
+/* Hashes */
+
+typedef struct HASH_ARG {
+	unsigned char *data;
+	FILE *f;				// File with the same data, for fhash
+} HASH_ARG;
+
+static void h_fhash(void *arg, long long n) {
+	HASH_ARG *a= (HASH_ARG *)arg;
+	long long i;
+	for (i= 0; i < n; i++)
+		sink+= fhash(a->f);
+}
+
+/** fhash's XOR of 32-bit words, without the stdio reads */
+static void h_xor32(void *arg, long long n) {
+	HASH_ARG *a= (HASH_ARG *)arg;
+	long long i;
+	size_t j;
+	for (i= 0; i < n; i++) {
+		uint32_t sum= 0, w;
+		for (j= 0; j < HASH_BYTES; j+= sizeof(w)) {
+			memcpy(&w, a->data + j, sizeof(w));
+			sum^= w;
+		}
+		sink+= sum;
+	}
+}
+
+static void h_fnv1a64(void *arg, long long n) {
+	HASH_ARG *a= (HASH_ARG *)arg;
+	long long i;
+	size_t j;
+	for (i= 0; i < n; i++) {
+		uint64_t h= 0xcbf29ce484222325ULL;
+		for (j= 0; j < HASH_BYTES; j++)
+			h= (h ^ a->data[j]) * 0x100000001b3ULL;
+		sink+= h;
+	}
+}
+
+#define XXH_P1	0x9E3779B185EBCA87ULL
+#define XXH_P2	0xC2B2AE3D27D4EB4FULL
+#define XXH_P3	0x165667B19E3779F9ULL
+#define XXH_P4	0x85EBCA77C2B2AE63ULL
+#define XXH_P5	0x27D4EB2F165667C5ULL
+#define ROTL64(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t xxh_round(uint64_t acc, uint64_t v) {
+	acc+= v * XXH_P2;
+	return ROTL64(acc, 31) * XXH_P1;
+}
+
+static uint64_t xxh_merge(uint64_t h, uint64_t v) {
+	return (h ^ xxh_round(0, v)) * XXH_P1 + XXH_P4;
+}
+
+/** XXH64 with seed 0 of 'len' bytes, a multiple of 32 */
+static uint64_t xxh64(const unsigned char *p, size_t len) {
+	uint64_t v1= XXH_P1 + XXH_P2, v2= XXH_P2, v3= 0, v4= -XXH_P1, h, w[4];
+	size_t j;
+	for (j= 0; j < len; j+= 32) {
+		memcpy(w, p + j, sizeof(w));
+		v1= xxh_round(v1, w[0]);
+		v2= xxh_round(v2, w[1]);
+		v3= xxh_round(v3, w[2]);
+		v4= xxh_round(v4, w[3]);
+	}
+	h= ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+	h= xxh_merge(h, v1);
+	h= xxh_merge(h, v2);
+	h= xxh_merge(h, v3);
+	h= xxh_merge(h, v4);
+	h+= len;
+	h^= h >> 33;
+	h*= XXH_P2;
+	h^= h >> 29;
+	h*= XXH_P3;
+	return h ^ (h >> 32);
+}
+
+static void h_xxh64(void *arg, long long n) {
+	HASH_ARG *a= (HASH_ARG *)arg;
+	long long i;
+	for (i= 0; i < n; i++)
+		sink+= xxh64(a->data, HASH_BYTES);
+}
+
+#if defined(__x86_64__)
+/** CRC32C with the SSE4.2 instruction */
+__attribute__((target("sse4.2")))
+static void h_crc32c(void *arg, long long n) {
+	HASH_ARG *a= (HASH_ARG *)arg;
+	long long i;
+	size_t j;
+	for (i= 0; i < n; i++) {
+		uint64_t crc= 0xffffffff, w;
+		for (j= 0; j < HASH_BYTES; j+= sizeof(w)) {
+			memcpy(&w, a->data + j, sizeof(w));
+			crc= __builtin_ia32_crc32di(crc, w);
+		}
+		sink+= crc ^ 0xffffffff;
+	}
+}
+#endif
+
+static void bench_hash(const char *dir) {
+	char path[512];
+	HASH_ARG a;
+	size_t j;
+	a.data= (unsigned char *)malloc(HASH_BYTES);
+	if (a.data == NULL) {
+		perror("malloc");
+		return;
+	}
+	for (j= 0; j < HASH_BYTES; j++)
+		a.data[j]= (unsigned char)((j * 2654435761U) >> 13);
+	snprintf(path, sizeof(path), "%s/fmbench.hash.XXXXXX", dir);
+	int fd= mkstemp(path);
+	if ((fd < 0) || (write(fd, a.data, HASH_BYTES) != HASH_BYTES) || ((a.f= fdopen(fd, "r")) == NULL)) {
+		perror(path);
+		free(a.data);
+		return;
+	}
+	unlink(path);
+	bench("hash/fhash", h_fhash, &a, HASH_BYTES);
+	bench("hash/xor32", h_xor32, &a, HASH_BYTES);
+	bench("hash/fnv1a64", h_fnv1a64, &a, HASH_BYTES);
+	bench("hash/xxh64", h_xxh64, &a, HASH_BYTES);
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+		bench("hash/crc32c", h_crc32c, &a, HASH_BYTES);
+#endif
+	fclose(a.f);
+	free(a.data);
+}
+
+
+/* DATA header parsing */
+
+static char pkts[N_PKTS][WRITE_BLOCK + 16];
+
+static void p_read_buf(void *arg, long long n) {
+	long long i, acc= 0;
+	for (i= 0; i < n; i++) {
+		char *pt= pkts[i & (N_PKTS - 1)];
+		unsigned char type;
+		short int sid;
+		int seq, len;
+		READ_BUF(pt, &type, sizeof(type));
+		READ_BUF(pt, &sid, sizeof(sid));
+		READ_BUF(pt, &seq, sizeof(seq));
+		READ_BUF(pt, &len, sizeof(len));
+		acc+= type + sid + seq + len;
+	}
+	sink+= acc;
+}
+
+static void p_memcpy(void *arg, long long n) {
+	long long i, acc= 0;
+	for (i= 0; i < n; i++) {
+		const char *pt= pkts[i & (N_PKTS - 1)];
+		unsigned char type;
+		short int sid;
+		int seq, len;
+		memcpy(&type, pt, sizeof(type));
+		memcpy(&sid, pt + 1, sizeof(sid));
+		memcpy(&seq, pt + 3, sizeof(seq));
+		memcpy(&len, pt + 7, sizeof(len));
+		acc+= type + sid + seq + len;
+	}
+	sink+= acc;
+}
+
+static void bench_parse(void) {
+	int i;
+	for (i= 0; i < N_PKTS; i++) {
+		char *pt= pkts[i];
+		unsigned char type= PKT_DATA;
+		short int sid= 1;
+		int seq= i * 7, len= WRITE_BLOCK;
+		WRITE_BUF(pt, &type, sizeof(type));
+		WRITE_BUF(pt, &sid, sizeof(sid));
+		WRITE_BUF(pt, &seq, sizeof(seq));
+		WRITE_BUF(pt, &len, sizeof(len));
+	}
+	bench("parse/read_buf", p_read_buf, NULL, 0);
+	bench("parse/memcpy", p_memcpy, NULL, 0);
+}
+
+
+/* SRR encoding */
+
+static long long srr_bytes= 0;
+
+/** Transport's sendto: the SRR is counted and discarded */
+static ssize_t srr_sendto(int s, const void *buf, size_t len, int flags, const struct sockaddr *to, socklen_t to_len) {
+	srr_bytes+= len;
+	return len;
+}
+
+static void s_send_srr(void *arg, long long n) {
+	ReceiverTh *t= (ReceiverTh *)arg;
+	long long i;
+	for (i= 0; i < n; i++)
+		send_SRR(t, t->sid, t->cid);
+	sink+= srr_bytes;
+}
+
+static void bench_srr(void) {
+	static const int log_bits[]= { 10, 16, 20 };
+	TRANSPORT_OPS ops= tp;
+	char name[64];
+	unsigned k;
+	long long i;
+	ReceiverTh *t= (ReceiverTh *)calloc(1, sizeof(ReceiverTh));
+	if (t == NULL) {
+		perror("calloc");
+		return;
+	}
+	t->self= t;
+	t->is_ipv4= TRUE;
+	t->saddr_def= TRUE;
+	t->u.saddr4.sin_family= AF_INET;
+	t->sid= 1;
+	t->cid= 1;
+	t->sm= -1;
+	strcpy(t->name_str, "BENCH>  ");
+	ops.sendto= srr_sendto;
+	transport_set(&ops);
+	for (k= 0; k < sizeof(log_bits) / sizeof(log_bits[0]); k++) {
+		long long bits= 1LL << log_bits[k];
+		if (new_bitmask(&t->bmask, bits) == NULL)
+			break;
+		// Mostly received, with one block in 100 missing
+		set_allbits(&t->bmask);
+		for (i= 0; i < bits; i+= 100)
+			unset_bit(&t->bmask, i);
+		t->srr_base= 0;
+		snprintf(name, sizeof(name), "srr/send_SRR/%lld", bits);
+		bench(name, s_send_srr, t, 0);
+		free_bitmask(&t->bmask);
+	}
+	transport_set(NULL);
+	free(t);
+}
+
+
+/* Write paths */
+
+typedef struct WR_ARG {
+	int fd;
+	FILE *f;
+	char *map;
+	long long blocks;		// Blocks in the file
+	char buf[WRITE_BLOCK];
+} WR_ARG;
+
+static void w_fseek_fwrite(void *arg, long long n) {
+	WR_ARG *a= (WR_ARG *)arg;
+	long long i;
+	for (i= 0; i < n; i++) {
+		fseek(a->f, (i % a->blocks) * WRITE_BLOCK, SEEK_SET);
+		if (fwrite(a->buf, 1, WRITE_BLOCK, a->f) != WRITE_BLOCK)
+			sink++;
+	}
+}
+
+static void w_pwrite(void *arg, long long n) {
+	WR_ARG *a= (WR_ARG *)arg;
+	long long i;
+	for (i= 0; i < n; i++) {
+		if (pwrite(a->fd, a->buf, WRITE_BLOCK, (off_t)(i % a->blocks) * WRITE_BLOCK) != WRITE_BLOCK)
+			sink++;
+	}
+}
+
+static void w_mmap(void *arg, long long n) {
+	WR_ARG *a= (WR_ARG *)arg;
+	long long i;
+	for (i= 0; i < n; i++)
+		memcpy(a->map + (i % a->blocks) * WRITE_BLOCK, a->buf, WRITE_BLOCK);
+}
+
+/** Open a new file in 'dir' for one write benchmark */
+static int wr_open(WR_ARG *a, const char *dir) {
+	char path[512];
+	snprintf(path, sizeof(path), "%s/fmbench.write.XXXXXX", dir);
+	if ((a->fd= mkstemp(path)) < 0) {
+		perror(path);
+		return -1;
+	}
+	unlink(path);
+	return 0;
+}
+
+static void bench_write(const char *dir) {
+	WR_ARG a;
+	memset(&a, 0, sizeof(a));
+	memset(a.buf, 0x5a, sizeof(a.buf));
+	a.blocks= WRITE_BYTES / WRITE_BLOCK;
+
+	if ((wr_open(&a, dir) == 0) && ((a.f= fdopen(a.fd, "w")) != NULL)) {
+		bench("write/fseek_fwrite", w_fseek_fwrite, &a, WRITE_BLOCK);
+		fclose(a.f);
+	}
+	if (wr_open(&a, dir) == 0) {
+		bench("write/pwrite", w_pwrite, &a, WRITE_BLOCK);
+		close(a.fd);
+	}
+	if (wr_open(&a, dir) == 0) {
+		if (!ftruncate(a.fd, a.blocks * WRITE_BLOCK) &&
+				((a.map= mmap(NULL, a.blocks * WRITE_BLOCK, PROT_WRITE, MAP_SHARED, a.fd, 0)) != MAP_FAILED)) {
+			bench("write/mmap", w_mmap, &a, WRITE_BLOCK);
+			munmap(a.map, a.blocks * WRITE_BLOCK);
+		} else
+			perror("write/mmap");
+		close(a.fd);
+	}
+}
+
+
+/* Results */
+
+static void write_json(FILE *f) {
+	struct utsname u;
+	int i;
+	if (uname(&u))
+		strcpy(u.nodename, "?");
+	fprintf(f, "{\n  \"tool\": \"fmbench\",\n  \"host\": \"%s\",\n  \"min_ms\": %lld,\n  \"results\": [\n",
+			u.nodename, min_ns / 1000000);
+	// One result per line; load_baseline depends on it
+	for (i= 0; i < n_results; i++)
+		fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.4f, \"mb_per_s\": %.2f, \"ops\": %lld}%s\n",
+				results[i].name, results[i].ns_per_op, results[i].mb_per_s, results[i].ops,
+				(i < n_results - 1) ? "," : "");
+	fprintf(f, "  ]\n}\n");
+}
+
+/** Compare with the results in 'path'; returns the number of regressions, or -1 */
+static int compare_baseline(const char *path, double tolerance) {
+	char line[512], name[64];
+	double base;
+	int i, regressions= 0, found= 0;
+	FILE *f= fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	printf("%-32s %12s %12s %8s\n", "benchmark", "base ns/op", "ns/op", "change");
+	while (fgets(line, sizeof(line), f) != NULL) {
+		const char *pn= strstr(line, "\"name\": \""), *pv= strstr(line, "\"ns_per_op\": ");
+		if ((pn == NULL) || (pv == NULL) || (sscanf(pn + 9, "%63[^\"]", name) != 1) ||
+				(sscanf(pv + 13, "%lf", &base) != 1) || (base <= 0))
+			continue;
+		for (i= 0; (i < n_results) && strcmp(results[i].name, name); i++)
+			;
+		if (i == n_results)
+			continue;	// Not run now (-f)
+		found++;
+		double change= (results[i].ns_per_op / base - 1) * 100;
+		printf("%-32s %12.2f %12.2f %+7.1f%%%s\n", name, base, results[i].ns_per_op, change,
+				(change > tolerance) ? "  REGRESSION" : ((change < -tolerance) ? "  faster" : ""));
+		if (change > tolerance)
+			regressions++;
+	}
+	fclose(f);
+	printf("%d benchmarks compared, %d regressions above %.0f%%\n", found, regressions, tolerance);
+	return regressions;
+}
+
+
+/* Wakeup latency */
+
+typedef struct WK_ARG {
+	int s;					// Socket of the benchmark
+	int peer;				// Socket of the echo thread
+} WK_ARG;
+
+/** Echo thread: returns every datagram until it gets "q" */
+static void *wk_echo(void *arg) {
+	WK_ARG *a= (WK_ARG *)arg;
+	char c;
+	while ((recv(a->peer, &c, 1, 0) == 1) && (c != 'q'))
+		send(a->peer, &c, 1, 0);
+	return NULL;
+}
+
+static void wk_select(void *arg, long long n) {
+	WK_ARG *a= (WK_ARG *)arg;
+	fd_set fds;
+	char c= 'x';
+	long long i;
+	for (i= 0; i < n; i++) {
+		send(a->s, &c, 1, 0);
+		FD_ZERO(&fds);
+		FD_SET(a->s, &fds);
+		if ((select(a->s + 1, &fds, NULL, NULL, NULL) < 0) || (recv(a->s, &c, 1, 0) != 1))
+			break;
+	}
+}
+
+static void wk_busy_poll(void *arg, long long n) {
+	WK_ARG *a= (WK_ARG *)arg;
+	char c= 'x';
+	long long i;
+	ssize_t r;
+	for (i= 0; i < n; i++) {
+		send(a->s, &c, 1, 0);
+		while (((r= recv(a->s, &c, 1, MSG_DONTWAIT)) < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			;
+		if (r != 1)
+			break;
+	}
+}
+
+/** Open a UDP socket on 127.0.0.1 and return it, or -1 */
+static int wk_socket(struct sockaddr_in *addr) {
+	socklen_t len= sizeof(*addr);
+	int s= socket(AF_INET, SOCK_DGRAM, 0);
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family= AF_INET;
+	addr->sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+	if ((s >= 0) && (bind(s, (struct sockaddr *)addr, sizeof(*addr)) ||
+			getsockname(s, (struct sockaddr *)addr, &len))) {
+		perror("wakeup socket");
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+static void bench_wakeup(void) {
+	struct sockaddr_in a1, a2;
+	pthread_t echo;
+	WK_ARG a;
+	char c= 'q';
+
+	a.s= wk_socket(&a1);
+	a.peer= wk_socket(&a2);
+	if ((a.s < 0) || (a.peer < 0) || connect(a.s, (struct sockaddr *)&a2, sizeof(a2)) ||
+			connect(a.peer, (struct sockaddr *)&a1, sizeof(a1)) || pthread_create(&echo, NULL, wk_echo, &a)) {
+		perror("wakeup benchmark");
+		if (a.s >= 0)
+			close(a.s);
+		if (a.peer >= 0)
+			close(a.peer);
+		return;
+	}
+	bench("wakeup/select", wk_select, &a, 0);
+	bench("wakeup/busy_poll", wk_busy_poll, &a, 0);
+	send(a.s, &c, 1, 0);
+	pthread_join(echo, NULL);
+	close(a.s);
+	close(a.peer);
+}
+
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-o out.json] [-c baseline.json] [-t pct] [-m ms] [-f filter] [-d dir]\n", prog);
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *out= NULL, *baseline= NULL, *dir= "/tmp";
+	double tolerance= 10;
+	int opt, res= 0;
+
+	while ((opt= getopt(argc, argv, "o:c:t:m:f:d:h")) != -1) {
+		switch (opt) {
+		case 'o': out= optarg; break;
+		case 'c': baseline= optarg; break;
+		case 't': tolerance= atof(optarg); break;
+		case 'm': min_ns= atoll(optarg) * 1000000LL; break;
+		case 'f': filter= optarg; break;
+		case 'd': dir= optarg; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((optind != argc) || (min_ns <= 0) || (tolerance < 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	bench_bitmask();
+	bench_hash(dir);
+	bench_parse();
+	bench_srr();
+	bench_write(dir);
+	bench_wakeup();
+
+	if (out != NULL) {
+		FILE *f= fopen(out, "w");
+		if (f == NULL) {
+			perror(out);
+			return 1;
+		}
+		write_json(f);
+		fclose(f);
+	} else if (baseline == NULL)
+		write_json(stdout);
+	if (baseline != NULL) {
+		int n= compare_baseline(baseline, tolerance);
+		res= (n != 0) ? 1 : 0;
+	}
+	return res;
+}
@@ -0,0 +1,785 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * fmperf.c
+ *
+ * End-to-end throughput run on this host: a multicast sender for synthetic
+ *   files and the headless receiver (fmulticast_cli) started as a child
+ *   process with 'n' transfers. Each request gets its own session (multicast
+ *   port) and its own sender thread, which sends the file at the given rate,
+ *   drops a fraction of the DATA packets on purpose and repairs the blocks
+ *   missing in the SRRs until the receiver leaves. The multicast packets
+ *   have TTL 0, so they do not leave the host. The received files are
+ *   checked against the generated contents and deleted.
+ *
+ *   fmperf [-n transfers] [-z size[K|M|G]] [-b block_size] [-l loss%] [-r Mbit/s]
+ *          [-t rx_threads] [-c cli] [-o dir] [-p tcp_port] [-S seed] [-C] [-Z codec] [-X]
+ *          [-T blocks[:rounds]] [-K stripes] [-Y layers[:loss%]] [-v] [-H]
+ *
+ *   -r Mbit/s	rate of all the sessions together (0= as fast as possible)
+ *   -C			the receiver sends its capabilities (fmulticast_cli -C); with
+ *				-b 0 each session uses the block size preferred by the receiver
+ *   -Z codec	compress the blocks with lz4 or zstd (PKT_DATAZ) when the receiver
+ *				decompresses them; implies -C
+ *   -X			compressible contents (each 8-byte word is repeated 8 times)
+ *   -T b[:r]	tail repair (fmulticast_cli -T): the sender answers PKT_TAIL with the
+ *				blocks on the TCP connection; implies -C
+ *   -K k		striped sessions (fmulticast_cli -K): block seq goes to stripe seq % k,
+ *				each stripe on its own port; implies -C
+ *   -Y n[:l]	layered sessions (fmulticast_cli -L l, default 10%): layer j is a
+ *				carousel of the whole file, starting at block j*n_blocks/n, sent at
+ *				2^j times the rate of -r on its own port; the SRRs are ignored and
+ *				the receiver joins the layers it can take; implies -C
+ *   -H			only print the header of the CSV rows
+ *
+ *   Prints one CSV row: goodput, receiver CPU utilisation and peak RSS,
+ *   feedback bytes (SRRs), packets, blocks repaired on TCP and the time to
+ *   verified completion
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "engine.h"
+#include "decomp.h"
+
+#define PERF_GROUP		"239.255.70.77"	// Multicast group of the sessions
+#define PERF_MPORT		31000	// Multicast port of session 0; session k uses PERF_MPORT+k
+#define MAX_TRANSFERS	1024
+#define OK_WAIT_MS		10000	// Time waiting for the receiver's OK
+#define IDLE_MS			30000	// A session without SRRs or TCP data for this long ends
+#define REPAIR_HOLDOFF_MS	20	// Minimum interval between two copies of the same block
+#define IP_OVERHEAD		28		// IPv4 and UDP headers, for the rate
+
+// One session of the sender
+typedef struct PERF_SES {
+	int k;					// Session number: its sid, cid and port offset
+	int ts;					// TCP connection with the receiver
+	pthread_t tid;
+	unsigned long long f_length;
+	long long n_blocks;
+	int block_size;
+	int codec;				// Codec of the blocks (Z_NONE= PKT_DATA/PKT_DATA64 packets)
+	int striped;			// The receiver sent CAP_STRIPES: the reply header lists the stripes
+	int layered;			// The receiver sent CAP_LAYERS: stripe j is layer j (STRIPE_LAYERS)
+	int n_stripes;			// Multicast groups of the session
+	struct sockaddr_in to[MAX_STRIPES];	// ... and their addresses
+	unsigned seed;			// Loss generator
+	// Counters
+	long long pkts;			// DATA packets, including the dropped ones
+	long long repairs;		// ... repeating a block
+	long long dropped;		// ... dropped on purpose
+	long long wire_bytes;	// Payload bytes of the DATA packets
+	long long n_srr;
+	long long srr_bytes;	// Feedback received
+	long long n_tail;		// PKT_TAIL requests
+	long long tail_blocks;	// ... and blocks sent on the TCP connection
+	int left;				// The receiver closed the connection
+} PERF_SES;
+
+// Run parameters
+static int n_transfers= 1;
+static unsigned long long f_size= 1 << 20;
+static int block_size= 1400;
+static int caps= 0;			// Read the receiver capabilities after the request
+static int codec= Z_NONE;	// Codec requested with -Z
+static int word_shift= 0;	// log2 of the repetitions of each word of the contents
+static int stripes= 1;		// Stripes asked with -K
+static int layers= 0;		// Layers asked with -Y
+static double loss= 0;
+static double rate_mbps= 1000;
+static unsigned seed= 1;
+
+static PERF_SES ses[MAX_TRANSFERS];
+static int n_ses= 0;
+
+
+/** Current CLOCK_MONOTONIC time, in ns */
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/** Word 'i' of every generated file */
+static unsigned long long pattern_word(unsigned long long i) {
+	unsigned long long z= i * 0x9e3779b97f4a7c15ULL + 0x632be59bd9b4e019ULL;
+	z= (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z= (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/** Contents of the generated files from offset 'off' */
+static void pattern(unsigned long long off, unsigned char *buf, int len) {
+	int i= 0;
+	while (i < len) {
+		unsigned long long o= off + i, w= pattern_word((o / 8) >> word_shift);
+		int b= o % 8, c= (8 - b < len - i) ? 8 - b : len - i;
+		memcpy(buf + i, (unsigned char *)&w + b, c);
+		i+= c;
+	}
+}
+
+/** Parse "size[K|M|G]" */
+static unsigned long long parse_size(const char *s) {
+	char *end;
+	unsigned long long v= strtoull(s, &end, 10);
+	switch (*end) {
+	case 'k': case 'K': return v << 10;
+	case 'm': case 'M': return v << 20;
+	case 'g': case 'G': return v << 30;
+	default: return v;
+	}
+}
+
+
+/* Sender */
+
+/** Mark the blocks missing in 'mask' (bit i is block base+i) that were sent before 'upto' */
+static void add_needs(unsigned char *need, unsigned *last_ms, long long *n_need, long long base,
+		const unsigned char *mask, int mask_len, long long upto, unsigned now_ms) {
+	long long i;
+	for (i= 0; (i < (long long)mask_len * 8) && (base + i < upto); i++) {
+		long long seq= base + i;
+		if ((mask[i / 8] & (1 << (i % 8))) || need[seq] || (now_ms - last_ms[seq] < REPAIR_HOLDOFF_MS))
+			continue;
+		need[seq]= 1;
+		(*n_need)++;
+	}
+}
+
+/** Compress 'len' bytes of 'src' with 'codec'; returns the compressed length, or 0 if
+ *  it does not fit in 'dst_len' bytes */
+static int compress_block(int codec, const unsigned char *src, int len, unsigned char *dst, int dst_len) {
+	switch (codec) {
+#ifdef HAVE_LZ4
+	case Z_LZ4:
+		return LZ4_compress_default((const char *)src, (char *)dst, len, dst_len);
+#endif
+#ifdef HAVE_ZSTD
+	case Z_ZSTD: {
+		size_t n= ZSTD_compress(dst, dst_len, src, len, 1);
+		return ZSTD_isError(n) ? 0 : (int)n;
+	}
+#endif
+	default:
+		return 0;
+	}
+}
+
+/** Write the packet of block 'seq' of session 's' in 'buf'; 'tmp' holds one block. With
+ *  'force64' an uncompressed block goes in a PKT_DATA64. Returns the packet length and
+ *  the length of its payload in 'payload' */
+static int build_block(PERF_SES *s, unsigned char *buf, unsigned char *tmp, long long seq,
+		int force64, int *payload) {
+	unsigned char type= (force64 || (s->n_blocks > 0x7fffffffLL)) ? PKT_DATA64 : PKT_DATA;
+	short sid= (short)s->k;
+	int len= (seq == s->n_blocks - 1) ? (int)(s->f_length - seq * s->block_size) : s->block_size;
+	unsigned char *pt= buf;
+	if (s->codec != Z_NONE) {
+		// Each block on its own; blocks that do not shrink go stored (Z_NONE)
+		int z;
+		unsigned char flags= s->codec;
+		pattern((unsigned long long)seq * s->block_size, tmp, len);
+		z= compress_block(s->codec, tmp, len, buf + DATAZ_HDR_LEN, len - 1);
+		if (z <= 0) {
+			memcpy(buf + DATAZ_HDR_LEN, tmp, len);
+			z= len;
+			flags= Z_NONE;
+		}
+		*pt++= PKT_DATAZ;
+		memcpy(pt, &sid, sizeof(sid)); pt+= sizeof(sid);
+		memcpy(pt, &seq, sizeof(seq)); pt+= sizeof(seq);
+		memcpy(pt, &z, sizeof(z)); pt+= sizeof(z);
+		memcpy(pt, &len, sizeof(len)); pt+= sizeof(len);
+		*pt++= flags;
+		len= z;
+	} else {
+		*pt++= type;
+	memcpy(pt, &sid, sizeof(sid)); pt+= sizeof(sid);
+	if (type == PKT_DATA) {
+		int seq32= (int)seq;
+		memcpy(pt, &seq32, sizeof(seq32)); pt+= sizeof(seq32);
+	} else {
+		memcpy(pt, &seq, sizeof(seq)); pt+= sizeof(seq);
+	}
+		memcpy(pt, &len, sizeof(len)); pt+= sizeof(len);
+		pattern((unsigned long long)seq * s->block_size, pt, len);
+	}
+	*payload= len;
+	return pt - buf + len;
+}
+
+/** Send block 'seq' of session 's' on socket 'us', to stripe 'j'; 'tmp' holds one block.
+ *  Returns the datagram length */
+static int send_block(PERF_SES *s, int us, unsigned char *buf, unsigned char *tmp, long long seq, int j) {
+	const struct sockaddr_in *to= &s->to[j];
+	int len, n= build_block(s, buf, tmp, seq, 0, &len);
+	s->pkts++;
+	s->wire_bytes+= len;
+	if ((loss > 0) && (rand_r(&s->seed) < loss * ((double)RAND_MAX + 1))) {
+		s->dropped++;
+		return n;
+	}
+	if (sendto(us, buf, n, 0, (const struct sockaddr *)to, sizeof(*to)) < 0)
+		perror("PERF> sendto");
+	return n;
+}
+
+/** Answer a PKT_TAIL (its type byte already read) with one PKT_DATA64 or PKT_DATAZ record
+ *  per block of its ranges on the TCP connection, and forget the pending multicast repairs
+ *  of those blocks. Returns 0 if the connection failed */
+static int answer_tail(PERF_SES *s, unsigned char *buf, unsigned char *tmp, unsigned char *need,
+		long long *n_need) {
+	unsigned char hdr[2 * sizeof(short) + sizeof(int)], rg[sizeof(long long) + sizeof(int)];
+	int n_ranges, count, len, n, r;
+	long long first, seq;
+
+	if (recv(s->ts, hdr, sizeof(hdr), MSG_WAITALL) != sizeof(hdr))
+		return 0;
+	memcpy(&n_ranges, hdr + 2 * sizeof(short), sizeof(n_ranges));
+	if ((n_ranges < 0) || (n_ranges > MAX_TAIL_RANGES))
+		return 0;
+	s->n_tail++;
+	for (r= 0; r < n_ranges; r++) {
+		if (recv(s->ts, rg, sizeof(rg), MSG_WAITALL) != sizeof(rg))
+			return 0;
+		memcpy(&first, rg, sizeof(first));
+		memcpy(&count, rg + sizeof(first), sizeof(count));
+		for (seq= (first < 0) ? 0 : first; (seq < first + count) && (seq < s->n_blocks); seq++) {
+			n= build_block(s, buf, tmp, seq, 1, &len);
+			if (send(s->ts, buf, n, MSG_NOSIGNAL) != n)
+				return 0;
+			s->tail_blocks++;
+			if (need[seq]) {
+				need[seq]= 0;
+				(*n_need)--;
+			}
+		}
+	}
+	return 1;
+}
+
+/** Read the receiver capabilities (engine.h) that follow the requested name; with
+ *  '-b 0' the session uses the first preferred block size that the receiver accepts,
+ *  and it compresses the blocks if the receiver has the codec of '-Z' */
+static int read_caps(PERF_SES *s) {
+	unsigned char tl[2];
+	int val[64], max_block= MAX_DATAGRAM_LEN - DATAZ_HDR_LEN, pref= 0, codecs= 1 << Z_NONE;
+
+	for (;;) {
+		if (recv(s->ts, tl, 1, MSG_WAITALL) != 1)
+			return 0;
+		if (tl[0] == CAP_END)
+			break;
+		if ((recv(s->ts, tl + 1, 1, MSG_WAITALL) != 1) ||
+				((tl[1] > 0) && (recv(s->ts, val, tl[1], MSG_WAITALL) != tl[1])))
+			return 0;
+		if ((tl[0] == CAP_MAX_BLOCK) && (tl[1] >= sizeof(int)))
+			max_block= val[0];
+		else if ((tl[0] == CAP_BLOCK_SIZES) && (tl[1] >= sizeof(int)))
+			pref= val[0];
+		else if ((tl[0] == CAP_CODECS) && (tl[1] >= sizeof(int)))
+			codecs= val[0];
+		else if ((tl[0] == CAP_STRIPES) && (tl[1] >= sizeof(int)) && !s->layered) {
+			s->striped= 1;
+			s->n_stripes= (stripes < val[0]) ? stripes : val[0];
+		} else if ((tl[0] == CAP_LAYERS) && (tl[1] >= sizeof(int)) && (layers > 1)) {
+			s->layered= 1;
+			s->striped= 0;
+			s->n_stripes= layers;
+		}
+	}
+	if (codecs & (1 << codec))
+		s->codec= codec;
+	if (s->block_size == 0)
+		s->block_size= (pref > 0) ? pref : 1400;
+	if (s->block_size > max_block)
+		s->block_size= max_block;
+	return 1;
+}
+
+/** Session of one request: reply, first pass, repairs until the receiver leaves */
+static void *session_thread(void *ptr) {
+	PERF_SES *s= (PERF_SES *)ptr;
+	char fname[256];
+	unsigned char hdr[128], *pt= hdr, *buf= NULL, *tmp= NULL, *need= NULL, srr[MAX_MESSAGE_LEN + 64];
+	unsigned *last_ms= NULL;
+	int us= -1, n, i= 0, j, zero= 0, one= 1;
+	long long next_seq= 0, n_need= 0, repair_pos= 0, t0= now_ns(), next_tx, last_rx;
+	long long l_pos[MAX_STRIPES], l_next[MAX_STRIPES];	// Next block and send time of each layer
+	double byte_ns= 0;		// Time sending one byte at the session's rate
+	struct pollfd pfd[2];
+
+	// Request: the file name and a NUL
+	while ((i < (int)sizeof(fname) - 1) && ((n= recv(s->ts, fname + i, 1, 0)) == 1) && fname[i])
+		i++;
+	fname[i]= '\0';
+	s->block_size= block_size;
+	s->n_stripes= 1;
+	if (caps && !read_caps(s))
+		goto end;
+	s->f_length= f_size;
+	s->n_blocks= (f_size + s->block_size - 1) / s->block_size;
+	if (s->n_blocks == 0)
+		s->n_blocks= 1;
+
+	// Reply header
+	short cid= (short)s->k, sid= (short)s->k;
+	int n32= (s->n_blocks > 0x7fffffffLL) ? N_BLOCKS_64 : (int)s->n_blocks;
+	unsigned int f_hash= 0;
+	struct in_addr group;
+	unsigned short mport= PERF_MPORT + s->k;
+	inet_pton(AF_INET, PERF_GROUP, &group);
+	memcpy(pt, &cid, sizeof(cid)); pt+= sizeof(cid);
+	memcpy(pt, &sid, sizeof(sid)); pt+= sizeof(sid);
+	memcpy(pt, &s->f_length, sizeof(s->f_length)); pt+= sizeof(s->f_length);
+	memcpy(pt, &s->block_size, sizeof(s->block_size)); pt+= sizeof(s->block_size);
+	memcpy(pt, &n32, sizeof(n32)); pt+= sizeof(n32);
+	if (n32 == N_BLOCKS_64) {
+		memcpy(pt, &s->n_blocks, sizeof(s->n_blocks)); pt+= sizeof(s->n_blocks);
+	}
+	memcpy(pt, &f_hash, sizeof(f_hash)); pt+= sizeof(f_hash);
+	memcpy(pt, &group, sizeof(group)); pt+= sizeof(group);
+	memcpy(pt, &mport, sizeof(mport)); pt+= sizeof(mport);
+	if (s->n_stripes < 1)
+		s->n_stripes= 1;
+	for (j= 0; j < s->n_stripes; j++) {
+		// Stripe j of session k uses port PERF_MPORT + k + j * MAX_TRANSFERS; a layer also needs its
+		//   own group, since the host joins a group for every port
+		unsigned short sport= mport + j * MAX_TRANSFERS;
+		int map= s->layered ? STRIPE_LAYERS : STRIPE_BLOCK_RR;
+		struct in_addr sgroup= group;
+		if (s->layered)
+			sgroup.s_addr= htonl(ntohl(group.s_addr) + j);
+		memset(&s->to[j], 0, sizeof(s->to[j]));
+		s->to[j].sin_family= AF_INET;
+		s->to[j].sin_addr= sgroup;
+		s->to[j].sin_port= htons(sport);
+		if (!s->striped && !s->layered)
+			continue;
+		if (j == 0) {
+			memcpy(pt, &s->n_stripes, sizeof(s->n_stripes)); pt+= sizeof(s->n_stripes);
+			memcpy(pt, &map, sizeof(map)); pt+= sizeof(map);
+		} else {
+			memcpy(pt, &sgroup, sizeof(sgroup)); pt+= sizeof(sgroup);
+			memcpy(pt, &sport, sizeof(sport)); pt+= sizeof(sport);
+		}
+	}
+	if (send(s->ts, hdr, pt - hdr, 0) != pt - hdr) {
+		perror("PERF> reply");
+		goto end;
+	}
+	// "OK"
+	struct timeval tv= { OK_WAIT_MS / 1000, 0 };
+	setsockopt(s->ts, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if ((recv(s->ts, hdr, 2, MSG_WAITALL) != 2) || memcmp(hdr, "OK", 2)) {
+		fprintf(stderr, "PERF> session %d: no OK from the receiver\n", s->k);
+		goto end;
+	}
+
+	// Multicast socket: TTL 0 keeps the packets in the host; the SRRs come back to it
+	if ((us= socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		perror("PERF> socket");
+		goto end;
+	}
+	setsockopt(us, IPPROTO_IP, IP_MULTICAST_TTL, &zero, sizeof(zero));
+	setsockopt(us, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one));
+	buf= (unsigned char *)malloc(DATAZ_HDR_LEN + s->block_size);
+	tmp= (unsigned char *)malloc(s->block_size);
+	need= (unsigned char *)calloc(s->n_blocks, 1);
+	last_ms= (unsigned *)calloc(s->n_blocks, sizeof(unsigned));
+	if ((buf == NULL) || (tmp == NULL) || (need == NULL) || (last_ms == NULL)) {
+		perror("PERF> malloc");
+		goto end;
+	}
+	if (rate_mbps > 0)
+		byte_ns= 8e3 * n_transfers / rate_mbps;
+
+	pfd[0].fd= s->ts;
+	pfd[0].events= POLLIN;
+	pfd[1].fd= us;
+	pfd[1].events= POLLIN;
+	next_tx= last_rx= now_ns();
+	for (j= 0; j < s->n_stripes; j++) {
+		l_pos[j]= j * s->n_blocks / s->n_stripes;
+		l_next[j]= next_tx;
+	}
+	for (;;) {
+		long long now= now_ns();
+		int have= s->layered || (next_seq < s->n_blocks) || (n_need > 0);
+		int timeout= have ? ((next_tx > now) ? (int)((next_tx - now) / 1000000) : 0) : 100;
+		if (poll(pfd, 2, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("PERF> poll");
+			break;
+		}
+		now= now_ns();
+		unsigned now_ms= (unsigned)((now - t0) / 1000000) + REPAIR_HOLDOFF_MS;
+		if (pfd[0].revents && (recv(s->ts, hdr, 1, MSG_PEEK | MSG_DONTWAIT) == 1) && (hdr[0] == PKT_TAIL)) {
+			recv(s->ts, hdr, 1, 0);
+			if (!answer_tail(s, buf, tmp, need, &n_need)) {
+				s->left= 1;
+				break;
+			}
+			last_rx= now_ns();
+		} else if (pfd[0].revents) {
+			// "END" or the close of the connection: the receiver left
+			n= recv(s->ts, hdr, sizeof(hdr), MSG_DONTWAIT);
+			if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EINTR))) {
+				s->left= 1;
+				break;
+			}
+			last_rx= now;
+		}
+		while ((n= recv(us, srr, sizeof(srr), MSG_DONTWAIT)) > 0) {
+			last_rx= now;
+			if (s->layered && ((srr[0] == PKT_SRR) || (srr[0] == PKT_SRR64))) {
+				// The carousels resend every block
+				s->n_srr++;
+				s->srr_bytes+= n;
+			} else if ((srr[0] == PKT_SRR) && (n > (int)SRR_HDR_LEN)) {
+				s->n_srr++;
+				s->srr_bytes+= n;
+				add_needs(need, last_ms, &n_need, 0, srr + SRR_HDR_LEN, n - SRR_HDR_LEN, next_seq, now_ms);
+			} else if ((srr[0] == PKT_SRR64) && (n > (int)SRR64_HDR_LEN)) {
+				long long base;
+				int w_len;
+				s->n_srr++;
+				s->srr_bytes+= n;
+				memcpy(&base, srr + SRR_HDR_LEN, sizeof(base));
+				memcpy(&w_len, srr + SRR_HDR_LEN + sizeof(base), sizeof(w_len));
+				if ((base >= 0) && (w_len > 0) && (w_len <= n - (int)SRR64_HDR_LEN))
+					add_needs(need, last_ms, &n_need, base, srr + SRR64_HDR_LEN, w_len, next_seq, now_ms);
+			}
+			// Our own multicast packets and the EXIT are ignored
+		}
+		if (!s->layered && (now - last_rx > IDLE_MS * 1000000LL)) {
+			fprintf(stderr, "PERF> session %d: receiver idle\n", s->k);
+			break;
+		}
+		// Layered session: layer j sends at 2^j times the session's rate, until the receiver leaves
+		for (j= 0; s->layered && (j < s->n_stripes); j++) {
+			while (now >= l_next[j]) {
+				long long seq= l_pos[j];
+				l_pos[j]= (l_pos[j] + 1) % s->n_blocks;
+				n= send_block(s, us, buf, tmp, seq, j);
+				l_next[j]+= (long long)((n + IP_OVERHEAD) * byte_ns) >> j;
+				if (byte_ns == 0)
+					break;
+			}
+			if ((j == 0) || (l_next[j] < next_tx))
+				next_tx= l_next[j];
+		}
+		// Send at the session's rate
+		while (!s->layered && (now >= next_tx)) {
+			long long seq= -1;
+			if (next_seq < s->n_blocks)
+				seq= next_seq++;
+			else {
+				for (; n_need > 0; repair_pos= (repair_pos + 1) % s->n_blocks) {
+					if (need[repair_pos]) {
+						seq= repair_pos;
+						need[seq]= 0;
+						n_need--;
+						s->repairs++;
+						break;
+					}
+				}
+			}
+			if (seq < 0) {
+				next_tx= now;
+				break;
+			}
+			last_ms[seq]= now_ms;
+			n= send_block(s, us, buf, tmp, seq, seq % s->n_stripes);
+			next_tx+= (long long)((n + IP_OVERHEAD) * byte_ns);
+			if (byte_ns == 0)
+				break;	// As fast as possible, still reading the SRRs
+		}
+	}
+
+	// Ends the session of any other receiver of the group
+	if (us >= 0) {
+		hdr[0]= PKT_STOP;
+		memcpy(hdr + 1, &sid, sizeof(sid));
+		sendto(us, hdr, 1 + sizeof(sid), 0, (struct sockaddr *)&s->to[0], sizeof(s->to[0]));
+	}
+end:
+	free(buf);
+	free(tmp);
+	free(need);
+	free(last_ms);
+	if (us >= 0)
+		close(us);
+	close(s->ts);
+	return NULL;
+}
+
+/** Accept the 'n_transfers' requests, one session thread each */
+static void *accept_thread(void *ptr) {
+	int ls= *(int *)ptr;
+	while (n_ses < n_transfers) {
+		int ts= accept(ls, NULL, NULL);
+		if (ts < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("PERF> accept");
+			break;
+		}
+		PERF_SES *s= &ses[n_ses];
+		memset(s, 0, sizeof(*s));
+		s->k= n_ses + 1;
+		s->ts= ts;
+		s->seed= seed + s->k;
+		if (pthread_create(&s->tid, NULL, session_thread, s)) {
+			perror("PERF> pthread_create");
+			close(ts);
+			break;
+		}
+		n_ses++;
+	}
+	return NULL;
+}
+
+
+/* Receiver */
+
+/** Check and delete the file received for transfer 'k'; returns TRUE if it is complete and correct */
+static int verify_file(const char *dir, int k) {
+	char pat[512];
+	unsigned char *got, *want;
+	unsigned long long off= 0;
+	glob_t g;
+	int ok= 0;
+	snprintf(pat, sizeof(pat), "%s/*.perf%d.bin", dir, k);
+	if ((glob(pat, 0, NULL, &g) != 0) || (g.gl_pathc == 0))
+		return 0;
+	FILE *f= fopen(g.gl_pathv[0], "r");
+	got= (unsigned char *)malloc(1 << 20);
+	want= (unsigned char *)malloc(1 << 20);
+	if ((f != NULL) && (got != NULL) && (want != NULL)) {
+		size_t n;
+		ok= 1;
+		while (ok && ((n= fread(got, 1, 1 << 20, f)) > 0)) {
+			pattern(off, want, n);
+			ok= !memcmp(got, want, n);
+			off+= n;
+		}
+		ok= ok && (off == f_size);
+	}
+	if (f != NULL)
+		fclose(f);
+	free(got);
+	free(want);
+	unlink(g.gl_pathv[0]);
+	globfree(&g);
+	return ok;
+}
+
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-n transfers] [-z size[K|M|G]] [-b block_size] [-l loss%%] [-r Mbit/s] "
+			"[-t rx_threads] [-c cli] [-o dir] [-p tcp_port] [-S seed] [-C] [-Z lz4|zstd] [-X] "
+			"[-T blocks[:rounds]] [-K stripes] [-Y layers[:loss%%]] [-v] [-H]\n", prog);
+}
+
+static const char *csv_header= "transfers,file_bytes,block_size,loss_pct,rate_mbps,verified,"
+		"transfer_s,verified_s,goodput_mbps,rx_cpu_pct,rx_peak_rss_mb,feedback_bytes,srrs,"
+		"data_pkts,repairs,dropped,wire_bytes,tail_blocks,stripes,layers";
+
+
+int main(int argc, char *argv[]) {
+	char tmp_dir[]= "/tmp/fmperf.XXXXXX", port_str[16];
+	const char *cli= "./fmulticast_cli", *out_dir= NULL, *rx_threads= NULL, *tail= NULL, *stripes_str= NULL;
+	char layer_loss[16]= "10";
+	int tcp_port= 20070, opt, ls, on= 1, k, verbose= 0, status, verified= 0;
+	struct sockaddr_in a;
+	struct rusage ru;
+	pthread_t atid;
+	pid_t pid;
+
+	while ((opt= getopt(argc, argv, "n:z:b:l:r:t:c:o:p:S:CZ:XT:K:Y:vHh")) != -1) {
+		switch (opt) {
+		case 'n': n_transfers= atoi(optarg); break;
+		case 'z': f_size= parse_size(optarg); break;
+		case 'b': block_size= atoi(optarg); break;
+		case 'l': loss= atof(optarg) / 100; break;
+		case 'r': rate_mbps= atof(optarg); break;
+		case 't': rx_threads= optarg; break;
+		case 'c': cli= optarg; break;
+		case 'o': out_dir= optarg; break;
+		case 'p': tcp_port= atoi(optarg); break;
+		case 'S': seed= strtoul(optarg, NULL, 0); break;
+		case 'C': caps= 1; break;
+		case 'Z':
+			caps= 1;
+			codec= !strcmp(optarg, "lz4") ? Z_LZ4 : !strcmp(optarg, "zstd") ? Z_ZSTD : -1;
+			break;
+		case 'X': word_shift= 3; break;
+		case 'T':
+			caps= 1;
+			tail= optarg;
+			break;
+		case 'K':
+			caps= 1;
+			stripes_str= optarg;
+			stripes= atoi(optarg);
+			break;
+		case 'Y':
+			caps= 1;
+			sscanf(optarg, "%d:%15s", &layers, layer_loss);
+			break;
+		case 'v': verbose= 1; break;
+		case 'H':
+			printf("%s\n", csv_header);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((optind != argc) || (n_transfers < 1) || (n_transfers > MAX_TRANSFERS) || (f_size == 0) ||
+			(block_size < (caps ? 0 : 1)) || (block_size + DATAZ_HDR_LEN > MAX_DATAGRAM_LEN) ||
+			(codec < 0) || (codec & ~Z_CODEC_MASK) || (stripes < 1) || (stripes > MAX_STRIPES) || (layers < 0) ||
+			(layers > MAX_STRIPES) || (atoi(layer_loss) <= 0) || (loss < 0) ||
+			(loss >= 1) || (rate_mbps < 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if ((out_dir == NULL) && ((out_dir= mkdtemp(tmp_dir)) == NULL)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	// Sender
+	memset(&a, 0, sizeof(a));
+	a.sin_family= AF_INET;
+	a.sin_port= htons(tcp_port);
+	a.sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+	if (((ls= socket(AF_INET, SOCK_STREAM, 0)) < 0) ||
+			setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+			bind(ls, (struct sockaddr *)&a, sizeof(a)) || listen(ls, n_transfers)) {
+		perror("PERF> TCP listener");
+		return 1;
+	}
+	if (pthread_create(&atid, NULL, accept_thread, &ls)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	// Receiver: "fmulticast_cli -o dir [-t n] perf1.bin 127.0.0.1 port ..."
+	char **args= (char **)calloc(3 * n_transfers + 14, sizeof(char *));
+	int na= 0;
+	snprintf(port_str, sizeof(port_str), "%d", tcp_port);
+	args[na++]= (char *)cli;
+	if (caps)
+		args[na++]= "-C";
+	args[na++]= "-o";
+	args[na++]= (char *)out_dir;
+	if (rx_threads != NULL) {
+		args[na++]= "-t";
+		args[na++]= (char *)rx_threads;
+	}
+	if (tail != NULL) {
+		args[na++]= "-T";
+		args[na++]= (char *)tail;
+	}
+	if (stripes_str != NULL) {
+		args[na++]= "-K";
+		args[na++]= (char *)stripes_str;
+	}
+	if (layers > 0) {
+		args[na++]= "-L";
+		args[na++]= layer_loss;
+	}
+	for (k= 1; k <= n_transfers; k++) {
+		char *name= (char *)malloc(32);
+		snprintf(name, 32, "perf%d.bin", k);
+		args[na++]= name;
+		args[na++]= "127.0.0.1";
+		args[na++]= port_str;
+	}
+	args[na]= NULL;
+
+	long long t0= now_ns();
+	if ((pid= fork()) < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		if (!verbose) {
+			int null= open("/dev/null", O_WRONLY);
+			dup2(null, STDOUT_FILENO);
+			dup2(null, STDERR_FILENO);
+		}
+		execv(cli, args);
+		perror(cli);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("wait4");
+		return 1;
+	}
+	long long t1= now_ns();
+	if (WIFEXITED(status) && (WEXITSTATUS(status) == 127)) {
+		fprintf(stderr, "failed to run '%s'\n", cli);
+		return 1;
+	}
+	// The sessions end when the receiver closes their connections
+	shutdown(ls, SHUT_RDWR);
+	close(ls);
+	pthread_join(atid, NULL);
+	for (k= 0; k < n_ses; k++)
+		pthread_join(ses[k].tid, NULL);
+	for (k= 1; k <= n_transfers; k++)
+		verified+= verify_file(out_dir, k);
+	long long t2= now_ns();
+	if (out_dir == tmp_dir)
+		rmdir(out_dir);
+
+	// Report
+	long long pkts= 0, repairs= 0, dropped= 0, n_srr= 0, srr_bytes= 0, wire_bytes= 0, tail_blocks= 0;
+	for (k= 0; k < n_ses; k++) {
+		pkts+= ses[k].pkts;
+		repairs+= ses[k].repairs;
+		dropped+= ses[k].dropped;
+		n_srr+= ses[k].n_srr;
+		srr_bytes+= ses[k].srr_bytes;
+		wire_bytes+= ses[k].wire_bytes;
+		tail_blocks+= ses[k].tail_blocks;
+	}
+	double secs= (t1 - t0) / 1e9;
+	double cpu= ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	printf("%d,%llu,%d,%g,%g,%d,%.3f,%.3f,%.1f,%.1f,%.1f,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%d,%d\n",
+			n_transfers, f_size, (n_ses > 0) ? ses[0].block_size : block_size, loss * 100, rate_mbps, verified, secs, (t2 - t0) / 1e9,
+			verified * (double)f_size * 8 / secs / 1e6, 100 * cpu / secs, ru.ru_maxrss / 1024.0,
+			srr_bytes, n_srr, pkts, repairs, dropped, wire_bytes, tail_blocks,
+			(n_ses > 0) ? ses[0].n_stripes : 1, (n_ses > 0) && ses[0].layered ? ses[0].n_stripes : 0);
+	return (verified == n_transfers) ? 0 : 2;
+}
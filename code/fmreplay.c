@@ -0,0 +1,1056 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * fmreplay.c
+ *
+ * Capture replay: reads a pcap or pcapng capture of a multicast session and
+ *   stands in for the sender on this host. It answers the TCP request with
+ *   the captured reply header, re-sends the captured DATA packets at their
+ *   original pace, scaled or as fast as possible, and answers the SRRs with
+ *   the captured blocks until the receiver leaves. By default it also runs
+ *   the receiver in the same process (libfmcast) and reports its completion
+ *   time, goodput and CPU time per GB
+ *
+ *   fmreplay [-s speed] [-f file] [-p tcp_port] [-i ifname] [-t rx_threads]
+ *            [-o dir] [-T idle_s] [-x] capture
+ *
+ *   -s speed	1= original pace (default), 2= twice as fast, 0= maximum speed
+ *   -f file	session of the request for 'file' (default: the first one)
+ *   -p port	TCP port to listen on (default: the captured one)
+ *   -i ifname	interface of the multicast packets (default: chosen by the routes)
+ *   -x			only replay the sender, for a receiver started apart
+ *
+ *   The multicast packets are sent with TTL 0, so they do not leave the host
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		// RUSAGE_THREAD
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "engine.h"
+#include "sock.h"
+#include "receiver_th.h"
+#include "registry.h"
+#include "logger.h"
+
+// Fragments being reassembled at the same time
+#define N_FRAGS			32
+// TCP connections followed in the capture, and bytes kept of each one
+#define N_STREAMS		256
+#define STREAM_MAX		4096
+// Minimum interval (ms) between two repairs of the same block
+#define REPAIR_HOLDOFF_MS	50
+// Time (ms) waiting for the receiver's request and OK
+#define ACCEPT_TIMEOUT_MS	10000
+
+/* Link types */
+#define DLT_NULL		0
+#define DLT_EN10MB		1
+#define DLT_RAW			101
+#define DLT_LINUX_SLL	113
+#define DLT_LINUX_SLL2	276
+
+
+// UDP datagram of the capture
+typedef struct CAP_DGRAM {
+	long long ts;			// ns
+	int family;				// AF_INET or AF_INET6
+	unsigned char dst[16];	// Destination address
+	unsigned short dport;	// Destination port
+	int len;
+	unsigned char *data;	// Into the mapped capture, or allocated when reassembled
+} CAP_DGRAM;
+
+// Payload of one direction of a TCP connection
+typedef struct CAP_STREAM {
+	int family;
+	unsigned char src[16], dst[16];
+	unsigned short sport, dport;
+	unsigned int next_seq;	// Next sequence number expected
+	int len;
+	unsigned char data[STREAM_MAX];
+} CAP_STREAM;
+
+// IP datagram being reassembled
+typedef struct CAP_FRAG {
+	int used;
+	int family;
+	unsigned char src[16], dst[16];
+	unsigned int id;
+	int proto;
+	long long ts;
+	int have;				// Bytes received
+	int total;				// Length of the payload (-1 until the last fragment arrives)
+	unsigned char *buf;
+} CAP_FRAG;
+
+// Session found in the capture
+typedef struct SESSION {
+	char fname[256];
+	int family;				// Of the TCP connection, which sets the address family of the reply
+	unsigned short tcp_port;
+	unsigned char reply[64];	// Reply header
+	int reply_len;
+	int group_off;			// Offset of the multicast address in the reply
+	short cid, sid;
+	unsigned long long f_length;
+	int block_size;
+	long long n_blocks;
+	unsigned char group[16];
+	unsigned short mport;
+	CAP_DGRAM **pkts;		// DATA packets of the session, by time
+	long long n_pkts;
+	long long *block;		// Last packet carrying each block (-1= none)
+	long long n_retrans;	// Packets repeating a block
+} SESSION;
+
+// Capture contents
+static GArray *dgrams= NULL;	// CAP_DGRAM
+static CAP_STREAM *streams= NULL;
+static int n_streams= 0;
+static CAP_FRAG frags[N_FRAGS];
+
+// Replay state
+static SESSION ses;
+static double speed= 1.0;
+static int tcp_port= 0;
+static int idle_s= 5;
+static const char *ifname= NULL;
+static volatile int replay_done= 0;
+static long long sent_pkts= 0, sent_repairs= 0, n_srr= 0;
+static double replay_cpu= 0;	// CPU time of the replay thread (s)
+static int replay_ok= 0;
+
+// Receiver state (test mode)
+static long long rx_end_ns= 0;
+static volatile int rx_completed= 0;	// The engine ended the transfer with RX_DONE
+
+
+/** Current CLOCK_MONOTONIC time, in ns */
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/** CPU time (s) of 'who' */
+static double cpu_time(int who) {
+	struct rusage ru;
+	if (getrusage(who, &ru))
+		return 0;
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+
+/* Reading the capture */
+
+/** Read an integer with 'n' bytes, little-endian or big-endian ('swap') as written in the capture */
+static unsigned long long rd(const unsigned char *p, int n, int swap) {
+	unsigned long long v= 0;
+	int i;
+	if (swap) {
+		for (i= 0; i < n; i++)
+			v= (v << 8) | p[i];
+	} else {
+		for (i= n - 1; i >= 0; i--)
+			v= (v << 8) | p[i];
+	}
+	return v;
+}
+
+/** Read a big-endian (network order) integer with 'n' bytes */
+static unsigned int rd_be(const unsigned char *p, int n) {
+	unsigned int v= 0;
+	int i;
+	for (i= 0; i < n; i++)
+		v= (v << 8) | p[i];
+	return v;
+}
+
+
+/** Add the payload of a TCP segment to its stream */
+static void add_tcp(int family, const unsigned char *src, const unsigned char *dst,
+		const unsigned char *p, int len) {
+	int alen= (family == AF_INET) ? 4 : 16, i, hlen;
+	unsigned short sport, dport;
+	unsigned int seq;
+	CAP_STREAM *s= NULL;
+
+	if (len < 20)
+		return;
+	sport= rd_be(p, 2);
+	dport= rd_be(p + 2, 2);
+	seq= rd_be(p + 4, 4);
+	if (p[13] & 0x02)	// SYN: the payload starts at seq+1
+		seq++;
+	hlen= (p[12] >> 4) * 4;
+	if ((hlen < 20) || (hlen > len))
+		return;
+	p+= hlen;
+	len-= hlen;
+	for (i= 0; i < n_streams; i++) {
+		if ((streams[i].family == family) && (streams[i].sport == sport) && (streams[i].dport == dport) &&
+				!memcmp(streams[i].src, src, alen) && !memcmp(streams[i].dst, dst, alen)) {
+			s= &streams[i];
+			break;
+		}
+	}
+	if (s == NULL) {
+		if (n_streams == N_STREAMS)
+			return;
+		s= &streams[n_streams++];
+		memset(s, 0, sizeof(*s));
+		s->family= family;
+		memcpy(s->src, src, alen);
+		memcpy(s->dst, dst, alen);
+		s->sport= sport;
+		s->dport= dport;
+		s->next_seq= seq;
+	}
+	if ((len == 0) || (seq != s->next_seq))
+		return;	// Retransmitted, or out of order after a loss in the capture
+	s->next_seq+= len;
+	if (len > STREAM_MAX - s->len)
+		len= STREAM_MAX - s->len;
+	memcpy(s->data + s->len, p, len);
+	s->len+= len;
+}
+
+
+/** Keep a UDP datagram; 'data' is copied when 'copy' is set */
+static void add_udp(long long ts, int family, const unsigned char *dst, const unsigned char *p, int len, int copy) {
+	CAP_DGRAM d;
+	int ulen;
+	if (len < 8)
+		return;
+	ulen= rd_be(p + 4, 2);
+	if ((ulen < 8) || (ulen > len))
+		return;	// Truncated by the capture's snap length
+	memset(&d, 0, sizeof(d));
+	d.ts= ts;
+	d.family= family;
+	memcpy(d.dst, dst, (family == AF_INET) ? 4 : 16);
+	d.dport= rd_be(p + 2, 2);
+	d.len= ulen - 8;
+	if (copy) {
+		d.data= (unsigned char *)malloc(d.len > 0 ? d.len : 1);
+		if (d.data == NULL)
+			return;
+		memcpy(d.data, p + 8, d.len);
+	} else
+		d.data= (unsigned char *)p + 8;
+	g_array_append_val(dgrams, d);
+}
+
+
+/** Handle the transport payload of an IP datagram; 'copy' when 'p' is a reassembly buffer */
+static void add_transport(long long ts, int family, const unsigned char *src, const unsigned char *dst,
+		int proto, const unsigned char *p, int len, int copy) {
+	if (proto == IPPROTO_TCP)
+		add_tcp(family, src, dst, p, len);
+	else if (proto == IPPROTO_UDP)
+		add_udp(ts, family, dst, p, len, copy);
+}
+
+
+/** Add a fragment at byte 'off' of an IP datagram; handles the datagram when it is complete */
+static void add_fragment(long long ts, int family, const unsigned char *src, const unsigned char *dst,
+		unsigned int id, int proto, int off, int more, const unsigned char *p, int len) {
+	int alen= (family == AF_INET) ? 4 : 16, i, oldest= 0;
+	CAP_FRAG *f= NULL;
+
+	if ((off + len > 65535) || (len <= 0))
+		return;
+	for (i= 0; i < N_FRAGS; i++) {
+		if (frags[i].used && (frags[i].family == family) && (frags[i].id == id) && (frags[i].proto == proto) &&
+				!memcmp(frags[i].src, src, alen) && !memcmp(frags[i].dst, dst, alen)) {
+			f= &frags[i];
+			break;
+		}
+		if (!frags[i].used || (frags[oldest].used && (frags[i].ts < frags[oldest].ts)))
+			oldest= i;
+	}
+	if (f == NULL) {
+		// Reuse a free slot, or drop the oldest datagram
+		f= &frags[oldest];
+		if (f->buf == NULL)
+			f->buf= (unsigned char *)malloc(65536);
+		if (f->buf == NULL)
+			return;
+		f->used= 1;
+		f->family= family;
+		memcpy(f->src, src, alen);
+		memcpy(f->dst, dst, alen);
+		f->id= id;
+		f->proto= proto;
+		f->ts= ts;
+		f->have= 0;
+		f->total= -1;
+	}
+	memcpy(f->buf + off, p, len);
+	f->have+= len;	// The capture has each fragment once
+	if (!more)
+		f->total= off + len;
+	if ((f->total >= 0) && (f->have >= f->total)) {
+		f->used= 0;
+		add_transport(f->ts, family, f->src, f->dst, proto, f->buf, f->total, 1);
+	}
+}
+
+
+/** Handle an IP packet */
+static void add_ip(long long ts, const unsigned char *p, int len) {
+	if (len < 1)
+		return;
+	if ((p[0] >> 4) == 4) {
+		int hlen= (p[0] & 0x0f) * 4, tot, frag, off;
+		if ((len < 20) || (hlen < 20))
+			return;
+		tot= rd_be(p + 2, 2);
+		if ((tot < hlen) || (tot > len))
+			return;
+		frag= rd_be(p + 6, 2);
+		off= (frag & 0x1fff) * 8;
+		if ((off > 0) || (frag & 0x2000))
+			add_fragment(ts, AF_INET, p + 12, p + 16, rd_be(p + 4, 2), p[9], off, frag & 0x2000,
+					p + hlen, tot - hlen);
+		else
+			add_transport(ts, AF_INET, p + 12, p + 16, p[9], p + hlen, tot - hlen, 0);
+	} else if ((p[0] >> 4) == 6) {
+		int nh, pos= 40, plen;
+		if (len < 40)
+			return;
+		plen= rd_be(p + 4, 2);
+		if (40 + plen > len)
+			return;
+		len= 40 + plen;
+		nh= p[6];
+		// Skip the extension headers
+		while ((nh == 0) || (nh == 43) || (nh == 60) || (nh == 44)) {
+			if (pos + 8 > len)
+				return;
+			if (nh == 44) {
+				int frag= rd_be(p + pos + 2, 2);
+				add_fragment(ts, AF_INET6, p + 8, p + 24, rd_be(p + pos + 4, 4), p[pos], frag & 0xfff8,
+						frag & 1, p + pos + 8, len - pos - 8);
+				return;
+			}
+			nh= p[pos];
+			pos+= (p[pos + 1] + 1) * 8;
+		}
+		if (pos <= len)
+			add_transport(ts, AF_INET6, p + 8, p + 24, nh, p + pos, len - pos, 0);
+	}
+}
+
+
+/** Handle a captured frame with link type 'link' */
+static void add_frame(long long ts, int link, const unsigned char *p, int len) {
+	int off, proto;
+	switch (link) {
+		case DLT_NULL:
+			off= 4;
+			break;
+		case DLT_RAW:
+		case 12:	// DLT_RAW on some systems
+		case 14:
+			off= 0;
+			break;
+		case DLT_EN10MB:
+			if (len < 14)
+				return;
+			off= 12;
+			proto= rd_be(p + off, 2);
+			while ((proto == 0x8100) || (proto == 0x88a8)) {	// VLAN tags
+				off+= 4;
+				if (off + 2 > len)
+					return;
+				proto= rd_be(p + off, 2);
+			}
+			if ((proto != 0x0800) && (proto != 0x86dd))
+				return;
+			off+= 2;
+			break;
+		case DLT_LINUX_SLL:
+			if ((len < 16) || ((rd_be(p + 14, 2) != 0x0800) && (rd_be(p + 14, 2) != 0x86dd)))
+				return;
+			off= 16;
+			break;
+		case DLT_LINUX_SLL2:
+			if ((len < 20) || ((rd_be(p, 2) != 0x0800) && (rd_be(p, 2) != 0x86dd)))
+				return;
+			off= 20;
+			break;
+		default:
+			return;
+	}
+	if (off < len)
+		add_ip(ts, p + off, len - off);
+}
+
+
+/** Read a classic pcap capture; returns the frames read, or -1 if the format is invalid */
+static long long read_pcap(const unsigned char *p, size_t size) {
+	unsigned int magic= rd(p, 4, 0);
+	int swap, nsec, link;
+	size_t pos= 24;
+	long long n= 0;
+
+	if ((magic == 0xa1b2c3d4) || (magic == 0xa1b23c4d))
+		swap= 0;
+	else if ((magic == 0xd4c3b2a1) || (magic == 0x4d3cb2a1))
+		swap= 1;
+	else
+		return -1;
+	nsec= (magic == 0xa1b23c4d) || (magic == 0x4d3cb2a1);
+	link= rd(p + 20, 4, swap) & 0xffff;
+	while (pos + 16 <= size) {
+		long long ts= rd(p + pos, 4, swap) * 1000000000LL + rd(p + pos + 4, 4, swap) * (nsec ? 1 : 1000);
+		unsigned int caplen= rd(p + pos + 8, 4, swap);
+		pos+= 16;
+		if (caplen > size - pos)
+			break;	// Truncated capture
+		add_frame(ts, link, p + pos, caplen);
+		pos+= caplen;
+		n++;
+	}
+	return n;
+}
+
+
+// Interface of a pcapng section
+typedef struct NG_IF {
+	int link;
+	long long tick_ns;		// ns per timestamp unit (0= resolution below 1 ns)
+	long long tick_div;		// Timestamp units per ns, when tick_ns is 0
+} NG_IF;
+
+/** Read a pcapng capture; returns the frames read, or -1 if the format is invalid */
+static long long read_pcapng(const unsigned char *p, size_t size) {
+	NG_IF ifs[64];
+	int n_ifs= 0, swap= 0;
+	size_t pos= 0;
+	long long n= 0, last_ts= 0;
+
+	while (pos + 12 <= size) {
+		unsigned int type= rd(p + pos, 4, swap), blen;
+		if (type == 0x0a0d0d0a) {
+			// Section header: sets the byte order of the section
+			unsigned int bom= rd(p + pos + 8, 4, 0);
+			if (bom == 0x1a2b3c4d)
+				swap= 0;
+			else if (bom == 0x4d3c2b1a)
+				swap= 1;
+			else
+				return -1;
+			n_ifs= 0;
+		}
+		blen= rd(p + pos + 4, 4, swap);
+		if ((blen < 12) || (blen > size - pos) || (blen % 4 != 0))
+			break;
+		const unsigned char *b= p + pos + 8;
+		int body= blen - 12;
+		if ((type == 1) && (body >= 8) && (n_ifs < 64)) {
+			// Interface description: link type and timestamp resolution
+			NG_IF *ifc= &ifs[n_ifs++];
+			int o= 8, res= 6;
+			ifc->link= rd(b, 2, swap);
+			while (o + 4 <= body) {
+				int code= rd(b + o, 2, swap), olen= rd(b + o + 2, 2, swap);
+				if (code == 0)
+					break;
+				if ((code == 9) && (olen >= 1) && (o + 4 < body))
+					res= b[o + 4];
+				o+= 4 + ((olen + 3) & ~3);
+			}
+			ifc->tick_ns= 1;
+			ifc->tick_div= 1;
+			if (res & 0x80) {
+				// Power of two: approximated by the nearest power of ten below
+				int e= res & 0x7f, d= 0;
+				while ((e -= 3) >= 0)
+					d++;
+				res= d;
+			}
+			if (res <= 9) {
+				int i;
+				for (i= res; i < 9; i++)
+					ifc->tick_ns*= 10;
+			} else {
+				int i;
+				ifc->tick_ns= 0;
+				for (i= 9; i < res; i++)
+					ifc->tick_div*= 10;
+			}
+		} else if ((type == 6) && (body >= 20)) {
+			// Enhanced packet
+			unsigned int ifn= rd(b, 4, swap), caplen= rd(b + 12, 4, swap);
+			unsigned long long t= (rd(b + 4, 4, swap) << 32) | rd(b + 8, 4, swap);
+			if ((ifn < (unsigned)n_ifs) && (caplen <= (unsigned)body - 20)) {
+				last_ts= ifs[ifn].tick_ns ? (long long)t * ifs[ifn].tick_ns : (long long)(t / ifs[ifn].tick_div);
+				add_frame(last_ts, ifs[ifn].link, b + 20, caplen);
+				n++;
+			}
+		} else if ((type == 3) && (body >= 4) && (n_ifs > 0)) {
+			// Simple packet: no timestamp
+			unsigned int olen= rd(b, 4, swap), caplen= min(olen, (unsigned)body - 4);
+			add_frame(last_ts, ifs[0].link, b + 4, caplen);
+			n++;
+		}
+		pos+= blen;
+	}
+	return n;
+}
+
+
+/* Session */
+
+/** Compare the times of two packets */
+static int cmp_pkt_time(const void *a, const void *b) {
+	const CAP_DGRAM *x= *(CAP_DGRAM * const *)a, *y= *(CAP_DGRAM * const *)b;
+	return (x->ts > y->ts) - (x->ts < y->ts);
+}
+
+/** Parse the reply header in 'r' (host byte order, as the sender writes it); returns FALSE if incomplete */
+static gboolean parse_reply(SESSION *s, const unsigned char *r, int len) {
+	int alen= (s->family == AF_INET) ? 4 : 16, pos= 0, n32;
+	unsigned int f_hash;
+
+	if (len < 20)
+		return FALSE;
+	memcpy(&s->cid, r, sizeof(s->cid));
+	if (s->cid < 0)
+		return FALSE;	// Error reply
+	memcpy(&s->sid, r + 2, sizeof(s->sid));
+	memcpy(&s->f_length, r + 4, sizeof(s->f_length));
+	memcpy(&s->block_size, r + 12, sizeof(s->block_size));
+	memcpy(&n32, r + 16, sizeof(n32));
+	pos= 20;
+	s->n_blocks= n32;
+	if (n32 == N_BLOCKS_64) {
+		if (len < pos + 8)
+			return FALSE;
+		memcpy(&s->n_blocks, r + pos, sizeof(s->n_blocks));
+		pos+= 8;
+	}
+	if (len < pos + (int)sizeof(f_hash) + alen + 2)
+		return FALSE;
+	pos+= sizeof(f_hash);
+	s->group_off= pos;
+	memcpy(s->group, r + pos, alen);
+	pos+= alen;
+	memcpy(&s->mport, r + pos, sizeof(s->mport));
+	pos+= 2;
+	if ((s->n_blocks <= 0) || (s->block_size <= 0) || (pos > (int)sizeof(s->reply)))
+		return FALSE;
+	memcpy(s->reply, r, pos);
+	s->reply_len= pos;
+	return TRUE;
+}
+
+
+/** Find the session requesting 'want' (NULL= the first one) and its DATA packets; returns FALSE if none */
+static gboolean find_session(SESSION *s, const char *want) {
+	int i, j;
+	guint k;
+
+	memset(s, 0, sizeof(*s));
+	for (i= 0; i < n_streams; i++) {
+		CAP_STREAM *c= &streams[i];
+		unsigned char *nul= memchr(c->data, '\0', c->len);
+		if ((nul == NULL) || (nul == c->data) || (nul - c->data >= (int)sizeof(s->fname)))
+			continue;
+		if ((want != NULL) && strcmp((char *)c->data, want))
+			continue;
+		// The reply goes in the other direction
+		for (j= 0; j < n_streams; j++) {
+			CAP_STREAM *r= &streams[j];
+			int alen= (c->family == AF_INET) ? 4 : 16;
+			if ((r->family != c->family) || (r->sport != c->dport) || (r->dport != c->sport) ||
+					memcmp(r->src, c->dst, alen) || memcmp(r->dst, c->src, alen))
+				continue;
+			s->family= c->family;
+			if (parse_reply(s, r->data, r->len)) {
+				strcpy(s->fname, (char *)c->data);
+				s->tcp_port= c->dport;
+				break;
+			}
+		}
+		if (s->reply_len > 0)
+			break;
+	}
+	if (s->reply_len == 0)
+		return FALSE;
+
+	// DATA packets of the session
+	if ((s->pkts= (CAP_DGRAM **)malloc(dgrams->len * sizeof(CAP_DGRAM *) + 1)) == NULL)
+		return FALSE;
+	for (k= 0; k < dgrams->len; k++) {
+		CAP_DGRAM *d= &g_array_index(dgrams, CAP_DGRAM, k);
+		short sid;
+		if ((d->family != s->family) || (d->dport != s->mport) ||
+				memcmp(d->dst, s->group, (s->family == AF_INET) ? 4 : 16) || (d->len < (int)DATA_HDR_LEN))
+			continue;
+		memcpy(&sid, d->data + 1, sizeof(sid));
+		if ((sid != s->sid) || ((d->data[0] != PKT_DATA) && (d->data[0] != PKT_DATA64)))
+			continue;
+		if ((d->data[0] == PKT_DATA64) && (d->len < (int)DATA64_HDR_LEN))
+			continue;
+		s->pkts[s->n_pkts++]= d;
+	}
+	qsort(s->pkts, s->n_pkts, sizeof(CAP_DGRAM *), cmp_pkt_time);
+
+	// Last packet of each block, for the repairs
+	if ((s->block= (long long *)malloc(s->n_blocks * sizeof(long long))) == NULL)
+		return FALSE;
+	memset(s->block, 0xff, s->n_blocks * sizeof(long long));
+	for (k= 0; k < s->n_pkts; k++) {
+		long long seq= -1;
+		if (s->pkts[k]->data[0] == PKT_DATA) {
+			int seq32;
+			memcpy(&seq32, s->pkts[k]->data + 3, sizeof(seq32));
+			seq= seq32;
+		} else
+			memcpy(&seq, s->pkts[k]->data + 3, sizeof(seq));
+		if ((seq < 0) || (seq >= s->n_blocks))
+			continue;
+		if (s->block[seq] >= 0)
+			s->n_retrans++;
+		s->block[seq]= k;
+	}
+	return TRUE;
+}
+
+
+/* Replay */
+
+/** Open the TCP socket listening on the loopback address; returns -1 on error */
+static int open_listener(void) {
+	int s, on= 1;
+	if (ses.family == AF_INET) {
+		struct sockaddr_in a;
+		memset(&a, 0, sizeof(a));
+		a.sin_family= AF_INET;
+		a.sin_port= htons(tcp_port);
+		a.sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+		if ((s= socket(AF_INET, SOCK_STREAM, 0)) < 0)
+			return -1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(s, (struct sockaddr *)&a, sizeof(a)) < 0) {
+			close(s);
+			return -1;
+		}
+	} else {
+		struct sockaddr_in6 a;
+		memset(&a, 0, sizeof(a));
+		a.sin6_family= AF_INET6;
+		a.sin6_port= htons(tcp_port);
+		a.sin6_addr= in6addr_loopback;
+		if ((s= socket(AF_INET6, SOCK_STREAM, 0)) < 0)
+			return -1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(s, (struct sockaddr *)&a, sizeof(a)) < 0) {
+			close(s);
+			return -1;
+		}
+	}
+	if (listen(s, 1) < 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+
+/** Open the UDP socket that sends the multicast packets and receives the SRRs; returns -1 on error */
+static int open_sender(struct sockaddr_storage *to, socklen_t *to_len) {
+	int s, zero= 0, on= 1;
+	unsigned int ifindex= (ifname != NULL) ? if_nametoindex(ifname) : 0;
+
+	if ((ifname != NULL) && (ifindex == 0)) {
+		fprintf(stderr, "unknown interface '%s'\n", ifname);
+		return -1;
+	}
+	memset(to, 0, sizeof(*to));
+	if (ses.family == AF_INET) {
+		struct sockaddr_in *a= (struct sockaddr_in *)to;
+		a->sin_family= AF_INET;
+		a->sin_port= htons(ses.mport);
+		memcpy(&a->sin_addr, ses.group, 4);
+		*to_len= sizeof(*a);
+		if ((s= socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+			return -1;
+		// TTL 0: looped back to this host only
+		unsigned char ttl= 0, loop= 1;
+		setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+		setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+		if (ifindex > 0) {
+			struct ip_mreqn mr;
+			memset(&mr, 0, sizeof(mr));
+			mr.imr_ifindex= ifindex;
+			setsockopt(s, IPPROTO_IP, IP_MULTICAST_IF, &mr, sizeof(mr));
+		}
+	} else {
+		struct sockaddr_in6 *a= (struct sockaddr_in6 *)to;
+		a->sin6_family= AF_INET6;
+		a->sin6_port= htons(ses.mport);
+		memcpy(&a->sin6_addr, ses.group, 16);
+		*to_len= sizeof(*a);
+		if ((s= socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+			return -1;
+		setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &zero, sizeof(zero));
+		setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &on, sizeof(on));
+		if (ifindex > 0)
+			setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex));
+	}
+	return s;
+}
+
+
+/** Accept the receiver and exchange the request, the reply header and the OK; returns the socket or -1 */
+static int serve_request(int ls) {
+	struct pollfd pf= {ls, POLLIN, 0};
+	char name[256], ok[3];
+	struct timeval tv= {ACCEPT_TIMEOUT_MS / 1000, 0};
+	int s, n= 0;
+
+	if (poll(&pf, 1, ACCEPT_TIMEOUT_MS) <= 0) {
+		fprintf(stderr, "RPL> no request from the receiver\n");
+		return -1;
+	}
+	if ((s= accept(ls, NULL, NULL)) < 0) {
+		perror("RPL> accept");
+		return -1;
+	}
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	// The request is the file name and a NUL
+	while (n < (int)sizeof(name)) {
+		if (recv(s, name + n, 1, 0) != 1)
+			break;
+		if (name[n++] == '\0')
+			break;
+	}
+	if ((n == 0) || (name[n - 1] != '\0')) {
+		fprintf(stderr, "RPL> invalid request\n");
+		close(s);
+		return -1;
+	}
+	if (strcmp(name, ses.fname))
+		fprintf(stderr, "RPL> request for '%s'; replaying '%s'\n", name, ses.fname);
+	if (send(s, ses.reply, ses.reply_len, MSG_NOSIGNAL) != ses.reply_len) {
+		perror("RPL> send reply");
+		close(s);
+		return -1;
+	}
+	if ((recv(s, ok, 2, MSG_WAITALL) != 2) || strncmp(ok, "OK", 2)) {
+		fprintf(stderr, "RPL> no OK from the receiver\n");
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+
+/** Re-send the blocks missing in bitmask window 'mask' (bit i= block base+i); returns the blocks sent */
+static long long repair(int us, struct sockaddr_storage *to, socklen_t to_len, long long *last_sent,
+		long long base, const unsigned char *mask, long long len) {
+	long long i, n= 0, now= now_ns();
+	for (i= 0; (i < len * 8) && (base + i < ses.n_blocks); i++) {
+		long long seq= base + i, k;
+		if ((mask[i / 8] & (1 << (i % 8))) || ((k= ses.block[seq]) < 0))
+			continue;
+		if (now - last_sent[seq] < REPAIR_HOLDOFF_MS * 1000000LL)
+			continue;	// Already re-sent: the SRRs come every two packets
+		last_sent[seq]= now;
+		if (sendto(us, ses.pkts[k]->data, ses.pkts[k]->len, 0, (struct sockaddr *)to, to_len) == ses.pkts[k]->len)
+			n++;
+	}
+	return n;
+}
+
+
+/** Replay thread: serves one receiver */
+static void *replay_thread(void *ptr) {
+	int ls= *(int *)ptr, ts, us;
+	struct sockaddr_storage to;
+	socklen_t to_len;
+	long long i, start, t0, *last_sent= NULL, idle_since;
+	unsigned char buf[MAX_MESSAGE_LEN], srr[MAX_MESSAGE_LEN];
+
+	ts= serve_request(ls);
+	close(ls);
+	if (ts < 0) {
+		replay_done= 1;
+		return NULL;
+	}
+	if ((us= open_sender(&to, &to_len)) < 0) {
+		perror("RPL> UDP socket");
+		close(ts);
+		replay_done= 1;
+		return NULL;
+	}
+
+	// DATA packets at the captured pace, scaled by 'speed'
+	start= now_ns();
+	t0= (ses.n_pkts > 0) ? ses.pkts[0]->ts : 0;
+	for (i= 0; (i < ses.n_pkts) && !replay_done; i++) {
+		CAP_DGRAM *d= ses.pkts[i];
+		if (speed > 0) {
+			long long at= start + (long long)((d->ts - t0) / speed);
+			if (at > now_ns()) {
+				struct timespec tsp= {at / 1000000000LL, at % 1000000000LL};
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsp, NULL);
+			}
+		}
+		if (sendto(us, d->data, d->len, 0, (struct sockaddr *)&to, to_len) == d->len)
+			sent_pkts++;
+		else if ((errno != ENOBUFS) && (errno != EAGAIN))
+			perror("RPL> sendto");
+	}
+
+	// Answer the SRRs until the receiver closes the connection or goes quiet
+	if ((last_sent= (long long *)calloc(ses.n_blocks, sizeof(long long))) == NULL) {
+		perror("RPL> calloc");
+		replay_done= 1;
+	}
+	idle_since= now_ns();
+	while (!replay_done && (now_ns() - idle_since < idle_s * 1000000000LL)) {
+		struct pollfd pf[2]= {{us, POLLIN, 0}, {ts, POLLIN, 0}};
+		int n, srr_len;
+		if (poll(pf, 2, 100) <= 0)
+			continue;
+		if (pf[1].revents) {
+			if (recv(ts, buf, sizeof(buf), MSG_DONTWAIT) <= 0) {
+				replay_ok= 1;	// The receiver closed the connection
+				break;
+			}
+		}
+		if (!(pf[0].revents & POLLIN))
+			continue;
+		// Only the last SRR queued matters: the older ones ask for blocks received since
+		srr_len= 0;
+		while ((n= recv(us, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			if (buf[0] == PKT_EXIT)
+				break;
+			if (((buf[0] == PKT_SRR) && (n >= 5)) || ((buf[0] == PKT_SRR64) && (n >= 17))) {
+				n_srr++;
+				memcpy(srr, buf, n);
+				srr_len= n;
+			}
+		}
+		if ((n > 0) && (buf[0] == PKT_EXIT)) {
+			replay_ok= 1;
+			break;
+		}
+		if (srr_len == 0)
+			continue;
+		idle_since= now_ns();
+		if (srr[0] == PKT_SRR)
+			sent_repairs+= repair(us, &to, to_len, last_sent, 0, srr + 5, srr_len - 5);
+		else {
+			long long base;
+			int w_len;
+			memcpy(&base, srr + 5, sizeof(base));
+			memcpy(&w_len, srr + 13, sizeof(w_len));
+			if ((base >= 0) && (w_len >= 0) && (w_len <= srr_len - 17))
+				sent_repairs+= repair(us, &to, to_len, last_sent, base, srr + 17, w_len);
+		}
+	}
+	// Ends the session of any other receiver of the group
+	buf[0]= PKT_STOP;
+	memcpy(buf + 1, &ses.sid, sizeof(ses.sid));
+	sendto(us, buf, 1 + sizeof(ses.sid), 0, (struct sockaddr *)&to, to_len);
+
+	free(last_sent);
+	close(us);
+	close(ts);
+	replay_cpu= cpu_time(RUSAGE_THREAD);
+	replay_done= 1;
+	return NULL;
+}
+
+
+/* Receiver (test mode) */
+
+/** Engine hook: the receiver's log messages are not shown */
+static void rpl_log(const char *str) {
+}
+
+/** Engine hook: the transfer ended */
+static void rpl_del_transfer(unsigned tid, gboolean from_thread) {
+	rx_end_ns= now_ns();
+}
+
+/** Engine hook: outcome of the transfer; runs before it leaves the registry */
+static void rpl_end_transfer(unsigned tid, gboolean completed) {
+	rx_completed= completed;
+}
+
+static const ENGINE_UI rpl_ui= {
+	.log= rpl_log,
+	.del_transfer= rpl_del_transfer,
+	.end_transfer= rpl_end_transfer
+};
+
+
+/** Return the length of the file received in 'dir', or -1, and delete it */
+static long long received_length(const char *dir) {
+	char pat[512];
+	glob_t g;
+	struct stat st;
+	long long len= -1;
+	snprintf(pat, sizeof(pat), "%s/*.%s", dir, ses.fname);
+	if (glob(pat, 0, NULL, &g) == 0) {
+		if ((g.gl_pathc > 0) && !stat(g.gl_pathv[0], &st))
+			len= st.st_size;
+		if (g.gl_pathc > 0)
+			unlink(g.gl_pathv[0]);
+		globfree(&g);
+	}
+	return len;
+}
+
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-s speed] [-f file] [-p tcp_port] [-i ifname] [-t rx_threads] "
+			"[-o dir] [-T idle_s] [-x] capture\n", prog);
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *want= NULL, *out_dir= NULL;
+	char tmp_dir[]= "/tmp/fmreplay.XXXXXX";
+	gboolean external= FALSE;
+	struct stat st;
+	unsigned char *cap;
+	long long frames, start;
+	double cpu0;
+	pthread_t tid;
+	int fd, opt, ls;
+
+	while ((opt= getopt(argc, argv, "s:f:p:i:t:o:T:xh")) != -1) {
+		switch (opt) {
+		case 's': speed= atof(optarg); break;
+		case 'f': want= optarg; break;
+		case 'p': tcp_port= atoi(optarg); break;
+		case 'i': ifname= optarg; break;
+		case 't': receiver_rx_threads= atoi(optarg); break;
+		case 'o': out_dir= optarg; break;
+		case 'T': idle_s= atoi(optarg); break;
+		case 'x': external= TRUE; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((optind != argc - 1) || (speed < 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Read the capture
+	if (((fd= open(argv[optind], O_RDONLY)) < 0) || fstat(fd, &st) || (st.st_size < 24)) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if ((cap= (unsigned char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	close(fd);
+	dgrams= g_array_new(FALSE, FALSE, sizeof(CAP_DGRAM));
+	streams= (CAP_STREAM *)calloc(N_STREAMS, sizeof(CAP_STREAM));
+	frames= (rd(cap, 4, 0) == 0x0a0d0d0a) ? read_pcapng(cap, st.st_size) : read_pcap(cap, st.st_size);
+	if (frames < 0) {
+		fprintf(stderr, "%s: not a pcap or pcapng capture\n", argv[optind]);
+		return 1;
+	}
+	if (!find_session(&ses, want)) {
+		fprintf(stderr, "%s: no session%s%s with its reply header in %lld frames\n", argv[optind],
+				want ? " for " : "", want ? want : "", frames);
+		return 1;
+	}
+	if (tcp_port == 0)
+		tcp_port= ses.tcp_port;
+	printf("capture: '%s' %llu bytes, %lld blocks of %d bytes; %lld DATA packets (%lld repeated) over %.3f s\n",
+			ses.fname, ses.f_length, ses.n_blocks, ses.block_size, ses.n_pkts, ses.n_retrans,
+			(ses.n_pkts > 1) ? (ses.pkts[ses.n_pkts - 1]->ts - ses.pkts[0]->ts) / 1e9 : 0.0);
+
+	signal(SIGPIPE, SIG_IGN);
+	if ((ls= open_listener()) < 0) {
+		perror("RPL> TCP listener");
+		return 1;
+	}
+	if (pthread_create(&tid, NULL, replay_thread, &ls)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	start= now_ns();
+	cpu0= cpu_time(RUSAGE_SELF);
+	if (external) {
+		printf("waiting for a request on %s port %d\n", (ses.family == AF_INET) ? "127.0.0.1" : "::1", tcp_port);
+		pthread_join(tid, NULL);
+	} else {
+		// Test mode: the receiver runs in this process
+		if ((out_dir == NULL) && ((out_dir= mkdtemp(tmp_dir)) == NULL)) {
+			perror("mkdtemp");
+			return 1;
+		}
+		path_dir= (char *)out_dir;
+		log_init();
+		engine_set_ui(&rpl_ui);
+		active= TRUE;
+		set_local_IP();
+		if (start_file_download(ses.fname, (ses.family == AF_INET) ? "127.0.0.1" : "::1", tcp_port) == NULL) {
+			fprintf(stderr, "failed to start the receiver\n");
+			return 1;
+		}
+		// The transfer is in the registry until it ends
+		while (registry_size() > 0)
+			usleep(10000);
+		pthread_join(tid, NULL);
+		log_close();
+	}
+
+	double secs= (((rx_end_ns > 0) ? rx_end_ns : now_ns()) - start) / 1e9;
+	printf("replay: %lld packets and %lld repairs for %lld SRRs at speed %g; receiver %s\n",
+			sent_pkts, sent_repairs, n_srr, speed, replay_ok ? "left" : "went quiet");
+	if (!external) {
+		long long got= received_length(out_dir);
+		double rx_cpu= cpu_time(RUSAGE_SELF) - cpu0 - replay_cpu;
+		// A file at full length may still have holes; the engine's outcome decides
+		int completed= rx_completed && (got == (long long)ses.f_length);
+		if (completed)
+			printf("receiver: completed in %.3f s, goodput %.2f MB/s, CPU %.3f s (%.3f s/GB)\n", secs,
+					ses.f_length / secs / 1e6, rx_cpu, (ses.f_length > 0) ? rx_cpu / (ses.f_length / 1e9) : 0.0);
+		else
+			printf("receiver: incomplete after %.3f s (%lld of %lld bytes written), CPU %.3f s\n",
+					secs, (got > 0) ? got : 0, (long long)ses.f_length, rx_cpu);
+		if (out_dir == tmp_dir)
+			rmdir(tmp_dir);
+		return !completed;
+	}
+	return !replay_ok;
+}
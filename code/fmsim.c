@@ -0,0 +1,453 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * fmsim.c
+ *
+ * Scaling simulator: runs many receivers of libfmcast and a model of the
+ *   sender in one process, over the simulated network of simnet.c. The
+ *   sender answers each request, starts the session when every receiver
+ *   answered OK (or OK_timeout after the first request), sends the file once
+ *   at the link rate and then repeats the blocks missing in the SRRs until
+ *   every receiver leaves. The same parameters and seed give the same results.
+ *
+ *   fmsim [-n receivers] [-b blocks] [-s block_size] [-r Mbit/s] [-l loss%]
+ *         [-B burst] [-d delay_ms] [-j jitter_ms] [-u up_loss%] [-q rcvbuf]
+ *         [-J join_ms] [-S seed] [-L limit_s] [-o dir] [-v]
+ *
+ *   -B burst	mean length of the loss bursts (1= independent losses)
+ *   -J join_ms	the receivers start evenly spread over this time
+ *   -v			show the output of the receivers
+ *
+ *   Reports the completion time distribution, the feedback volume (SRRs),
+ *   the repairs and the repair latency: the time from the loss of a block at
+ *   a receiver to the arrival of its next copy there
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include "engine.h"
+#include "receiver_th.h"
+#include "registry.h"
+#include "logger.h"
+#include "hist.h"
+#include "transport.h"
+#include "simnet.h"
+
+#define SIM_TCP_PORT	20000	// Port of the sender's TCP server
+#define SIM_MCAST_PORT	30000	// Port of the multicast session
+#define SIM_SID			1
+#define SIM_IP_OVERHEAD	28		// IPv4 and UDP headers, for the link rate
+
+// Sender's view of one receiver
+typedef struct SIM_RCV {
+	long long t_start;		// Virtual time when the receiver started
+	long long t_end;		// ... when its transfer ended (0= running)
+	int replied;			// Reply header sent
+	int ok;					// "OK" received
+	int closed;				// TCP connection closed
+	int completed;			// Received the whole file
+	unsigned char *got;		// Blocks delivered to the receiver
+	long long *lost_at;		// Virtual time + 1 of the loss of each block not repaired yet (0= none)
+} SIM_RCV;
+
+// Scenario
+static int n_rcv= 100;
+static long long n_blocks= 1000;
+static int block_size= 1400;
+static double rate_mbps= 100;
+static SIM_PARAMS prm;
+
+// Sender state
+static SIM_RCV *rcv;
+static long long next_seq= 0;		// Next block of the first pass
+static unsigned char *need;			// Blocks to repeat
+static long long *last_sent;		// Virtual time each block was last sent (-1= never)
+static long long n_need= 0, repair_pos= 0;
+static long long holdoff_ns;		// Blocks sent less than one round-trip ago are not repeated
+static int started= 0, idle= 0, stopped= 0;
+static int n_ok= 0, n_closed= 0;
+static unsigned char *pkt;
+
+// Results
+static long long sent_first= 0, sent_repairs= 0;
+static long long n_srr= 0, srr_bytes= 0, n_exit= 0, failed_starts= 0;
+static LAT_HIST completion, repair_lat;
+
+
+/* Sender */
+
+/** Multicast the next block: the first pass, then the repairs; idle when nothing is needed */
+static void send_next(void *arg) {
+	long long seq= -1;
+	int len;
+	char *pt= (char *)pkt;
+	short sid= SIM_SID;
+	unsigned char type= PKT_DATA;
+	int seq32;
+
+	if (stopped)
+		return;
+	if (next_seq < n_blocks) {
+		seq= next_seq++;
+		sent_first++;
+	} else {
+		for (; n_need > 0; repair_pos= (repair_pos + 1) % n_blocks) {
+			if (need[repair_pos]) {
+				seq= repair_pos;
+				need[seq]= 0;
+				n_need--;
+				sent_repairs++;
+				break;
+			}
+		}
+	}
+	if (seq < 0) {
+		idle= 1;
+		return;
+	}
+	seq32= (int)seq;
+	len= block_size;
+	memcpy(pt, &type, sizeof(type));
+	memcpy(pt + 1, &sid, sizeof(sid));
+	memcpy(pt + 3, &seq32, sizeof(seq32));
+	memcpy(pt + 7, &len, sizeof(len));
+	memset(pt + DATA_HDR_LEN, (int)(seq & 0xff), len);
+	last_sent[seq]= simnet_now();
+	simnet_mcast(pkt, DATA_HDR_LEN + len, SIM_MCAST_PORT);
+	// Serialization at the link rate
+	simnet_timer(simnet_now() + (long long)((DATA_HDR_LEN + len + SIM_IP_OVERHEAD) * 8e3 / rate_mbps),
+			send_next, NULL);
+}
+
+/** Start the session, once */
+static void start_session(void *arg) {
+	if (started)
+		return;
+	started= 1;
+	send_next(NULL);
+}
+
+/** Mark the blocks missing in 'mask' (bit i is block base+i) for repair */
+static void add_needs(long long base, const unsigned char *mask, int mask_len) {
+	long long i, now= simnet_now();
+	for (i= 0; (i < (long long)mask_len * 8) && (base + i < next_seq); i++) {
+		long long seq= base + i;
+		if ((mask[i / 8] & (1 << (i % 8))) || need[seq] || (now - last_sent[seq] < holdoff_ns))
+			continue;
+		need[seq]= 1;
+		n_need++;
+	}
+	if ((n_need > 0) && idle && !stopped) {
+		idle= 0;
+		simnet_timer(simnet_now(), send_next, NULL);
+	}
+}
+
+/** TCP bytes from receiver 'node': the request, "OK" and "END" */
+static void snd_tcp_data(int node, const unsigned char *buf, int len) {
+	SIM_RCV *r= &rcv[node];
+	if (!r->replied) {
+		// Reply header; the request fits in one segment
+		unsigned char hdr[64], *pt= hdr;
+		short cid= (short)(node + 1), sid= SIM_SID;
+		unsigned long long f_length= (unsigned long long)n_blocks * block_size;
+		int n32= (int)n_blocks;
+		unsigned int f_hash= 0;
+		struct in_addr group;
+		unsigned short mport= SIM_MCAST_PORT;
+		inet_pton(AF_INET, "239.1.2.3", &group);
+		memcpy(pt, &cid, sizeof(cid)); pt+= sizeof(cid);
+		memcpy(pt, &sid, sizeof(sid)); pt+= sizeof(sid);
+		memcpy(pt, &f_length, sizeof(f_length)); pt+= sizeof(f_length);
+		memcpy(pt, &block_size, sizeof(block_size)); pt+= sizeof(block_size);
+		memcpy(pt, &n32, sizeof(n32)); pt+= sizeof(n32);
+		memcpy(pt, &f_hash, sizeof(f_hash)); pt+= sizeof(f_hash);
+		memcpy(pt, &group, sizeof(group)); pt+= sizeof(group);
+		memcpy(pt, &mport, sizeof(mport)); pt+= sizeof(mport);
+		simnet_tcp_send(node, hdr, pt - hdr);
+		r->replied= 1;
+		simnet_timer(simnet_now() + OK_timeout * 1000000LL, start_session, NULL);
+	} else if (!r->ok && (len >= 2) && !memcmp(buf, "OK", 2)) {
+		r->ok= 1;
+		if (++n_ok == n_rcv)
+			start_session(NULL);
+	}
+}
+
+/** Receiver 'node' closed its connection: it left the session */
+static void snd_tcp_close(int node) {
+	if (rcv[node].closed)
+		return;
+	rcv[node].closed= 1;
+	if (++n_closed == n_rcv) {
+		unsigned char stop[1 + sizeof(short)];
+		short sid= SIM_SID;
+		stop[0]= PKT_STOP;
+		memcpy(stop + 1, &sid, sizeof(sid));
+		simnet_mcast(stop, sizeof(stop), SIM_MCAST_PORT);
+		stopped= 1;
+	}
+}
+
+/** Datagram from receiver 'node': SRR or EXIT */
+static void snd_udp(int node, const unsigned char *buf, int len) {
+	if (len < 1)
+		return;
+	switch (buf[0]) {
+	case PKT_SRR:
+		n_srr++;
+		srr_bytes+= len;
+		if (len > (int)SRR_HDR_LEN)
+			add_needs(0, buf + SRR_HDR_LEN, len - SRR_HDR_LEN);
+		break;
+	case PKT_SRR64:
+		n_srr++;
+		srr_bytes+= len;
+		if (len > (int)SRR64_HDR_LEN) {
+			long long base;
+			int w_len;
+			memcpy(&base, buf + SRR_HDR_LEN, sizeof(base));
+			memcpy(&w_len, buf + SRR_HDR_LEN + sizeof(base), sizeof(w_len));
+			if (w_len > len - (int)SRR64_HDR_LEN)
+				w_len= len - SRR64_HDR_LEN;
+			add_needs(base, buf + SRR64_HDR_LEN, w_len);
+		}
+		break;
+	case PKT_EXIT:
+		n_exit++;
+		break;
+	}
+}
+
+/** A DATA packet was lost on the way to 'node' or delivered to it */
+static void snd_fate(int node, const unsigned char *buf, int len, int delivered) {
+	SIM_RCV *r= &rcv[node];
+	int seq32;
+	if ((len < (int)DATA_HDR_LEN) || (buf[0] != PKT_DATA))
+		return;
+	memcpy(&seq32, buf + 3, sizeof(seq32));
+	if ((seq32 < 0) || (seq32 >= n_blocks))
+		return;
+	if (delivered) {
+		r->got[seq32]= 1;
+		if (r->lost_at[seq32]) {
+			hist_record(&repair_lat, simnet_now() - (r->lost_at[seq32] - 1));
+			r->lost_at[seq32]= 0;
+		}
+	} else if (!r->got[seq32] && !r->lost_at[seq32])
+		r->lost_at[seq32]= simnet_now() + 1;
+}
+
+
+/* Receivers */
+
+/** Start the receiver of 'node' */
+static void start_receiver(int node) {
+	char name[32];
+	snprintf(name, sizeof(name), "sim%d.bin", node);
+	rcv[node].t_start= simnet_now();
+	if (start_file_download(name, "127.0.0.1", SIM_TCP_PORT) == NULL)
+		failed_starts++;
+}
+
+/** Engine hook: the receiver's log messages are not shown */
+static void sim_log(const char *str) {
+}
+
+/** Engine hook: the transfer ended; a complete file is checked and deleted */
+static void sim_del_transfer(unsigned tid, gboolean from_thread) {
+	int node= simnet_node();
+	ReceiverTh *t= registry_lookup(tid);
+	struct stat st;
+	if ((node < 0) || (rcv[node].t_end > 0))
+		return;
+	rcv[node].t_end= simnet_now();
+	if ((t == NULL) || (t->n_recv < t->bmask.b_len))
+		return;
+	if (!stat(t->name_f, &st) && (st.st_size == n_blocks * block_size)) {
+		rcv[node].completed= 1;
+		hist_record(&completion, rcv[node].t_end - rcv[node].t_start);
+	}
+	unlink(t->name_f);
+}
+
+static const ENGINE_UI sim_ui= {
+	.log= sim_log,
+	.del_transfer= sim_del_transfer
+};
+
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-n receivers] [-b blocks] [-s block_size] [-r Mbit/s] [-l loss%%] "
+			"[-B burst] [-d delay_ms] [-j jitter_ms] [-u up_loss%%] [-q rcvbuf] [-J join_ms] "
+			"[-S seed] [-L limit_s] [-o dir] [-v]\n", prog);
+}
+
+
+int main(int argc, char *argv[]) {
+	char tmp_dir[]= "/tmp/fmsim.XXXXXX";
+	const char *out_dir= NULL;
+	double join_ms= 0, up_loss= -1;
+	gboolean verbose= FALSE;
+	struct timespec w0, w1;
+	struct rlimit rl;
+	SIM_SENDER sender= {
+		.tcp_data= snd_tcp_data,
+		.tcp_close= snd_tcp_close,
+		.udp= snd_udp,
+		.fate= snd_fate
+	};
+	int i, opt, saved_stdout= -1, completed= 0;
+
+	memset(&prm, 0, sizeof(prm));
+	prm.down.loss= 0.01;
+	prm.down.burst= 1;
+	prm.down.delay_ns= 5000000;
+	prm.down.jitter_ns= 1000000;
+	prm.rcvbuf= 212992;
+	prm.seed= 1;
+	prm.limit_ns= 600 * 1000000000LL;
+	while ((opt= getopt(argc, argv, "n:b:s:r:l:B:d:j:u:q:J:S:L:o:vh")) != -1) {
+		switch (opt) {
+		case 'n': n_rcv= atoi(optarg); break;
+		case 'b': n_blocks= atoll(optarg); break;
+		case 's': block_size= atoi(optarg); break;
+		case 'r': rate_mbps= atof(optarg); break;
+		case 'l': prm.down.loss= atof(optarg) / 100; break;
+		case 'B': prm.down.burst= atof(optarg); break;
+		case 'd': prm.down.delay_ns= (long long)(atof(optarg) * 1e6); break;
+		case 'j': prm.down.jitter_ns= (long long)(atof(optarg) * 1e6); break;
+		case 'u': up_loss= atof(optarg) / 100; break;
+		case 'q': prm.rcvbuf= atoi(optarg); break;
+		case 'J': join_ms= atof(optarg); break;
+		case 'S': prm.seed= strtoull(optarg, NULL, 0); break;
+		case 'L': prm.limit_ns= (long long)(atof(optarg) * 1e9); break;
+		case 'o': out_dir= optarg; break;
+		case 'v': verbose= TRUE; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((optind != argc) || (n_rcv < 1) || (n_rcv > 32767) || (n_blocks < 1) || (n_blocks > 0x7fffffff) ||
+			(block_size < 1) || (block_size + DATA_HDR_LEN > MAX_MESSAGE_LEN) || (rate_mbps <= 0) ||
+			(prm.down.loss < 0) || (prm.down.loss >= 1)) {
+		usage(argv[0]);
+		return 1;
+	}
+	prm.up= prm.down;
+	prm.up.loss= (up_loss >= 0) ? up_loss : prm.down.loss;
+	holdoff_ns= prm.down.delay_ns + prm.down.jitter_ns + prm.up.delay_ns + prm.up.jitter_ns;
+	if ((out_dir == NULL) && ((out_dir= mkdtemp(tmp_dir)) == NULL)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	// Each receiver keeps its file open
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && (rl.rlim_cur < rl.rlim_max)) {
+		rl.rlim_cur= rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	// Sender and receivers
+	rcv= (SIM_RCV *)calloc(n_rcv, sizeof(SIM_RCV));
+	need= (unsigned char *)calloc(n_blocks, 1);
+	last_sent= (long long *)malloc(n_blocks * sizeof(long long));
+	pkt= (unsigned char *)malloc(DATA_HDR_LEN + block_size);
+	if ((rcv == NULL) || (need == NULL) || (last_sent == NULL) || (pkt == NULL)) {
+		perror("malloc");
+		return 1;
+	}
+	for (i= 0; i < n_blocks; i++)
+		last_sent[i]= -1000000000000LL;
+	for (i= 0; i < n_rcv; i++) {
+		rcv[i].got= (unsigned char *)calloc(n_blocks, 1);
+		rcv[i].lost_at= (long long *)calloc(n_blocks, sizeof(long long));
+		if ((rcv[i].got == NULL) || (rcv[i].lost_at == NULL)) {
+			perror("malloc");
+			return 1;
+		}
+	}
+	hist_init(&completion);
+	hist_init(&repair_lat);
+
+	// One receive thread per transfer, without the features that need a real network
+	receiver_rx_threads= 1;
+	receiver_busy_poll= 0;
+	receiver_use_ring= 0;
+	receiver_workers= 0;
+	receiver_max_transfers= 0;
+	receiver_metrics_port= 0;
+	receiver_trace= 0;
+	receiver_pool_slots= 16;	// A busy-poll batch (8) and the next datagram; the engine uses at least 9
+	path_dir= (char *)out_dir;
+	active= TRUE;
+
+	simnet_init(&prm, &sender, n_rcv);
+	transport_set(&simnet_transport);
+	for (i= 0; i < n_rcv; i++)
+		simnet_start(i, (long long)(join_ms * 1e6 * i / n_rcv), start_receiver);
+
+	if (!verbose) {
+		// The receivers write to stdout
+		fflush(stdout);
+		saved_stdout= dup(STDOUT_FILENO);
+		int null= open("/dev/null", O_WRONLY);
+		if (null >= 0) {
+			dup2(null, STDOUT_FILENO);
+			close(null);
+		}
+	}
+	log_init();
+	engine_set_ui(&sim_ui);
+	clock_gettime(CLOCK_MONOTONIC, &w0);
+	simnet_run();
+	clock_gettime(CLOCK_MONOTONIC, &w1);
+	log_close();
+	if (saved_stdout >= 0) {
+		fflush(stdout);
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+	}
+
+	// Report
+	const SIM_STATS *ss= simnet_stats();
+	for (i= 0; i < n_rcv; i++)
+		completed+= rcv[i].completed;
+	printf("fmsim: %d receivers, %lld blocks of %d bytes at %g Mbit/s, seed %llu\n",
+			n_rcv, n_blocks, block_size, rate_mbps, prm.seed);
+	printf("network: loss %.2f%% (burst %g) delay %.1f ms jitter %.1f ms; uplink loss %.2f%%; "
+			"socket buffer %d bytes\n", prm.down.loss * 100, prm.down.burst, prm.down.delay_ns / 1e6,
+			prm.down.jitter_ns / 1e6, prm.up.loss * 100, prm.rcvbuf);
+	printf("completed %d/%d%s; completion time p50 %.3f s, p90 %.3f s, p99 %.3f s, max %.3f s\n",
+			completed, n_rcv, (failed_starts > 0) ? " (some failed to start)" : "",
+			hist_percentile(&completion, 50) / 1e9, hist_percentile(&completion, 90) / 1e9,
+			hist_percentile(&completion, 99) / 1e9, completion.max / 1e9);
+	printf("feedback: %lld SRRs (%.1f per receiver), %.2f MB; %lld EXITs\n",
+			n_srr, (double)n_srr / n_rcv, srr_bytes / 1e6, n_exit);
+	printf("sender: %lld blocks and %lld repairs (%.1f%%)%s\n", sent_first, sent_repairs,
+			100.0 * sent_repairs / (sent_first ? sent_first : 1), stopped ? "" : "; stopped by the time limit");
+	printf("repair latency: n=%lld p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+			repair_lat.n, hist_percentile(&repair_lat, 50) / 1e6, hist_percentile(&repair_lat, 90) / 1e6,
+			hist_percentile(&repair_lat, 99) / 1e6, repair_lat.max / 1e6);
+	printf("datagrams: %lld to the receivers (%lld lost, %lld dropped by full sockets), "
+			"%lld from them (%lld lost)\n", ss->down_pkts, ss->down_lost, ss->sock_drops,
+			ss->up_pkts, ss->up_lost);
+	printf("simulated %.3f s in %.3f s (%lld events, %lld thread switches)\n", simnet_now() / 1e9,
+			(w1.tv_sec - w0.tv_sec) + (w1.tv_nsec - w0.tv_nsec) / 1e9, ss->events, ss->switches);
+	if (out_dir == tmp_dir)
+		rmdir(out_dir);
+	fflush(stdout);
+	// Receivers that did not end are still blocked in the simulated network
+	_exit((completed == n_rcv) ? 0 : 2);
+}
@@ -0,0 +1,372 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * fmtrace.c
+ *
+ * Offline analyser of the receiver's event traces (trace.h). Merges the
+ *   traces of the threads of one transfer and prints:
+ *   - the histogram of loss bursts (consecutive blocks skipped by the sender's
+ *     first pass, as seen by the receiver);
+ *   - the distribution of the repair latency (from the detection of a loss
+ *     to the arrival of the missing block);
+ *   - the distributions of the block write time and of the lock waits.
+ *   Optionally, exports a timeline for chrome://tracing or Perfetto.
+ *
+ *   fmtrace [-c timeline.json] [-b bucket_ms] file.trace0 [file.trace1 ...]
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "trace.h"
+
+// Log2 histogram buckets
+#define N_BUCKETS		48
+// Exact buckets of the loss burst histogram (longer bursts share the last one)
+#define MAX_BURST		64
+// Write time above which a write is reported as a disk stall (ns)
+#define STALL_NS		10000000ULL
+// Maximum number of trace files (threads)
+#define MAX_TRACES		64
+
+// Event with the thread that recorded it
+typedef struct EVT {
+	TRACE_EVT e;
+	unsigned thread;
+} EVT;
+
+// Growable array of values
+typedef struct VEC {
+	uint64_t *v;
+	size_t n, size;
+} VEC;
+
+// Blocks found missing when a later block arrived
+typedef struct GAP {
+	int64_t lo, hi;			// Missing blocks
+	uint64_t detect;		// Detection time
+} GAP;
+
+static EVT *evts= NULL;
+static size_t n_evts= 0, size_evts= 0;
+static TRACE_HDR hdr0;		// Header of the first trace
+
+
+/** Append 'x' to 'vec' */
+static void vec_add(VEC *vec, uint64_t x) {
+	if (vec->n == vec->size) {
+		vec->size= vec->size ? 2 * vec->size : 1024;
+		if ((vec->v= (uint64_t *)realloc(vec->v, vec->size * sizeof(uint64_t))) == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	vec->v[vec->n++]= x;
+}
+
+
+/** Read the events of trace file 'path'; returns the number of events */
+static long load_trace(const char *path) {
+	TRACE_HDR h;
+	FILE *f= fopen(path, "r");
+	uint64_t n, first, i;
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	if ((fread(&h, sizeof(h), 1, f) != 1) || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) ||
+			(h.version != TRACE_VERSION) || (h.evt_size != sizeof(TRACE_EVT))) {
+		fprintf(stderr, "%s: not a trace file\n", path);
+		fclose(f);
+		return -1;
+	}
+	if (n_evts == 0)
+		hdr0= h;
+	// The ring keeps the last 'capacity' events; after a wrap, the oldest is at head % capacity
+	n= (h.head < h.capacity) ? h.head : h.capacity;
+	first= (h.head < h.capacity) ? 0 : h.head % h.capacity;
+	if (n_evts + n > size_evts) {
+		size_evts= n_evts + n;
+		if ((evts= (EVT *)realloc(evts, size_evts * sizeof(EVT))) == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	for (i= 0; i < n; i++) {
+		EVT *e= &evts[n_evts];
+		if (fseek(f, sizeof(h) + ((first + i) % h.capacity) * sizeof(TRACE_EVT), SEEK_SET) ||
+				(fread(&e->e, sizeof(TRACE_EVT), 1, f) != 1))
+			break;	// Trace of a thread that did not end
+		e->thread= h.thread;
+		n_evts++;
+	}
+	fclose(f);
+	fprintf(stdout, "%s: thread %u, %llu events%s\n", path, h.thread, (unsigned long long)i,
+			(h.head > h.capacity) ? " (ring wrapped, oldest events lost)" : "");
+	return (long)i;
+}
+
+
+/** Order of the events: time */
+static int evt_cmp(const void *a, const void *b) {
+	const EVT *x= (const EVT *)a, *y= (const EVT *)b;
+	return (x->e.ts < y->e.ts) ? -1 : (x->e.ts > y->e.ts);
+}
+
+static int u64_cmp(const void *a, const void *b) {
+	uint64_t x= *(const uint64_t *)a, y= *(const uint64_t *)b;
+	return (x < y) ? -1 : (x > y);
+}
+
+
+/** Print the distribution of 'vec' (ns), in log2 buckets of microseconds, and its percentiles */
+static void print_distribution(const char *title, VEC *vec) {
+	long hist[N_BUCKETS];
+	size_t i;
+	int k, last= -1;
+
+	fprintf(stdout, "\n%s: %lu samples\n", title, (unsigned long)vec->n);
+	if (vec->n == 0)
+		return;
+	qsort(vec->v, vec->n, sizeof(uint64_t), u64_cmp);
+	memset(hist, 0, sizeof(hist));
+	for (i= 0; i < vec->n; i++) {
+		uint64_t us= vec->v[i] / 1000;
+		for (k= 0; (k < N_BUCKETS - 1) && (us >= (2ULL << k)); k++)
+			;
+		hist[k]++;
+		if (k > last)
+			last= k;
+	}
+	for (k= 0; k <= last; k++) {
+		if (hist[k] > 0)
+			fprintf(stdout, "  < %10llu us: %ld\n", 2ULL << k, hist[k]);
+	}
+	fprintf(stdout, "  p50 %.1f us  p90 %.1f us  p99 %.1f us  p999 %.1f us  max %.1f us\n",
+			vec->v[vec->n * 50 / 100] / 1e3, vec->v[vec->n * 90 / 100] / 1e3,
+			vec->v[vec->n * 99 / 100] / 1e3, vec->v[vec->n * 999 / 1000] / 1e3,
+			vec->v[vec->n - 1] / 1e3);
+}
+
+
+/** Locate the gap with block 'seq' (the gaps are sorted and disjoint); NULL if none */
+static GAP *find_gap(GAP *gaps, size_t n, int64_t seq) {
+	size_t lo= 0, hi= n;
+	while (lo < hi) {
+		size_t mid= (lo + hi) / 2;
+		if (seq < gaps[mid].lo)
+			hi= mid;
+		else if (seq > gaps[mid].hi)
+			lo= mid + 1;
+		else
+			return &gaps[mid];
+	}
+	return NULL;
+}
+
+
+/** Print the timeline in the Trace Event Format; packets are counted per 'bucket_ms' */
+static void export_timeline(const char *path, int bucket_ms) {
+	FILE *f= fopen(path, "w");
+	uint64_t t0= n_evts ? evts[0].e.ts : 0, bucket= (uint64_t)bucket_ms * 1000000ULL, b_end;
+	uint64_t begin[MAX_TRACES];
+	long n_new= 0, n_dup= 0, n_lost= 0;
+	int64_t max_seq= -1;
+	size_t i;
+	const char *sep= "";
+
+	if (f == NULL) {
+		perror(path);
+		return;
+	}
+	memset(begin, 0, sizeof(begin));
+	fprintf(f, "{\"traceEvents\":[\n");
+	b_end= t0 + bucket;
+	for (i= 0; i <= n_evts; i++) {
+		// Close the packet counters of the buckets before this event
+		while ((i == n_evts) ? (n_new + n_dup + n_lost > 0) : (evts[i].e.ts >= b_end)) {
+			fprintf(f, "%s{\"name\":\"packets\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,"
+					"\"args\":{\"new\":%ld,\"dup\":%ld,\"lost\":%ld}}", sep,
+					(b_end - bucket - t0) / 1e3, n_new, n_dup, n_lost);
+			sep= ",\n";
+			n_new= n_dup= n_lost= 0;
+			b_end+= bucket;
+		}
+		if (i == n_evts)
+			break;
+		EVT *e= &evts[i];
+		double ts= (e->e.ts - t0) / 1e3;
+		unsigned th= e->thread % MAX_TRACES;
+		switch (e->e.type) {
+		case TR_PKT:
+			n_new++;
+			if (e->e.a > max_seq + 1) {
+				n_lost+= e->e.a - max_seq - 1;
+				fprintf(f, "%s{\"name\":\"loss\",\"ph\":\"i\",\"s\":\"p\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+						"\"args\":{\"first\":%lld,\"blocks\":%lld}}", sep, e->thread, ts,
+						(long long)(max_seq + 1), (long long)(e->e.a - max_seq - 1));
+				sep= ",\n";
+			}
+			if (e->e.a > max_seq)
+				max_seq= e->e.a;
+			break;
+		case TR_DUP:
+			n_dup++;
+			break;
+		case TR_WRITE_BEGIN:
+			begin[th]= e->e.ts;
+			break;
+		case TR_WRITE_END:
+			if (begin[th] > 0) {
+				fprintf(f, "%s{\"name\":\"write\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+						"\"args\":{\"seq\":%lld}}", sep, e->thread, (begin[th] - t0) / 1e3,
+						(e->e.ts - begin[th]) / 1e3, (long long)e->e.a);
+				sep= ",\n";
+				begin[th]= 0;
+			}
+			break;
+		case TR_LOCK_WAIT:
+			fprintf(f, "%s{\"name\":\"lock wait\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					sep, e->thread, ts - e->e.a / 1e3, e->e.a / 1e3);
+			sep= ",\n";
+			break;
+		case TR_SRR:
+			fprintf(f, "%s{\"name\":\"SRR\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+					"\"args\":{\"base\":%lld,\"bytes\":%u}}", sep, e->thread, ts, (long long)e->e.a, e->e.b);
+			sep= ",\n";
+			break;
+		case TR_INVALID:
+		case TR_STOP:
+			fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", sep,
+					(e->e.type == TR_STOP) ? "STOP" : "invalid", e->thread, ts);
+			sep= ",\n";
+			break;
+		}
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"file\":\"%s\"}}\n", hdr0.fname);
+	fclose(f);
+	fprintf(stdout, "\nTimeline written to '%s'\n", path);
+}
+
+
+/** Print the command line syntax */
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-c timeline.json] [-b bucket_ms] file.trace0 [file.trace1 ...]\n", prog);
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *timeline= NULL;
+	int bucket_ms= 10, opt, k;
+	long burst[MAX_BURST + 1];
+	uint64_t begin[MAX_TRACES];
+	VEC repair= {NULL, 0, 0}, writes= {NULL, 0, 0}, waits= {NULL, 0, 0};
+	GAP *gaps= NULL;
+	size_t n_gaps= 0, size_gaps= 0, i;
+	long n_pkt= 0, n_dup= 0, n_inv= 0, n_srr= 0, n_stall= 0, n_repaired= 0;
+	int64_t max_seq= -1;
+
+	while ((opt= getopt(argc, argv, "c:b:h")) != -1) {
+		switch (opt) {
+		case 'c': timeline= optarg; break;
+		case 'b': bucket_ms= atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((optind == argc) || (bucket_ms <= 0) || (argc - optind > MAX_TRACES)) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (k= optind; k < argc; k++) {
+		if (load_trace(argv[k]) < 0)
+			return 1;
+	}
+	qsort(evts, n_evts, sizeof(EVT), evt_cmp);
+
+	memset(burst, 0, sizeof(burst));
+	memset(begin, 0, sizeof(begin));
+	for (i= 0; i < n_evts; i++) {
+		EVT *e= &evts[i];
+		unsigned th= e->thread % MAX_TRACES;
+		switch (e->e.type) {
+		case TR_PKT:
+			n_pkt++;
+			if (e->e.a > max_seq + 1) {
+				// Blocks skipped: a loss burst, repaired later
+				int64_t len= e->e.a - max_seq - 1;
+				burst[(len > MAX_BURST) ? MAX_BURST : len]++;
+				if (n_gaps == size_gaps) {
+					size_gaps= size_gaps ? 2 * size_gaps : 1024;
+					if ((gaps= (GAP *)realloc(gaps, size_gaps * sizeof(GAP))) == NULL) {
+						perror("realloc");
+						return 1;
+					}
+				}
+				gaps[n_gaps].lo= max_seq + 1;
+				gaps[n_gaps].hi= e->e.a - 1;
+				gaps[n_gaps].detect= e->e.ts;
+				n_gaps++;
+			} else if (e->e.a < max_seq) {
+				// A missing block arrived
+				GAP *g= find_gap(gaps, n_gaps, e->e.a);
+				if (g != NULL) {
+					vec_add(&repair, e->e.ts - g->detect);
+					n_repaired++;
+				}
+			}
+			if (e->e.a > max_seq)
+				max_seq= e->e.a;
+			break;
+		case TR_DUP: n_dup++; break;
+		case TR_INVALID: n_inv++; break;
+		case TR_SRR: n_srr++; break;
+		case TR_WRITE_BEGIN:
+			begin[th]= e->e.ts;
+			break;
+		case TR_WRITE_END:
+			if (begin[th] > 0) {
+				vec_add(&writes, e->e.ts - begin[th]);
+				if (e->e.ts - begin[th] >= STALL_NS)
+					n_stall++;
+				begin[th]= 0;
+			}
+			break;
+		case TR_LOCK_WAIT:
+			vec_add(&waits, (uint64_t)e->e.a);
+			break;
+		}
+	}
+
+	fprintf(stdout, "\nFile '%s': %lld blocks of %d bytes; %.3f s traced\n", hdr0.fname,
+			(long long)hdr0.n_blocks, hdr0.block_size,
+			n_evts ? (evts[n_evts - 1].e.ts - evts[0].e.ts) / 1e9 : 0.0);
+	fprintf(stdout, "New blocks %ld, duplicates %ld, invalid %ld, SRRs %ld, disk stalls (>= %llu ms) %ld\n",
+			n_pkt, n_dup, n_inv, n_srr, STALL_NS / 1000000ULL, n_stall);
+
+	fprintf(stdout, "\nLoss bursts: %lu (%ld blocks repaired)\n", (unsigned long)n_gaps, n_repaired);
+	for (k= 1; k <= MAX_BURST; k++) {
+		if (burst[k] > 0)
+			fprintf(stdout, "  %s%3d blocks: %ld\n", (k == MAX_BURST) ? ">=" : "  ", k, burst[k]);
+	}
+	print_distribution("Repair latency (loss detected -> block received)", &repair);
+	print_distribution("Block write time", &writes);
+	print_distribution("Lock waits", &waits);
+
+	if (timeline != NULL)
+		export_timeline(timeline, bucket_ms);
+
+	free(repair.v);
+	free(writes.v);
+	free(waits.v);
+	free(gaps);
+	free(evts);
+	return 0;
+}
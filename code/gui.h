@@ -29,6 +29,7 @@ typedef struct
 		GtkTreeView				*treeProc;
 		GtkListStore			*th_store;
 		GtkTextView				*textView;
+		GtkEntry				*entrySearch;
 } GUI_WindowElements;
 
 // Global pointer to the main window elements
@@ -42,6 +43,12 @@ gboolean GUI_init_app (GUI_WindowElements *window);
 
 // Logs the message str to the textview and command line
 void Log (const gchar * str);
+// Queues the message str to the textview from any thread (logger hook)
+void GUI_log_async (const gchar * str);
+// Keeps the next log lines in file 'path' (NULL= none)
+void GUI_set_log_spill (const char *path);
+// Closes the log spill file
+void GUI_close_log (void);
 
 
 
@@ -87,7 +94,7 @@ gboolean GUI_locate_Ftrans(unsigned tid, GtkTreeIter *iter, gboolean lock_gdk);
 // Add line with thread 'tid' data to list
 gboolean GUI_add_Ftrans(unsigned tid, const char *ip, int port, const char *f_name, gboolean lock_gdk);
 // Update the percentage information in thread tid information
-gboolean GUI_update_Ftrans_tx(unsigned tid, int trans, int total, gboolean lock_gdk);
+gboolean GUI_update_Ftrans_tx(unsigned tid, long long trans, long long total, gboolean lock_gdk);
 // Get all information from the line with 'tid' in the thread list
 gboolean GUI_get_Ftrans_info(unsigned tid, const char **ip, int *port,
 		const char **transf, const char **filename, gboolean lock_gdk);
@@ -120,6 +127,8 @@ const gchar *GUI_get_save_filename (GUI_WindowElements *win);
 
 // Handles 'Clear' button - clears textMemo
 void on_buttonClear_clicked (GtkButton *button, gpointer user_data);
+// Handles 'Search' button - finds the next log line with the text in entrySearch
+void on_buttonSearch_clicked (GtkButton *button, gpointer user_data);
 
 
 // External event handlers in file.c and callbacks.c
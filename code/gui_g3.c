@@ -41,6 +41,14 @@ pthread_mutex_t gmutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Counter of active threads in window
 int win_cnt;
+// Rows of the file transfer list indexed by tid (unsigned -> GtkTreeIter*); the
+// GtkListStore iters stay valid while the row exists, so each lookup is O(1)
+static GHashTable *ftrans_rows= NULL;
+
+// Log spill file; keeps every line shown in the log window, including the ones dropped from it
+static FILE *log_spill= NULL;
+// Maximum number of matching lines shown by a search in the spill file
+#define SEARCH_MAX_MATCHES	20
 
 #ifdef DEBUG
 #define LOCK_MUTEX(mutex,str) { \
@@ -103,6 +111,8 @@ GUI_init_app (GUI_WindowElements *win)
                                                              "procstore"));
         win->textView = GTK_TEXT_VIEW (gtk_builder_get_object (builder,
                                                                 "textview"));
+        win->entrySearch = GTK_ENTRY (gtk_builder_get_object (builder,
+                                                                "entrySearch"));
         /* connect signals, passing our TutorialTextEditor struct as user data */
         gtk_builder_connect_signals (builder, win);
 
@@ -110,30 +120,92 @@ GUI_init_app (GUI_WindowElements *win)
         g_object_unref (G_OBJECT (builder));
 
         win_cnt= 0;
+        ftrans_rows= g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
 
         return TRUE;
 }
 
 
-/** Logs the message str to the textview and command line */
-void Log (const gchar * str)
+/** Appends the message str to the textview, keeping at most gui_log_lines lines;
+ *  the cost does not depend on the number of lines already shown */
+static void GUI_append_log (const gchar * str)
 {
   GtkTextBuffer *textbuf;
-  GtkTextIter tend;
-
-  // Adds text to the command line
-  g_print("%s", str);
+  GtkTextIter tbegin, tend;
+  int extra;
 
   pthread_mutex_lock( &lmutex );	// Locks log mutex
-  // Write text to textArea
+  if ((log_spill == NULL) && (gui_log_spill != NULL)) {
+	  if ((log_spill= fopen(gui_log_spill, "a+")) == NULL)
+		  perror("opening log spill file");
+  }
+  if (log_spill != NULL)
+	  fputs(str, log_spill);
   textbuf = GTK_TEXT_BUFFER (gtk_text_view_get_buffer (main_window->textView));
-  gtk_text_buffer_get_iter_at_offset (textbuf, &tend, -1);	// Gets reference to the last position
   // Adds text to the textview
+  gtk_text_buffer_get_end_iter (textbuf, &tend);
   gtk_text_buffer_insert (textbuf, &tend, str, strlen (str));
+  // Drops the oldest lines; the line count is kept by the buffer's B-tree
+  extra= gtk_text_buffer_get_line_count (textbuf) - 1 - gui_log_lines;
+  if (extra > 0) {
+	  gtk_text_buffer_get_start_iter (textbuf, &tbegin);
+	  gtk_text_buffer_get_iter_at_line (textbuf, &tend, extra);
+	  gtk_text_buffer_delete (textbuf, &tbegin, &tend);
+  }
   pthread_mutex_unlock( &lmutex );	// unlocks log mutex
 }
 
 
+/** Keeps the next log lines in file 'path' (NULL= none); the file is opened by the next line */
+void GUI_set_log_spill (const char *path)
+{
+  pthread_mutex_lock( &lmutex );
+  if (log_spill != NULL) {
+	  fclose(log_spill);
+	  log_spill= NULL;
+  }
+  gui_log_spill= path;
+  pthread_mutex_unlock( &lmutex );
+}
+
+
+/** Closes the log spill file */
+void GUI_close_log (void)
+{
+  pthread_mutex_lock( &lmutex );
+  if (log_spill != NULL) {
+	  fclose(log_spill);
+	  log_spill= NULL;
+  }
+  pthread_mutex_unlock( &lmutex );
+}
+
+
+/** Logs the message str to the textview and command line */
+void Log (const gchar * str)
+{
+  // Adds text to the command line
+  g_print("%s", str);
+  GUI_append_log(str);
+}
+
+
+/** Idle callback that shows a line queued by GUI_log_async; runs with the GDK lock */
+static gboolean GUI_log_idle (gpointer data)
+{
+  GUI_append_log((const gchar *) data);
+  g_free(data);
+  return FALSE;	// run once
+}
+
+
+/** Queues the message str to the textview; called by the logger thread */
+void GUI_log_async (const gchar * str)
+{
+  gdk_threads_add_idle(GUI_log_idle, g_strdup(str));
+}
+
+
 // Translates a string into its numerical value
 static int get_number_from_text(const gchar *text) {
   int n= 0;
@@ -226,39 +298,23 @@ void GUI_block_entrys(gboolean block)
 /** Search for 'tid' in file transfer list; returns iter */
 gboolean GUI_locate_Ftrans(unsigned tid, GtkTreeIter *iter, gboolean lock_gdk) {
 	assert(iter != NULL);
-	GtkTreeModel *tree_model;
-	gboolean valid;
-	int cnt= win_cnt;
+	GtkTreeIter *row;
+	gboolean valid= FALSE;
 
-	// Get the first iter in the list
 	if (lock_gdk) {
 		/* get GTK thread lock */
 		gdk_threads_enter ();
 	}
-
-	tree_model= GTK_TREE_MODEL(main_window->th_store);
-	if (tree_model == NULL)
-		return FALSE;
-	valid = gtk_tree_model_get_iter_first (tree_model, iter);
-	while (valid && (cnt-->0))
-	{
-		// Walk through the list, reading each row
-		unsigned tid_val;
-
-		// Make sure you terminate calls to gtk_tree_model_get() with a '-1' value
-		gtk_tree_model_get (tree_model, iter,
-				0, &tid_val,
-				-1);
-		if (tid == tid_val) {
-			return gtk_list_store_iter_is_valid (GTK_LIST_STORE(main_window->th_store), iter);
-		}
-		valid = gtk_tree_model_iter_next (tree_model, iter);
+	if ((ftrans_rows != NULL) &&
+			((row= (GtkTreeIter *)g_hash_table_lookup(ftrans_rows, GUINT_TO_POINTER(tid))) != NULL)) {
+		*iter= *row;
+		valid= TRUE;
 	}
 	if (lock_gdk) {
 		/* release GTK thread lock */
 		gdk_threads_leave ();
 	}
-	return FALSE;
+	return valid;
 }
 
 
@@ -286,13 +342,17 @@ gboolean GUI_add_Ftrans(unsigned tid, const char *ip, int port, const char *f_na
 	} else {
 		// new file
 		gtk_list_store_append(GTK_LIST_STORE(main_window->th_store), &iter);
+		GtkTreeIter *row= g_new(GtkTreeIter, 1);
+		*row= iter;
+		g_hash_table_insert(ftrans_rows, GUINT_TO_POINTER(tid), row);
 		win_cnt++;
 #ifdef DEBUG
 		fprintf(stdout, "Win list cont= %d\n", win_cnt);
 #endif
 	}
-	gtk_list_store_set(GTK_LIST_STORE(main_window->th_store), &iter, 0, tid, 1, strdup(ip),
-			2, port, 3, strdup(" "), 4, strdup(f_name), -1);
+	// The list store keeps its own copies of the strings
+	gtk_list_store_set(GTK_LIST_STORE(main_window->th_store), &iter, 0, tid, 1, ip,
+			2, port, 3, " ", 4, f_name, -1);
 	if (lock_gdk) {
 		/* release GTK thread lock */
 		gdk_threads_leave ();
@@ -304,11 +364,11 @@ gboolean GUI_add_Ftrans(unsigned tid, const char *ip, int port, const char *f_na
 
 
 /** Update the percentage information in thread tid information */
-gboolean GUI_update_Ftrans_tx(unsigned tid, int trans, int total, gboolean lock_gdk) {
+gboolean GUI_update_Ftrans_tx(unsigned tid, long long trans, long long total, gboolean lock_gdk) {
 	GtkTreeIter iter;
 	char str_buf[80];
 #ifdef DEBUG
-	g_print("GUI_update_Ftrans_tx(%u - %d,%d)\n", tid, trans, total);
+	g_print("GUI_update_Ftrans_tx(%u - %lld,%lld)\n", tid, trans, total);
 #endif
 	LOCK_MUTEX(&gmutex, "lock_f2\n");
 	if (lock_gdk) {
@@ -324,10 +384,10 @@ gboolean GUI_update_Ftrans_tx(unsigned tid, int trans, int total, gboolean lock_
 		return FALSE;
 	}
 #ifdef DEBUG
-	g_print("Thread %u updated trans %d\n", tid, trans);
+	g_print("Thread %u updated trans %lld\n", tid, trans);
 #endif
-	sprintf(str_buf, "%d of %d", trans, total);
-	gtk_list_store_set(GTK_LIST_STORE(main_window->th_store), &iter, 3, strdup(str_buf), -1);
+	sprintf(str_buf, "%lld of %lld", trans, total);
+	gtk_list_store_set(GTK_LIST_STORE(main_window->th_store), &iter, 3, str_buf, -1);
 	if (lock_gdk) {
 		/* get GTK thread lock */
 		gdk_threads_leave ();
@@ -377,6 +437,7 @@ gboolean GUI_del_Ftrans(unsigned tid, gboolean lock_gdk) {
 		gdk_threads_enter ();
 	}
 	if (GUI_locate_Ftrans(tid, &iter, FALSE)) {
+		g_hash_table_remove(ftrans_rows, GUINT_TO_POINTER(tid));
 		gtk_list_store_remove(GTK_LIST_STORE(main_window->th_store), &iter);
 		win_cnt--;
 #ifdef DEBUG
@@ -409,6 +470,7 @@ void GUI_clear_Ftrans(gboolean lock_gdk) {
 		gdk_threads_enter ();
 	}
 	gtk_list_store_clear(GTK_LIST_STORE(main_window->th_store));
+	g_hash_table_remove_all(ftrans_rows);
 	if (lock_gdk) {
 		/* get GTK thread lock */
 		gdk_threads_leave ();
@@ -544,3 +606,76 @@ void on_buttonClear_clicked (GtkButton * button, gpointer user_data)
 }
 
 
+/** Searches the text of entrySearch in the spill file; shows the last matching lines */
+static void search_spill (const gchar *text)
+{
+  char line[1024];
+  char *match[SEARCH_MAX_MATCHES];
+  int n= 0, i;
+  GString *res;
+  GtkWidget *dialog;
+
+  memset(match, 0, sizeof(match));
+  pthread_mutex_lock( &lmutex );
+  fflush(log_spill);
+  rewind(log_spill);
+  while (fgets(line, sizeof(line), log_spill) != NULL) {
+	  if (strstr(line, text) != NULL) {
+		  g_free(match[n % SEARCH_MAX_MATCHES]);
+		  match[n % SEARCH_MAX_MATCHES]= g_strdup(line);
+		  n++;
+	  }
+  }
+  fseek(log_spill, 0, SEEK_END);
+  pthread_mutex_unlock( &lmutex );
+
+  res= g_string_new(NULL);
+  g_string_printf(res, "%d lines with '%s' in %s", n, text, gui_log_spill);
+  if (n > SEARCH_MAX_MATCHES)
+	  g_string_append_printf(res, " (last %d shown)", SEARCH_MAX_MATCHES);
+  g_string_append(res, ":\n");
+  for (i= (n > SEARCH_MAX_MATCHES) ? n - SEARCH_MAX_MATCHES : 0; i < n; i++) {
+	  g_string_append(res, match[i % SEARCH_MAX_MATCHES]);
+  }
+  for (i= 0; i < SEARCH_MAX_MATCHES; i++)
+	  g_free(match[i]);
+
+  dialog = gtk_message_dialog_new (GTK_WINDOW (main_window->window),
+                                   GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+                                   GTK_MESSAGE_INFO,
+                                   GTK_BUTTONS_OK,
+                                   "%s", res->str);
+  gtk_window_set_title (GTK_WINDOW (dialog), "Search");
+  gtk_dialog_run (GTK_DIALOG (dialog));
+  gtk_widget_destroy (dialog);
+  g_string_free(res, TRUE);
+}
+
+
+/** Handles 'Search' button - selects the next line in the log window with the
+ *  text in entrySearch; when there is none, searches the spill file */
+void on_buttonSearch_clicked (GtkButton * button, gpointer user_data)
+{
+  GtkTextBuffer *textbuf;
+  GtkTextIter tstart, mbegin, mend;
+  const gchar *text= gtk_entry_get_text (main_window->entrySearch);
+
+  if ((text == NULL) || (*text == '\0'))
+	  return;
+  textbuf = GTK_TEXT_BUFFER (gtk_text_view_get_buffer (main_window->textView));
+  // Continues after the current selection
+  if (!gtk_text_buffer_get_selection_bounds (textbuf, NULL, &tstart))
+	  gtk_text_buffer_get_start_iter (textbuf, &tstart);
+  if (gtk_text_iter_forward_search (&tstart, text, 0, &mbegin, &mend, NULL)) {
+	  gtk_text_buffer_select_range (textbuf, &mbegin, &mend);
+	  gtk_text_view_scroll_to_iter (main_window->textView, &mbegin, 0.1, FALSE, 0, 0);
+	  return;
+  }
+  // Not in the window: clear the selection, so the next click starts again
+  gtk_text_buffer_get_start_iter (textbuf, &tstart);
+  gtk_text_buffer_place_cursor (textbuf, &tstart);
+  if (log_spill != NULL)
+	  search_spill (text);
+}
+
+
@@ -0,0 +1,107 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * hist.c
+ *
+ * Latency histograms. Values below 32 have one bucket each; a value with its
+ *   most significant bit at position m >= 5 goes to the bucket of its next
+ *   five bits, so recording is a count-leading-zeros, two shifts and an
+ *   atomic add. The percentiles report the middle of the bucket.
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "hist.h"
+
+
+/** Bucket of value 'v' */
+static int hist_index(unsigned long long v) {
+	if (v < HIST_SUB)
+		return (int)v;
+	int m= 63 - __builtin_clzll(v);
+	if (m > HIST_MAX_MSB)
+		return HIST_BUCKETS - 1;
+	return HIST_SUB + (m - HIST_SUB_BITS) * HIST_SUB + (int)((v >> (m - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+
+/** Value in the middle of bucket 'i' */
+static long long hist_value(int i) {
+	if (i < HIST_SUB)
+		return i;
+	int m= (i - HIST_SUB) / HIST_SUB + HIST_SUB_BITS;
+	long long low= (long long)(HIST_SUB + (i - HIST_SUB) % HIST_SUB) << (m - HIST_SUB_BITS);
+	return low + ((1LL << (m - HIST_SUB_BITS)) >> 1);
+}
+
+
+/** Clear the histogram */
+void hist_init(LAT_HIST *h) {
+	memset(h, 0, sizeof(*h));
+}
+
+
+/** Record value 'v' (ns); may run concurrently with other hist_record calls */
+void hist_record(LAT_HIST *h, long long v) {
+	long long m;
+	if (v < 0)
+		v= 0;
+	__atomic_add_fetch(&h->counts[hist_index(v)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->n, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->sum, v, __ATOMIC_RELAXED);
+	m= __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while ((v > m) && !__atomic_compare_exchange_n(&h->max, &m, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+
+/** Add the values of 'src' to 'dst' */
+void hist_merge(LAT_HIST *dst, const LAT_HIST *src) {
+	int i;
+	long long m, v;
+	for (i= 0; i < HIST_BUCKETS; i++) {
+		if ((v= __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED)) != 0)
+			__atomic_add_fetch(&dst->counts[i], v, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&dst->n, __atomic_load_n(&src->n, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&dst->sum, __atomic_load_n(&src->sum, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	v= __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+	m= __atomic_load_n(&dst->max, __ATOMIC_RELAXED);
+	while ((v > m) && !__atomic_compare_exchange_n(&dst->max, &m, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+
+/** Return the value (ns) below which 'p' percent of the values are (0 if empty) */
+long long hist_percentile(const LAT_HIST *h, double p) {
+	long long n= 0, acc= 0, target;
+	int i;
+	// Count the buckets instead of using h->n, which may be ahead of them while recording
+	for (i= 0; i < HIST_BUCKETS; i++)
+		n+= __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+	if (n == 0)
+		return 0;
+	target= (long long)(p / 100.0 * n + 0.5);
+	if (target < 1)
+		target= 1;
+	for (i= 0; i < HIST_BUCKETS; i++) {
+		acc+= __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+		if (acc >= target)
+			break;
+	}
+	long long v= hist_value(i < HIST_BUCKETS ? i : HIST_BUCKETS - 1);
+	long long m= __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	return (v > m) ? m : v;
+}
+
+
+/** Write "n=.. p50=.. p99=.. p999=.. max=.." (in us) to 'buf' */
+void hist_summary(const LAT_HIST *h, char *buf, int len) {
+	snprintf(buf, len, "n=%lld p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus",
+			__atomic_load_n(&h->n, __ATOMIC_RELAXED), hist_percentile(h, 50) / 1e3,
+			hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3,
+			__atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1e3);
+}
@@ -0,0 +1,43 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * hist.h
+ *
+ * Header file of the latency histograms: log-linear buckets (as in HDR
+ *   histograms) with 32 sub-buckets per power of two, for a relative error
+ *   below 3.2%, from 1 ns up to 2^48 ns (78 hours)
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_HIST_H
+#define HAVE_HIST_H
+
+// Bits of the sub-bucket index, and sub-buckets per power of two
+#define HIST_SUB_BITS	5
+#define HIST_SUB		(1 << HIST_SUB_BITS)
+// Highest power of two recorded; larger values go to the last bucket
+#define HIST_MAX_MSB	47
+// Number of buckets
+#define HIST_BUCKETS	(HIST_SUB + (HIST_MAX_MSB - HIST_SUB_BITS + 1) * HIST_SUB)
+
+// Histogram of values in ns; recorded concurrently with atomic adds
+typedef struct LAT_HIST {
+	long long counts[HIST_BUCKETS];
+	long long n;			// Values recorded
+	long long sum;			// Sum of the values
+	long long max;			// Largest value
+} LAT_HIST;
+
+// Clear the histogram
+void hist_init(LAT_HIST *h);
+// Record value 'v' (ns); may run concurrently with other hist_record calls
+void hist_record(LAT_HIST *h, long long v);
+// Add the values of 'src' to 'dst'
+void hist_merge(LAT_HIST *dst, const LAT_HIST *src);
+// Return the value (ns) below which 'p' percent of the values are (0 if empty)
+long long hist_percentile(const LAT_HIST *h, double p);
+// Write "n=.. p50=.. p99=.. p999=.. max=.." (in us) to 'buf'
+void hist_summary(const LAT_HIST *h, char *buf, int len);
+
+#endif
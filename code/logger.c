@@ -0,0 +1,283 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * logger.c
+ *
+ * Asynchronous logging subsystem. Each thread owns a single-producer ring of
+ * fixed-size records, registered on its first use; a background thread drains
+ * all rings, formats the records and writes them to the console, an optional
+ * file and the GUI. Producers never lock or block.
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#include "logger.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+// Log record
+typedef struct LOG_REC {
+	guint64 ts;					// Wall clock time, in ns
+	const char *fmt;			// Format of a binary record; NULL for text records
+	long a[4];					// Arguments of a binary record
+	unsigned char level;		// Log level
+	unsigned char togui;		// Also show in the GUI
+	char tag[LOG_TAG_LEN];		// Thread tag
+	char text[LOG_TEXT_LEN];	// Text record contents
+} LOG_REC;
+
+// Single-producer single-consumer ring of one thread
+typedef struct LOG_RING {
+	unsigned head __attribute__((aligned(64)));	// Next record to write; owner thread only
+	unsigned tail __attribute__((aligned(64)));	// Next record to read; consumer only
+	int closed;					// Set when the owner thread exits
+	struct LOG_RING *next;		// Registry link
+	LOG_REC rec[LOG_RING_SIZE];
+} LOG_RING;
+
+
+static LOG_RING *rings = NULL;	// Registry of thread rings
+static pthread_mutex_t reg_mutex = PTHREAD_MUTEX_INITIALIZER;	// Protects the registry
+static pthread_key_t ring_key;	// Marks the ring closed when its thread exits
+static __thread LOG_RING *my_ring = NULL;	// Ring of the current thread
+
+static gboolean running = FALSE;	// Consumer thread state
+static pthread_t consumer_tid;
+static FILE *log_file = NULL;		// Optional log file
+static void (*gui_hook)(const char *line) = NULL;	// Shows a line in the GUI
+static long dropped = 0;			// Records dropped because a ring was full
+
+static const char *level_name[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+
+/** Current wall clock time, in ns */
+static guint64 now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (guint64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Thread exit: the consumer frees the ring after draining it */
+static void ring_release(void *ptr) {
+	__atomic_store_n(&((LOG_RING *) ptr)->closed, 1, __ATOMIC_RELEASE);
+}
+
+/** Return the ring of the current thread, creating it on first use */
+static LOG_RING *get_ring(void) {
+	if (my_ring != NULL)
+		return my_ring;
+	LOG_RING *r = (LOG_RING *) aligned_alloc(64, sizeof(LOG_RING));
+	if (r == NULL)
+		return NULL;
+	memset(r, 0, sizeof(LOG_RING));
+	pthread_setspecific(ring_key, r);
+	pthread_mutex_lock(&reg_mutex);
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&reg_mutex);
+	my_ring = r;
+	return r;
+}
+
+/** Write the message of a record (without time stamp) to 'buf' */
+static void format_msg(LOG_REC *rec, char *buf, int size) {
+	int n = snprintf(buf, size, "%s", rec->tag);
+	if (rec->fmt != NULL)
+		n += snprintf(buf + n, size - n, rec->fmt, rec->a[0], rec->a[1], rec->a[2], rec->a[3]);
+	else
+		n += snprintf(buf + n, size - n, "%s", rec->text);
+	if ((n < size - 1) && ((n == 0) || (buf[n - 1] != '\n'))) {
+		buf[n] = '\n';
+		buf[n + 1] = '\0';
+	}
+}
+
+/** Write one record to the console, the log file and the GUI */
+static void output_rec(LOG_REC *rec) {
+	char msg[LOG_TAG_LEN + LOG_TEXT_LEN + 200];
+	char stamp[40];
+	struct tm tm;
+	time_t sec = (time_t) (rec->ts / 1000000000ULL);
+
+	format_msg(rec, msg, sizeof(msg));
+	localtime_r(&sec, &tm);
+	int n = strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+	snprintf(stamp + n, sizeof(stamp) - n, ".%06lu %-5s ",
+			(unsigned long) ((rec->ts / 1000) % 1000000), level_name[rec->level & 3]);
+	fprintf(stdout, "%s%s", stamp, msg);
+	if (log_file != NULL)
+		fprintf(log_file, "%s%s", stamp, msg);
+	if (rec->togui && (gui_hook != NULL))
+		gui_hook(msg);
+}
+
+/** Drain all rings; frees the rings of the threads that ended */
+static void drain_all(void) {
+	LOG_RING **pr;
+	pthread_mutex_lock(&reg_mutex);
+	for (pr = &rings; *pr != NULL;) {
+		LOG_RING *r = *pr;
+		int closed = __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+		unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		while (r->tail != head) {
+			output_rec(&r->rec[r->tail & (LOG_RING_SIZE - 1)]);
+			__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+		}
+		if (closed) {
+			*pr = r->next;
+			free(r);
+		} else
+			pr = &r->next;
+	}
+	pthread_mutex_unlock(&reg_mutex);
+	fflush(stdout);
+	if (log_file != NULL)
+		fflush(log_file);
+}
+
+/** Consumer thread */
+static void *log_consumer(void *ptr) {
+	while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		drain_all();
+		usleep(LOG_FLUSH_US);
+	}
+	drain_all();
+	return NULL;
+}
+
+
+/** Start the consumer thread */
+void log_init(void) {
+	if (running)
+		return;
+	pthread_key_create(&ring_key, ring_release);
+	running = TRUE;
+	if (pthread_create(&consumer_tid, NULL, log_consumer, NULL)) {
+		perror("starting the logger thread");
+		running = FALSE;
+	}
+}
+
+/** Flush every ring and stop the consumer thread */
+void log_close(void) {
+	if (!running)
+		return;
+	__atomic_store_n(&running, FALSE, __ATOMIC_RELEASE);
+	pthread_join(consumer_tid, NULL);
+	log_open_file(NULL);
+}
+
+/** Also write the log to file 'path' (NULL closes it) */
+gboolean log_open_file(const char *path) {
+	FILE *f = NULL;
+	if ((path != NULL) && ((f = fopen(path, "a")) == NULL)) {
+		perror("opening the log file");
+		return FALSE;
+	}
+	pthread_mutex_lock(&reg_mutex);	// The consumer writes with reg_mutex locked
+	if (log_file != NULL)
+		fclose(log_file);
+	log_file = f;
+	pthread_mutex_unlock(&reg_mutex);
+	return TRUE;
+}
+
+/** Function that shows a formatted line in the GUI; called by the consumer thread */
+void log_set_gui_hook(void (*hook)(const char *line)) {
+	gui_hook = hook;
+}
+
+/** Reserve the next record of the current thread's ring; NULL if the ring is full */
+static LOG_REC *log_reserve(int level, gboolean togui, const char *tag) {
+	LOG_RING *r = get_ring();
+	if (r == NULL)
+		return NULL;
+	unsigned head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+		__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	LOG_REC *rec = &r->rec[head & (LOG_RING_SIZE - 1)];
+	rec->ts = now_ns();
+	rec->level = level;
+	rec->togui = togui;
+	if (tag != NULL) {
+		strncpy(rec->tag, tag, LOG_TAG_LEN - 1);
+		rec->tag[LOG_TAG_LEN - 1] = '\0';
+	} else
+		rec->tag[0] = '\0';
+	return rec;
+}
+
+/** Publish the record reserved by log_reserve */
+static void log_commit(void) {
+	__atomic_store_n(&my_ring->head, my_ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/** Queue a binary record; never blocks */
+void log_write(int level, gboolean togui, const char *tag, const char *fmt,
+		long a0, long a1, long a2, long a3) {
+	assert(fmt != NULL);
+	if (!running) {
+		// Logger not started: write synchronously
+		fprintf(stdout, "%s", (tag != NULL) ? tag : "");
+		fprintf(stdout, fmt, a0, a1, a2, a3);
+		fprintf(stdout, "\n");
+		return;
+	}
+	LOG_REC *rec = log_reserve(level, togui, tag);
+	if (rec == NULL)
+		return;
+	rec->fmt = fmt;
+	rec->a[0] = a0;
+	rec->a[1] = a1;
+	rec->a[2] = a2;
+	rec->a[3] = a3;
+	log_commit();
+}
+
+/** Queue a copy of string 's' */
+void log_text(int level, gboolean togui, const char *tag, const char *s) {
+	assert(s != NULL);
+	if (!running) {
+		fprintf(stdout, "%s%s\n", (tag != NULL) ? tag : "", s);
+		return;
+	}
+	LOG_REC *rec = log_reserve(level, togui, tag);
+	if (rec == NULL)
+		return;
+	rec->fmt = NULL;
+	strncpy(rec->text, s, LOG_TEXT_LEN - 1);
+	rec->text[LOG_TEXT_LEN - 1] = '\0';
+	log_commit();
+}
+
+/** Rate limiter used by LOG_RATE: allows 'per_sec' records per second. The first record
+ *  allowed after some were suppressed is preceded by one with their number */
+gboolean log_site_allow(LOG_SITE *site, int per_sec, int level, const char *tag) {
+	int n;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	if (__atomic_load_n(&site->sec, __ATOMIC_RELAXED) != now.tv_sec) {
+		__atomic_store_n(&site->sec, now.tv_sec, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->cnt, 0, __ATOMIC_RELAXED);
+	}
+	if (__atomic_add_fetch(&site->cnt, 1, __ATOMIC_RELAXED) <= per_sec) {
+		if ((n = __atomic_exchange_n(&site->dropped, 0, __ATOMIC_RELAXED)) > 0)
+			log_write(level, FALSE, tag, "%ld messages suppressed", n, 0, 0, 0);
+		return TRUE;
+	}
+	__atomic_add_fetch(&site->dropped, 1, __ATOMIC_RELAXED);
+	return FALSE;
+}
+
+/** Number of records dropped because a ring was full */
+long log_dropped(void) {
+	return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
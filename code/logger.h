@@ -0,0 +1,84 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * logger.h
+ *
+ * Header file of the asynchronous logging subsystem: threads write fixed-size
+ * records into their own lock-free ring; a background thread formats them to
+ * the console, an optional file and the GUI
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_LOGGER_H
+#define HAVE_LOGGER_H
+
+#include <glib.h>
+
+// Log levels
+#define LOG_LVL_DEBUG	0
+#define LOG_LVL_INFO	1
+#define LOG_LVL_WARN	2
+#define LOG_LVL_ERROR	3
+
+// Calls below LOG_MIN_LEVEL are removed at compile time
+#ifndef LOG_MIN_LEVEL
+#ifdef DEBUG
+#define LOG_MIN_LEVEL	LOG_LVL_DEBUG
+#else
+#define LOG_MIN_LEVEL	LOG_LVL_INFO
+#endif
+#endif
+
+#define LOG_RING_SIZE	1024	// Records per thread ring; power of 2
+#define LOG_TAG_LEN		16		// Thread tag length (e.g. "RCV(1)> ")
+#define LOG_TEXT_LEN	192		// Text copied by log_text
+#define LOG_FLUSH_US	5000	// Period of the consumer thread, in microseconds
+
+// Per call-site rate limiter state (see LOG_RATE)
+typedef struct LOG_SITE {
+	long sec;		// Current one-second window
+	int cnt;		// Records in the window
+	int dropped;	// Records suppressed since the last one allowed
+} LOG_SITE;
+
+// Binary record: 'fmt' must be a literal whose conversions take longs (%ld, %lu, %lx)
+#define LOG_MSG(lvl, togui, tag, fmt, a0, a1, a2, a3) do { \
+		if ((lvl) >= LOG_MIN_LEVEL) \
+			log_write((lvl), (togui), (tag), (fmt), (long)(a0), (long)(a1), (long)(a2), (long)(a3)); \
+	} while (0)
+
+// Binary record limited to 'per_sec' records per second at this call site
+#define LOG_RATE(lvl, per_sec, tag, fmt, a0, a1, a2, a3) do { \
+		if ((lvl) >= LOG_MIN_LEVEL) { \
+			static LOG_SITE _log_site; \
+			if (log_site_allow(&_log_site, (per_sec), (lvl), (tag))) \
+				log_write((lvl), FALSE, (tag), (fmt), (long)(a0), (long)(a1), (long)(a2), (long)(a3)); \
+		} \
+	} while (0)
+
+#define LOG_DEBUG(tag, fmt, a0, a1, a2, a3)	LOG_MSG(LOG_LVL_DEBUG, FALSE, tag, fmt, a0, a1, a2, a3)
+#define LOG_INFO(tag, fmt, a0, a1, a2, a3)	LOG_MSG(LOG_LVL_INFO, FALSE, tag, fmt, a0, a1, a2, a3)
+
+
+// Start the consumer thread
+void log_init(void);
+// Flush every ring and stop the consumer thread
+void log_close(void);
+// Also write the log to file 'path' (NULL closes it)
+gboolean log_open_file(const char *path);
+// Function that shows a formatted line in the GUI; called by the consumer thread
+void log_set_gui_hook(void (*hook)(const char *line));
+
+// Queue a binary record; never blocks (the record is dropped and counted if the ring is full)
+void log_write(int level, gboolean togui, const char *tag, const char *fmt,
+		long a0, long a1, long a2, long a3);
+// Queue a copy of string 's'
+void log_text(int level, gboolean togui, const char *tag, const char *s);
+// Rate limiter used by LOG_RATE; the first record allowed after some were suppressed
+//   is preceded by a record with their number, with 'level' and 'tag'
+gboolean log_site_allow(LOG_SITE *site, int per_sec, int level, const char *tag);
+// Number of records dropped because a ring was full
+long log_dropped(void);
+
+#endif
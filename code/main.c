@@ -14,12 +14,18 @@
 #include <assert.h>
 #include <time.h>
 #include <memory.h>
+#include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "gui.h"
 #include "sock.h"
 #include "callbacks.h"
 #include "file.h"
+#include "logger.h"
+#include "workers.h"
+#include "taskpool.h"
+#include "scheduler.h"
+#include "metrics.h"
 
 /* Public variables */
 GUI_WindowElements *main_window;	// Pointer to all elements of main window
@@ -32,12 +38,25 @@ int main (int argc, char *argv[]) {
     /* init glib threads */
     gdk_threads_init ();
 
-    /* initialize GTK+ libraries */
+    /* initialize GTK+ libraries; they remove their own options from argv */
     gtk_init (&argc, &argv);
 
+    /* -s file: keeps every line of the log window in 'file', searchable from the window */
+    if ((argc == 3) && !strcmp (argv[1], "-s")) {
+      GUI_set_log_spill (argv[2]);
+    } else if (argc != 1) {
+      fprintf (stderr, "usage: %s [-s log_spill_file]\n", argv[0]);
+      return 1;
+    }
+
     if (GUI_init_app (main_window) == FALSE) return 1; /* error loading UI */
 	gtk_widget_show (main_window->window);
 
+    /* start the logger thread; it shows the GUI messages through idle callbacks */
+    log_init ();
+    log_set_gui_hook (GUI_log_async);
+    engine_set_ui (&GUI_engine_ui);
+
     // Defines the output directory, where the files will be written
     char *homedir= getenv("HOME");
     if (homedir == NULL)
@@ -64,6 +83,17 @@ int main (int argc, char *argv[]) {
 	/* release GTK thread lock */
 	gdk_threads_leave ();
 
+    /* no more queued transfers; the workers leave after their current transfer */
+    sched_stop ();
+    workers_stop ();
+    taskpool_stop ();
+    metrics_stop ();
+
+    /* flush pending log records */
+    log_set_gui_hook (NULL);
+    log_close ();
+    GUI_close_log ();
+
     /* free memory we allocated for TutorialTextEditor struct */
     g_slice_free (GUI_WindowElements, main_window);
 
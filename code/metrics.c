@@ -0,0 +1,567 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * metrics.c
+ *
+ * Metrics endpoint. A thread answers "GET /metrics" on 127.0.0.1 with the
+ *   counters of every transfer and the global totals, in the Prometheus text
+ *   format. The counters are copied from the registry with relaxed atomic
+ *   loads; the registry read lock is only held while copying, and no lock of
+ *   the receive path is taken. The totals of the transfers that ended are
+ *   kept apart, so the global counters never go back. The latency histograms
+ *   are exported as summaries with the 0.5, 0.9, 0.99 and 0.999 quantiles.
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "engine.h"
+#include "sock.h"
+#include "receiver_th.h"
+#include "registry.h"
+#include "scheduler.h"
+#include "metrics.h"
+#include "transport.h"
+#include "taskpool.h"
+
+// Totals of the transfers that ended; updated atomically
+static TRANSFER_STATS ended;
+static long long n_completed= 0;	// Transfers that received every block
+static long long n_failed= 0;		// Transfers stopped before the end
+static long long ended_drops= 0;	// Datagrams dropped by the sockets of the transfers that ended
+static LAT_HIST ended_lat[N_LAT];	// Latencies of the transfers that ended
+// Taken shared by the transfers that leave the registry and fold their counters into the totals,
+//   and exclusive by a scrape, so it never sees a transfer in both or in neither
+static pthread_rwlock_t fold_lock= PTHREAD_RWLOCK_INITIALIZER;
+
+static int ms= -1;					// Listening socket
+static pthread_t metrics_tid;
+static gboolean metrics_running= FALSE;
+static volatile gboolean metrics_quit= FALSE;
+
+
+/** Reset the counters of a new transfer */
+void metrics_init_stats(TRANSFER_STATS *s) {
+	memset(s, 0, sizeof(*s));
+	s->start_us= transport_monotonic_us();	// The receive threads measure with the transport's clock
+	s->rate_us= g_get_monotonic_time();
+}
+
+
+/** Reset the latencies of a new transfer */
+void metrics_init_lat(TRANSFER_LAT *l) {
+	memset(l, 0, sizeof(*l));
+	l->max_seq= -1;
+}
+
+
+/** Record the arrival of a DATA packet at 'now' (monotonic ns) */
+void metrics_packet(TRANSFER_LAT *l, long long now) {
+	long long prev= __atomic_exchange_n(&l->last_ns, now, __ATOMIC_RELAXED);
+	if ((prev > 0) && (now > prev))	// Packets handled by other threads may come out of order
+		hist_record(&l->h[LAT_GAP], now - prev);
+}
+
+
+// Gap 'i' of the ring, from the oldest
+#define GAP(l, i)	((l)->gaps[((l)->gap_head + (i)) % LAT_GAPS])
+
+/** Lock the gap ring; only held for a few instructions, so it spins */
+static void gap_lock(TRANSFER_LAT *l) {
+	while (__atomic_test_and_set(&l->gap_lock, __ATOMIC_ACQUIRE))
+		;
+}
+
+static void gap_unlock(TRANSFER_LAT *l) {
+	__atomic_clear(&l->gap_lock, __ATOMIC_RELEASE);
+}
+
+/** Add the gap of blocks 'lo' to 'hi', detected at 'now'; the ring is locked */
+static void add_gap(TRANSFER_LAT *l, long long lo, long long hi, long long now) {
+	int i;
+	if (l->gap_n == LAT_GAPS) {
+		// Forget the oldest gap
+		l->gap_head= (l->gap_head + 1) % LAT_GAPS;
+		l->gap_n--;
+	}
+	// Another thread may have added a later gap first: keep the ring sorted
+	for (i= l->gap_n++; (i > 0) && (GAP(l, i - 1).lo > lo); i--)
+		GAP(l, i)= GAP(l, i - 1);
+	GAP(l, i).lo= lo;
+	GAP(l, i).hi= hi;
+	GAP(l, i).t= now;
+}
+
+/** Return the gap with block 'seq', or NULL; the ring is locked */
+static LOSS_GAP *find_gap(TRANSFER_LAT *l, long long seq) {
+	int a= 0, b= l->gap_n - 1;
+	while (a <= b) {
+		int m= (a + b) / 2;
+		LOSS_GAP *g= &GAP(l, m);
+		if (seq < g->lo)
+			b= m - 1;
+		else if (seq > g->hi)
+			a= m + 1;
+		else
+			return g;
+	}
+	return NULL;
+}
+
+
+/** Record the arrival of new block 'seq' of the transfer started at 'start_us' (monotonic us) */
+void metrics_new_block(TRANSFER_LAT *l, long long seq, long long now, gint64 start_us) {
+	long long m;
+
+	if (!__atomic_exchange_n(&l->first, 1, __ATOMIC_RELAXED))
+		hist_record(&l->h[LAT_FIRST], now - start_us * 1000);
+	m= __atomic_load_n(&l->max_seq, __ATOMIC_RELAXED);
+	while ((seq > m) && !__atomic_compare_exchange_n(&l->max_seq, &m, seq, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	if (seq > m + 1) {
+		// Blocks m+1 to seq-1 are missing
+		gap_lock(l);
+		add_gap(l, m + 1, seq - 1, now);
+		gap_unlock(l);
+	} else if (seq < m) {
+		// A missing block arrived: a repair, or a block reordered between the receive threads
+		LOSS_GAP *g;
+		gap_lock(l);
+		if ((g= find_gap(l, seq)) != NULL)
+			hist_record(&l->h[LAT_REPAIR], now - g->t);
+		gap_unlock(l);
+	}
+}
+
+
+/** Write the latency summary of a transfer to 'buf' */
+void metrics_lat_summary(const TRANSFER_LAT *l, char *buf, int len) {
+	static const char *names[N_LAT]= {"gap", "repair", "write", "first block"};
+	int i, n= 0;
+	for (i= 0; (i < N_LAT) && (n < len - 1); i++) {
+		n+= snprintf(buf + n, len - n, "%s%s: ", (i > 0) ? "; " : "", names[i]);
+		if (n < len - 1)
+			hist_summary(&l->h[i], buf + n, len - n);
+		n+= strlen(buf + n);
+	}
+}
+
+
+/** Remove a transfer that ended from the registry and add its counters and latencies, and the
+ *  datagrams its sockets dropped, to the global totals; a scrape sees either the running
+ *  transfer or its counters in the totals */
+void metrics_transfer_ended(ReceiverTh *t, long long drops, gboolean completed) {
+	const TRANSFER_STATS *s= &t->stats;
+	const TRANSFER_LAT *l= &t->lat;
+	int i;
+	pthread_rwlock_rdlock(&fold_lock);
+	registry_remove(t);
+	for (i= 0; i < N_LAT; i++)
+		hist_merge(&ended_lat[i], &l->h[i]);
+	__atomic_add_fetch(&ended_drops, drops, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ended.pkts, __atomic_load_n(&s->pkts, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ended.bytes, __atomic_load_n(&s->bytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ended.dups, __atomic_load_n(&s->dups, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ended.invalid, __atomic_load_n(&s->invalid, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ended.srrs, __atomic_load_n(&s->srrs, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ended.zbytes, __atomic_load_n(&s->zbytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ended.tail_blocks, __atomic_load_n(&s->tail_blocks, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ended.busy_pkts, __atomic_load_n(&s->busy_pkts, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_add_fetch(completed ? &n_completed : &n_failed, 1, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&fold_lock);
+}
+
+
+// Quantiles exported for the latencies
+static const double quantiles[]= {0.5, 0.9, 0.99, 0.999};
+#define N_QUANTILES	(sizeof(quantiles) / sizeof(quantiles[0]))
+
+// Latency summary of one transfer
+typedef struct METRICS_LAT_SNAP {
+	long long n;
+	long long sum;			// ns
+	long long q[N_QUANTILES];	// ns
+} METRICS_LAT_SNAP;
+
+// Copy of the state of one transfer
+typedef struct METRICS_SNAP {
+	unsigned tid;
+	char fname[81];
+	TRANSFER_STATS s;
+	METRICS_LAT_SNAP lat[N_LAT];
+	long long outstanding;	// Blocks missing
+	long long drops;		// Datagrams dropped by the multicast socket
+	int block_size;
+} METRICS_SNAP;
+
+// State gathered from the registry
+typedef struct METRICS_SCAN {
+	GArray *arr;			// METRICS_SNAP of each transfer
+	LAT_HIST *lat;			// Latencies of every transfer (N_LAT histograms)
+} METRICS_SCAN;
+
+/** Copy the counters of one transfer; the registry shard is read-locked */
+static void snap_transfer(ReceiverTh *t, gpointer data) {
+	METRICS_SCAN *scan= (METRICS_SCAN *)data;
+	METRICS_SNAP sn;
+	int i;
+	guint q;
+
+	if ((t->self != t) || (t->tid == 0))
+		return;
+	memset(&sn, 0, sizeof(sn));
+	sn.tid= t->reg_tid;
+	memcpy(sn.fname, t->fname, sizeof(sn.fname));
+	sn.fname[sizeof(sn.fname) - 1]= '\0';
+	sn.s.pkts= __atomic_load_n(&t->stats.pkts, __ATOMIC_RELAXED);
+	sn.s.bytes= __atomic_load_n(&t->stats.bytes, __ATOMIC_RELAXED);
+	sn.s.dups= __atomic_load_n(&t->stats.dups, __ATOMIC_RELAXED);
+	sn.s.invalid= __atomic_load_n(&t->stats.invalid, __ATOMIC_RELAXED);
+	sn.s.srrs= __atomic_load_n(&t->stats.srrs, __ATOMIC_RELAXED);
+	sn.s.zbytes= __atomic_load_n(&t->stats.zbytes, __ATOMIC_RELAXED);
+	sn.s.tail_blocks= __atomic_load_n(&t->stats.tail_blocks, __ATOMIC_RELAXED);
+	sn.s.busy_pkts= __atomic_load_n(&t->stats.busy_pkts, __ATOMIC_RELAXED);
+	sn.block_size= t->block_size;
+	sn.drops= receiver_socket_drops(t);
+	if (!bitmask_isempty(&t->bmask)) {
+		long long got= __atomic_load_n(&t->n_recv, __ATOMIC_RELAXED);
+		gint64 now= g_get_monotonic_time();
+		sn.outstanding= t->bmask.b_len - got;
+		// Goodput of the blocks written since the previous sample; only this thread writes the rate fields
+		if (now - t->stats.rate_us >= METRICS_RATE_MS * 1000L) {
+			t->stats.goodput= (got * t->block_size - t->stats.rate_bytes) * 1e6 / (now - t->stats.rate_us);
+			t->stats.rate_bytes= got * t->block_size;
+			t->stats.rate_us= now;
+		}
+	}
+	sn.s.goodput= t->stats.goodput;
+	for (i= 0; i < N_LAT; i++) {
+		sn.lat[i].n= __atomic_load_n(&t->lat.h[i].n, __ATOMIC_RELAXED);
+		sn.lat[i].sum= __atomic_load_n(&t->lat.h[i].sum, __ATOMIC_RELAXED);
+		for (q= 0; q < N_QUANTILES; q++)
+			sn.lat[i].q[q]= hist_percentile(&t->lat.h[i], quantiles[q] * 100);
+		hist_merge(&scan->lat[i], &t->lat.h[i]);
+	}
+	g_array_append_val(scan->arr, sn);
+}
+
+
+/** Append 'str' to 'out' as a label value (escapes '\', '"' and newlines) */
+static void append_label(GString *out, const char *str) {
+	for (; *str != '\0'; str++) {
+		if ((*str == '\\') || (*str == '"'))
+			g_string_append_c(out, '\\');
+		if (*str == '\n')
+			g_string_append(out, "\\n");
+		else
+			g_string_append_c(out, *str);
+	}
+}
+
+/** Append the header of a metric */
+static void append_header(GString *out, const char *name, const char *type, const char *help) {
+	g_string_append_printf(out, "# HELP fmcast_%s %s\n# TYPE fmcast_%s %s\n", name, help, name, type);
+}
+
+/** Append one sample of a transfer */
+static void append_sample(GString *out, const char *name, const METRICS_SNAP *sn, double v) {
+	g_string_append_printf(out, "fmcast_%s{tid=\"%u\",file=\"", name, sn->tid);
+	append_label(out, sn->fname);
+	if (isnan(v))
+		g_string_append(out, "\"} NaN\n");
+	else
+		g_string_append_printf(out, "\"} %.17g\n", v);
+}
+
+
+// Counters exported per transfer and globally
+typedef struct METRICS_COUNTER {
+	const char *name;
+	const char *help;
+	size_t offset;			// Field in TRANSFER_STATS
+} METRICS_COUNTER;
+
+static const METRICS_COUNTER counters[]= {
+	{"packets_received_total", "DATA packets received.", offsetof(TRANSFER_STATS, pkts)},
+	{"bytes_received_total", "Bytes of the DATA packets received.", offsetof(TRANSFER_STATS, bytes)},
+	{"duplicate_packets_total", "DATA packets carrying blocks already received.", offsetof(TRANSFER_STATS, dups)},
+	{"invalid_packets_total", "DATA packets with invalid sequence numbers or lengths.", offsetof(TRANSFER_STATS, invalid)},
+	{"srr_sent_total", "SRR packets sent.", offsetof(TRANSFER_STATS, srrs)},
+	{"decompressed_bytes_total", "Bytes of the compressed blocks after decompression.", offsetof(TRANSFER_STATS, zbytes)},
+	{"tail_repair_blocks_total", "DATA records received on the TCP connection (tail repair).", offsetof(TRANSFER_STATS, tail_blocks)},
+	{"busy_poll_packets_total", "Datagrams read while busy polling the multicast socket.", offsetof(TRANSFER_STATS, busy_pkts)},
+};
+#define N_COUNTERS	(sizeof(counters) / sizeof(counters[0]))
+
+// Latency summaries exported per transfer and globally, indexed by LAT_*
+typedef struct METRICS_LAT {
+	const char *name;
+	const char *help;
+} METRICS_LAT;
+
+static const METRICS_LAT lats[N_LAT]= {
+	{"packet_gap_seconds", "Time between two DATA packets."},
+	{"repair_seconds", "Time from the detection of a loss to the arrival of the missing block."},
+	{"disk_write_seconds", "Time from the arrival of a new block to its write in the file."},
+	{"first_block_seconds", "Time from the start of a transfer to its first block."},
+};
+
+/** Append the latency summary of a transfer */
+static void append_lat_samples(GString *out, const char *name, const METRICS_SNAP *sn, const METRICS_LAT_SNAP *ls) {
+	guint q;
+	for (q= 0; q < N_QUANTILES; q++) {
+		g_string_append_printf(out, "fmcast_%s{tid=\"%u\",file=\"", name, sn->tid);
+		append_label(out, sn->fname);
+		g_string_append_printf(out, "\",quantile=\"%g\"} %.9f\n", quantiles[q], ls->q[q] / 1e9);
+	}
+	g_string_append_printf(out, "fmcast_%s_sum{tid=\"%u\",file=\"", name, sn->tid);
+	append_label(out, sn->fname);
+	g_string_append_printf(out, "\"} %.9f\n", ls->sum / 1e9);
+	g_string_append_printf(out, "fmcast_%s_count{tid=\"%u\",file=\"", name, sn->tid);
+	append_label(out, sn->fname);
+	g_string_append_printf(out, "\"} %lld\n", ls->n);
+}
+
+#define COUNTER(s, c)	(*(const long long *)((const char *)(s) + (c)->offset))
+
+
+/** Format every metric in 'out' */
+static void format_metrics(GString *out) {
+	GArray *arr= g_array_new(FALSE, FALSE, sizeof(METRICS_SNAP));
+	METRICS_SCAN scan= {arr, (LAT_HIST *)calloc(N_LAT, sizeof(LAT_HIST))};
+	TRANSFER_STATS tot;
+	TASKPOOL_STATS ts;
+	long long drops, outstanding= 0;
+	double goodput= 0;
+	guint i, q;
+	size_t c;
+	int l;
+
+	if (scan.lat == NULL) {
+		g_array_free(arr, TRUE);
+		return;
+	}
+	// Global totals: the transfers that ended plus the running ones
+	pthread_rwlock_wrlock(&fold_lock);
+	for (l= 0; l < N_LAT; l++)
+		hist_merge(&scan.lat[l], &ended_lat[l]);
+	registry_foreach(snap_transfer, &scan);
+	drops= __atomic_load_n(&ended_drops, __ATOMIC_RELAXED);
+	memset(&tot, 0, sizeof(tot));
+	for (c= 0; c < N_COUNTERS; c++)
+		*(long long *)((char *)&tot + counters[c].offset)= __atomic_load_n(
+				(long long *)((char *)&ended + counters[c].offset), __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&fold_lock);
+	for (i= 0; i < arr->len; i++) {
+		METRICS_SNAP *sn= &g_array_index(arr, METRICS_SNAP, i);
+		for (c= 0; c < N_COUNTERS; c++)
+			*(long long *)((char *)&tot + counters[c].offset)+= COUNTER(&sn->s, &counters[c]);
+		drops+= sn->drops;
+		outstanding+= sn->outstanding;
+		goodput+= sn->s.goodput;
+	}
+
+	for (c= 0; c < N_COUNTERS; c++) {
+		char name[64];
+		append_header(out, counters[c].name, "counter", counters[c].help);
+		g_string_append_printf(out, "fmcast_%s %lld\n", counters[c].name, COUNTER(&tot, &counters[c]));
+		snprintf(name, sizeof(name), "transfer_%s", counters[c].name);
+		append_header(out, name, "counter", counters[c].help);
+		for (i= 0; i < arr->len; i++) {
+			METRICS_SNAP *sn= &g_array_index(arr, METRICS_SNAP, i);
+			append_sample(out, name, sn, COUNTER(&sn->s, &counters[c]));
+		}
+	}
+
+	append_header(out, "socket_drops_total", "counter", "Datagrams dropped by the multicast sockets.");
+	g_string_append_printf(out, "fmcast_socket_drops_total %lld\n", drops);
+	append_header(out, "transfer_socket_drops_total", "counter", "Datagrams dropped by the multicast socket.");
+	for (i= 0; i < arr->len; i++) {
+		METRICS_SNAP *sn= &g_array_index(arr, METRICS_SNAP, i);
+		append_sample(out, "transfer_socket_drops_total", sn, sn->drops);
+	}
+
+	for (l= 0; l < N_LAT; l++) {
+		char name[64];
+		append_header(out, lats[l].name, "summary", lats[l].help);
+		for (q= 0; q < N_QUANTILES; q++)
+			g_string_append_printf(out, "fmcast_%s{quantile=\"%g\"} %.9f\n", lats[l].name, quantiles[q],
+					hist_percentile(&scan.lat[l], quantiles[q] * 100) / 1e9);
+		g_string_append_printf(out, "fmcast_%s_sum %.9f\nfmcast_%s_count %lld\n", lats[l].name,
+				scan.lat[l].sum / 1e9, lats[l].name, scan.lat[l].n);
+		snprintf(name, sizeof(name), "transfer_%s", lats[l].name);
+		append_header(out, name, "summary", lats[l].help);
+		for (i= 0; i < arr->len; i++) {
+			METRICS_SNAP *sn= &g_array_index(arr, METRICS_SNAP, i);
+			append_lat_samples(out, name, sn, &sn->lat[l]);
+		}
+	}
+
+	append_header(out, "goodput_bytes_per_second", "gauge", "Bytes written to the files per second.");
+	g_string_append_printf(out, "fmcast_goodput_bytes_per_second %.17g\n", goodput);
+	append_header(out, "transfer_goodput_bytes_per_second", "gauge", "Bytes written to the file per second.");
+	for (i= 0; i < arr->len; i++) {
+		METRICS_SNAP *sn= &g_array_index(arr, METRICS_SNAP, i);
+		append_sample(out, "transfer_goodput_bytes_per_second", sn, sn->s.goodput);
+	}
+
+	append_header(out, "blocks_outstanding", "gauge", "Blocks not received yet.");
+	g_string_append_printf(out, "fmcast_blocks_outstanding %lld\n", outstanding);
+	append_header(out, "transfer_blocks_outstanding", "gauge", "Blocks not received yet.");
+	for (i= 0; i < arr->len; i++) {
+		METRICS_SNAP *sn= &g_array_index(arr, METRICS_SNAP, i);
+		append_sample(out, "transfer_blocks_outstanding", sn, sn->outstanding);
+	}
+
+	append_header(out, "transfer_time_to_complete_seconds", "gauge",
+			"Time to receive the outstanding blocks at the current goodput (NaN if unknown).");
+	for (i= 0; i < arr->len; i++) {
+		METRICS_SNAP *sn= &g_array_index(arr, METRICS_SNAP, i);
+		double ttc= (sn->s.goodput > 0) ? sn->outstanding * (double)sn->block_size / sn->s.goodput : NAN;
+		append_sample(out, "transfer_time_to_complete_seconds", sn, ttc);
+	}
+
+	// The latency summaries above are compared between runs with and without busy polling
+	append_header(out, "busy_poll_microseconds", "gauge", "Time spinning on the multicast socket before blocking (0= off).");
+	g_string_append_printf(out, "fmcast_busy_poll_microseconds %d\n", receiver_busy_poll);
+
+	append_header(out, "transfers_active", "gauge", "Transfers running.");
+	g_string_append_printf(out, "fmcast_transfers_active %u\n", arr->len);
+	append_header(out, "transfers_queued", "gauge", "Requests waiting in the scheduler.");
+	g_string_append_printf(out, "fmcast_transfers_queued %d\n", sched_pending());
+	append_header(out, "transfers_completed_total", "counter", "Transfers that received every block.");
+	g_string_append_printf(out, "fmcast_transfers_completed_total %lld\n", __atomic_load_n(&n_completed, __ATOMIC_RELAXED));
+	append_header(out, "transfers_failed_total", "counter", "Transfers stopped before the end.");
+	g_string_append_printf(out, "fmcast_transfers_failed_total %lld\n", __atomic_load_n(&n_failed, __ATOMIC_RELAXED));
+
+	taskpool_stats(&ts);
+	append_header(out, "taskpool_threads", "gauge", "Task pool threads running the per-block work.");
+	g_string_append_printf(out, "fmcast_taskpool_threads %d\n", ts.threads);
+	append_header(out, "taskpool_groups", "gauge", "Transfers with block tasks queued or running.");
+	g_string_append_printf(out, "fmcast_taskpool_groups %d\n", ts.groups);
+	append_header(out, "taskpool_queue_depth", "gauge", "Block tasks queued.");
+	g_string_append_printf(out, "fmcast_taskpool_queue_depth %lld\n", ts.depth);
+	append_header(out, "taskpool_queue_depth_max", "gauge", "Most block tasks queued at one time.");
+	g_string_append_printf(out, "fmcast_taskpool_queue_depth_max %lld\n", ts.max_depth);
+	append_header(out, "taskpool_tasks_total", "counter", "Block tasks run by the pool.");
+	g_string_append_printf(out, "fmcast_taskpool_tasks_total %lld\n", ts.run);
+	append_header(out, "taskpool_steals_total", "counter", "Block tasks taken from the queue of another pool thread.");
+	g_string_append_printf(out, "fmcast_taskpool_steals_total %lld\n", ts.steals);
+	append_header(out, "taskpool_refused_total", "counter",
+			"Block tasks refused (queue full or transfer above its share) and run by the receive thread.");
+	g_string_append_printf(out, "fmcast_taskpool_refused_total %lld\n", ts.refused);
+
+	g_array_free(arr, TRUE);
+	free(scan.lat);
+}
+
+
+/** Answer one HTTP request on socket 's' */
+static void serve_client(int s) {
+	char req[1024];
+	struct timeval tv= {1, 0};
+	int n;
+
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if ((n= recv(s, req, sizeof(req) - 1, 0)) <= 0)
+		return;
+	req[n]= '\0';
+
+	GString *body= g_string_new(NULL);
+	const char *status= "200 OK";
+	if (!strncmp(req, "GET /metrics ", 13) || !strncmp(req, "GET / ", 6))
+		format_metrics(body);
+	else {
+		status= "404 Not Found";
+		g_string_append(body, "Not found; try /metrics\n");
+	}
+	GString *out= g_string_new(NULL);
+	g_string_append_printf(out, "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %lu\r\nConnection: close\r\n\r\n", status, (unsigned long)body->len);
+	g_string_append_len(out, body->str, body->len);
+	const char *pt= out->str;
+	size_t left= out->len;
+	while (left > 0) {
+		ssize_t w= send(s, pt, left, MSG_NOSIGNAL);
+		if (w <= 0)
+			break;
+		pt+= w;
+		left-= w;
+	}
+	g_string_free(out, TRUE);
+	g_string_free(body, TRUE);
+}
+
+
+/** Metrics thread: serves the requests one at a time */
+static void *metrics_thread_function(void *ptr) {
+	while (!metrics_quit) {
+		int s= accept(ms, NULL, NULL);
+		if (s < 0) {
+			if (!metrics_quit)
+				perror("MET> accept");
+			continue;
+		}
+		serve_client(s);
+		close(s);
+	}
+	return NULL;
+}
+
+
+/** Start the HTTP listener on 127.0.0.1:'port'; returns FALSE on error */
+gboolean metrics_start(int port) {
+	struct sockaddr_in addr;
+	int on= 1;
+
+	if (metrics_running)
+		return TRUE;
+	if ((ms= socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("MET> socket");
+		return FALSE;
+	}
+	setsockopt(ms, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family= AF_INET;
+	addr.sin_port= htons(port);
+	addr.sin_addr.s_addr= htonl(INADDR_LOOPBACK);	// Not reachable from other hosts
+	if ((bind(ms, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(ms, 8) < 0)) {
+		perror("MET> bind/listen");
+		close(ms);
+		ms= -1;
+		return FALSE;
+	}
+	metrics_quit= FALSE;
+	if (pthread_create(&metrics_tid, NULL, metrics_thread_function, NULL)) {
+		perror("MET> pthread_create");
+		close(ms);
+		ms= -1;
+		return FALSE;
+	}
+	metrics_running= TRUE;
+	fprintf(stdout, "MET> metrics at http://127.0.0.1:%d/metrics\n", port);
+	return TRUE;
+}
+
+
+/** Stop the HTTP listener */
+void metrics_stop(void) {
+	if (!metrics_running)
+		return;
+	metrics_quit= TRUE;
+	shutdown(ms, SHUT_RDWR);	// Wakes the thread blocked in accept
+	pthread_join(metrics_tid, NULL);
+	close(ms);
+	ms= -1;
+	metrics_running= FALSE;
+}
@@ -0,0 +1,90 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * metrics.h
+ *
+ * Header file of the metrics endpoint: per-transfer counters, updated by the
+ *   receive threads with relaxed atomics, and an HTTP listener on localhost
+ *   that exposes them in the Prometheus text format
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_METRICS_H
+#define HAVE_METRICS_H
+
+#include <glib.h>
+#include "hist.h"
+
+struct ReceiverTh;
+
+// Minimum interval (ms) between two goodput samples of one transfer
+#define METRICS_RATE_MS		1000
+
+// Counters of one transfer; the receive threads only add to them
+typedef struct TRANSFER_STATS {
+	long long pkts;			// DATA packets received
+	long long bytes;		// Bytes of the DATA packets received
+	long long dups;			// DATA packets with blocks already received
+	long long invalid;		// DATA packets with invalid sequence numbers or lengths
+	long long srrs;			// SRR packets sent
+	long long zbytes;		// Bytes of the compressed blocks after decompression
+	long long tail_blocks;	// DATA records received on the TCP connection (tail repair)
+	long long busy_pkts;	// Datagrams read while busy polling (receiver_busy_poll)
+	gint64 start_us;		// Start time (monotonic us)
+	// Goodput samples; only used by the metrics thread
+	long long rate_bytes;	// Bytes written at the last sample
+	gint64 rate_us;			// Time of the last sample
+	double goodput;			// Bytes/s between the last two samples
+} TRANSFER_STATS;
+
+/* Latency histograms of a transfer */
+#define LAT_GAP			0	// Time between two DATA packets
+#define LAT_REPAIR		1	// From the detection of a loss to the arrival of the missing block
+#define LAT_WRITE		2	// From the arrival of a new block to its write (after decompression, if any)
+#define LAT_FIRST		3	// From the start of the transfer to the first block (one value)
+#define N_LAT			4
+
+// Losses remembered to measure the repair time; older ones are forgotten
+#define LAT_GAPS		256
+
+// Range of blocks found missing when a later block arrived
+typedef struct LOSS_GAP {
+	long long lo, hi;		// First and last block missing
+	long long t;			// Detection time (monotonic ns)
+} LOSS_GAP;
+
+// Latencies of one transfer; recorded by the receive threads
+typedef struct TRANSFER_LAT {
+	LAT_HIST h[N_LAT];
+	long long last_ns;		// Arrival of the last DATA packet (monotonic ns)
+	long long max_seq;		// Highest block received
+	int first;				// Set when the first block arrived
+	// Ring of the gaps, sorted by block; guarded by gap_lock
+	char gap_lock;
+	LOSS_GAP gaps[LAT_GAPS];
+	int gap_head, gap_n;
+} TRANSFER_LAT;
+
+// Add 'v' to a counter
+#define STAT_ADD(t, field, v)	__atomic_add_fetch(&(t)->stats.field, (v), __ATOMIC_RELAXED)
+
+// Reset the counters of a new transfer
+void metrics_init_stats(TRANSFER_STATS *s);
+// Reset the latencies of a new transfer
+void metrics_init_lat(TRANSFER_LAT *l);
+// Record the arrival of a DATA packet at 'now' (monotonic ns)
+void metrics_packet(TRANSFER_LAT *l, long long now);
+// Record the arrival of new block 'seq' of the transfer started at 'start_us' (monotonic us)
+void metrics_new_block(TRANSFER_LAT *l, long long seq, long long now, gint64 start_us);
+// Write the latency summary of a transfer to 'buf'
+void metrics_lat_summary(const TRANSFER_LAT *l, char *buf, int len);
+// Remove a transfer that ended from the registry and add its counters and latencies, and the datagrams its
+//   sockets dropped, to the global totals, as one step for the scrapes
+void metrics_transfer_ended(struct ReceiverTh *t, long long drops, gboolean completed);
+// Start the HTTP listener on 127.0.0.1:'port'; returns FALSE on error
+gboolean metrics_start(int port);
+// Stop the HTTP listener
+void metrics_stop(void);
+
+#endif
@@ -0,0 +1,66 @@
+#!/bin/sh
+#/*****************************************************************************\
+# * Redes Integradas de Telecomunicacoes
+# * MIEEC / MEEC / MERSIM - FCT NOVA  2025/2026
+# *
+# * perf.sh
+# *
+# * Sweep of fmperf runs (loopback sender and headless receiver); one CSV row
+# *   per run in PERF_OUT. The lists can be set in the environment; PERF_FULL=1
+# *   sweeps the whole range (up to 10 GB files and 256 transfers), which needs
+# *   several hours and free disk space for PERF_MAX_BYTES
+# *
+# * @author  Luis Bernardo
+#\*****************************************************************************/
+
+if [ -n "$PERF_FULL" ]; then
+	SIZES=${SIZES:-"1M 100M 1G 10G"}
+	BLOCKS=${BLOCKS:-"512 1400 4096 8192"}
+	LOSSES=${LOSSES:-"0 1 5 10"}
+	TRANSFERS=${TRANSFERS:-"1 16 64 256"}
+	PERF_MAX_BYTES=${PERF_MAX_BYTES:-10G}
+else
+	SIZES=${SIZES:-"1M 16M"}
+	BLOCKS=${BLOCKS:-"512 1400 8192"}
+	LOSSES=${LOSSES:-"0 1 10"}
+	TRANSFERS=${TRANSFERS:-"1 16"}
+	PERF_MAX_BYTES=${PERF_MAX_BYTES:-1G}
+fi
+PERF_RATE=${PERF_RATE:-1000}
+PERF_OUT=${PERF_OUT:-perf.csv}
+FMPERF=${FMPERF:-./fmperf}
+
+# "10G" -> bytes
+bytes() {
+	case $1 in
+	*K|*k) echo $(( ${1%?} * 1024 )) ;;
+	*M|*m) echo $(( ${1%?} * 1048576 )) ;;
+	*G|*g) echo $(( ${1%?} * 1073741824 )) ;;
+	*) echo $1 ;;
+	esac
+}
+
+max=$(bytes $PERF_MAX_BYTES)
+$FMPERF -H > $PERF_OUT || exit 1
+cat $PERF_OUT
+failed=0
+row=$(mktemp) || exit 1
+trap 'rm -f $row' EXIT
+for n in $TRANSFERS; do
+	for z in $SIZES; do
+		if [ $(( $(bytes $z) * n )) -gt $max ]; then
+			echo "# skipped $n x $z (above PERF_MAX_BYTES= $PERF_MAX_BYTES)" >&2
+			continue
+		fi
+		for b in $BLOCKS; do
+			for l in $LOSSES; do
+				# fmperf's own status; after a pipe, $? would be the status of the last command
+				$FMPERF -n $n -z $z -b $b -l $l -r $PERF_RATE $PERF_ARGS > $row || failed=1
+				cat $row
+				cat $row >> $PERF_OUT
+			done
+		done
+	done
+done
+echo "# results in $PERF_OUT" >&2
+exit $failed
@@ -0,0 +1,114 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * pktpool.c
+ *
+ * Functions that handle PKT_POOLs: fixed-size, cache-line aligned packet
+ * buffers, allocated once per receive thread and recycled without malloc/free
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#include "pktpool.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+
+/** Initialize an empty pool descriptor */
+void pkt_pool_empty(PKT_POOL *pool) {
+	assert(pool != NULL);
+	pool->free = pool->returned = NULL;
+	pool->bufs = NULL;
+	pool->mem = NULL;
+	pool->mem_len = 0;
+	pool->slot_size = pool->n_slots = 0;
+	pool->huge = FALSE;
+}
+
+/** Create a pool with n_slots slots holding up to 'size' bytes each */
+gboolean pkt_pool_init(PKT_POOL *pool, int n_slots, int size, gboolean hugepages) {
+	int i;
+	assert(pool != NULL);
+	assert((n_slots > 0) && (size > 0));
+	pkt_pool_empty(pool);
+	pool->slot_size = ((size + PKT_SLOT_ALIGN - 1) / PKT_SLOT_ALIGN) * PKT_SLOT_ALIGN;
+	pool->n_slots = n_slots;
+	pool->mem_len = (size_t) pool->slot_size * n_slots;
+	if (hugepages) {
+		size_t len = ((pool->mem_len + PKT_HUGEPAGE - 1) / PKT_HUGEPAGE) * PKT_HUGEPAGE;
+		void *pt = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (pt != MAP_FAILED) {
+			pool->mem = (char *) pt;
+			pool->mem_len = len;
+			pool->huge = TRUE;
+		} else {
+			perror("hugepage packet pool (using normal pages)");
+		}
+	}
+	if (pool->mem == NULL)
+		pool->mem = (char *) aligned_alloc(PKT_SLOT_ALIGN, pool->mem_len);
+	pool->bufs = (PKT_BUF *) calloc(n_slots, sizeof(PKT_BUF));
+	if ((pool->mem == NULL) || (pool->bufs == NULL)) {
+		pkt_pool_free(pool);
+		return FALSE;
+	}
+	for (i = n_slots - 1; i >= 0; i--) {
+		pool->bufs[i].pool = pool;
+		pool->bufs[i].data = pool->mem + (size_t) i * pool->slot_size;
+		pool->bufs[i].next = pool->free;
+		pool->free = &pool->bufs[i];
+	}
+	return TRUE;
+}
+
+/** Free the pool's memory */
+void pkt_pool_free(PKT_POOL *pool) {
+	assert(pool != NULL);
+	if (pool->mem != NULL) {
+		if (pool->huge)
+			munmap(pool->mem, pool->mem_len);
+		else
+			free(pool->mem);
+	}
+	if (pool->bufs != NULL)
+		free(pool->bufs);
+	pkt_pool_empty(pool);
+}
+
+/** Get a free buffer with one reference; owner thread only */
+PKT_BUF *pkt_get(PKT_POOL *pool) {
+	assert(pool != NULL);
+	if (pool->free == NULL)
+		// Take every buffer released by the other threads at once; no ABA problem
+		pool->free = __atomic_exchange_n(&pool->returned, NULL, __ATOMIC_ACQUIRE);
+	PKT_BUF *b = pool->free;
+	if (b == NULL)
+		return NULL;
+	pool->free = b->next;
+	b->next = NULL;
+	b->refcnt = 1;
+	b->len = 0;
+	return b;
+}
+
+/** Add a reference to a buffer handed to another stage */
+void pkt_ref(PKT_BUF *b) {
+	assert((b != NULL) && (b->refcnt > 0));
+	__atomic_add_fetch(&b->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+/** Drop a reference; the last one pushes the buffer onto its pool's return stack */
+void pkt_put(PKT_BUF *b) {
+	assert((b != NULL) && (b->refcnt > 0));
+	if (__atomic_sub_fetch(&b->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	PKT_POOL *pool = b->pool;
+	PKT_BUF *head = __atomic_load_n(&pool->returned, __ATOMIC_RELAXED);
+	do {
+		b->next = head;
+	} while (!__atomic_compare_exchange_n(&pool->returned, &head, b, TRUE,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,64 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * pktpool.h
+ *
+ * Header file for type PKT_POOL, a per-thread pool of fixed-size packet buffers
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_PKTPOOL_H
+#define HAVE_PKTPOOL_H
+
+#include <glib.h>
+#include <pthread.h>
+
+// Slots start on cache-line boundaries
+#define PKT_SLOT_ALIGN	64
+// Hugepage size used when the pool is hugepage-backed
+#define PKT_HUGEPAGE	(2 * 1024 * 1024)
+
+struct PKT_POOL;
+
+// Packet buffer - one pool slot
+typedef struct PKT_BUF {
+	struct PKT_BUF *next;		// Free list link
+	struct PKT_POOL *pool;		// Pool that owns the slot
+	int refcnt;					// References held by the pipeline stages
+	int len;					// Bytes used in 'data'
+	char *data;					// Slot memory
+} PKT_BUF;
+
+// Definition of PKT_POOL type
+typedef struct PKT_POOL {
+	PKT_BUF *free;				// Free slots; only used by the owner thread
+	PKT_BUF *returned;			// Slots released by other threads (lock-free stack)
+	PKT_BUF *bufs;				// Slot descriptors
+	char *mem;					// Slot memory
+	size_t mem_len;				// Slot memory length
+	int slot_size;				// Slot length, multiple of PKT_SLOT_ALIGN
+	int n_slots;				// Number of slots
+	gboolean huge;				// TRUE if 'mem' is a hugepage mapping
+} PKT_POOL;
+
+
+// Create a pool with n_slots slots holding up to 'size' bytes each; uses hugepages if requested and available
+gboolean pkt_pool_init(PKT_POOL *pool, int n_slots, int size, gboolean hugepages);
+
+// Initialize an empty pool descriptor
+void pkt_pool_empty(PKT_POOL *pool);
+
+// Free the pool's memory; all buffers must have been released
+void pkt_pool_free(PKT_POOL *pool);
+
+// Get a free buffer with one reference; owner thread only. Returns NULL if the pool is exhausted
+PKT_BUF *pkt_get(PKT_POOL *pool);
+
+// Add a reference to a buffer handed to another stage
+void pkt_ref(PKT_BUF *b);
+
+// Drop a reference; the last one returns the buffer to its pool. Any thread may call it
+void pkt_put(PKT_BUF *b);
+
+#endif
@@ -9,8 +9,15 @@
  * @author  Luis Bernardo
 \*****************************************************************************/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		// pthread_setaffinity_np
+#endif
+#include <stdio.h>
 #include <assert.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/wait.h>
@@ -21,19 +28,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
 #include "sock.h"
-#include "gui.h"
 #include "bitmask.h"
-#include "callbacks.h"
+#include "engine.h"
 #include "receiver_th.h"
 #include "file.h"
+#include "logger.h"
+#include "workers.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "transport.h"
+#include "decomp.h"
 
 
-// Active receiver list
-GList *rcv_list = NULL;
+// Active receivers are kept in the registry (registry.c)
 // thread static counter
 static int rcv_count= 0;
 
+static void stop_rx_threads(ReceiverTh *t);
+
 // Disable DEBUG in this module
 //#ifdef DEBUG
 //#undef DEBUG
@@ -53,18 +68,45 @@ void debugstr(const char *str) {
 |* Functions that handle file reception *|
  \***************************************/
 
-// Mutex to synchronize changes to file transfer lists
+// Mutex that serializes the receivers' teardown; lookups use the registry's locks
 pthread_mutex_t rmutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Result of processing one multicast packet (also stored in ReceiverTh.done)
+#define RX_CONTINUE	0	// Keep receiving
+#define RX_STOP		1	// Session stopped (STOP packet or error)
+#define RX_DONE		2	// All blocks were received
+
+// Tail repair (ReceiverTh.tail): the last missing blocks are asked on the TCP connection
+#define TAIL_OFF	0	// Repairs through multicast SRRs
+#define TAIL_ON		1	// PKT_TAIL sent; the SRRs stop
+#define TAIL_FAILED	2	// The sender did not answer; back to the SRRs
+#define TAIL_ENABLED	(receiver_send_caps && (receiver_tail_blocks > 0))
+
+// ReceiverTh.saddr_def while a receive thread writes the sender's address (FALSE before, TRUE after)
+#define SADDR_CLAIMED	2
+// The sender's address can be read
+#define SADDR_KNOWN(t)	(__atomic_load_n(&(t)->saddr_def, __ATOMIC_ACQUIRE) == TRUE)
+
+// Interval (ms) between the checks of the loss in a layered session (STRIPE_LAYERS)
+#define LAYER_INTERVAL_MS	500
+// Packets needed in one interval to decide on the loss
+#define LAYER_MIN_PKTS		20
+// Initial and longest wait (ms) before joining a layer again; doubled when a join fails
+#define LAYER_JOIN_MS		1000
+#define LAYER_JOIN_MAX_MS	32000
+// Time (ms) after a join during which loss is blamed on the new layer (the first check after
+//   a join comes two intervals later)
+#define LAYER_DETECT_MS		(3 * LAYER_INTERVAL_MS)
+
 
 #ifdef DEBUG
 #define LOCK_MUTEX(mutex,str) { \
-			pthread_mutex_lock( mutex ); \
+			trace_mutex_lock( mutex ); \
 			fprintf(stdout,"l %s", str); \
 		}
 #else
 #define LOCK_MUTEX(mutex,str) { \
-			pthread_mutex_lock( mutex ); \
+			trace_mutex_lock( mutex ); \
 		}
 #endif
 
@@ -92,25 +134,43 @@ void free_receiverTh(ReceiverTh *t, gboolean lock, gboolean lock_gdb) {
 #endif
 	t->active= FALSE;
 	t->self = NULL;
+	// The extra receive threads and the block tasks still count blocks and bytes:
+	// they finish before the counters are folded into the totals
+	stop_rx_threads(t);
+	engine_end_transfer(t->reg_tid, t->done == RX_DONE);
 	if (lock)
 		LOCK_MUTEX(&rmutex, "lock_r0\n");
-	rcv_list = g_list_remove(rcv_list, t);
+	// Leaves the registry and adds its counters to the totals in one step for the scrapes
+	metrics_transfer_ended(t, receiver_socket_drops(t), t->done == RX_DONE);
 	if (lock)
 		UNLOCK_MUTEX(&rmutex, "lock_r0\n");
+	sched_release(t);	// Frees the slot for the next queued transfer
 
 	if (t->tid > 0) {
-		GUI_del_Ftrans(t->tid, lock_gdb); // Deletes the thread entry in the window
+		engine_del_transfer(t->tid, lock_gdb); // Deletes the thread entry in the window
 		t->tid = 0;
 	}
 
 	if (t->st > -1) {
-		close(t->st);
+		tp.close(t->st);
 		t->st = -1;
 	}
 	if (t->sm > -1) {
-		close(t->sm);
+		tp.close(t->sm);
 		t->sm = -1;
 	}
+	for (int i = 1; i < MAX_STRIPES; i++) {
+		if (t->stripe[i].fd > -1) {
+			tp.close(t->stripe[i].fd);
+			t->stripe[i].fd = -1;
+		}
+	}
+	ring_close(&t->ring);
+	if (t->tail_pb != NULL) {
+		pkt_put(t->tail_pb);
+		t->tail_pb = NULL;
+	}
+	pkt_pool_free(&t->pool);
 	if (t->sf != NULL) {
 		fclose(t->sf);
 		t->sf = NULL;
@@ -122,7 +182,7 @@ void free_receiverTh(ReceiverTh *t, gboolean lock, gboolean lock_gdb) {
 
 
 // writes to socket s and warns about errors writing
-#define WARN_WRITE(s, var, size)	if (write(s,var,size)!=size) perror("Error in write to TCP socket")
+#define WARN_WRITE(s, var, size)	if (tp.send(s,var,size,0)!=size) perror("Error in write to TCP socket")
 
 
 /** Function that stops a thread in a orderly way (sending EXIT message, deleting the file) */
@@ -143,10 +203,11 @@ void sstop_thread(ReceiverTh *t, gboolean send_exit, gboolean delete_file, gbool
 	// Anticipates flag and window changes
 	t->active= FALSE;
 	if (t->tid > 0) {
-		GUI_del_Ftrans(t->tid, lock_gdb); // Deletes the thread entry in the window
+		engine_del_transfer(t->tid, lock_gdb); // Deletes the thread entry in the window
 		t->tid = 0;
 	}
 
+	stop_rx_threads(t);
 	if (send_exit) {
 		send_EXIT(t, t->sid, t->cid);
 	}
@@ -169,15 +230,18 @@ void sstop_thread(ReceiverTh *t, gboolean send_exit, gboolean delete_file, gbool
 
 /** Stop one Receiver by tid */
 void stop_receiver_by_tid(unsigned tid, gboolean lock_gdk) {
-	ReceiverTh *r= locate_receiverTh(tid, lock_gdk);
+	// Holding rmutex, the receiver cannot be freed between the lookup and the stop
+	LOCK_MUTEX(&rmutex, "lock_r1a\n");
+	ReceiverTh *r= registry_lookup(tid);
 	if (r != NULL) {
 #ifdef DEBUG
 		fprintf(stdout, "receiver(%u) stopped\n", tid);
 #endif
-		sstop_thread(r, TRUE, TRUE, TRUE, lock_gdk);
+		sstop_thread(r, TRUE, TRUE, FALSE, lock_gdk);
 	} else {
 		debugstr("Invalid tid in stop_receiver_by_tid\n");
 	}
+	UNLOCK_MUTEX(&rmutex, "lock_r1a\n");
 }
 
 
@@ -186,10 +250,9 @@ void stop_receivers(gboolean lock_gdb) {
 #ifdef DEBUG
 		fprintf(stdout, "stop_receivers()\n");
 #endif
+	ReceiverTh *r;
 	LOCK_MUTEX(&rmutex, "lock_r1b\n");
-	while (rcv_list != NULL) {
-		assert(rcv_list->data != NULL);
-		ReceiverTh *r= (ReceiverTh *) rcv_list->data;
+	while ((r= registry_any()) != NULL) {
 		sstop_thread(r, TRUE, TRUE, FALSE, lock_gdb);
 	}
 	UNLOCK_MUTEX(&rmutex, "lock_r1b\n");
@@ -198,21 +261,32 @@ void stop_receivers(gboolean lock_gdb) {
 
 /** Locate a Receiver identified by a pid */
 ReceiverTh *locate_receiverTh(unsigned tid, gboolean lock) {
-	LOCK_MUTEX(&rmutex, "lock_r2a\n");
-	GList *l = rcv_list;
-	for (l = rcv_list; l != NULL; l = g_list_next(l)) {
-		ReceiverTh *pt = (ReceiverTh *) l->data;
-		if (pt->self != pt) {
-			debugstr("Invalid pointer in locate_receiver\n");
-			continue;
-		}
-		if (((unsigned)pt->tid) == tid) {
-			UNLOCK_MUTEX(&rmutex, "lock_r2a\n");
-			return pt;
-		}
+	ReceiverTh *pt= registry_lookup(tid);
+	if ((pt != NULL) && (pt->self != pt)) {
+		debugstr("Invalid pointer in locate_receiver\n");
+		return NULL;
 	}
-	UNLOCK_MUTEX(&rmutex, "lock_r2a\n");
-	return NULL;
+	return pt;
+}
+
+
+/** Shows the progress of one transfer; the registry shard is read-locked */
+static void publish_progress(ReceiverTh *pt, gpointer data) {
+	if ((pt->self != pt) || !pt->active || (pt->tid == 0) || bitmask_isempty(&pt->bmask))
+		return;
+	long long got = __atomic_load_n(&pt->n_recv, __ATOMIC_RELAXED);
+	if (got != pt->shown_recv) {
+		engine_update_transfer(pt->tid, got, pt->bmask.b_len);
+		pt->shown_recv = got;
+	}
+}
+
+
+/** Show the progress of every transfer in the front end; called periodically by its main loop
+ *  (in the GUI, with the GDK lock). Reads the counters published by the receive threads without locking them.
+ *  The stopping receivers release the registry locks before taking the GDK lock */
+void publish_receivers_progress(void) {
+	registry_foreach(publish_progress, NULL);
 }
 
 
@@ -257,8 +331,9 @@ ReceiverTh *new_receiverTh_desc(const gchar *name, const gchar *ip, int port) {
 
 		//Log("new_receiverTh_desc incomplete - IPv4 not supported yet\n");
 	} else {
-		sprintf(tmp_buf, "Unknown destination '%s'\n", ip);
-		Log(tmp_buf);
+		char msg[200];	// Called from the workers and the scheduler: no shared buffers
+		snprintf(msg, sizeof(msg), "Unknown destination '%s'\n", ip);
+		engine_log(msg);
 		return NULL;
 	}
 
@@ -294,52 +369,95 @@ ReceiverTh *new_receiverTh_desc(const gchar *name, const gchar *ip, int port) {
 	r->cid = -1; // Client ID
 	r->sid = -1; // Session ID
 	new_empty_bitmask(&r->bmask);
+	r->block_size = 0;
+	r->n_recv = 0;
+	r->shown_recv = -1;
+	r->data_counter = 0;
+	r->blocks64 = FALSE;
+	r->srr_base = 0;
+	task_group_init(&r->tasks);
+	r->tail = TAIL_OFF;
+	r->tail_rounds = 0;
+	r->tail_asked = r->tail_rx = r->tail_seen = 0;
+	r->tail_pb = NULL;
+	r->tail_got = 0;
+	r->n_stripes = 1;
+	r->stripe_map = STRIPE_BLOCK_RR;
+	for (int i = 0; i < MAX_STRIPES; i++) {
+		r->stripe[i].fd = -1;
+		r->stripe[i].last_seq = -1;
+		r->stripe[i].join_ms = LAYER_JOIN_MS;
+	}
+	r->n_layers = 1;
+	r->done = 0;
+	r->n_rx = 0;
+	r->wake[0] = r->wake[1] = -1;
+	ring_init(&r->ring);
+	pkt_pool_empty(&r->pool);
 
 	// r->DATA_cnt = 0; // Received DATA packet's counter since last SRR
 	// r->SRR_cnt = 0; // SRR sent counter since last packet
 
+	r->reg_tid = 0;
+	memset(&r->skey, 0, sizeof(r->skey));
+	r->skey_bound = FALSE;
+	r->sched_weight = 0;
+	r->sched_prefetch = FALSE;
+	metrics_init_stats(&r->stats);
+	metrics_init_lat(&r->lat);
+	r->trace_cnt = 0;
+
 	r->self = r;		// self-pointer, to validate receiver descriptor
 	r->active = FALSE;
-
-	rcv_list = g_list_append(rcv_list, r);
 	return r;
 }
 
 
 
 
-/** Log function for thread that send messages using the pipe */
+/** Log function for threads; the message is queued to the logger thread, so the
+ *  receivers never wait for the console or the GDK lock */
 void sLog(ReceiverTh *t, const char *s, gboolean togui) {
-	char stmp_buf[300];
 	assert(s != NULL);
 	assert((strlen(t->name_str)<=12) && (strlen(t->name_str)>7));
-	assert(strlen(s)<sizeof(stmp_buf));
-	sprintf(stmp_buf, "%s%s\n", t->name_str, s);
-	if (togui) {
-		// get GTK thread lock
-		gdk_threads_enter ();
-		Log(stmp_buf);
-		// release GTK thread lock
-		gdk_threads_leave ();
-	} else
-		fprintf(stdout, "%s", stmp_buf);
+	log_text(LOG_LVL_INFO, togui, t->name_str, s);
 }
 
 
+static LOG_SITE srr_site;	// Rate limit of the SRR log messages
+
 /** Function that sends a SRR to the sender */
 gboolean send_SRR(ReceiverTh *t, short int sid, short int cid) {
-	if (!t->saddr_def) {
+	if (!SADDR_KNOWN(t)) {
 		debugstr("FLAG saddr_def is FALSE\n");
 		return FALSE;
 	}
-	char buf[2000], *pt = buf;
+	char buf[MAX_MESSAGE_LEN], *pt = buf;
+	char msg[200];	// Called from every receive thread: no shared buffers
 	char type = PKT_SRR;
+	int hdr_len = sizeof(char) + 2 * sizeof(short int);
 
 	assert(!bitmask_isempty(&t->bmask));
-	WRITE_BUF(pt, &type, sizeof(char));
-	WRITE_BUF(pt, &t->sid, sizeof(t->sid));
-	WRITE_BUF(pt, &t->cid, sizeof(t->cid));
-	WRITE_BUF(pt, t->bmask.mask, t->bmask.B_len);
+	if (t->blocks64 || (hdr_len + t->bmask.B_len > sizeof(buf))) {
+		// Window of the bitmask starting at the first byte with missing blocks
+		long long base = first_unset_bit(&t->bmask, __atomic_load_n(&t->srr_base, __ATOMIC_RELAXED)) & ~7LL;
+		int w_len;
+		__atomic_store_n(&t->srr_base, base, __ATOMIC_RELAXED);
+		hdr_len += sizeof(long long) + sizeof(int);
+		w_len = (int) min(t->bmask.B_len - base / 8, (long long)(sizeof(buf) - hdr_len));
+		type = PKT_SRR64;
+		WRITE_BUF(pt, &type, sizeof(char));
+		WRITE_BUF(pt, &t->sid, sizeof(t->sid));
+		WRITE_BUF(pt, &t->cid, sizeof(t->cid));
+		WRITE_BUF(pt, &base, sizeof(base));
+		WRITE_BUF(pt, &w_len, sizeof(w_len));
+		WRITE_BUF(pt, t->bmask.mask + base / 8, w_len);
+	} else {
+		WRITE_BUF(pt, &type, sizeof(char));
+		WRITE_BUF(pt, &t->sid, sizeof(t->sid));
+		WRITE_BUF(pt, &t->cid, sizeof(t->cid));
+		WRITE_BUF(pt, t->bmask.mask, t->bmask.B_len);
+	}
 	int n= 0;
 	if (t->is_ipv4) {
 		// IPv4
@@ -363,44 +481,49 @@ gboolean send_SRR(ReceiverTh *t, short int sid, short int cid) {
 		addr4.sin_port = t->u.saddr4.sin_port;
 		addr4.sin_addr = t->u.saddr4.sin_addr;
 
-		n = sendto(t->sm, buf, pt - buf, 0, (struct sockaddr *)&addr4, sizeof(addr4));
+		n = tp.sendto(t->sm, buf, pt - buf, 0, (struct sockaddr *)&addr4, sizeof(addr4));
 
 
 
 
 	} else {
 		// IPv6
-		n= sendto(t->sm, buf, pt - buf, 0, (struct sockaddr *) &t->u.saddr6,
+		n= tp.sendto(t->sm, buf, pt - buf, 0, (struct sockaddr *) &t->u.saddr6,
 				sizeof(struct sockaddr_in6));
 	}
 
+	if (n == (pt - buf)) {
+		STAT_ADD(t, srrs, 1);
+		TRACE(TR_SRR, (type == PKT_SRR64) ? __atomic_load_n(&t->srr_base, __ATOMIC_RELAXED) : 0, pt - buf);
+	}
 	if (n != (pt - buf)){
 		perror("RCV>sendto(SRR)");
 	}
-	else {
+	else if ((LOG_LVL_DEBUG >= LOG_MIN_LEVEL) && log_site_allow(&srr_site, 10, LOG_LVL_DEBUG, t->name_str)) {
+		// Formatting the bitmask is expensive: at most 10 messages per second
 		if (t->is_ipv4) {
 			// IPv4
 			// TASK x - implement the missing code
 			// ...
-			sprintf(tmp_buf, "Sent SRR(SID=%hd,CID=%hd,M=%s) to %s-%d", t->sid, t->cid, bitmask_to_string(&t->bmask), addr_ipv4(&t->u.saddr4.sin_addr), (int) ntohs(t->u.saddr4.sin_port));
-			sLog(t, tmp_buf, FALSE);
+			sprintf(msg, "Sent SRR(SID=%hd,CID=%hd,M=%s) to %s-%d", t->sid, t->cid, bitmask_to_string(&t->bmask), addr_ipv4(&t->u.saddr4.sin_addr), (int) ntohs(t->u.saddr4.sin_port));
+			sLog(t, msg, FALSE);
 
 		} else {
 			// IPv6
-			sprintf(tmp_buf, "Sent SRR(SID=%hd,CID=%hd,M=%s) to %s-%d", t->sid, t->cid, bitmask_to_string(&t->bmask), addr_ipv6(&t->u.saddr6.sin6_addr), (int) ntohs(t->u.saddr6.sin6_port));
-			sLog(t, tmp_buf, FALSE);
+			sprintf(msg, "Sent SRR(SID=%hd,CID=%hd,M=%s) to %s-%d", t->sid, t->cid, bitmask_to_string(&t->bmask), addr_ipv6(&t->u.saddr6.sin6_addr), (int) ntohs(t->u.saddr6.sin6_port));
+			sLog(t, msg, FALSE);
 		}
 	}
-	printf("O n E IGUAL A %d", n);
 	return (n == (pt - buf));
 }
 
 
 /** Function that sends a SRR to the sender */
 gboolean send_EXIT(ReceiverTh *t, short int sid, short int cid) {
-	if (!t->saddr_def || (t->sm < -1))
+	if (!SADDR_KNOWN(t) || (t->sm < -1))
 		return FALSE;
 	char buf[10], *pt = buf;
+	char msg[200];
 	char type = PKT_EXIT;
 
 	WRITE_BUF(pt, &type, sizeof(char));
@@ -418,7 +541,7 @@ gboolean send_EXIT(ReceiverTh *t, short int sid, short int cid) {
 		addr4.sin_port = t->u.saddr4.sin_port;
 		addr4.sin_addr = t->u.saddr4.sin_addr;
 
-		n = sendto(t->sm, buf, pt - buf, 0, (struct sockaddr *)&addr4, sizeof(addr4));
+		n = tp.sendto(t->sm, buf, pt - buf, 0, (struct sockaddr *)&addr4, sizeof(addr4));
 		//Log("IPv4 not supported on send_SRR\n");
 		return FALSE;
 		//Log("IPv4 not supported on send_EXIT\n");
@@ -426,7 +549,7 @@ gboolean send_EXIT(ReceiverTh *t, short int sid, short int cid) {
 		//
 	} else {
 		// IPv6
-		n= sendto(t->sm, buf, pt - buf, 0, (struct sockaddr *) &t->u.saddr6,
+		n= tp.sendto(t->sm, buf, pt - buf, 0, (struct sockaddr *) &t->u.saddr6,
 				sizeof(struct sockaddr_in6));
 
 	}
@@ -437,15 +560,15 @@ gboolean send_EXIT(ReceiverTh *t, short int sid, short int cid) {
 			// IPv4
 			// TASK x - implement the missing code
 			// ...
-			sprintf(tmp_buf, "Sent EXIT(SID=%hd,CID=%hd,M=%s) to %s-%d", t->sid, t->cid,
-					bitmask_to_string(&t->bmask), inet_ntoa(t->u.saddr4.sin_addr),
+			sprintf(msg, "Sent EXIT(SID=%hd,CID=%hd,M=%s) to %s-%d", t->sid, t->cid,
+					bitmask_to_string(&t->bmask), addr_ipv4(&t->u.saddr4.sin_addr),
 					(int) ntohs(t->u.saddr4.sin_port));
-			sLog(t, tmp_buf, FALSE);
+			sLog(t, msg, FALSE);
 		} else {
 			// IPv6
-			sprintf(tmp_buf, "Sent EXIT(SID=%hd,CID=%hd) to %s-%d", t->sid, t->cid,
+			sprintf(msg, "Sent EXIT(SID=%hd,CID=%hd) to %s-%d", t->sid, t->cid,
 					addr_ipv6(&t->u.saddr6.sin6_addr), (int) ntohs(t->u.saddr6.sin6_port));
-			sLog(t, tmp_buf, FALSE);
+			sLog(t, msg, FALSE);
 		}
 	}
 	return (n == (pt - buf));
@@ -459,19 +582,991 @@ gboolean send_EXIT(ReceiverTh *t, short int sid, short int cid) {
 						}
 
 
+/********************************************************\
+|* Functions that drain the multicast socket (fan-out)  *|
+ \********************************************************/
+
+
+// Poll period of the extra receive threads, in miliseconds
+#define RX_POLL_TIMEOUT	100
+
+// Number of datagrams read by each recvmmsg call while busy-polling
+#define RX_BATCH		8
+
+// Length of the packet buffers of transfer 't': its longest DATA datagram (STOP packets are shorter)
+#define RX_SLOT_LEN(t)	((int)((t)->block_size + DATAZ_HDR_LEN))
+// Packet buffers per receive thread: a whole busy-poll batch and the next datagram
+#define POOL_SLOTS		max(receiver_pool_slots, RX_BATCH + 1)
+// Compressed blocks of one transfer waiting in the task pool; each holds a packet buffer,
+//   so a busy-poll batch and the next datagram always find free ones
+#define Z_INFLIGHT_MAX	(POOL_SLOTS - RX_BATCH - 1)
+
+
+/** Pin a thread to CPU 'cpu' (modulo the number of CPUs); does nothing if cpu < 0 */
+static void pin_thread(pthread_t th, int cpu) {
+	if (cpu < 0)
+		return;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu % (ncpu > 0 ? ncpu : 1), &set);
+	if (pthread_setaffinity_np(th, sizeof(set), &set))
+		fprintf(stderr, "RCV> failed to pin thread to CPU %d\n", cpu);
+}
+
+
+/** Count a DATA datagram of layer 'k': each layer sends the blocks in order, wrapping at the end,
+ *  so a jump in the sequence is the loss on the layer. Called by the layer's receive thread */
+static void count_layer(ReceiverTh *t, int k, const char *buf, int n) {
+	RX_STRIPE *s = &t->stripe[k];
+	long long seq, gap, b_len = t->bmask.b_len;
+	int seq32;
+
+	if ((buf[0] == PKT_DATA) && (n >= DATA_HDR_LEN)) {
+		memcpy(&seq32, buf + sizeof(char) + sizeof(short int), sizeof(seq32));
+		seq = seq32;
+	} else if (((buf[0] == PKT_DATA64) || (buf[0] == PKT_DATAZ)) && (n >= DATA64_HDR_LEN))
+		memcpy(&seq, buf + sizeof(char) + sizeof(short int), sizeof(seq));
+	else
+		return;
+	if ((seq < 0) || (seq >= b_len))
+		return;
+	if (s->last_seq >= 0) {
+		gap = (seq - s->last_seq - 1 + b_len) % b_len;
+		// A long jump is a reordering or the sender restarting the layer, not loss
+		if (gap <= b_len / 2)
+			__atomic_add_fetch(&s->lost, gap, __ATOMIC_RELAXED);
+	}
+	s->last_seq = seq;
+	__atomic_add_fetch(&s->rx, 1, __ATOMIC_RELAXED);
+}
+
+
+/** Save the sender's address 'from' of the first datagram. The receive threads race for it:
+ *  the first one claims the flag, writes the address, and only then marks it known */
+static void set_sender_addr(ReceiverTh *t, const void *from) {
+	gboolean unset = FALSE;
+	if ((__atomic_load_n(&t->saddr_def, __ATOMIC_RELAXED) != FALSE) ||
+			!__atomic_compare_exchange_n(&t->saddr_def, &unset, SADDR_CLAIMED, FALSE,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	if (t->is_ipv4)
+		memcpy(&t->u.saddr4, from, sizeof(struct sockaddr_in));
+	else
+		memcpy(&t->u.saddr6, from, sizeof(struct sockaddr_in6));
+	__atomic_store_n(&t->saddr_def, TRUE, __ATOMIC_RELEASE);
+}
+
+
+/** Read one datagram from multicast socket 'fd' (t->sm or a stripe) without blocking, and learn
+ *  the sender's address. Returns the datagram length, 0 if another receive thread took it, or -1 on error */
+static int recv_mcast_packet(ReceiverTh *t, int fd, char *buf, int buf_len) {
+	int n;
+	if (t->is_ipv4) {
+		struct sockaddr_in addrec;
+		socklen_t addrlen = sizeof(addrec);
+		n = tp.recvfrom(fd, buf, buf_len, MSG_DONTWAIT,
+					 (struct sockaddr *)&addrec, &addrlen);
+		if (n > 0)
+			set_sender_addr(t, &addrec);
+	} else {
+		struct sockaddr_in6 addrec6;
+		socklen_t addrlen6 = sizeof(addrec6);
+		n = tp.recvfrom(fd, buf, buf_len, MSG_DONTWAIT,
+					 (struct sockaddr *)&addrec6, &addrlen6);
+		if (n > 0)
+			set_sender_addr(t, &addrec6);
+	}
+	if (n < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+			return 0;
+		perror("RCV>recvfrom");
+		return -1;
+	}
+	if ((n > 0) && (t->stripe_map == STRIPE_LAYERS)) {
+		for (int k = 0; k < t->n_stripes; k++) {
+			if (fd == ((k == 0) ? t->sm : t->stripe[k].fd)) {
+				count_layer(t, k, buf, n);
+				break;
+			}
+		}
+	}
+	return n;
+}
+
+
+/** Discard the next datagram of multicast socket 'fd' when no packet buffer is free; the
+ *  SRRs repair its block. Returns -1 on error */
+static int drop_mcast_packet(ReceiverTh *t, int fd) {
+	char c;
+	if ((tp.recv(fd, &c, sizeof(c), MSG_DONTWAIT) < 0) &&
+			(errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+		perror("RCV>recv(drop)");
+		return -1;
+	}
+	LOG_RATE(LOG_LVL_WARN, 10, t->name_str, "no free packet buffer - datagram dropped", 0, 0, 0, 0);
+	return 0;
+}
+
+
+/** Write block 'seq' (len bytes of data) at its offset and count it; the threads write
+ *  disjoint blocks concurrently. 't0' is the arrival of its packet (LAT_WRITE starts there).
+ *  Returns FALSE if the write failed */
+static gboolean write_block(ReceiverTh *t, long long seq, const char *data, int len, long long t0) {
+	struct timespec w1;
+	// Every block but the last is block_size long, so the offset does not depend on len
+	off_t offset = (off_t) seq * t->block_size;
+
+	TRACE(TR_WRITE_BEGIN, seq, len);
+	if (pwrite(fileno(t->sf), data, len, offset) != len) {
+		perror("RCV>pwrite");
+		return FALSE;
+	}
+	tp.clock_gettime(CLOCK_MONOTONIC, &w1);
+	TRACE(TR_WRITE_END, seq, len);
+	hist_record(&t->lat.h[LAT_WRITE], w1.tv_sec * 1000000000LL + w1.tv_nsec - t0);
+	__atomic_add_fetch(&t->data_counter, 1, __ATOMIC_RELAXED);
+	// Counted after the write, so n_recv==b_len means every block is on disk.
+	// The GUI samples this counter (publish_receivers_progress); no GTK call here
+	__atomic_add_fetch(&t->n_recv, 1, __ATOMIC_ACQ_REL);
+	return TRUE;
+}
+
+
+// Output buffer of the blocks decompressed by each thread
+static pthread_key_t zbuf_key;
+static pthread_once_t zbuf_once = PTHREAD_ONCE_INIT;
+
+typedef struct ZBUF {
+	int len;
+	char data[];
+} ZBUF;
+
+static void zbuf_key_init(void) {
+	pthread_key_create(&zbuf_key, free);
+}
+
+
+/** Decompress block 'seq' of a PKT_DATAZ packet, which arrived at 't0', and write it at its
+ *  uncompressed offset. A corrupt block is marked missing again. Returns RX_CONTINUE or RX_STOP */
+static int store_zblock(ReceiverTh *t, long long seq, const char *data, int len, int orig_len, int codec,
+		long long t0) {
+	ZBUF *zb;
+	int n;
+
+	pthread_once(&zbuf_once, zbuf_key_init);
+	zb = (ZBUF *) pthread_getspecific(zbuf_key);
+	if ((zb == NULL) || (zb->len < t->block_size)) {
+		free(zb);
+		if ((zb = (ZBUF *) malloc(sizeof(ZBUF) + t->block_size)) == NULL) {
+			pthread_setspecific(zbuf_key, NULL);
+			perror("RCV>malloc");
+			return RX_STOP;
+		}
+		zb->len = t->block_size;
+		pthread_setspecific(zbuf_key, zb);
+	}
+	n = decomp_block(codec, data, len, zb->data, orig_len);
+	if (n != orig_len) {
+		atomic_unset_bit(&t->bmask, seq);
+		STAT_ADD(t, invalid, 1);
+		TRACE(TR_INVALID, seq, len);
+		LOG_RATE(LOG_LVL_WARN, 10, t->name_str, "Corrupt compressed block %ld (codec %ld)", seq, codec, 0, 0);
+		return RX_CONTINUE;
+	}
+	STAT_ADD(t, zbytes, n);
+	if (!write_block(t, seq, zb->data, n, t0)) {
+		sLog(t, "Error writing block to file", FALSE);
+		return RX_STOP;
+	}
+	return RX_CONTINUE;
+}
+
+
+// Compressed block queued in the task pool
+typedef struct ZJOB {
+	ReceiverTh *t;
+	PKT_BUF *pb;				// Packet holding the block; the job holds one reference
+	const char *data;			// Compressed data, in pb
+	long long seq;
+	long long t0;				// Arrival of the packet
+	int len, orig_len, codec;
+} ZJOB;
+
+
+/** Block task: decompresses and stores one block and, after the last one, wakes the transfer
+ *  thread. The transfer is not freed while it has queued tasks (stop_rx_threads waits for them) */
+static void zblock_job(void *arg) {
+	ZJOB *j = (ZJOB *) arg;
+	ReceiverTh *t = j->t;
+	int res = RX_CONTINUE, running = RX_CONTINUE;
+
+	if (t->active && !__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+		res = store_zblock(t, j->seq, j->data, j->len, j->orig_len, j->codec, j->t0);
+		if ((res == RX_CONTINUE) && (__atomic_load_n(&t->n_recv, __ATOMIC_ACQUIRE) >= t->bmask.b_len))
+			res = RX_DONE;
+		if ((res != RX_CONTINUE) &&
+				__atomic_compare_exchange_n(&t->done, &running, res, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+				(t->wake[1] >= 0) && (write(t->wake[1], "x", 1) != 1))
+			perror("RCV>write(wake)");
+	}
+	pkt_put(j->pb);
+	free(j);
+}
+
+
+/** Queue a new compressed block in the task pool, or decompress it here when the pool is
+ *  not running, refuses it (full, or the transfer above its share) or the packet is not in
+ *  a pool buffer (packet ring) */
+static int handle_zblock(ReceiverTh *t, PKT_BUF *pb, long long seq, const char *data, int len,
+		int orig_len, int codec, long long t0) {
+	ZJOB *j;
+
+	if ((pb != NULL) && (taskpool_count() > 0) &&
+			(__atomic_load_n(&t->tasks.pending, __ATOMIC_RELAXED) < Z_INFLIGHT_MAX) &&
+			((j = (ZJOB *) malloc(sizeof(ZJOB))) != NULL)) {
+		j->t = t;
+		j->pb = pb;
+		j->data = data;
+		j->seq = seq;
+		j->t0 = t0;
+		j->len = len;
+		j->orig_len = orig_len;
+		j->codec = codec;
+		pkt_ref(pb);
+		if (task_submit(&t->tasks, zblock_job, j))
+			return RX_CONTINUE;
+		pkt_put(pb);
+		free(j);
+	}
+	return store_zblock(t, seq, data, len, orig_len, codec, t0);
+}
+
+
+/** Process one multicast packet; runs concurrently on every receive thread of the transfer.
+ *  'pb' holds the packet (NULL when it is in the packet ring).
+ *  main_th is TRUE on the transfer thread, the only one allowed to take the GDK lock */
+static int handle_mcast_packet(ReceiverTh *t, PKT_BUF *pb, char *buf, int n, gboolean main_th) {
+	char *pt = buf;
+	unsigned char type, flags = 0;
+	short int sid;
+	int seq32;
+	long long seq;
+	int len, orig_len;
+	struct timespec w0;
+	long long now;
+
+	READ_BUF(pt, &type, sizeof(type));
+	LOG_RATE(LOG_LVL_DEBUG, 10, t->name_str, "RECEBEU type=%ld", type, 0, 0, 0);
+
+	switch(type) {
+		case PKT_DATA:
+			if (n < DATA_HDR_LEN)
+				return RX_CONTINUE;
+			READ_BUF(pt, &sid, sizeof(sid));
+			READ_BUF(pt, &seq32, sizeof(seq32));
+			READ_BUF(pt, &len, sizeof(len));
+			seq = seq32;
+			LOG_RATE(LOG_LVL_DEBUG, 10, t->name_str, "Received packet: type=%ld, sid=%ld, seq=%ld, len=%ld",
+					type, sid, seq, len);
+			break;
+		case PKT_DATA64:
+			if (n < DATA64_HDR_LEN)
+				return RX_CONTINUE;
+			READ_BUF(pt, &sid, sizeof(sid));
+			READ_BUF(pt, &seq, sizeof(seq));
+			READ_BUF(pt, &len, sizeof(len));
+			LOG_RATE(LOG_LVL_DEBUG, 10, t->name_str, "Received packet: type=%ld, sid=%ld, seq=%ld, len=%ld",
+					type, sid, seq, len);
+			break;
+		case PKT_DATAZ:
+			if (n < DATAZ_HDR_LEN)
+				return RX_CONTINUE;
+			READ_BUF(pt, &sid, sizeof(sid));
+			READ_BUF(pt, &seq, sizeof(seq));
+			READ_BUF(pt, &len, sizeof(len));
+			READ_BUF(pt, &orig_len, sizeof(orig_len));
+			READ_BUF(pt, &flags, sizeof(flags));
+			break;
+		case PKT_STOP:
+			READ_BUF(pt, &sid, sizeof(sid));
+			LOG_INFO(t->name_str, "STOP: type=%ld, sid=%ld", type, sid, 0, 0);
+			TRACE(TR_STOP, RX_STOP, 0);
+			return RX_STOP;
+		default:
+			// SRR and EXIT packets from other receivers - do nothing
+			return RX_CONTINUE;
+	}
+
+	tp.clock_gettime(CLOCK_MONOTONIC, &w0);
+	now = w0.tv_sec * 1000000000LL + w0.tv_nsec;
+	metrics_packet(&t->lat, now);
+	STAT_ADD(t, pkts, 1);
+	STAT_ADD(t, bytes, n);
+	// The offset of a block does not depend on its length, so each block has the length
+	// the file geometry gives it: block_size, or last_len for the last one
+	if ((seq < 0) || (seq >= t->bmask.b_len) || (len < 0) || (len > n - (pt - buf)) || (len > t->block_size) ||
+			(((type == PKT_DATAZ) ? orig_len : len) != ((seq < t->bmask.b_len - 1) ? t->block_size : t->last_len)) ||
+			((type == PKT_DATAZ) && !(decomp_codecs() & (1 << (flags & Z_CODEC_MASK))))) {
+		STAT_ADD(t, invalid, 1);
+		TRACE(TR_INVALID, seq, len);
+		if (t->stripe_map != STRIPE_LAYERS)
+			send_SRR(t, t->sid, t->cid);
+		LOG_RATE(LOG_LVL_WARN, 10, t->name_str, "Invalid block sequence %ld (b_len=%ld)", seq, t->bmask.b_len, 0, 0);
+		return RX_CONTINUE;
+	}
+
+	if (!test_and_set_bit(&t->bmask, seq)) {
+		// New block: the blocks are disjoint, so pwrite lets the threads write concurrently
+		TRACE(TR_PKT, seq, len);
+		metrics_new_block(&t->lat, seq, now, t->stats.start_us);
+		if (type == PKT_DATAZ) {
+			if (handle_zblock(t, pb, seq, pt, len, orig_len, flags & Z_CODEC_MASK, now) != RX_CONTINUE)
+				return RX_STOP;
+		} else if (!write_block(t, seq, pt, len, now)) {
+			sLog(t, "Error writing block to file", main_th);
+			return RX_STOP;
+		}
+	} else {
+		STAT_ADD(t, dups, 1);
+		TRACE(TR_DUP, seq, len);
+	}
+	//		Do not forget to send SRR for every 2 DATA packets or at the end of the file
+	//		The layers of a layered session repeat every block, so they need no SRRs
+	if ((__atomic_load_n(&t->data_counter, __ATOMIC_RELAXED) % 2 == 0) &&
+			(__atomic_load_n(&t->tail, __ATOMIC_RELAXED) != TAIL_ON) && (t->stripe_map != STRIPE_LAYERS)) {
+		send_SRR(t, t->sid, t->cid);
+		LOG_RATE(LOG_LVL_DEBUG, 10, t->name_str, "SRR SEND", 0, 0, 0, 0);
+	}
+	if (__atomic_load_n(&t->n_recv, __ATOMIC_ACQUIRE) >= t->bmask.b_len) {
+		LOG_INFO(t->name_str, "ALL BLOCKS RECEIVED", 0, 0, 0, 0);
+		return RX_DONE;
+	}
+	return RX_CONTINUE;
+}
+
+
+/** Deadline 'receiver_busy_poll' microseconds after 'now' */
+static void busy_poll_deadline(const struct timespec *now, struct timespec *deadline) {
+	deadline->tv_sec = now->tv_sec + receiver_busy_poll / 1000000;
+	deadline->tv_nsec = now->tv_nsec + (receiver_busy_poll % 1000000) * 1000L;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+
+/** Spin on the non-blocking multicast socket, reading batches with recvmmsg, until
+ *  receiver_busy_poll microseconds pass without data or the transfer ends; the caller then
+ *  blocks in select. Returns RX_CONTINUE when the budget expires, the packet handler's
+ *  result, or -1 on error */
+static int busy_poll_mcast(ReceiverTh *t) {
+	PKT_BUF *bufs[RX_BATCH];
+	struct sockaddr_in6 from[RX_BATCH];	// also holds IPv4 addresses
+	struct iovec iov[RX_BATCH];
+	struct mmsghdr msgs[RX_BATCH];
+	struct timespec now, deadline;
+	int i, j, k, n, nb = 0, res = RX_CONTINUE;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < RX_BATCH; i++) {
+		iov[i].iov_len = t->pool.slot_size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &from[i];
+	}
+	tp.clock_gettime(CLOCK_MONOTONIC, &now);
+	busy_poll_deadline(&now, &deadline);
+	do {
+		// Refill the batch; bufs[0..nb-1] are the free buffers
+		while ((nb < RX_BATCH) && ((bufs[nb] = pkt_get(&t->pool)) != NULL))
+			nb++;
+		if (nb == 0)
+			break;	// Every buffer is queued for decompression; select waits for them
+		for (i = 0; i < nb; i++) {
+			iov[i].iov_base = bufs[i]->data;
+			msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+		}
+		n = tp.recvmmsg(t->sm, msgs, nb, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+				perror("RCV>recvmmsg");
+				res = -1;
+				break;
+			}
+			n = 0;
+		}
+		STAT_ADD(t, busy_pkts, n);
+		for (i = 0; i < n; i++) {
+			set_sender_addr(t, &from[i]);
+			bufs[i]->len = msgs[i].msg_len;
+			if (t->stripe_map == STRIPE_LAYERS)
+				count_layer(t, 0, bufs[i]->data, bufs[i]->len);
+			res = handle_mcast_packet(t, bufs[i], bufs[i]->data, bufs[i]->len, TRUE);
+			if (__atomic_load_n(&bufs[i]->refcnt, __ATOMIC_ACQUIRE) > 1) {
+				// Queued for decompression: the job releases it
+				pkt_put(bufs[i]);
+				bufs[i] = NULL;
+			}
+			if (res != RX_CONTINUE)
+				break;
+		}
+		for (j = k = 0; j < nb; j++) {
+			if (bufs[j] != NULL)
+				bufs[k++] = bufs[j];
+		}
+		nb = k;
+		if (res != RX_CONTINUE)
+			break;
+		tp.clock_gettime(CLOCK_MONOTONIC, &now);
+		if (n > 0)
+			busy_poll_deadline(&now, &deadline);	// Data arrived: restart the budget
+	} while (t->active && !__atomic_load_n(&t->done, __ATOMIC_ACQUIRE) && ((now.tv_sec < deadline.tv_sec) ||
+			((now.tv_sec == deadline.tv_sec) && (now.tv_nsec < deadline.tv_nsec))));
+	for (i = 0; i < nb; i++)
+		pkt_put(bufs[i]);
+	return res;
+}
+
+
+/** Start tracing the calling thread to "<file>.trace<k>"; k= 0 is the transfer thread */
+static void start_trace(ReceiverTh *t) {
+	char path[sizeof(t->name_f) + 16];
+	unsigned k = __atomic_fetch_add(&t->trace_cnt, 1, __ATOMIC_RELAXED);
+	snprintf(path, sizeof(path), "%s.trace%u", t->name_f, k);
+	if (!trace_begin(path, receiver_trace_events, k, t->block_size, t->bmask.b_len, t->fname))
+		sLog(t, "failed to start the event trace", FALSE);
+}
+
+
+// Socket drained by an extra receive thread: t->sm, shared with the transfer thread, or a stripe
+typedef struct RX_ARG {
+	ReceiverTh *t;
+	int fd;
+} RX_ARG;
+
+
+/** Extra receive thread: drains one multicast socket until the transfer ends */
+static void *rx_thread_function(void *ptr) {
+	ReceiverTh *t = ((RX_ARG *) ptr)->t;
+	int fd = ((RX_ARG *) ptr)->fd;
+	PKT_POOL pool;
+	struct pollfd pfd;
+	int res = RX_CONTINUE;
+
+	free(ptr);
+	// Each thread owns its buffers, allocated (and first touched) on its own CPU
+	if (!pkt_pool_init(&pool, POOL_SLOTS, RX_SLOT_LEN(t), receiver_pool_hugepages)) {
+		fprintf(stderr, "RCV> failed to allocate packet buffers\n");
+		return NULL;
+	}
+	if (receiver_trace)
+		start_trace(t);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (t->active && !__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+		int n = tp.poll(&pfd, 1, RX_POLL_TIMEOUT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("RCV>poll");
+			res = RX_STOP;
+			break;
+		}
+		if (n == 0)
+			continue;
+		PKT_BUF *pb = pkt_get(&pool);
+		if (pb == NULL) {
+			if (drop_mcast_packet(t, fd) < 0) {
+				res = RX_STOP;
+				break;
+			}
+			continue;
+		}
+		if ((n = recv_mcast_packet(t, fd, pb->data, pool.slot_size)) < 0) {
+			pkt_put(pb);
+			res = RX_STOP;
+			break;
+		}
+		pb->len = n;
+		if (n > 0)
+			res = handle_mcast_packet(t, pb, pb->data, n, FALSE);
+		pkt_put(pb);
+		if (res != RX_CONTINUE)
+			break;
+	}
+	if (res != RX_CONTINUE) {
+		// Report the end of the transfer to the transfer thread
+		int running = RX_CONTINUE;
+		__atomic_compare_exchange_n(&t->done, &running, res, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		if (write(t->wake[1], "x", 1) != 1)
+			perror("RCV>write(wake)");
+	}
+	// The queued block tasks hold buffers of this pool; this thread queues no more, so
+	// once the transfer's tasks drain none of them references the pool
+	task_group_wait(&t->tasks);
+	pkt_pool_free(&pool);
+	trace_end();
+	return NULL;
+}
+
+
+/** Packet ring callback: learns the sender's address and processes the datagram */
+static int ring_packet(void *ptr, char *data, int len, const struct sockaddr *from) {
+	ReceiverTh *t = (ReceiverTh *) ptr;
+	set_sender_addr(t, from);
+	return handle_mcast_packet(t, NULL, data, len, TRUE);
+}
+
+
+/** MTU towards the sender: the MTU of interface 'dev' (NULL= none), or the path MTU of the
+ *  TCP connection to the sender; 1500 if both are unknown, which is logged */
+static int path_mtu(ReceiverTh *t, const char *dev) {
+	int mtu = -1;
+	socklen_t len = sizeof(mtu);
+
+	if (dev != NULL)
+		mtu = get_interface_mtu(dev);
+	if ((mtu <= 0) && ((tp.getsockopt(t->st, t->is_ipv4 ? IPPROTO_IP : IPPROTO_IPV6,
+			t->is_ipv4 ? IP_MTU : IPV6_MTU, &mtu, &len) < 0) || (mtu <= 0))) {
+		sLog(t, "path MTU unknown - assuming 1500 bytes", FALSE);
+		mtu = 1500;
+	}
+	return mtu;
+}
+
+
+/** Largest UDP payload that reaches the receiver without fragmentation, from the MTU of
+ *  receiver_nic_dev or the path MTU */
+static int max_datagram(ReceiverTh *t) {
+	return min(path_mtu(t, receiver_nic_dev) - (t->is_ipv4 ? 20 : 40) - 8, MAX_DATAGRAM_LEN);
+}
+
+
+/** Append a capability TLV to the request */
+static char *put_cap(char *pt, unsigned char type, const void *val, int len) {
+	*pt++ = type;
+	*pt++ = (unsigned char) len;
+	memcpy(pt, val, len);
+	return pt + len;
+}
+
+
+/** Send the request: the file name, its NUL and, when receiver_send_caps is set, the
+ *  receiver capabilities (engine.h), so the sender can choose a block size that fits
+ *  the path MTU and the receive buffers */
+static gboolean send_request(ReceiverTh *t) {
+	char buf[sizeof(t->fname) + 64], *pt = buf, msg[100];
+	int n = strlen(t->fname) + 1;
+
+	memcpy(pt, t->fname, n);
+	pt += n;
+	if (receiver_send_caps) {
+		int dgram = max_datagram(t), max_block = MAX_DATAGRAM_LEN - DATAZ_HDR_LEN, rcvbuf = 0, s;
+		int sizes[2], n_sizes = 1, codecs = decomp_codecs();
+		socklen_t len = sizeof(rcvbuf);
+
+		// The largest 8-byte multiple that fits, then the largest power of two (aligned writes)
+		sizes[0] = (dgram - DATAZ_HDR_LEN) & ~7;
+		for (sizes[1] = 512; 2 * sizes[1] <= sizes[0]; sizes[1] *= 2)
+			;
+		if (sizes[1] < sizes[0])
+			n_sizes = 2;
+		pt = put_cap(pt, CAP_MAX_DATAGRAM, &dgram, sizeof(dgram));
+		pt = put_cap(pt, CAP_BLOCK_SIZES, sizes, n_sizes * sizeof(int));
+		pt = put_cap(pt, CAP_MAX_BLOCK, &max_block, sizeof(max_block));
+		pt = put_cap(pt, CAP_CODECS, &codecs, sizeof(codecs));
+		if (TAIL_ENABLED)
+			pt = put_cap(pt, CAP_TAIL_REPAIR, &receiver_tail_blocks, sizeof(receiver_tail_blocks));
+		if (receiver_max_stripes > 1) {
+			int stripes = min(receiver_max_stripes, MAX_STRIPES);
+			pt = put_cap(pt, CAP_STRIPES, &stripes, sizeof(stripes));
+		}
+		if (receiver_layer_loss > 0)
+			pt = put_cap(pt, CAP_LAYERS, &receiver_layer_loss, sizeof(receiver_layer_loss));
+		// Buffer of a new UDP socket, as the multicast socket will get
+		if ((s = tp.socket(t->is_ipv4 ? AF_INET : AF_INET6, SOCK_DGRAM, 0)) >= 0) {
+			if ((tp.getsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) == 0) && (rcvbuf > 0))
+				pt = put_cap(pt, CAP_RCV_BUFFER, &rcvbuf, sizeof(rcvbuf));
+			tp.close(s);
+		}
+		*pt++ = CAP_END;
+		snprintf(msg, sizeof(msg), "capabilities: datagram %d, blocks %d/%d", dgram, sizes[0], sizes[n_sizes - 1]);
+		sLog(t, msg, FALSE);
+	}
+	if (tp.send(t->st, buf, pt - buf, 0) < 0) {
+		perror("RCV>error sending request");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+/** Ask the sender for the missing blocks on the TCP connection (PKT_TAIL), in at most
+ *  MAX_TAIL_RANGES ranges; the others are asked when the answer ends */
+static gboolean send_tail_request(ReceiverTh *t) {
+	char buf[sizeof(char) + 2 * sizeof(short int) + sizeof(int) +
+			MAX_TAIL_RANGES * (sizeof(long long) + sizeof(int))], *pt = buf;
+	char type = PKT_TAIL;
+	long long first, last, asked = 0;
+	int count, n_ranges = 0;
+
+	pt += sizeof(char) + 2 * sizeof(short int) + sizeof(int);
+	first = first_unset_bit(&t->bmask, __atomic_load_n(&t->srr_base, __ATOMIC_RELAXED));
+	while ((first < t->bmask.b_len) && (n_ranges < MAX_TAIL_RANGES)) {
+		for (last = first + 1; (last < t->bmask.b_len) && (last - first < 0x7fffffff) &&
+				!bit_isset(&t->bmask, last); last++)
+			;
+		count = (int)(last - first);
+		WRITE_BUF(pt, &first, sizeof(first));
+		WRITE_BUF(pt, &count, sizeof(count));
+		asked += count;
+		n_ranges++;
+		first = first_unset_bit(&t->bmask, last);
+	}
+	int len = pt - buf;
+	pt = buf;
+	WRITE_BUF(pt, &type, sizeof(char));
+	WRITE_BUF(pt, &t->sid, sizeof(t->sid));
+	WRITE_BUF(pt, &t->cid, sizeof(t->cid));
+	WRITE_BUF(pt, &n_ranges, sizeof(n_ranges));
+	if (tp.send(t->st, buf, len, 0) != len) {
+		perror("RCV>send(TAIL)");
+		return FALSE;
+	}
+	t->tail_asked = asked;
+	t->tail_rx = t->tail_seen = 0;
+	LOG_INFO(t->name_str, "Tail repair: asked %ld blocks in %ld ranges on TCP", asked, n_ranges, 0, 0);
+	return TRUE;
+}
+
+
+/** Start the tail repair when at most receiver_tail_blocks are missing (after the last block
+ *  arrived, or on an SRR timeout) or after receiver_tail_rounds SRR timeouts. On a timeout
+ *  in tail mode, waits while the answer is still arriving, asks the blocks again once it is
+ *  complete or, if no record came since the last timeout, goes back to the SRRs.
+ *  Returns FALSE if the request could not be sent */
+static gboolean check_tail_repair(ReceiverTh *t, gboolean timeout) {
+	long long missing;
+
+	if (!TAIL_ENABLED || (t->st < 0) || (t->tail == TAIL_FAILED))
+		return TRUE;
+	if (t->tail == TAIL_ON) {
+		if (!timeout)
+			return TRUE;
+		if (t->tail_rx == t->tail_seen) {
+			// The records that still arrive are applied, but the SRRs repair the rest
+			__atomic_store_n(&t->tail, TAIL_FAILED, __ATOMIC_RELAXED);
+			sLog(t, "no answer to the tail repair request - back to SRRs", FALSE);
+			return TRUE;
+		}
+		if (t->tail_rx >= t->tail_asked)
+			return send_tail_request(t);
+		t->tail_seen = t->tail_rx;
+		return TRUE;
+	}
+	missing = t->bmask.b_len - __atomic_load_n(&t->n_recv, __ATOMIC_ACQUIRE);
+	if ((missing <= 0) || !((timeout && (t->tail_rounds >= receiver_tail_rounds)) ||
+			((missing <= receiver_tail_blocks) && (timeout || bit_isset(&t->bmask, t->bmask.b_len - 1)))))
+		return TRUE;
+	__atomic_store_n(&t->tail, TAIL_ON, __ATOMIC_RELAXED);
+	return send_tail_request(t);
+}
+
+
+/** Read what the TCP connection holds of the answer to PKT_TAIL, without blocking, so a
+ *  sender that stalls in the middle of a record cannot hold the transfer thread. Each whole
+ *  record is handled as a multicast DATA packet. Returns the packet handler's result, or
+ *  -1 if the stream failed or is not an answer */
+static int recv_tail_record(ReceiverTh *t) {
+	int hdr_len = 0, len = 0, need, n;
+
+	if ((t->tail_pb == NULL) && ((t->tail_pb = pkt_get(&t->pool)) == NULL))
+		return RX_CONTINUE;	// Every buffer is queued; read it in the next round
+	char *data = t->tail_pb->data;
+	for (;;) {
+		// Type, then the rest of the header, then the block
+		if (t->tail_got >= 1) {
+			hdr_len = (data[0] == PKT_DATA64) ? DATA64_HDR_LEN : (data[0] == PKT_DATAZ) ? DATAZ_HDR_LEN : 0;
+			if (hdr_len == 0) {
+				sLog(t, "invalid record type in the tail repair stream", TRUE);
+				return -1;
+			}
+		}
+		if ((hdr_len > 0) && (t->tail_got >= hdr_len)) {
+			memcpy(&len, data + sizeof(char) + sizeof(short int) + sizeof(long long), sizeof(len));
+			if ((len < 0) || (len > t->block_size)) {
+				sLog(t, "invalid record length in the tail repair stream", TRUE);
+				return -1;
+			}
+		}
+		need = (t->tail_got < 1) ? 1 : (t->tail_got < hdr_len) ? hdr_len : hdr_len + len;
+		if (t->tail_got == need)
+			break;
+		n = tp.recv(t->st, data + t->tail_got, need - t->tail_got, MSG_DONTWAIT);
+		if (n == 0) {
+			sLog(t, "the sender closed the connection during the tail repair", TRUE);
+			return -1;
+		}
+		if (n < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				return RX_CONTINUE;	// The rest of the record comes later
+			perror("RCV>recv(tail)");
+			return -1;
+		}
+		t->tail_got += n;
+	}
+
+	PKT_BUF *pb = t->tail_pb;
+	t->tail_pb = NULL;
+	t->tail_got = 0;
+	pb->len = hdr_len + len;
+	STAT_ADD(t, tail_blocks, 1);
+	t->tail_rx++;
+	int res = handle_mcast_packet(t, pb, pb->data, pb->len, TRUE);
+	pkt_put(pb);
+	return res;
+}
+
+
+/** Read the stripes at the end of the reply header (engine.h): sets t->n_stripes and
+ *  t->stripe_map and the group and port of stripes 1..n_stripes-1 */
+static gboolean recv_stripes(ReceiverTh *t) {
+	int i, n, map;
+
+	if ((tp.recv(t->st, &n, sizeof(n), MSG_WAITALL) != sizeof(n)) ||
+			(tp.recv(t->st, &map, sizeof(map), MSG_WAITALL) != sizeof(map))) {
+		perror("RCV>recv(stripes)");
+		return FALSE;
+	}
+	if ((map == STRIPE_LAYERS) ? ((receiver_layer_loss <= 0) || (n < 1) || (n > MAX_STRIPES))
+			: (((map != STRIPE_BLOCK_RR) && (map != STRIPE_RANGES)) ||
+				(n < 1) || (n > min(receiver_max_stripes, MAX_STRIPES))))
+		return FALSE;
+	for (i = 1; i < n; i++) {
+		RX_STRIPE *s = &t->stripe[i];
+		if ((t->is_ipv4 ? (tp.recv(t->st, &s->group4, sizeof(s->group4), MSG_WAITALL) != sizeof(s->group4))
+						: (tp.recv(t->st, &s->group6, sizeof(s->group6), MSG_WAITALL) != sizeof(s->group6))) ||
+				(tp.recv(t->st, &s->port, sizeof(s->port), MSG_WAITALL) != sizeof(s->port))) {
+			perror("RCV>recv(stripes)");
+			return FALSE;
+		}
+	}
+	t->n_stripes = n;
+	t->stripe_map = map;
+	return TRUE;
+}
+
+
+/** Join (or leave) the multicast group of stripe 'k' (k >= 1) on its socket */
+static gboolean set_membership(ReceiverTh *t, int k, gboolean join) {
+	RX_STRIPE *s = &t->stripe[k];
+	int res;
+
+	if (t->is_ipv4) {
+		struct ip_mreq imr;
+		memset(&imr, 0, sizeof(imr));
+		imr.imr_multiaddr = s->group4;
+		imr.imr_interface.s_addr = htonl(INADDR_ANY);
+		res = tp.setsockopt(s->fd, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP,
+				(char *)&imr, sizeof(imr));
+	} else {
+		struct ipv6_mreq imr;
+		memset(&imr, 0, sizeof(imr));
+		imr.ipv6mr_multiaddr = s->group6;
+		res = tp.setsockopt(s->fd, IPPROTO_IPV6, join ? IPV6_ADD_MEMBERSHIP : IPV6_DROP_MEMBERSHIP,
+				(char *)&imr, sizeof(imr));
+	}
+	if (res < 0) {
+		perror(join ? "RCV>setsockopt(ADD_MEMBERSHIP) of a stripe" : "RCV>setsockopt(DROP_MEMBERSHIP) of a stripe");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+/** Open the UDP socket of stripe 'k' (k >= 1) on its port and join its group; the layers
+ *  above 0 of a layered session are only joined later, by adapt_layers */
+static gboolean join_stripe(ReceiverTh *t, int k) {
+	RX_STRIPE *s = &t->stripe[k];
+
+	s->fd = t->is_ipv4 ? init_socket_ipv4(SOCK_DGRAM, s->port, TRUE) : init_socket_ipv6(SOCK_DGRAM, s->port, TRUE);
+	if (s->fd < 0)
+		return FALSE;
+	if ((t->stripe_map != STRIPE_LAYERS) && !set_membership(t, k, TRUE))
+		return FALSE;
+	if (receiver_busy_poll > 0)
+		set_socket_busy_poll(s->fd, receiver_busy_poll);
+	return TRUE;
+}
+
+
+/** Datagrams dropped by the multicast sockets of a transfer (all its stripes) */
+long long receiver_socket_drops(ReceiverTh *t) {
+	long long n = (t->sm >= 0) ? get_socket_drops(t->sm) : 0;
+	for (int i = 1; i < t->n_stripes; i++) {
+		if (t->stripe[i].fd >= 0)
+			n += get_socket_drops(t->stripe[i].fd);
+	}
+	return n;
+}
+
+
+/** Receiver-driven layering: every LAYER_INTERVAL_MS, measure the loss of the joined layers (the
+ *  jumps in their block sequences plus the socket drops). Above receiver_layer_loss the top layer
+ *  is left; below a fifth of it the next layer is joined once its join timer expires. A layer
+ *  that causes loss right after its join waits twice as long before the next try, so receivers
+ *  behind a slow link settle below it. Returns FALSE if the membership could not be changed */
+static gboolean adapt_layers(ReceiverTh *t) {
+	struct timespec ts;
+	long long now, rx = 0, lost = 0, drops, d_rx, d_lost;
+	int k;
+
+	if (t->stripe_map != STRIPE_LAYERS)
+		return TRUE;
+	tp.clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	if (now < t->layer_next)
+		return TRUE;
+	t->layer_next = now + LAYER_INTERVAL_MS * 1000000LL;
+	// Every layer is counted, so the datagrams of a layer just left still add to the totals
+	for (k = 0; k < t->n_stripes; k++) {
+		rx += __atomic_load_n(&t->stripe[k].rx, __ATOMIC_RELAXED);
+		lost += __atomic_load_n(&t->stripe[k].lost, __ATOMIC_RELAXED);
+	}
+	drops = receiver_socket_drops(t);
+	d_rx = rx - t->layer_rx;
+	d_lost = lost - t->layer_lost + drops - t->layer_drops;
+	t->layer_rx = rx;
+	t->layer_lost = lost;
+	t->layer_drops = drops;
+	if (d_rx + d_lost < LAYER_MIN_PKTS)
+		return TRUE;
+
+	if ((d_lost * 100 > receiver_layer_loss * (d_rx + d_lost)) && (t->n_layers > 1)) {
+		k = --t->n_layers;
+		if (!set_membership(t, k, FALSE))
+			return FALSE;
+		if (now - t->layer_join_t < LAYER_DETECT_MS * 1000000LL)
+			t->stripe[k].join_ms = min(2 * t->stripe[k].join_ms, LAYER_JOIN_MAX_MS);
+		t->layer_join_next = now + t->stripe[k].join_ms * 1000000LL;
+	} else if ((d_lost * 500 < receiver_layer_loss * (d_rx + d_lost)) && (t->n_layers < t->n_stripes) &&
+			(now >= t->layer_join_next)) {
+		k = t->n_layers++;
+		t->stripe[k].last_seq = -1;	// The layer's thread is idle until the group is joined
+		if (!set_membership(t, k, TRUE))
+			return FALSE;
+		t->layer_join_t = now;
+		t->layer_join_next = now + t->stripe[k].join_ms * 1000000LL;
+	} else
+		return TRUE;
+	LOG_INFO(t->name_str, "%ld of %ld layers joined (loss %ld/%ld)", t->n_layers, t->n_stripes, d_lost, d_rx + d_lost);
+	// The next interval would still see the packets of the old set of layers
+	t->layer_next += LAYER_INTERVAL_MS * 1000000LL;
+	return TRUE;
+}
+
+
+/** Capture the multicast data with a TPACKET_V3 ring instead of reading t->sm.
+ *  Keeps the socket path if the ring cannot be created or if the datagrams would be
+ *  fragmented, since the ring filter only accepts whole datagrams */
+static void open_ring(ReceiverTh *t, struct in_addr *maddr4, struct in6_addr *maddr6,
+		u_short port, int block_size) {
+	int mtu = path_mtu(t, receiver_ring_dev);	// The ring device, or the path to the sender
+	int hdr_len = (t->is_ipv4 ? 20 : 40) + 8 + (t->blocks64 ? DATA64_HDR_LEN : DATA_HDR_LEN);
+
+	if (block_size + hdr_len > mtu) {
+		sLog(t, "blocks do not fit in the MTU - packet ring not used", FALSE);
+		return;
+	}
+	if (!(t->is_ipv4 ? ring_open_ipv4(&t->ring, receiver_ring_dev, maddr4, port)
+					 : ring_open_ipv6(&t->ring, receiver_ring_dev, maddr6, port))) {
+		sLog(t, "failed to open packet ring - using the UDP socket", FALSE);
+		return;
+	}
+	// From now on t->sm only keeps the group membership and sends SRRs
+	socket_drop_all(t->sm);
+	sLog(t, "receiving multicast data through a TPACKET_V3 ring", FALSE);
+}
+
+
+/** Start receiver_rx_threads-1 extra threads sharing t->sm, each pinned to its own CPU.
+ *  Linux hands a copy of each multicast datagram to every socket joined to the group,
+ *  even with SO_REUSEPORT, so the threads share one socket and the kernel gives
+ *  each datagram to a single reader. The other stripes are only read by their threads, so
+ *  the transfer cannot run without all of them. Returns FALSE if a thread was not started */
+static gboolean start_rx_threads(ReceiverTh *t) {
+	int i, k = max(min(receiver_rx_threads - 1, MAX_RX_THREADS - (t->n_stripes - 1)), 0);
+	RX_ARG *a;
+
+	if (workers_count() == 0)
+		pin_thread(pthread_self(), receiver_rx_cpu0);	// Workers are already pinned
+	if ((t->ring.fd >= 0) || (t->stripe_map == STRIPE_LAYERS))
+		k = 0;	// The ring is read by the transfer thread alone; it decompresses inline.
+				// The loss of a layer is counted by a single reader
+	// The extra threads and the block tasks wake the transfer thread when they end the transfer
+	if ((k == 0) && (t->n_stripes <= 1) && !(receiver_send_caps && (taskpool_count() > 0)))
+		return TRUE;
+	if (pipe(t->wake)) {
+		perror("RCV>pipe");
+		t->wake[0] = t->wake[1] = -1;
+		return FALSE;
+	}
+	// k threads share 'sm'; then one thread for each of the other stripes
+	for (i = 0; i < k + t->n_stripes - 1; i++) {
+		if ((a = (RX_ARG *) malloc(sizeof(RX_ARG))) == NULL) {
+			perror("RCV>malloc");
+			return FALSE;	// The threads already started leave in stop_rx_threads
+		}
+		a->t = t;
+		a->fd = (i < k) ? t->sm : t->stripe[i - k + 1].fd;
+		if (tp.thread_create(&t->rx_tid[t->n_rx], NULL, rx_thread_function, (void *)a)) {
+			fprintf(stderr, "RCV> error starting receive thread\n");
+			free(a);
+			return FALSE;
+		}
+		pin_thread(t->rx_tid[t->n_rx], (receiver_rx_cpu0 < 0) ? -1 : receiver_rx_cpu0 + 1 + i);
+		t->n_rx++;
+	}
+#ifdef DEBUG
+	fprintf(stdout, "%s%d extra receive threads started\n", t->name_str, t->n_rx);
+#endif
+	return TRUE;
+}
+
+
+/** Wait for the extra receive threads and the queued compressed blocks; the threads leave
+ *  when t->active is FALSE or t->done is set, and the blocks are then dropped */
+static void stop_rx_threads(ReceiverTh *t) {
+	int i;
+	if (!t->done && t->active)
+		__atomic_store_n(&t->done, RX_STOP, __ATOMIC_RELEASE);
+	for (i = 0; i < t->n_rx; i++)
+		pthread_join(t->rx_tid[i], NULL);
+	t->n_rx = 0;
+	// The queued block tasks use the file, the wake pipe and the packet buffers
+	task_group_wait(&t->tasks);
+	if (t->wake[0] >= 0) {
+		close(t->wake[0]);
+		close(t->wake[1]);
+		t->wake[0] = t->wake[1] = -1;
+	}
+}
+
+
 /**
- * Thread function that implements the receiver algorithm;
- * 		runs in an independent threads
+ * Receiver algorithm of one transfer;
+ * 		called by receiver_thread_function, in its own thread or in a worker
  **/
-void *receiver_thread_function(void *ptr) {
-	int block_size, n_blocks;
+static void *receive_file(void *ptr) {
+	int block_size, n_blocks32;
+	long long n_blocks;
 	unsigned long long f_length;
 	unsigned int f_hash;
 	struct ipv6_mreq imr_MCast6; // To regist socket in the IPv6 multicast group address
 	struct ip_mreq imr_MCast4; // To regist socket in the IPv4 multicast group address
 	u_short MCast_port;
-	static char buf[8000];
-	static char stmp_buf[8000];
 	struct timeval tv1, tv2, timeout; // To measure the transfer duration
 	struct timezone tz;
 	// ...
@@ -480,14 +1575,13 @@ void *receiver_thread_function(void *ptr) {
 	assert(t != NULL);
 
 	// Add to the GUI thread list
-	GUI_add_Ftrans((unsigned)t->tid, addr_ipv6(&t->v.addr.sin6_addr), ntohs(t->v.addr.sin6_port), t->fname, TRUE);
-	usleep(1000);  // Give some time for the thread to appear in the graphical interface
+	engine_add_transfer(t->tid, addr_ipv6(&t->v.addr.sin6_addr), ntohs(t->v.addr.sin6_port), t->fname);
 
 	// Thread code
 	sprintf(t->name_str, "RCV(%d)> ", ++rcv_count);
 	fprintf(stdout, "%sstarted reading thread (file= '%s' tid = %u)\n",
-			t->name_str, t->fname, (unsigned) t->tid);
-	if (gettimeofday(&tv1, &tz)) {
+			t->name_str, t->fname, t->tid);
+	if (tp.gettimeofday(&tv1, &tz)) {
 		perror("getting reception starting time");
 	}
 
@@ -524,7 +1618,7 @@ void *receiver_thread_function(void *ptr) {
 	*/
 	if(t->is_ipv4){
 		// FAZ a conexao IPV4 ao servidor, caso nao fizer cria o erro ; Cool
-		if (connect(t->st,(struct sockaddr *) &t->v.addr4, sizeof (t->v.addr4)) < 0) {
+		if (tp.connect(t->st,(struct sockaddr *) &t->v.addr4, sizeof (t->v.addr4)) < 0) {
 					perror("RCV>error connecting TCP socket to request file");
 					sLog(t, "connection failed", TRUE);
 					STOP_THREAD(t, FALSE, FALSE);
@@ -532,7 +1626,7 @@ void *receiver_thread_function(void *ptr) {
 	}
 	else{
 		// FAZ a conexao IPV6 ao servidor, caso nao fizer cria o erro ; Cool
-		if (connect(t->st,(struct sockaddr *) &t->v.addr, sizeof (t->v.addr)) < 0) {
+		if (tp.connect(t->st,(struct sockaddr *) &t->v.addr, sizeof (t->v.addr)) < 0) {
 					perror("RCV>error connecting TCP socket to request file");
 					sLog(t, "connection failed", TRUE);
 					STOP_THREAD(t, FALSE, FALSE);
@@ -557,8 +1651,7 @@ void *receiver_thread_function(void *ptr) {
 				sLog(t, "failed to send name", TRUE);
 				STOP_THREAD(t, FALSE, FALSE);
 	}*/
-	if (send(t->st, t->fname, strlen(t->fname) + 1, 0) < 0) {
-	    perror("RCV>error sending request");
+	if (!send_request(t)) {
 	    sLog(t, "failed to send name", TRUE);
 	    STOP_THREAD(t, FALSE, FALSE);
 	}
@@ -577,7 +1670,7 @@ void *receiver_thread_function(void *ptr) {
 	/* Configura socket para esperar no máximo 10 segundos */
 	timeout.tv_sec= OK_timeout * 10;	//METER OK_timeout em Segundos
 	timeout.tv_usec= 0; //uSegundos
-	if (setsockopt(t->st, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) <0) {
+	if (tp.setsockopt(t->st, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) <0) {
 		perror ("Erro a definir timeout");
 		exit (1);
 	}
@@ -592,7 +1685,7 @@ void *receiver_thread_function(void *ptr) {
 	// Receive the reply header:
 
 	// Read the CID
-	if (recv(t->st, &t->cid, sizeof(t->cid), 0) <= 0) {
+	if (tp.recv(t->st, &t->cid, sizeof(t->cid), 0) <= 0) {
 		if (errno == EWOULDBLOCK) {
 			sLog(t, "Timeout waiting for a server's response in TCP", TRUE);
 		} else {
@@ -642,7 +1735,7 @@ void *receiver_thread_function(void *ptr) {
 	//	#endif
 
     // RECEBER O SID
-	if (recv(t->st, &t->sid, sizeof(t->sid), 0) <= 0) {
+	if (tp.recv(t->st, &t->sid, sizeof(t->sid), 0) <= 0) {
 		if (errno == EWOULDBLOCK) {
 			sLog(t, "Erro no SID", TRUE);
 		} else {
@@ -653,7 +1746,7 @@ void *receiver_thread_function(void *ptr) {
 	}
 
 	// RECEBER O F_LENGTH
-	if (recv(t->st, &f_length, sizeof(f_length), 0) <= 0) {
+	if (tp.recv(t->st, &f_length, sizeof(f_length), 0) <= 0) {
 		if (errno == EWOULDBLOCK) {
 			sLog(t, "Erro no F_LENGTH", TRUE);
 		} else {
@@ -664,7 +1757,7 @@ void *receiver_thread_function(void *ptr) {
 	}
 
 	// RECEBER O BLOCK_SIZE
-	if (recv(t->st, &block_size, sizeof(block_size), 0) <= 0) {
+	if (tp.recv(t->st, &block_size, sizeof(block_size), 0) <= 0) {
 		if (errno == EWOULDBLOCK) {
 			sLog(t, "Erro no BLOCK_SIZE", TRUE);
 		} else {
@@ -675,7 +1768,7 @@ void *receiver_thread_function(void *ptr) {
 	}
 
 	// RECEBER O N_BLOCKS
-	if (recv(t->st, &n_blocks, sizeof(n_blocks), 0) <= 0) {
+	if (tp.recv(t->st, &n_blocks32, sizeof(n_blocks32), 0) <= 0) {
 		if (errno == EWOULDBLOCK) {
 			sLog(t, "Erro no N_BLOCKS", TRUE);
 		} else {
@@ -684,9 +1777,28 @@ void *receiver_thread_function(void *ptr) {
 		}
 		STOP_THREAD(t, FALSE, FALSE);
 	}
+	n_blocks = n_blocks32;
+	if (n_blocks32 == N_BLOCKS_64) {
+		// More than 2^31-1 blocks: the real count follows, and DATA packets carry 64-bit numbers
+		if (tp.recv(t->st, &n_blocks, sizeof(n_blocks), MSG_WAITALL) != sizeof(n_blocks)) {
+			perror("N_BLOCKS64 > ERROR");
+			sLog(t, "N_BLOCKS64", TRUE);
+			STOP_THREAD(t, FALSE, FALSE);
+		}
+		t->blocks64 = TRUE;
+	}
+	// Only the last block may be short (a zero-length one is an empty file)
+	if ((n_blocks <= 0) || (block_size <= 0) || (block_size > MAX_DATAGRAM_LEN - DATAZ_HDR_LEN) ||
+			(f_length < (unsigned long long)(n_blocks - 1) * block_size) ||
+			(f_length > (unsigned long long)n_blocks * block_size)) {
+		sLog(t, "invalid file geometry in the reply header", TRUE);
+		STOP_THREAD(t, FALSE, FALSE);
+	}
+	if (block_size + DATAZ_HDR_LEN > max_datagram(t))
+		sLog(t, "blocks larger than the path MTU - the datagrams will be fragmented", FALSE);
 
 	// RECEBER O F_HASH
-	if (recv(t->st, &f_hash, sizeof(f_hash), 0) <= 0) {
+	if (tp.recv(t->st, &f_hash, sizeof(f_hash), 0) <= 0) {
 		if (errno == EWOULDBLOCK) {
 			sLog(t, "Erro no F_HASH", TRUE);
 		} else {
@@ -703,7 +1815,7 @@ void *receiver_thread_function(void *ptr) {
 		struct in6_addr maddr6;		// multicast IPv6 address to receive the file
 	// RECEBER O ENDEREÇO MULTICAST IPV4 OU IPV6
 	if (t->is_ipv4) {
-		if (recv(t->st, &maddr4, sizeof(maddr4), 0) <= 0) {
+		if (tp.recv(t->st, &maddr4, sizeof(maddr4), 0) <= 0) {
 			if (errno == EWOULDBLOCK) {
 				sLog(t, "Erro no MCAST IPV4", TRUE);
 			} else {
@@ -714,7 +1826,7 @@ void *receiver_thread_function(void *ptr) {
 		}
 	} else {
 
-		if (recv(t->st, &maddr6, sizeof(maddr6), 0) <= 0) {
+		if (tp.recv(t->st, &maddr6, sizeof(maddr6), 0) <= 0) {
 			if (errno == EWOULDBLOCK) {
 				sLog(t, "Erro no MCAST IPV6", TRUE);
 			} else {
@@ -726,7 +1838,7 @@ void *receiver_thread_function(void *ptr) {
 	}
 
 	// RECEBER O MCAST_PORT
-	if (recv(t->st, &MCast_port, sizeof(MCast_port), 0) <= 0) {
+	if (tp.recv(t->st, &MCast_port, sizeof(MCast_port), 0) <= 0) {
 		if (errno == EWOULDBLOCK) {
 			sLog(t, "Erro no MCAST_PORT", TRUE);
 		} else {
@@ -736,7 +1848,22 @@ void *receiver_thread_function(void *ptr) {
 		STOP_THREAD(t, FALSE, FALSE);
 	}
 
+	// Striped or layered session: the other groups follow the header
+	if (receiver_send_caps && ((receiver_max_stripes > 1) || (receiver_layer_loss > 0)) && !recv_stripes(t)) {
+		sLog(t, "invalid stripes in the reply header", TRUE);
+		STOP_THREAD(t, FALSE, FALSE);
+	}
 
+	// A prefetched transfer waits for a free slot before joining the group and answering OK
+	if (t->sched_prefetch) {
+		int res= sched_wait_admission(t);
+		if (res == SCHED_CANCELLED)
+			return NULL;	// Stopped while waiting; 't' was freed
+		if (res == SCHED_TIMEOUT) {
+			sLog(t, "no free slot before the OK timeout; request queued again", FALSE);
+			STOP_THREAD(t, FALSE, FALSE);
+		}
+	}
 
 
 
@@ -774,7 +1901,7 @@ void *receiver_thread_function(void *ptr) {
 		imr_MCast4.imr_multiaddr = maddr4;      // Endereço multicast recebido do servidor
 		imr_MCast4.imr_interface.s_addr = htonl(INADDR_ANY); // Usa interface default
 
-		if (setsockopt(t->sm, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+		if (tp.setsockopt(t->sm, IPPROTO_IP, IP_ADD_MEMBERSHIP,
 					   (char *)&imr_MCast4, sizeof(imr_MCast4)) < 0) {
 			perror("RCV>setsockopt(IP_ADD_MEMBERSHIP)");
 			sLog(t, "failed to join IPv4 multicast group", TRUE);
@@ -796,7 +1923,7 @@ void *receiver_thread_function(void *ptr) {
 		imr_MCast6.ipv6mr_multiaddr = maddr6;
 		imr_MCast6.ipv6mr_interface = 0; // 0 → interface default
 
-		if (setsockopt(t->sm, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP,
+		if (tp.setsockopt(t->sm, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP,
 		               (char *)&imr_MCast6, sizeof(imr_MCast6)) < 0) {
 		    perror("RCV>setsockopt(IPV6_ADD_MEMBERSHIP)");
 		    sLog(t, "failed to join IPv6 multicast group", TRUE);
@@ -813,27 +1940,73 @@ void *receiver_thread_function(void *ptr) {
 
 
 
-	printf("numero de blocos recebidos ---->>>>>>>%d\n\n\n", n_blocks);
-	// Initialize the bitmask
-	new_bitmask(&t->bmask, n_blocks);
+	// The other stripes, each on its own socket and receive thread
+	for (int k = 1; k < t->n_stripes; k++) {
+		if (!join_stripe(t, k)) {
+			sLog(t, "failed to join a stripe of the session", TRUE);
+			STOP_THREAD(t, TRUE, TRUE);
+		}
+	}
+	if (t->n_stripes > 1) {
+		char msg[80];
+		snprintf(msg, sizeof(msg), "%s session: %d groups (%s)",
+				(t->stripe_map == STRIPE_LAYERS) ? "layered" : "striped", t->n_stripes,
+				(t->stripe_map == STRIPE_LAYERS) ? "layer 0 joined" :
+				(t->stripe_map == STRIPE_RANGES) ? "ranges" : "round-robin");
+		sLog(t, msg, FALSE);
+	}
+
+	// Index the transfer by multicast session
+	REG_KEY key;
+	memset(&key, 0, sizeof(key));
+	if (t->is_ipv4) {
+		// IPv4-mapped address ::ffff:a.b.c.d
+		key.group.s6_addr[10]= key.group.s6_addr[11]= 0xff;
+		memcpy(&key.group.s6_addr[12], &maddr4, sizeof(maddr4));
+	} else
+		key.group= maddr6;
+	key.port= MCast_port;
+	key.sid= t->sid;
+	if (registry_bind_session(t, &key) != NULL)
+		sLog(t, "another transfer is receiving the same session", TRUE);
+
+	// Packet buffers, allocated (and first touched) by the thread that uses them
+	t->block_size = block_size;
+	t->last_len = (int)(f_length - (unsigned long long)(n_blocks - 1) * block_size);
+	if (!pkt_pool_init(&t->pool, POOL_SLOTS, RX_SLOT_LEN(t), receiver_pool_hugepages)) {
+		sLog(t, "failed to allocate packet buffers", TRUE);
+		STOP_THREAD(t, TRUE, TRUE);
+	}
+
+	printf("numero de blocos recebidos ---->>>>>>>%lld\n\n\n", n_blocks);
 
 	// Create a file where the data will be stored
 	if (strlen(path_dir) > 0) {
 		fprintf(stdout, "path_dir='%s' name='%s'\n", path_dir, t->fname);
 		// Define the filename as "path/"tid".Name"
-		snprintf(t->name_f, sizeof(t->name_f), "%s/%d.%s", path_dir, (unsigned)t->tid, t->fname);
+		snprintf(t->name_f, sizeof(t->name_f), "%s/%u.%s", path_dir, t->tid, t->fname);
 	} else {
 		// Define the filename as "Name"."pid"
-		snprintf(t->name_f, sizeof(t->name_f), "%d.%s", (unsigned)t->tid, t->fname);
+		snprintf(t->name_f, sizeof(t->name_f), "%u.%s", t->tid, t->fname);
 	}
 	fprintf(stdout, "%sWill store data in file '%s'\n", t->name_str, t->name_f);
 
+	// Initialize the bitmask; large masks are mapped from a file next to the data
+	char bmask_f[sizeof(t->name_f) + 8];
+	snprintf(bmask_f, sizeof(bmask_f), "%s.bmask", t->name_f);
+	if (new_bitmask_mapped(&t->bmask, n_blocks, bmask_f) == NULL) {
+		sLog(t, "failed to allocate the bitmask", TRUE);
+		STOP_THREAD(t, TRUE, FALSE);
+	}
+
 	// Open file for writing
 	if ((t->sf = fopen(t->name_f, "w")) == NULL) {
 		perror("RCV>failed to open file");
 		sLog(t, "failed to open file", TRUE);
 		STOP_THREAD(t, TRUE, FALSE);
 	}
+	if (receiver_trace)
+		start_trace(t);
 
 
 	// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -842,7 +2015,7 @@ void *receiver_thread_function(void *ptr) {
 
 	// Send "OK" confirmation to the server (TCP)
 	const char *ok_msg = "OK";
-	if (send(t->st, ok_msg, strlen(ok_msg), 0) < 0) {
+	if (tp.send(t->st, ok_msg, strlen(ok_msg), 0) < 0) {
 		perror("RCV>error sending OK");
 		sLog(t, "failed to send OK", TRUE);
 		STOP_THREAD(t, TRUE, TRUE);
@@ -852,39 +2025,23 @@ void *receiver_thread_function(void *ptr) {
 
 
 
+	// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+	// Start the extra receive threads, which share the multicast socket
+	if (receiver_busy_poll > 0)
+		set_socket_busy_poll(t->sm, receiver_busy_poll);
+	if (receiver_use_ring && (t->stripe_map != STRIPE_LAYERS))
+		open_ring(t, &maddr4, &maddr6, MCast_port, block_size);
+	if (!start_rx_threads(t)) {
+		sLog(t, "failed to start the receive threads", TRUE);
+		STOP_THREAD(t, TRUE, TRUE);
+	}
+
 	// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 	// Prepare structures to read multicast data, with a timeout of 'receiver_SRR_timeout'
-	// Suggestion: Study how to use the select function together with the fd_set masks ...
-	int smask_size = max(t->st, t->sm)+1;	// select mask size
 	int n;
-	// fd_set ...
-	// ...
+	int rfd = (t->ring.fd >= 0) ? t->ring.fd : t->sm;	// descriptor with multicast data
 	fd_set read_fds;
 	struct timeval sel_timeout;
-	// Initializations
-	FD_ZERO(&read_fds);
-	FD_SET(t->sm, &read_fds); // multicast socket
-	//FD_SET(t->st, &read_fds); // TCP socket
-	sel_timeout.tv_sec = receiver_SRR_timeout;
-	sel_timeout.tv_usec = 0;
-
-	//n = select(smask_size, &read_fds, NULL, NULL, &sel_timeout);
-
-	/*
-	if (n < 0) {
-		perror ("Interruption of select"); // errno = EINTR foi interrompido
-	}
-	else if (n == 0) {
-		fprintf(stderr, "Timeout\n"); …
-	} else {
-	if (FD_ISSET(sd1, &rmask)) {// Há dados disponíveis para leitura em sd1
-
-	}
-	if (FD_ISSET(sd2, &rmask)) { // Há dados disponíveis para leitura em sd2
-
-	}
-	}*/
-
 
 #ifdef DEBUG
 	fprintf(stdout, "RCV> Main cycle (Timeout=%d s)\n",
@@ -894,21 +2051,62 @@ void *receiver_thread_function(void *ptr) {
 	// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 	// Data reading loop
 
-	int data_counter = 0;
 	do {
-		// Initializations
-		// ... initialize the fd_set and timeout values ...
+		if (!t->done && !check_tail_repair(t, FALSE)) {
+			sLog(t, "failed to send the tail repair request", TRUE);
+			STOP_THREAD(t, TRUE, TRUE);
+		}
+		if (!t->done && !adapt_layers(t)) {
+			sLog(t, "failed to change the layers of the session", TRUE);
+			STOP_THREAD(t, TRUE, TRUE);
+		}
+		if (t->done == RX_STOP) {
+			STOP_THREAD(t, TRUE, TRUE);
+		} else if (t->done == RX_DONE) {
+			// FECHAR FICHEIRO
+			stop_rx_threads(t);
+			fclose(t->sf);
+			t->sf = NULL;
+			if (!tp.gettimeofday(&tv2, &tz)) {
+				char msg[120];
+				sprintf(msg, "transfer completed in %.3f ms (busy-poll %s)",
+						(tv2.tv_sec - tv1.tv_sec) * 1e3 + (tv2.tv_usec - tv1.tv_usec) / 1e3,
+						(receiver_busy_poll > 0) ? "on" : "off");
+				sLog(t, msg, TRUE);
+			}
+			{
+				char lat_msg[600];
+				metrics_lat_summary(&t->lat, lat_msg, sizeof(lat_msg));
+				sLog(t, lat_msg, TRUE);
+			}
+			STOP_THREAD(t, TRUE, TRUE);
+		}
 
-		if (t->st >= 0) FD_SET(t->st, &read_fds);
+		if ((receiver_busy_poll > 0) && (rfd == t->sm)) {
+			// Low-latency mode: spin on the socket before sleeping in select
+			int res = busy_poll_mcast(t);
+			if (res < 0) {
+				sLog(t, "Error reading UDP data", TRUE);
+				STOP_THREAD(t, TRUE, TRUE);
+			}
+			if (res != RX_CONTINUE) {
+				__atomic_store_n(&t->done, res, __ATOMIC_RELEASE);
+				continue;
+			}
+		}
 
-		sel_timeout.tv_sec = receiver_SRR_timeout;
-		sel_timeout.tv_usec = 0;
-		int smask_size = max(t->st, t->sm)+1;
+		// Initializations
+		FD_ZERO(&read_fds);
+		FD_SET(rfd, &read_fds); // multicast socket or packet ring
+		if (t->st >= 0) FD_SET(t->st, &read_fds); // TCP socket
+		if (t->wake[0] >= 0) FD_SET(t->wake[0], &read_fds); // extra receive threads
 
+		sel_timeout.tv_sec = receiver_SRR_timeout / 1000;
+		sel_timeout.tv_usec = (receiver_SRR_timeout % 1000) * 1000;
+		int smask_size = max(max(t->st, rfd), t->wake[0])+1;
 
 		// Wait for multicast or TCP packets, up to SRR_Timeout seconds
-		// n= 0; // n= select(smask_size, ...);  -  n must have the value returned by select function
-		n = select(smask_size, &read_fds, NULL, NULL, &sel_timeout);
+		n = tp.select(smask_size, &read_fds, NULL, NULL, &sel_timeout);
 
 		if (n == -1) {
 			// ---------------------------------------------------------------
@@ -923,9 +2121,15 @@ void *receiver_thread_function(void *ptr) {
 		} else if (n == 0) {
 			// ---------------------------------------------------------------
 			// Timeout
-			// ...
-			// Send SRR message
+			// Send SRR message, or ask the last blocks on the TCP connection
 			if (!bitmask_isempty(&t->bmask)) {
+				t->tail_rounds++;
+				if (!check_tail_repair(t, TRUE)) {
+					sLog(t, "failed to send the tail repair request", TRUE);
+					STOP_THREAD(t, TRUE, TRUE);
+				}
+			}
+			if (!bitmask_isempty(&t->bmask) && (t->tail != TAIL_ON) && (t->stripe_map != STRIPE_LAYERS)) {
 				sLog(t, "Timeout expired - sending SRR", FALSE);
 				if (!send_SRR(t, t->sid, t->cid)) {
 					sLog(t, "failed to send SRR", TRUE);
@@ -935,139 +2139,63 @@ void *receiver_thread_function(void *ptr) {
 
 		} else {
 			// ---------------------------------------------------------------
-			// Received a data packet
-			if (FD_ISSET(t->st, &read_fds)){
+			if ((t->wake[0] >= 0) && FD_ISSET(t->wake[0], &read_fds)) {
+				// An extra receive thread ended the transfer; t->done tells why
+				char c;
+				if (read(t->wake[0], &c, 1) < 0)
+					perror("RCV>read(wake)");
+			}
+			if ((t->st >= 0) && FD_ISSET(t->st, &read_fds) && (t->tail != TAIL_OFF) && !t->done) {
+				// Block asked in the tail repair, also when it arrives after the fall back to SRRs;
+				//   the next ranges are asked when they all arrived
+				int res = recv_tail_record(t);
+				if (res < 0) {
+					sLog(t, "tail repair stream failed", TRUE);
+					STOP_THREAD(t, TRUE, TRUE);
+				}
+				if (res != RX_CONTINUE)
+					__atomic_store_n(&t->done, res, __ATOMIC_RELEASE);
+				else if ((t->tail == TAIL_ON) && (t->tail_rx >= t->tail_asked) && !send_tail_request(t)) {
+					sLog(t, "failed to send the tail repair request", TRUE);
+					STOP_THREAD(t, TRUE, TRUE);
+				}
+			} else if ((t->st >= 0) && FD_ISSET(t->st, &read_fds)) {
 				printf("Server Error, shut down connection \n");
 				STOP_THREAD(t, TRUE, TRUE);
-
 			}
-			if(FD_ISSET(t->sm, &read_fds)){
-				// Define auxiliary variables ...
-				char *pt = buf;
-				struct sockaddr_in addrec;
-				struct sockaddr_in6 addrec6;
-				unsigned char type;
-				short int sid;
-				int seq;
-				int len;
-
-/*
-				if(t->is_ipv4){ // IPV4
-					socklen_t addrlen = sizeof(addrec);
-					n = recvfrom(t->sm, buf, sizeof(buf), 0, (struct sockaddr *)&addrec, &addrlen);
+			if (!t->done && (rfd == t->ring.fd) && FD_ISSET(rfd, &read_fds)) {
+				// The kernel released one or more blocks of the ring
+				int res = ring_read(&t->ring, ring_packet, t);
+				if (res < 0) {
+					sLog(t, "Error reading the packet ring", TRUE);
+					STOP_THREAD(t, TRUE, TRUE);
 				}
-				else { // IPV6
-					socklen_t addrlen6 = sizeof(addrec6);
-					n = recvfrom(t->sm, buf, sizeof(buf), 0, (struct sockaddr *)&addrec6, &addrlen6);
-
+				if (res != RX_CONTINUE)
+					__atomic_store_n(&t->done, res, __ATOMIC_RELEASE);
+			} else if (!t->done && FD_ISSET(rfd, &read_fds)) {
+				// Received a data packet
+				PKT_BUF *pb = pkt_get(&t->pool);
+				if (pb == NULL) {
+					if (drop_mcast_packet(t, t->sm) < 0) {
+						sLog(t, "Error reading UDP data", TRUE);
+						STOP_THREAD(t, TRUE, TRUE);
+					}
+					continue;
 				}
-
-				if(n <= 0) {
-					perror("RCV>recvfrom");
+				n = recv_mcast_packet(t, t->sm, pb->data, t->pool.slot_size);
+				if (n < 0) {
+					pkt_put(pb);
 					sLog(t, "Error reading UDP data", TRUE);
 					STOP_THREAD(t, TRUE, TRUE);
 				}
-
-*/
-				if (t->is_ipv4) {
-					struct sockaddr_in addrec;
-					socklen_t addrlen = sizeof(addrec);
-					n = recvfrom(t->sm, buf, sizeof(buf), 0,
-								 (struct sockaddr *)&addrec, &addrlen);
-					if (n <= 0) { perror("recvfrom"); STOP_THREAD(t, TRUE, TRUE); }
-					if (!t->saddr_def) { t->u.saddr4 = addrec; t->saddr_def = TRUE; }
-				} else {
-					struct sockaddr_in6 addrec6;
-					socklen_t addrlen6 = sizeof(addrec6);
-					n = recvfrom(t->sm, buf, sizeof(buf), 0,
-								 (struct sockaddr *)&addrec6, &addrlen6);
-					if (n <= 0) { perror("recvfrom"); STOP_THREAD(t, TRUE, TRUE); }
-					if (!t->saddr_def) { t->u.saddr6 = addrec6; t->saddr_def = TRUE; }
+				if (n > 0) {
+					pb->len = n;
+					int res = handle_mcast_packet(t, pb, pb->data, n, TRUE);
+					if (res != RX_CONTINUE)
+						__atomic_store_n(&t->done, res, __ATOMIC_RELEASE);
 				}
-
-				READ_BUF(pt, &type, sizeof(type));
-				printf("RCV> RECEBEU type=%d\n", type);
-				// depois continua com o processamento do bloco
-
-				/*switch(type) {
-					case 1:
-						READ_BUF(pt, &sid, sizeof(sid));
-						READ_BUF(pt, &seq, sizeof(seq));
-						READ_BUF(pt, &len, sizeof(len));
-						printf("RCV> Received packet: type=%d, sid=%d, seq=%d, len=%ld\n", type, sid, seq, len);
-						// VALIDAR LEN SID SEQ E DATA
-				}*/
-
-
-				switch(type) {
-					case 1:
-						// DATA TYPE
-						READ_BUF(pt, &sid, sizeof(sid));
-						READ_BUF(pt, &seq, sizeof(seq));
-						READ_BUF(pt, &len, sizeof(len));
-						printf("RCV> Received packet: type=%d, sid=%d, seq=%d, len=%ld\n", type, sid, seq, len);
-						// VALIDAR LEN SID SEQ E DATA
-						break;
-					case 2:
-						// SRR DO NOTHING
-						break;
-					case 3:
-						// STOP TYPE
-						READ_BUF(pt, &sid, sizeof(sid));
-						printf("RCV> STOP: type=%d, sid=%d\n", type, sid);
-						STOP_THREAD(t, TRUE, TRUE);
-						break;
-					case 4:
-						// EXIT TYPE
-						// Do NOTHING
-						break;
-
-
-				}
-
-					if (seq < 0 || seq >= t->bmask.b_len) {
-						char tmp[200];
-						sprintf(tmp, "RCV> Invalid block sequence %d (b_len=%d)", seq, t->bmask.b_len);
-						send_SRR(t, t->sid, t->cid);
-						sLog(t, tmp, TRUE);
-						continue; // ou STOP_THREAD(t, TRUE, TRUE) se for fatal
-					}
-
-					//int adjusted_seq = seq - 1;
-					if(/*TESTAR SE A DATA E NOVA OU NAO*/ bit_isset(&t->bmask,seq) == 0){
-						// WRITE FILE
-						data_counter++;
-						long offset = (long) seq * len;
-						if (fseek(t->sf, offset, SEEK_SET) != 0) {
-							perror("RCV>fseek");
-							sLog(t, "Error positioning file pointer", TRUE);
-							STOP_THREAD(t, TRUE, TRUE);
-						}
-						fwrite(pt, 1, len, t->sf);
-						GUI_update_Ftrans_tx((unsigned)t->tid, count_bits(&t->bmask), t->bmask.b_len, TRUE);
-						set_bit(&t->bmask,seq); // ATUALIZAR BITMASK
-					}
-					//		Do not forget to send SRR for every 2 DATA packets or at the end of the file
-					if (data_counter % 2 == 0 ) {
-				        send_SRR(t, t->sid, t->cid);
-				        printf("RCV> SRR SEND\n");
-				    }
-					if(all_bits(&t->bmask)){
-						// FECHAR FICHEIRO
-						printf("RCV> ALL BLOCKS RECEIVED\n");
-						fclose(t->sf);
-						t->sf = NULL;
-						GUI_update_Ftrans_tx((unsigned)t->tid, count_bits(&t->bmask), t->bmask.b_len, TRUE);
-						STOP_THREAD(t, TRUE, TRUE);
-					}
+				pkt_put(pb);
 			}
-			/*else{
-				printf("ERRO NO SERVER\n");
-				fclose(t->sf);
-				t->sf = NULL;
-				STOP_THREAD(t, TRUE, TRUE);
-			}*/
-
 		}
 	}
 
@@ -1078,21 +2206,105 @@ void *receiver_thread_function(void *ptr) {
 }
 
 
+/** Function that implements the receiver algorithm; runs on a Pthread or in a worker */
+void *receiver_thread_function(void *ptr) {
+	void *res = receive_file(ptr);
+	trace_end();	// The transfer may have been freed; the trace belongs to the thread
+	return res;
+}
+
+
+/** Worker job that runs one transfer; the receiver may have been stopped while queued */
+static void *run_transfer(void *ptr) {
+	ReceiverTh *t = locate_receiverTh(GPOINTER_TO_UINT(ptr), FALSE);
+	if (t == NULL) {
+		debugstr("Transfer stopped before it started\n");
+		return NULL;
+	}
+	return receiver_thread_function(t);
+}
+
+
+/** Worker job dropped by workers_stop: the transfer never started, so it only leaves the
+ *  registry and releases its slot */
+static void *drop_transfer(void *ptr) {
+	LOCK_MUTEX(&rmutex, "lock_r4\n");
+	ReceiverTh *t = registry_lookup(GPOINTER_TO_UINT(ptr));
+	if (t != NULL)
+		sstop_thread(t, FALSE, FALSE, FALSE, TRUE);
+	UNLOCK_MUTEX(&rmutex, "lock_r4\n");
+	return NULL;
+}
+
+
+/** New transfer id; ids are never 0, which marks a transfer that left the front end */
+static unsigned new_transfer_id(void) {
+	static unsigned transfer_cnt = 0;
+	unsigned id;
+	while ((id = __atomic_add_fetch(&transfer_cnt, 1, __ATOMIC_RELAXED)) == 0)
+		;
+	return id;
+}
+
+
 /** Start thread for downloading a file */
 ReceiverTh *start_file_download(const gchar *name, const gchar *ip, int port) {
+	return start_file_download_sched(name, ip, port, 0, FALSE);
+}
+
+
+/** Start a download for the scheduler, taking 'weight' slots (0= not scheduled); a prefetch
+ *  waits for a slot after the handshake. When it returns NULL, no slot was released */
+ReceiverTh *start_file_download_sched(const gchar *name, const gchar *ip, int port, int weight, gboolean prefetch) {
 	if ((name == NULL) || (ip == NULL) || (port <= 0)) {
 		debugstr("Error: null param in start_file_download\n");
 		return NULL;
 	}
+	if (receiver_pool_slots < RX_BATCH + 1) {
+		static gboolean warned = FALSE;
+		if (!__atomic_exchange_n(&warned, TRUE, __ATOMIC_RELAXED))
+			LOG_MSG(LOG_LVL_WARN, FALSE, "RCV> ", "receiver_pool_slots=%ld is below the minimum; using %ld",
+					receiver_pool_slots, RX_BATCH + 1, 0, 0);
+	}
 
 	ReceiverTh *t = new_receiverTh_desc(name, ip, port);
+	if (t == NULL)
+		return NULL;
+	t->sched_weight = prefetch ? 0 : weight;
+	t->sched_prefetch = prefetch;
+
+	// Registered before it can stop, which takes rmutex
+	t->tid = new_transfer_id();
+	LOCK_MUTEX(&rmutex, "lock_r3\n");
+	if (!registry_add(t)) {
+		UNLOCK_MUTEX(&rmutex, "lock_r3\n");
+		fprintf(stderr, "main: transfer id %u is in use\n", t->tid);
+		free_bitmask(&t->bmask);
+		free(t);
+		return NULL;
+	}
+
+	// Queue the transfer in the least-loaded worker
+	if (workers_count() > 0) {
+		UNLOCK_MUTEX(&rmutex, "lock_r3\n");
+		if (workers_submit(run_transfer, drop_transfer, GUINT_TO_POINTER(t->tid)))
+			return t;
+		t->sched_weight = 0;	// The caller undoes the admission
+		t->sched_prefetch = FALSE;
+		free_receiverTh(t, TRUE, FALSE);
+		return NULL;
+	}
 
 	// Start the thread
-	if (pthread_create(&t->tid, NULL, receiver_thread_function, (void *)t)) {
+	if (tp.thread_create(&t->thread, NULL, receiver_thread_function, (void *)t)) {
+		registry_remove(t);
+		UNLOCK_MUTEX(&rmutex, "lock_r3\n");
 		fprintf(stderr, "main: error starting thread\n");
+		free_bitmask(&t->bmask);
 		free (t);
 		return NULL;
 	}
+	UNLOCK_MUTEX(&rmutex, "lock_r3\n");
 
 	return t;
 }
\ No newline at end of file
@@ -12,23 +12,37 @@
 #ifndef RECEIVERTH_H
 #define RECEIVERTH_H
 
-#include <gtk/gtk.h>
+#include <stdio.h>
+#include <glib.h>
 #include <netinet/in.h>
-
-/* Symbols defined in callbakcs.h:
+#include "engine.h"
+#include "bitmask.h"
+#include "ring.h"
+#include "pktpool.h"
+#include "registry.h"
+#include "metrics.h"
+#include "taskpool.h"
+
+/* Symbols defined in engine.h:
 	MAX_MESSAGE_LEN	// Maximum length of a message
-
-	// Packet types
-	PKT_DATA - Data packet; sent by the senders
-	PKT_SRR - Source Receiver Report; sent by the receivers
-	PKT_STOP - Stops a transmission; sent by the senders to the receivers
-	PKT_EXIT - Leave receivers group; sent by the receiver to the senders
+	PKT_DATA, PKT_SRR, PKT_STOP, PKT_EXIT, PKT_DATA64, PKT_SRR64, PKT_DATAZ - packet types
+	receiver_* - parameters for file transmission
 */
 
-/* Parameters for file transmission defined in callback.c: */
-extern const int receiver_SRR_timeout;  // Waiting time to generate SRR at the receiver
-extern const int OK_timeout; // Maximum waiting time for an OK at the sender
-
+// Maximum number of receive threads sharing one transfer
+#define MAX_RX_THREADS	16
+
+// One multicast group of a striped or layered session
+typedef struct RX_STRIPE {
+	struct in_addr group4;		// Group of an IPv4 session
+	struct in6_addr group6;		// ... of an IPv6 session
+	u_short port;
+	int fd;						// UDP socket (-1 for stripe 0, which is 'sm')
+	// Layered sessions
+	long long last_seq;			// Last block received on the layer (-1= none); its receive thread only
+	long long rx, lost;			// Packets received and missing from the layer's block sequence (atomic)
+	int join_ms;				// Wait before joining the layer again
+} RX_STRIPE;
 
 // Receiver-thread data entry
 typedef struct ReceiverTh {
@@ -43,7 +57,8 @@ typedef struct ReceiverTh {
 	//struct sockaddr_in addr4;	// TCP Destination address IPV4
 	//struct sockaddr_in6 addr;	// TCP Destination address IPV6
 	gboolean is_ipv4;			// TRUE if IPv4, FALSE if IPv6
-	pthread_t tid; 				// Thread ID
+	unsigned tid;				// Transfer id, from a counter; 0 once it left the front end
+	pthread_t thread;			// Thread running the transfer, when there are no workers
 	char fname[81]; 			// Requested filename
 
 	int st; // TCP socket descriptor
@@ -52,7 +67,7 @@ typedef struct ReceiverTh {
 	char name_str[80];
 	char name_f[256]; // name of created file
 	BITMASK bmask; // BITMASK with received blocks
-	gboolean saddr_def; // If sender's IP address is known
+	gboolean saddr_def; // If sender's IP address is known (atomic; SADDR_CLAIMED while it is written)
 	union {
 		struct sockaddr_in6 saddr6; // UDP sender's IPv6 address
 		struct sockaddr_in saddr4; // UDP sender's IPv4 address
@@ -61,6 +76,45 @@ typedef struct ReceiverTh {
 	short int cid; 				// Client ID
 	short int sid; 				// Session ID
 
+	int block_size;				// Block size
+	int last_len;				// Length of the last block (from the file length)
+	gboolean blocks64;			// 64-bit session: the header carried a 64-bit block count
+	long long n_recv;			// Blocks received; updated atomically by the receive threads
+	long long shown_recv;		// Value of n_recv last shown in the GUI (GUI thread only)
+	long long data_counter;		// DATA packets written; updated atomically
+	long long srr_base;			// Blocks before this one are all received (hint for PKT_SRR64)
+	int done;					// 0 while receiving; otherwise, why the transfer ended
+	int n_rx;					// Number of extra receive threads
+	pthread_t rx_tid[MAX_RX_THREADS];	// Extra receive threads draining 'sm' and the stripes
+	int n_stripes;				// Multicast groups of the session (1= not striped)
+	int stripe_map;				// How the blocks are spread over the stripes (STRIPE_*)
+	RX_STRIPE stripe[MAX_STRIPES];	// Stripes; 1..n_stripes-1 are each drained by one extra thread
+	int n_layers;				// Layers joined (0..n_layers-1) of a layered session (STRIPE_LAYERS)
+	long long layer_rx, layer_lost;	// Packets received and lost in the joined layers at the last check
+	long long layer_drops;		// Socket drops at the last check
+	long long layer_next;		// Time of the next check (monotonic ns)
+	long long layer_join_t;		// Time of the last join
+	long long layer_join_next;	// Earliest time of the next join
+	int wake[2];				// Pipe used by the extra threads and the pool tasks to wake the transfer thread
+	TASK_GROUP tasks;			// Block tasks of the transfer queued in the task pool
+	int tail;					// Tail repair state (TAIL_* in receiver_th.c); set by the transfer thread
+	int tail_rounds;			// SRR timeouts so far
+	long long tail_asked;		// Blocks asked in the last PKT_TAIL
+	long long tail_rx;			// ... and records received since it
+	long long tail_seen;		// tail_rx at the last SRR timeout; no progress means no answer
+	PKT_BUF *tail_pb;			// Record of the answer being read, without blocking
+	int tail_got;				// ... and its bytes read so far
+	PKT_RING ring;				// Capture ring, replacing reads from 'sm' when open
+	PKT_POOL pool;				// Packet buffers of the transfer thread
+	unsigned reg_tid;			// tid under which the receiver is registered
+	REG_KEY skey;				// Multicast session (group, port, SID)
+	gboolean skey_bound;		// If the registry indexes the receiver by 'skey'
+	int sched_weight;			// Slots taken in the scheduler (0= not counted)
+	gboolean sched_prefetch;	// Started by the scheduler before a slot was free
+	TRANSFER_STATS stats;		// Counters exported by the metrics endpoint
+	TRANSFER_LAT lat;			// Latency histograms
+	unsigned trace_cnt;			// Threads that started tracing this transfer
+
 	// Additional fields are needed to implement the receiver logic
 	// ...
 } ReceiverTh;
@@ -75,6 +129,12 @@ ReceiverTh *locate_receiverTh(unsigned tid, gboolean lock);	// Locate a Receiver
 ReceiverTh *new_receiverTh_desc(const gchar *name, const gchar *ip, int port); // Add a new receiver descriptor to the list
 // Start thread for downloading a file
 ReceiverTh *start_file_download(const gchar *name, const gchar *ip, int port);
+// Start a download for the scheduler, taking 'weight' slots; a prefetch waits for a slot after the handshake
+ReceiverTh *start_file_download_sched(const gchar *name, const gchar *ip, int port, int weight, gboolean prefetch);
+// Show the progress counters of all transfers in the GUI; runs in the GTK main loop
+void publish_receivers_progress(void);
+// Datagrams dropped by the multicast sockets of a transfer (all its stripes)
+long long receiver_socket_drops(ReceiverTh *t);
 
 /* Functions used in the file receiving threads */
 // Log function for threads to display messages
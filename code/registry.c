@@ -0,0 +1,201 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * registry.c
+ *
+ * Receiver registry: the active receivers are kept in REG_SHARDS hash tables
+ *   indexed by transfer id, and REG_SHARDS hash tables indexed by multicast session.
+ *   Lookups take the read lock of one shard, so they run in parallel and
+ *   never walk the whole set of receivers.
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <pthread.h>
+#include <string.h>
+#include <assert.h>
+#include "bitmask.h"
+#include "registry.h"
+#include "receiver_th.h"
+
+// One shard: a hash table protected by a read-write lock
+typedef struct REG_SHARD {
+	pthread_rwlock_t lock;
+	GHashTable *tab;
+} REG_SHARD;
+
+static REG_SHARD by_tid[REG_SHARDS];		// unsigned tid (transfer id) -> ReceiverTh
+static REG_SHARD by_session[REG_SHARDS];	// REG_KEY -> ReceiverTh
+static int n_reg= 0;						// Registered receivers (atomic)
+static pthread_once_t reg_once= PTHREAD_ONCE_INIT;
+
+
+/** Hash of a session key */
+static guint key_hash(gconstpointer p) {
+	const REG_KEY *k= (const REG_KEY *)p;
+	const guint32 *a= (const guint32 *)&k->group;
+	guint h= a[0] ^ a[1] ^ a[2] ^ a[3];
+	return (h * 2654435761u) ^ ((guint)k->port << 16) ^ (guint)(unsigned short)k->sid;
+}
+
+/** Compares two session keys */
+static gboolean key_equal(gconstpointer a, gconstpointer b) {
+	const REG_KEY *k1= (const REG_KEY *)a, *k2= (const REG_KEY *)b;
+	return (k1->port == k2->port) && (k1->sid == k2->sid) &&
+			!memcmp(&k1->group, &k2->group, sizeof(k1->group));
+}
+
+/** Creates the hash tables */
+static void registry_init(void) {
+	int i;
+	for (i= 0; i < REG_SHARDS; i++) {
+		pthread_rwlock_init(&by_tid[i].lock, NULL);
+		by_tid[i].tab= g_hash_table_new(g_direct_hash, g_direct_equal);
+		pthread_rwlock_init(&by_session[i].lock, NULL);
+		by_session[i].tab= g_hash_table_new(key_hash, key_equal);
+	}
+}
+
+/** Shard of a tid; the ids are consecutive, so the bits are mixed first */
+static inline REG_SHARD *tid_shard(unsigned tid) {
+	return &by_tid[((tid * 2654435761u) >> 16) % REG_SHARDS];
+}
+
+/** Shard of a session key */
+static inline REG_SHARD *session_shard(const REG_KEY *k) {
+	return &by_session[(key_hash(k) >> 8) % REG_SHARDS];
+}
+
+
+/** Add a receiver, indexed by its tid; the tid is saved in 't', because the
+ *  receiver clears t->tid while it stops. Returns FALSE, without replacing the
+ *  registered receiver, if the tid is already in use */
+gboolean registry_add(ReceiverTh *t) {
+	gboolean added= FALSE;
+	assert(t != NULL);
+	pthread_once(&reg_once, registry_init);
+	REG_SHARD *s= tid_shard(t->tid);
+	pthread_rwlock_wrlock(&s->lock);
+	if (g_hash_table_lookup(s->tab, GUINT_TO_POINTER(t->tid)) == NULL) {
+		t->reg_tid= t->tid;
+		g_hash_table_insert(s->tab, GUINT_TO_POINTER(t->reg_tid), t);
+		__atomic_add_fetch(&n_reg, 1, __ATOMIC_RELAXED);
+		added= TRUE;
+	}
+	pthread_rwlock_unlock(&s->lock);
+	return added;
+}
+
+
+/** Remove a receiver from both indexes; returns TRUE if it was registered */
+gboolean registry_remove(ReceiverTh *t) {
+	gboolean found= FALSE;
+	assert(t != NULL);
+	pthread_once(&reg_once, registry_init);
+	REG_SHARD *s= tid_shard(t->reg_tid);
+	pthread_rwlock_wrlock(&s->lock);
+	if (g_hash_table_lookup(s->tab, GUINT_TO_POINTER(t->reg_tid)) == t) {
+		g_hash_table_remove(s->tab, GUINT_TO_POINTER(t->reg_tid));
+		__atomic_sub_fetch(&n_reg, 1, __ATOMIC_RELAXED);
+		found= TRUE;
+	}
+	pthread_rwlock_unlock(&s->lock);
+
+	if (t->skey_bound) {
+		s= session_shard(&t->skey);
+		pthread_rwlock_wrlock(&s->lock);
+		if (g_hash_table_lookup(s->tab, &t->skey) == t)
+			g_hash_table_remove(s->tab, &t->skey);
+		pthread_rwlock_unlock(&s->lock);
+		t->skey_bound= FALSE;
+	}
+	return found;
+}
+
+
+/** Index the receiver by the session key 'key'; returns the receiver already
+ *  registered for the same session, or NULL */
+ReceiverTh *registry_bind_session(ReceiverTh *t, const REG_KEY *key) {
+	ReceiverTh *old;
+	assert((t != NULL) && (key != NULL));
+	pthread_once(&reg_once, registry_init);
+	REG_SHARD *s= session_shard(key);
+	pthread_rwlock_wrlock(&s->lock);
+	old= (ReceiverTh *)g_hash_table_lookup(s->tab, key);
+	if (old == NULL) {
+		t->skey= *key;	// The table keeps a pointer to the key stored in 't'
+		t->skey_bound= TRUE;
+		g_hash_table_insert(s->tab, &t->skey, t);
+	}
+	pthread_rwlock_unlock(&s->lock);
+	return (old == t) ? NULL : old;
+}
+
+
+/** Locate a receiver by tid */
+ReceiverTh *registry_lookup(unsigned tid) {
+	pthread_once(&reg_once, registry_init);
+	REG_SHARD *s= tid_shard(tid);
+	pthread_rwlock_rdlock(&s->lock);
+	ReceiverTh *t= (ReceiverTh *)g_hash_table_lookup(s->tab, GUINT_TO_POINTER(tid));
+	pthread_rwlock_unlock(&s->lock);
+	return t;
+}
+
+
+/** Locate a receiver by multicast session */
+ReceiverTh *registry_lookup_session(const struct in6_addr *group, u_short port, short int sid) {
+	REG_KEY k;
+	pthread_once(&reg_once, registry_init);
+	memset(&k, 0, sizeof(k));
+	k.group= *group;
+	k.port= port;
+	k.sid= sid;
+	REG_SHARD *s= session_shard(&k);
+	pthread_rwlock_rdlock(&s->lock);
+	ReceiverTh *t= (ReceiverTh *)g_hash_table_lookup(s->tab, &k);
+	pthread_rwlock_unlock(&s->lock);
+	return t;
+}
+
+
+/** Return any registered receiver, or NULL if the registry is empty */
+ReceiverTh *registry_any(void) {
+	GHashTableIter it;
+	gpointer key, val= NULL;
+	int i;
+	pthread_once(&reg_once, registry_init);
+	for (i= 0; i < REG_SHARDS; i++) {
+		pthread_rwlock_rdlock(&by_tid[i].lock);
+		g_hash_table_iter_init(&it, by_tid[i].tab);
+		gboolean found= g_hash_table_iter_next(&it, &key, &val);
+		pthread_rwlock_unlock(&by_tid[i].lock);
+		if (found)
+			return (ReceiverTh *)val;
+	}
+	return NULL;
+}
+
+
+/** Call 'fn' for every registered receiver; one shard is read-locked at a time,
+ *  so the receivers visited cannot be freed during the call */
+void registry_foreach(registry_func fn, gpointer data) {
+	GHashTableIter it;
+	gpointer key, val;
+	int i;
+	pthread_once(&reg_once, registry_init);
+	for (i= 0; i < REG_SHARDS; i++) {
+		pthread_rwlock_rdlock(&by_tid[i].lock);
+		g_hash_table_iter_init(&it, by_tid[i].tab);
+		while (g_hash_table_iter_next(&it, &key, &val))
+			fn((ReceiverTh *)val, data);
+		pthread_rwlock_unlock(&by_tid[i].lock);
+	}
+}
+
+
+/** Number of registered receivers */
+int registry_size(void) {
+	return __atomic_load_n(&n_reg, __ATOMIC_RELAXED);
+}
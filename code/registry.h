@@ -0,0 +1,51 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * registry.h
+ *
+ * Header file of the receiver registry, a sharded hash map of the active
+ *   receivers indexed by transfer id and by multicast session
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_REGISTRY_H
+#define HAVE_REGISTRY_H
+
+#include <glib.h>
+#include <netinet/in.h>
+
+// Number of shards; each one has its own read-write lock
+#define REG_SHARDS	16
+
+struct ReceiverTh;
+
+// Multicast session key: group address (IPv4 groups as ::ffff:a.b.c.d), port and SID
+typedef struct REG_KEY {
+	struct in6_addr group;		// Multicast group address
+	u_short port;				// Multicast port (host order)
+	short int sid;				// Session ID
+} REG_KEY;
+
+// Function called for each registered receiver; runs with the shard read-locked
+typedef void (*registry_func)(struct ReceiverTh *t, gpointer data);
+
+// Add a receiver, indexed by its tid; returns FALSE if the tid is already in use
+gboolean registry_add(struct ReceiverTh *t);
+// Remove a receiver from both indexes; returns TRUE if it was registered
+gboolean registry_remove(struct ReceiverTh *t);
+// Index the receiver by the session key 'key'; returns the receiver
+//   already registered for the same session, or NULL
+struct ReceiverTh *registry_bind_session(struct ReceiverTh *t, const REG_KEY *key);
+// Locate a receiver by tid
+struct ReceiverTh *registry_lookup(unsigned tid);
+// Locate a receiver by multicast session
+struct ReceiverTh *registry_lookup_session(const struct in6_addr *group, u_short port, short int sid);
+// Return any registered receiver, or NULL if the registry is empty
+struct ReceiverTh *registry_any(void);
+// Call 'fn' for every registered receiver
+void registry_foreach(registry_func fn, gpointer data);
+// Number of registered receivers
+int registry_size(void);
+
+#endif
@@ -0,0 +1,270 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * ring.c
+ *
+ * Functions that capture multicast UDP datagrams with an AF_PACKET socket and
+ * a TPACKET_V3 memory-mapped ring: the kernel fills whole blocks of frames,
+ * which are read without one system call or copy per datagram
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <net/if.h>
+#include <poll.h>
+#include <assert.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include "ring.h"
+
+
+// Initialize an unused ring descriptor
+void ring_init(PKT_RING *r) {
+	assert(r != NULL);
+	r->fd = -1;
+	r->map = NULL;
+	r->map_len = 0;
+	r->cur = 0;
+}
+
+
+// Attach the classic BPF program 'code' to socket 's'
+static gboolean attach_filter(int s, struct sock_filter *code, int len) {
+	struct sock_fprog prog;
+	prog.len = len;
+	prog.filter = code;
+	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+		perror("setsockopt SO_ATTACH_FILTER");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+// Attach a filter that discards every datagram received by socket 's'
+// Used on the UDP socket, which only keeps the group membership while the ring is in use
+gboolean socket_drop_all(int s) {
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	return attach_filter(s, code, sizeof(code) / sizeof(code[0]));
+}
+
+
+// Return the MTU of interface 'ifname', or -1
+int get_interface_mtu(const char *ifname) {
+	struct ifreq req;
+	int fd, mtu = -1;
+	assert(ifname != NULL);
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return -1;
+	memset(&req, 0, sizeof(req));
+	strncpy(req.ifr_name, ifname, sizeof(req.ifr_name) - 1);
+	if (ioctl(fd, SIOCGIFMTU, &req) == 0)
+		mtu = req.ifr_mtu;
+	close(fd);
+	return mtu;
+}
+
+
+// Create the AF_PACKET socket, attach the filter, map the ring and bind it to the interface
+static gboolean ring_open(PKT_RING *r, const char *ifname, int proto,
+		struct sock_filter *code, int code_len) {
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	int version = TPACKET_V3;
+
+	assert(r != NULL);
+	ring_init(r);
+	// SOCK_DGRAM: the frames start at the network header on every link type
+	if ((r->fd = socket(AF_PACKET, SOCK_DGRAM, htons(proto))) < 0) {
+		perror("AF_PACKET socket creation (needs CAP_NET_RAW)");
+		return FALSE;
+	}
+	// Filter before binding, so no unrelated frame reaches the ring
+	if (!attach_filter(r->fd, code, code_len))
+		goto fail;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		perror("setsockopt PACKET_VERSION");
+		goto fail;
+	}
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = RING_BLOCK_NR;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCK_NR;
+	req.tp_retire_blk_tov = RING_BLOCK_TIMEOUT;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		perror("setsockopt PACKET_RX_RING");
+		goto fail;
+	}
+	r->map_len = (size_t) req.tp_block_size * req.tp_block_nr;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, 0);
+	if (r->map == MAP_FAILED) {
+		perror("mmap of the packet ring");
+		r->map = NULL;
+		goto fail;
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(proto);
+	sll.sll_ifindex = (ifname == NULL) ? 0 : if_nametoindex(ifname);
+	if ((ifname != NULL) && (sll.sll_ifindex == 0)) {
+		fprintf(stderr, "Unknown interface '%s' for the packet ring\n", ifname);
+		goto fail;
+	}
+	if (bind(r->fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+		perror("bind of the packet ring");
+		goto fail;
+	}
+	return TRUE;
+
+fail:
+	ring_close(r);
+	return FALSE;
+}
+
+
+// Open a ring capturing the UDP datagrams sent to the IPv4 group:port
+gboolean ring_open_ipv4(PKT_RING *r, const char *ifname, struct in_addr *group, unsigned short port) {
+	assert(group != NULL);
+	// Accept unfragmented UDP datagrams to group:port
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),					// protocol
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 8),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16),					// destination address
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(group->s_addr), 0, 6),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),					// flags and fragment offset
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 4, 0),
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),					// X = IP header length
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),					// UDP destination port
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0x40000),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	return ring_open(r, ifname, ETH_P_IP, code, sizeof(code) / sizeof(code[0]));
+}
+
+
+// Open a ring capturing the UDP datagrams sent to the IPv6 group:port
+// Datagrams with extension headers (e.g. fragments) are not captured
+gboolean ring_open_ipv6(PKT_RING *r, const char *ifname, struct in6_addr *group, unsigned short port) {
+	assert(group != NULL);
+	const uint32_t *g = (const uint32_t *) group->s6_addr;
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),					// next header
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 11),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 24),					// destination address
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(g[0]), 0, 9),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 28),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(g[1]), 0, 7),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 32),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(g[2]), 0, 5),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 36),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(g[3]), 0, 3),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 42),					// UDP destination port
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0x40000),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	return ring_open(r, ifname, ETH_P_IPV6, code, sizeof(code) / sizeof(code[0]));
+}
+
+
+// Parse the IP and UDP headers of one frame and hand the payload to the callback
+static int ring_deliver(char *data, int len, ring_callback cb, void *ptr) {
+	struct udphdr *udp;
+	int ulen;
+
+	if (len < 1)
+		return 0;
+	if ((data[0] >> 4) == 4) {
+		struct iphdr *ip = (struct iphdr *) data;
+		struct sockaddr_in from;
+		int ihl = ip->ihl * 4;
+		if ((len < ihl + (int) sizeof(struct udphdr)) || (ihl < (int) sizeof(struct iphdr)))
+			return 0;
+		udp = (struct udphdr *) (data + ihl);
+		ulen = ntohs(udp->len);
+		if ((ulen < (int) sizeof(struct udphdr)) || (ihl + ulen > len))
+			return 0;
+		memset(&from, 0, sizeof(from));
+		from.sin_family = AF_INET;
+		from.sin_addr.s_addr = ip->saddr;
+		from.sin_port = udp->source;
+		return cb(ptr, (char *) (udp + 1), ulen - sizeof(struct udphdr), (struct sockaddr *) &from);
+	} else {
+		struct ip6_hdr *ip6 = (struct ip6_hdr *) data;
+		struct sockaddr_in6 from;
+		if (len < (int) (sizeof(struct ip6_hdr) + sizeof(struct udphdr)))
+			return 0;
+		udp = (struct udphdr *) (ip6 + 1);
+		ulen = ntohs(udp->len);
+		if ((ulen < (int) sizeof(struct udphdr)) || ((int) sizeof(struct ip6_hdr) + ulen > len))
+			return 0;
+		memset(&from, 0, sizeof(from));
+		from.sin6_family = AF_INET6;
+		from.sin6_addr = ip6->ip6_src;
+		from.sin6_port = udp->source;
+		return cb(ptr, (char *) (udp + 1), ulen - sizeof(struct udphdr), (struct sockaddr *) &from);
+	}
+}
+
+
+// Deliver all datagrams in the blocks already released by the kernel; does not block
+// UDP checksums are not verified on this path
+int ring_read(PKT_RING *r, ring_callback cb, void *ptr) {
+	assert((r != NULL) && (cb != NULL));
+	if (r->map == NULL)
+		return -1;
+	for (;;) {
+		struct tpacket_block_desc *pbd =
+			(struct tpacket_block_desc *) (r->map + (size_t) r->cur * RING_BLOCK_SIZE);
+		if (!(__atomic_load_n(&pbd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			return 0;	// The kernel still owns the block
+
+		int i, res = 0, num = pbd->hdr.bh1.num_pkts;
+		struct tpacket3_hdr *ppd = (struct tpacket3_hdr *) ((char *) pbd + pbd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; (i < num) && (res == 0); i++) {
+			struct sockaddr_ll *sll = (struct sockaddr_ll *)
+				((char *) ppd + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+			// Skip our own datagrams, seen twice on the loopback device, and truncated frames
+			if ((sll->sll_pkttype != PACKET_OUTGOING) && (ppd->tp_snaplen == ppd->tp_len))
+				res = ring_deliver((char *) ppd + ppd->tp_net, ppd->tp_snaplen, cb, ptr);
+			ppd = (struct tpacket3_hdr *) ((char *) ppd + ppd->tp_next_offset);
+		}
+		// Return the block to the kernel
+		__atomic_store_n(&pbd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		r->cur = (r->cur + 1) % RING_BLOCK_NR;
+		if (res != 0)
+			return res;
+	}
+}
+
+
+// Unmap the ring and close the socket
+void ring_close(PKT_RING *r) {
+	assert(r != NULL);
+	if (r->map != NULL) {
+		munmap(r->map, r->map_len);
+		r->map = NULL;
+	}
+	if (r->fd >= 0) {
+		close(r->fd);
+		r->fd = -1;
+	}
+}
@@ -0,0 +1,58 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * ring.h
+ *
+ * Header file of functions that capture multicast UDP datagrams with an
+ * AF_PACKET socket and a TPACKET_V3 memory-mapped ring
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef _INCL_RING_H_
+#define _INCL_RING_H_
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <glib.h>
+
+// Ring geometry: RING_BLOCK_NR blocks of RING_BLOCK_SIZE bytes
+#define RING_BLOCK_SIZE		(1 << 20)
+#define RING_BLOCK_NR		64
+#define RING_FRAME_SIZE		2048
+// Time (ms) after which the kernel hands a partially filled block to the user
+#define RING_BLOCK_TIMEOUT	2
+
+// Memory-mapped capture ring
+typedef struct PKT_RING {
+	int fd;				// AF_PACKET socket; -1 if the ring is not used
+	char *map;			// Mapped ring
+	size_t map_len;		// Mapped ring length
+	int cur;			// Next block to read
+} PKT_RING;
+
+// Callback for each captured datagram: returns 0 to continue, or a value that stops ring_read
+typedef int (*ring_callback)(void *ptr, char *data, int len, const struct sockaddr *from);
+
+// Initialize an unused ring descriptor
+void ring_init(PKT_RING *r);
+
+// Open a ring capturing the UDP datagrams sent to group:port (port in host order)
+// ifname = interface name, or NULL for all interfaces
+gboolean ring_open_ipv4(PKT_RING *r, const char *ifname, struct in_addr *group, unsigned short port);
+gboolean ring_open_ipv6(PKT_RING *r, const char *ifname, struct in6_addr *group, unsigned short port);
+
+// Deliver all datagrams in the blocks already released by the kernel; does not block
+// Returns 0, -1 on error, or the first non-zero value returned by the callback
+int ring_read(PKT_RING *r, ring_callback cb, void *ptr);
+
+// Unmap the ring and close the socket
+void ring_close(PKT_RING *r);
+
+// Return the MTU of interface 'ifname', or -1
+int get_interface_mtu(const char *ifname);
+
+// Attach a filter that discards every datagram received by socket 's'
+gboolean socket_drop_all(int s);
+
+#endif
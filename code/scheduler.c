@@ -0,0 +1,399 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * scheduler.c
+ *
+ * Download scheduler. The requests wait in a priority queue (FIFO among
+ *   equal priorities) and a scheduler thread starts them while:
+ *   - the weights of the running transfers fit in the effective limit, which
+ *     starts at the slot count and moves by one slot when the aggregate
+ *     goodput grows or drops by SCHED_GAIN_PCT with work queued. The slot
+ *     count is 'receiver_max_transfers', capped by the number of workers:
+ *     a transfer holds its worker until it ends, so with workers running
+ *     their number is a hard limit on the concurrent transfers;
+ *   - the kernel's dirty and writeback data is below 'receiver_max_dirty_mb'.
+ *   When a running transfer has received 'receiver_prefetch_pct' of its
+ *   blocks, the head of the queue is started as a prefetch: it runs the TCP
+ *   handshake and waits for a slot before joining the group and sending OK;
+ *   it also holds a worker, so it needs one spare.
+ *   The sender only waits OK_timeout for the OK, so a prefetch that does not
+ *   get a slot within half of it gives up and goes back to the queue.
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "engine.h"
+#include "receiver_th.h"
+#include "registry.h"
+#include "workers.h"
+#include "logger.h"
+#include "scheduler.h"
+
+// Queued request
+typedef struct SCHED_ITEM {
+	char fname[81];			// Requested file
+	char ip[128];			// Sender's address
+	int port;				// Sender's TCP port
+	int prio;				// Higher starts first
+	int weight;				// Slots taken while running
+	unsigned long seq;		// Arrival order, among equal priorities
+	gint64 not_before;		// Earliest prefetch time (monotonic us)
+} SCHED_ITEM;
+
+// State of the prefetch slot
+#define PF_NONE		0	// No prefetch
+#define PF_RUNNING	1	// Handshake running
+#define PF_WAITING	2	// Handshake done, waiting for a slot
+
+// Scheduler state; protected by 'smutex'
+static GQueue queue= G_QUEUE_INIT;	// SCHED_ITEM, sorted by priority
+static unsigned long seq_cnt= 0;	// Arrival counter
+static int n_active= 0;				// Admitted transfers running
+static int launching= 0;			// Admitted requests being started, not yet in the registry
+static int active_weight= 0;		// Sum of their weights
+static int limit_eff= 0;			// Effective limit, in weight units
+static SCHED_ITEM *pf_item= NULL;	// Request of the prefetched transfer
+static int pf_state= PF_NONE;		// State of the prefetch
+static unsigned pf_gen= 0;			// Prefetch number, so a waiter never takes a later prefetch as its own
+static long long done_bytes= 0;		// Bytes received by the transfers already ended
+static long long backlog_kb= 0;		// Dirty and writeback data, last sample (kB)
+static gboolean near_end= FALSE;	// A running transfer passed 'receiver_prefetch_pct'
+
+static pthread_mutex_t smutex= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scond= PTHREAD_COND_INITIALIZER;	// State changes, for the thread and the waiter
+static pthread_t sched_tid;
+static gboolean sched_running= FALSE;
+static gboolean sched_quit= FALSE;
+
+
+/** Absolute time 'ms' milliseconds from now, for pthread_cond_timedwait */
+static void deadline_ms(struct timespec *ts, int ms) {
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec+= ms / 1000;
+	ts->tv_nsec+= (long)(ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec-= 1000000000L;
+	}
+}
+
+
+/** Order of the queue: higher priority first, then arrival order */
+static gint item_cmp(gconstpointer a, gconstpointer b, gpointer data) {
+	const SCHED_ITEM *x= (const SCHED_ITEM *)a, *y= (const SCHED_ITEM *)b;
+	if (x->prio != y->prio)
+		return (x->prio > y->prio) ? -1 : 1;
+	return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+
+/** Read the dirty and writeback data waiting for the disk (kB); -1 if unknown */
+static long long read_disk_backlog(void) {
+	char line[128];
+	long long kb= 0, v;
+	FILE *f= fopen("/proc/meminfo", "r");
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if ((sscanf(line, "Dirty: %lld kB", &v) == 1) || (sscanf(line, "Writeback: %lld kB", &v) == 1))
+			kb+= v;
+	}
+	fclose(f);
+	return kb;
+}
+
+
+/** Number of slots: 'receiver_max_transfers', capped by the number of workers (0= no limit) */
+static int max_slots(void) {
+	int nw= workers_count();
+	if (receiver_max_transfers <= 0)
+		return nw;
+	return (nw > 0) ? min(receiver_max_transfers, nw) : receiver_max_transfers;
+}
+
+
+/** TRUE if no worker is free for another transfer; 'smutex' is locked */
+static gboolean workers_busy(void) {
+	int nw= workers_count();
+	return (nw > 0) && (n_active + (pf_state != PF_NONE) >= nw);
+}
+
+
+/** TRUE if a transfer of weight 'w' may start now; 'smutex' is locked */
+static gboolean can_admit(int w) {
+	if (!active)
+		return FALSE;
+	if (n_active == 0)
+		return TRUE;	// Always keep one transfer running
+	if (active_weight + w > limit_eff)
+		return FALSE;
+	if ((receiver_max_dirty_mb > 0) && (backlog_kb > (long long)receiver_max_dirty_mb * 1024))
+		return FALSE;
+	return TRUE;
+}
+
+
+// Totals collected from the registry
+typedef struct SCHED_SAMPLE {
+	long long bytes;	// Bytes received by the running transfers
+	gboolean near_end;	// One of them passed 'receiver_prefetch_pct'
+} SCHED_SAMPLE;
+
+/** Add the progress of one transfer to the sample; the registry shard is read-locked */
+static void sample_transfer(ReceiverTh *t, gpointer data) {
+	SCHED_SAMPLE *s= (SCHED_SAMPLE *)data;
+	if ((t->self != t) || bitmask_isempty(&t->bmask))
+		return;
+	long long got= __atomic_load_n(&t->n_recv, __ATOMIC_RELAXED);
+	s->bytes+= got * t->block_size;
+	if ((t->sched_weight > 0) && (got * 100 >= t->bmask.b_len * (long long)receiver_prefetch_pct))
+		s->near_end= TRUE;
+}
+
+
+/** Start the request 'it', admitted or as a prefetch; 'smutex' is locked and released meanwhile */
+static void launch(SCHED_ITEM *it, gboolean prefetch) {
+	if (prefetch) {
+		pf_item= it;
+		pf_state= PF_RUNNING;
+		pf_gen++;
+	} else {
+		n_active++;
+		active_weight+= it->weight;
+		launching++;	// Still pending until it is registered (a prefetch is counted by pf_state)
+	}
+	pthread_mutex_unlock(&smutex);	// Starting takes rmutex, which is held while releasing slots
+	LOG_INFO("SCH> ", "starting a queued transfer (weight %ld, prefetch %ld)", it->weight, prefetch, 0, 0);
+	ReceiverTh *t= start_file_download_sched(it->fname, it->ip, it->port, it->weight, prefetch);
+	pthread_mutex_lock(&smutex);
+	if (!prefetch)
+		launching--;
+	if (t != NULL) {
+		if (!prefetch)
+			free(it);
+		return;
+	}
+	// Failed to start; nothing was released by the transfer
+	if (prefetch) {
+		pf_item= NULL;
+		pf_state= PF_NONE;
+	} else {
+		n_active--;
+		active_weight-= it->weight;
+	}
+	free(it);
+}
+
+
+/** Scheduler thread: samples the transfers and starts the queued requests */
+static void *sched_thread_function(void *ptr) {
+	gint64 last_eval= g_get_monotonic_time();
+	long long last_bytes= -1;
+	double goodput= 0;	// Bytes/s at the previous evaluation
+	struct timespec ts;
+
+	pthread_mutex_lock(&smutex);
+	while (!sched_quit) {
+		SCHED_SAMPLE s= {0, FALSE};
+		long long bk;
+		gint64 now;
+
+		// Sample without holding 'smutex': the registry locks are taken
+		pthread_mutex_unlock(&smutex);
+		registry_foreach(sample_transfer, &s);
+		bk= read_disk_backlog();
+		now= g_get_monotonic_time();
+		pthread_mutex_lock(&smutex);
+
+		backlog_kb= (bk < 0) ? 0 : bk;
+		near_end= s.near_end;
+		s.bytes+= done_bytes;
+		if (now - last_eval >= SCHED_EVAL_MS * 1000L) {
+			if (last_bytes >= 0) {
+				double gp= (s.bytes - last_bytes) * 1e6 / (now - last_eval);
+				// Probe the limit only when there is work waiting for a slot
+				if (!g_queue_is_empty(&queue) && (active_weight >= limit_eff)) {
+					if ((gp > goodput * (100 + SCHED_GAIN_PCT) / 100) && (limit_eff < max_slots()))
+						limit_eff++;
+					else if ((gp < goodput * (100 - SCHED_GAIN_PCT) / 100) && (limit_eff > 1))
+						limit_eff--;
+				}
+				goodput= gp;
+			}
+			last_bytes= s.bytes;
+			last_eval= now;
+		}
+
+		// Start the queued requests; a prefetched transfer goes first
+		if (pf_state == PF_NONE) {
+			SCHED_ITEM *it;
+			while (((it= (SCHED_ITEM *)g_queue_peek_head(&queue)) != NULL) && !workers_busy()
+					&& can_admit(it->weight)) {
+				g_queue_pop_head(&queue);
+				launch(it, FALSE);
+			}
+			if ((it != NULL) && active && near_end && (it->not_before <= now) && (pf_state == PF_NONE)
+					&& !workers_busy()) {
+				g_queue_pop_head(&queue);
+				launch(it, TRUE);
+			}
+		} else if (pf_state == PF_WAITING) {
+			pthread_cond_broadcast(&scond);	// The waiter checks the new sample
+		}
+
+		deadline_ms(&ts, SCHED_TICK_MS);
+		pthread_cond_timedwait(&scond, &smutex, &ts);
+	}
+	pthread_mutex_unlock(&smutex);
+	return NULL;
+}
+
+
+/** Queue the download of 'name' from 'ip':'port'. Higher 'prio' starts first; 'weight'
+ *  is the number of slots the transfer takes. Without a limit or workers, starts it now */
+gboolean sched_submit(const char *name, const char *ip, int port, int prio, int weight) {
+	int slots= max_slots();
+	if (slots <= 0)
+		return (start_file_download(name, ip, port) != NULL);
+	if ((name == NULL) || (ip == NULL) || (port <= 0) || (strlen(name) >= sizeof(((SCHED_ITEM *)0)->fname)))
+		return FALSE;
+
+	SCHED_ITEM *it= (SCHED_ITEM *)malloc(sizeof(SCHED_ITEM));
+	if (it == NULL)
+		return FALSE;
+	strcpy(it->fname, name);
+	strncpy(it->ip, ip, sizeof(it->ip) - 1);
+	it->ip[sizeof(it->ip) - 1]= '\0';
+	it->port= port;
+	it->prio= prio;
+	it->weight= (weight < 1) ? 1 : min(weight, slots);
+	it->not_before= 0;
+
+	pthread_mutex_lock(&smutex);
+	if (!sched_running) {
+		limit_eff= slots;
+		sched_quit= FALSE;
+		if (pthread_create(&sched_tid, NULL, sched_thread_function, NULL)) {
+			perror("SCH> pthread_create");
+			pthread_mutex_unlock(&smutex);
+			free(it);
+			return FALSE;
+		}
+		sched_running= TRUE;
+	}
+	it->seq= seq_cnt++;
+	g_queue_insert_sorted(&queue, it, item_cmp, NULL);
+	pthread_cond_broadcast(&scond);
+	LOG_INFO("SCH> ", "request queued (priority %ld, weight %ld, %ld waiting)", prio, it->weight,
+			g_queue_get_length(&queue), 0);
+	pthread_mutex_unlock(&smutex);
+	return TRUE;
+}
+
+
+/** Number of queued requests, including a prefetched one waiting for a slot and the ones
+ *  being started, which are not in the registry yet */
+int sched_pending(void) {
+	pthread_mutex_lock(&smutex);
+	int n= g_queue_get_length(&queue) + (pf_state != PF_NONE) + launching;
+	pthread_mutex_unlock(&smutex);
+	return n;
+}
+
+
+/** Drop the queued requests (the running transfers are not stopped) */
+void sched_clear(void) {
+	SCHED_ITEM *it;
+	pthread_mutex_lock(&smutex);
+	while ((it= (SCHED_ITEM *)g_queue_pop_head(&queue)) != NULL)
+		free(it);
+	pthread_mutex_unlock(&smutex);
+}
+
+
+/** Stop the scheduler thread */
+void sched_stop(void) {
+	pthread_mutex_lock(&smutex);
+	if (!sched_running) {
+		pthread_mutex_unlock(&smutex);
+		return;
+	}
+	sched_quit= TRUE;
+	pthread_cond_broadcast(&scond);
+	pthread_mutex_unlock(&smutex);
+	pthread_join(sched_tid, NULL);
+	sched_running= FALSE;
+	sched_clear();
+}
+
+
+/** Wait for a slot after the handshake of a prefetched transfer; returns SCHED_*.
+ *  When it returns SCHED_CANCELLED, 't' was freed by sched_release */
+int sched_wait_admission(ReceiverTh *t) {
+	struct timespec ts;
+	int res= SCHED_CANCELLED;
+	unsigned gen;
+
+	deadline_ms(&ts, OK_timeout / 2);
+	pthread_mutex_lock(&smutex);
+	gen= pf_gen;
+	if (pf_state == PF_RUNNING)
+		pf_state= PF_WAITING;
+	while ((pf_state == PF_WAITING) && (pf_gen == gen)) {
+		if (can_admit(pf_item->weight)) {
+			// 't' is alive: sched_release clears the prefetch before it is freed
+			n_active++;
+			active_weight+= pf_item->weight;
+			t->sched_weight= pf_item->weight;
+			t->sched_prefetch= FALSE;
+			res= SCHED_ADMITTED;
+			break;
+		}
+		if (pthread_cond_timedwait(&scond, &smutex, &ts) == ETIMEDOUT) {
+			// Back to the queue; retry the prefetch after one SRR period
+			t->sched_prefetch= FALSE;
+			pf_item->not_before= g_get_monotonic_time() + receiver_SRR_timeout * 1000L;
+			g_queue_insert_sorted(&queue, pf_item, item_cmp, NULL);
+			pf_item= NULL;
+			res= SCHED_TIMEOUT;
+			break;
+		}
+	}
+	if (res == SCHED_ADMITTED)
+		free(pf_item);
+	if (res != SCHED_CANCELLED) {
+		pf_item= NULL;
+		pf_state= PF_NONE;
+		pthread_cond_broadcast(&scond);
+	}
+	pthread_mutex_unlock(&smutex);
+	return res;
+}
+
+
+/** Release the slot of a transfer; called when it is freed */
+void sched_release(ReceiverTh *t) {
+	pthread_mutex_lock(&smutex);
+	if (t->sched_weight > 0) {
+		n_active--;
+		active_weight-= t->sched_weight;
+		done_bytes+= __atomic_load_n(&t->n_recv, __ATOMIC_RELAXED) * t->block_size;
+		t->sched_weight= 0;
+		pthread_cond_broadcast(&scond);
+	} else if (t->sched_prefetch && (pf_state != PF_NONE)) {
+		// Stopped during the handshake or while waiting: the request is dropped
+		t->sched_prefetch= FALSE;
+		free(pf_item);
+		pf_item= NULL;
+		pf_state= PF_NONE;
+		pthread_cond_broadcast(&scond);
+	}
+	pthread_mutex_unlock(&smutex);
+}
@@ -0,0 +1,49 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * scheduler.h
+ *
+ * Header file of the download scheduler: queues the requested files by
+ *   priority and starts them while the concurrency limit, the aggregate
+ *   goodput and the disk-writer backlog allow it
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_SCHEDULER_H
+#define HAVE_SCHEDULER_H
+
+#include <glib.h>
+
+struct ReceiverTh;
+
+// Period (ms) of the scheduler thread
+#define SCHED_TICK_MS		250
+// Period (ms) between goodput measurements that adapt the effective limit
+#define SCHED_EVAL_MS		2000
+// Relative goodput change (%) that opens or closes one more slot
+#define SCHED_GAIN_PCT		5
+
+// Result of sched_wait_admission
+#define SCHED_ADMITTED		0	// The transfer got a slot
+#define SCHED_TIMEOUT		1	// No slot before the sender's OK timeout; the request was queued again
+#define SCHED_CANCELLED		2	// The transfer was stopped while waiting; it was freed
+
+// Queue the download of 'name' from 'ip':'port'. Higher 'prio' starts first; 'weight'
+//   is the number of slots the transfer takes. Without a limit, starts it now
+gboolean sched_submit(const char *name, const char *ip, int port, int prio, int weight);
+// Number of queued requests, including a prefetched one waiting for a slot and the ones
+//   being started, which are not in the registry yet
+int sched_pending(void);
+// Drop the queued requests (the running transfers are not stopped)
+void sched_clear(void);
+// Stop the scheduler thread
+void sched_stop(void);
+
+/* Functions used by the transfers */
+// Wait for a slot after the handshake of a prefetched transfer; returns SCHED_*
+int sched_wait_admission(struct ReceiverTh *t);
+// Release the slot of a transfer; called when it is freed
+void sched_release(struct ReceiverTh *t);
+
+#endif
@@ -0,0 +1,947 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * simnet.c
+ *
+ * Simulated network. The engine threads are real threads, but only the one
+ *   holding the baton runs: it runs until it blocks in select, poll, recv or
+ *   connect, and then returns the baton to simnet_run. When no thread can run,
+ *   simnet_run takes the next event of a heap ordered by virtual time (and by
+ *   creation, for equal times) and advances the clock to it. The engine code
+ *   takes no virtual time, so the results do not depend on the host.
+ *
+ *   Each node has its own sockets, numbered from SIM_FD0. The multicast
+ *   datagrams are copied to the member sockets bound to their port, after a
+ *   delay with jitter and a Gilbert-Elliott loss process per node; the TCP
+ *   bytes keep their order and are never lost.
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		// recvmmsg
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <linux/sock_diag.h>
+#include "simnet.h"
+
+#define SIM_FD0			512			// First socket number of each node, above the real descriptors
+#define SIM_STACK		(256 * 1024)	// Stack of the engine threads
+#define SIM_EPOCH_S		1700000000LL	// Wall clock time (s) at virtual time 0
+#define SIM_SENDER_PORT	20000		// Source port of the datagrams received by the nodes
+
+// Payload shared by the copies of a datagram
+typedef struct SIM_BUF {
+	int refs;
+	int len;
+	unsigned char data[];
+} SIM_BUF;
+
+// Datagram queued in a socket
+typedef struct SIM_PKT {
+	SIM_BUF *b;
+	struct SIM_PKT *next;
+} SIM_PKT;
+
+typedef struct SIM_SOCK {
+	int used;
+	int family;				// AF_INET or AF_INET6
+	int type;				// SOCK_DGRAM or SOCK_STREAM
+	int port;				// Bound port
+	int member;				// Joined a multicast group
+	long long rcvtimeo;		// SO_RCVTIMEO (ns; 0= none)
+	SIM_PKT *head, *tail;	// Queued datagrams
+	int queued;				// ... bytes
+	unsigned drops;			// Datagrams dropped because the queue was full
+	unsigned char *rx;		// TCP bytes not read yet
+	int rx_len, rx_size;
+} SIM_SOCK;
+
+// Thread states
+#define TH_RUNNABLE		0
+#define TH_RUNNING		1
+#define TH_BLOCKED		2
+#define TH_DONE			3
+
+typedef struct SIM_THREAD {
+	pthread_cond_t cv;		// Signalled when the thread gets the baton
+	int run;				// The thread has the baton
+	int state;
+	unsigned gen;			// Incremented when the thread wakes; cancels the pending timeouts
+	int node;
+	void *(*fn)(void *);
+	void *arg;
+	struct SIM_THREAD *next;		// Run queue or free list
+	struct SIM_THREAD *bnext, *bprev;	// Threads blocked in the node
+} SIM_THREAD;
+
+// Two-state loss process: no losses in the good state, every packet lost in the bad one
+typedef struct SIM_LOSS {
+	int bad;
+} SIM_LOSS;
+
+typedef struct SIM_NODE {
+	SIM_SOCK socks[SIM_MAX_FDS];
+	int tcp_fd;				// Socket connected to the sender (-1= none)
+	SIM_THREAD *blocked;	// Threads waiting for data or a timeout
+	unsigned long long rng;	// Generator of the node's losses and jitter
+	SIM_LOSS down, up;
+} SIM_NODE;
+
+// Event types
+#define EV_START		0	// Start a node
+#define EV_TIMER		1	// Sender timer
+#define EV_WAKE			2	// Timeout of a blocked thread
+#define EV_MCAST		3	// Multicast datagram arrives at a node
+#define EV_TCP_DOWN		4	// TCP bytes arrive at a node
+#define EV_TCP_UP		5	// TCP bytes arrive at the sender
+#define EV_TCP_CLOSE	6	// The node's TCP close arrives at the sender
+#define EV_UDP_UP		7	// Datagram arrives at the sender
+
+typedef struct SIM_EVT {
+	long long t;			// Virtual time
+	unsigned long long seq;	// Creation order, for events with the same time
+	int type;
+	int node;
+	int port;
+	unsigned gen;			// Thread generation (EV_WAKE)
+	SIM_THREAD *th;
+	SIM_BUF *b;
+	void (*start)(int node);
+	void (*fn)(void *arg);
+	void *arg;
+} SIM_EVT;
+
+
+static SIM_PARAMS prm;
+static SIM_SENDER snd;
+static SIM_STATS stats;
+static SIM_NODE *nodes= NULL;
+static int n_nodes= 0;
+
+static long long now= 0;			// Virtual time (ns)
+static SIM_EVT *heap= NULL;			// Events, as a binary heap
+static int heap_n= 0, heap_size= 0;
+static unsigned long long evt_seq= 0;
+
+// The engine threads and the sender never run at the same time, so the state
+//  above is only locked to pass the baton
+static pthread_mutex_t sim_mx= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t main_cv= PTHREAD_COND_INITIALIZER;	// Signalled when the baton returns
+static int main_turn= 0;
+static SIM_THREAD *run_head= NULL, *run_tail= NULL;	// Threads ready to run
+static SIM_THREAD *th_free= NULL;	// Ended threads, kept because old timeouts point to them
+static __thread SIM_THREAD *self= NULL;	// Thread running this code (NULL in the sender)
+static int start_node= -1;			// Node being started by an EV_START
+
+
+/* Random numbers */
+
+/** Next number of generator 'x' (splitmix64) */
+static unsigned long long sim_rand(unsigned long long *x) {
+	unsigned long long z= (*x += 0x9e3779b97f4a7c15ULL);
+	z= (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z= (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/** Uniform number in [0, 1[ */
+static double sim_uniform(unsigned long long *x) {
+	return (sim_rand(x) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/** TRUE if the next packet of link 'l' is lost; the bad state lasts 'burst' packets on average */
+static int sim_lost(const SIM_LINK *l, SIM_LOSS *s, unsigned long long *x) {
+	if (l->loss <= 0)
+		return 0;
+	if (l->burst <= 1)
+		return sim_uniform(x) < l->loss;
+	if (s->bad)
+		s->bad= sim_uniform(x) >= 1.0 / l->burst;
+	else
+		s->bad= sim_uniform(x) < l->loss / (l->burst * (1 - l->loss));
+	return s->bad;
+}
+
+/** Delay of the next packet of link 'l' */
+static long long sim_delay(const SIM_LINK *l, unsigned long long *x) {
+	return l->delay_ns + ((l->jitter_ns > 0) ? (long long)(sim_rand(x) % l->jitter_ns) : 0);
+}
+
+
+/* Events */
+
+static void heap_push(SIM_EVT *e) {
+	int i;
+	if (heap_n == heap_size) {
+		heap_size= heap_size ? 2 * heap_size : 4096;
+		heap= (SIM_EVT *)realloc(heap, heap_size * sizeof(SIM_EVT));
+		assert(heap != NULL);
+	}
+	e->seq= evt_seq++;
+	for (i= heap_n++; i > 0; i= (i - 1) / 2) {
+		SIM_EVT *p= &heap[(i - 1) / 2];
+		if ((p->t < e->t) || ((p->t == e->t) && (p->seq < e->seq)))
+			break;
+		heap[i]= *p;
+	}
+	heap[i]= *e;
+}
+
+static void heap_pop(SIM_EVT *e) {
+	int i= 0, c;
+	*e= heap[0];
+	SIM_EVT *last= &heap[--heap_n];
+	while ((c= 2 * i + 1) < heap_n) {
+		if ((c + 1 < heap_n) && ((heap[c + 1].t < heap[c].t) ||
+				((heap[c + 1].t == heap[c].t) && (heap[c + 1].seq < heap[c].seq))))
+			c++;
+		if ((last->t < heap[c].t) || ((last->t == heap[c].t) && (last->seq < heap[c].seq)))
+			break;
+		heap[i]= heap[c];
+		i= c;
+	}
+	heap[i]= *last;
+}
+
+static SIM_BUF *buf_new(const void *data, int len) {
+	SIM_BUF *b= (SIM_BUF *)malloc(sizeof(SIM_BUF) + len);
+	assert(b != NULL);
+	b->refs= 1;
+	b->len= len;
+	memcpy(b->data, data, len);
+	return b;
+}
+
+static void buf_unref(SIM_BUF *b) {
+	if (--b->refs == 0)
+		free(b);
+}
+
+/** Queue an event of 'type' for 'node', carrying 'b' */
+static void sim_event(long long t, int type, int node, SIM_BUF *b) {
+	SIM_EVT e;
+	memset(&e, 0, sizeof(e));
+	e.t= t;
+	e.type= type;
+	e.node= node;
+	e.b= b;
+	heap_push(&e);
+}
+
+
+/* Engine threads */
+
+/** Append 'th' to the run queue */
+static void sim_runnable(SIM_THREAD *th) {
+	if (th->state == TH_BLOCKED) {
+		SIM_NODE *nd= &nodes[th->node];
+		if (th->bprev != NULL)
+			th->bprev->bnext= th->bnext;
+		else
+			nd->blocked= th->bnext;
+		if (th->bnext != NULL)
+			th->bnext->bprev= th->bprev;
+	}
+	th->state= TH_RUNNABLE;
+	th->gen++;
+	th->next= NULL;
+	if (run_tail != NULL)
+		run_tail->next= th;
+	else
+		run_head= th;
+	run_tail= th;
+}
+
+/** Wake the threads of node 'nd' that are waiting */
+static void sim_wake_node(SIM_NODE *nd) {
+	while (nd->blocked != NULL)
+		sim_runnable(nd->blocked);
+}
+
+/** Return the baton and wait for it; called with sim_mx locked */
+static void sim_yield(SIM_THREAD *th) {
+	main_turn= 1;
+	pthread_cond_signal(&main_cv);
+	while (!th->run)
+		pthread_cond_wait(&th->cv, &sim_mx);
+	th->run= 0;
+}
+
+/** Block the calling thread until its node receives data or the virtual time reaches 'deadline' (-1= none) */
+static void sim_block(long long deadline) {
+	SIM_THREAD *th= self;
+	SIM_NODE *nd;
+	assert(th != NULL);		// The sender never blocks
+	nd= &nodes[th->node];
+	th->state= TH_BLOCKED;
+	th->bprev= NULL;
+	th->bnext= nd->blocked;
+	if (nd->blocked != NULL)
+		nd->blocked->bprev= th;
+	nd->blocked= th;
+	if (deadline >= 0) {
+		SIM_EVT e;
+		memset(&e, 0, sizeof(e));
+		e.t= deadline;
+		e.type= EV_WAKE;
+		e.th= th;
+		e.gen= th->gen;
+		heap_push(&e);
+	}
+	pthread_mutex_lock(&sim_mx);
+	sim_yield(th);
+	pthread_mutex_unlock(&sim_mx);
+}
+
+/** Body of the engine threads: waits for the baton before running 'fn' */
+static void *sim_thread_main(void *ptr) {
+	SIM_THREAD *th= (SIM_THREAD *)ptr;
+	void *res;
+	pthread_mutex_lock(&sim_mx);
+	while (!th->run)
+		pthread_cond_wait(&th->cv, &sim_mx);
+	th->run= 0;
+	pthread_mutex_unlock(&sim_mx);
+	self= th;
+	res= th->fn(th->arg);
+	pthread_mutex_lock(&sim_mx);
+	th->state= TH_DONE;
+	main_turn= 1;
+	pthread_cond_signal(&main_cv);
+	pthread_mutex_unlock(&sim_mx);
+	return res;
+}
+
+/** Give the baton to 'th' and wait until it blocks or ends; called with sim_mx locked */
+static void sim_give(SIM_THREAD *th) {
+	th->state= TH_RUNNING;
+	th->run= 1;
+	main_turn= 0;
+	pthread_cond_signal(&th->cv);
+	while (!main_turn)
+		pthread_cond_wait(&main_cv, &sim_mx);
+	stats.switches++;
+	if (th->state == TH_DONE) {
+		th->next= th_free;
+		th_free= th;
+	}
+}
+
+/** Node of the running code */
+static SIM_NODE *sim_node(void) {
+	int node= (self != NULL) ? self->node : start_node;
+	return (node >= 0) ? &nodes[node] : NULL;
+}
+
+
+/* Sockets */
+
+/** Socket 's' of the running node, or NULL (errno= EBADF) */
+static SIM_SOCK *sim_sock(int s) {
+	SIM_NODE *nd= sim_node();
+	if ((nd == NULL) || (s < SIM_FD0) || (s >= SIM_FD0 + SIM_MAX_FDS) || !nd->socks[s - SIM_FD0].used) {
+		errno= EBADF;
+		return NULL;
+	}
+	return &nd->socks[s - SIM_FD0];
+}
+
+/** TRUE if a read of 'k' would not block */
+static int sim_readable(const SIM_SOCK *k) {
+	return (k->head != NULL) || (k->rx_len > 0);
+}
+
+/** Remaining time until 'deadline' in 'tv' */
+static void sim_remaining(long long deadline, struct timeval *tv) {
+	long long left= (deadline > now) ? deadline - now : 0;
+	tv->tv_sec= left / 1000000000LL;
+	tv->tv_usec= (left % 1000000000LL) / 1000;
+}
+
+/** Deadline of a read of 'k'; 'flags' may have MSG_DONTWAIT */
+static long long sim_read_deadline(const SIM_SOCK *k, int flags) {
+	if (flags & MSG_DONTWAIT)
+		return now;
+	return (k->rcvtimeo > 0) ? now + k->rcvtimeo : -1;
+}
+
+/** Dequeue one datagram of 'k' */
+static SIM_BUF *sim_dequeue(SIM_SOCK *k) {
+	SIM_PKT *p= k->head;
+	SIM_BUF *b;
+	if (p == NULL)
+		return NULL;
+	if ((k->head= p->next) == NULL)
+		k->tail= NULL;
+	b= p->b;
+	k->queued-= b->len;
+	free(p);
+	return b;
+}
+
+/** Address of the sender, as seen by 'k' */
+static void sim_sender_addr(const SIM_SOCK *k, struct sockaddr *from, socklen_t *from_len) {
+	if ((from == NULL) || (from_len == NULL))
+		return;
+	if (k->family == AF_INET6) {
+		struct sockaddr_in6 a;
+		memset(&a, 0, sizeof(a));
+		a.sin6_family= AF_INET6;
+		a.sin6_addr= in6addr_loopback;
+		a.sin6_port= htons(SIM_SENDER_PORT);
+		memcpy(from, &a, (*from_len < sizeof(a)) ? *from_len : sizeof(a));
+		*from_len= sizeof(a);
+	} else {
+		struct sockaddr_in a;
+		memset(&a, 0, sizeof(a));
+		a.sin_family= AF_INET;
+		a.sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+		a.sin_port= htons(SIM_SENDER_PORT);
+		memcpy(from, &a, (*from_len < sizeof(a)) ? *from_len : sizeof(a));
+		*from_len= sizeof(a);
+	}
+}
+
+static int sim_socket(int domain, int type, int protocol) {
+	SIM_NODE *nd= sim_node();
+	int i;
+	if (nd == NULL) {
+		errno= EPERM;
+		return -1;
+	}
+	for (i= 0; i < SIM_MAX_FDS; i++) {
+		if (!nd->socks[i].used) {
+			memset(&nd->socks[i], 0, sizeof(SIM_SOCK));
+			nd->socks[i].used= 1;
+			nd->socks[i].family= domain;
+			nd->socks[i].type= type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+			return SIM_FD0 + i;
+		}
+	}
+	errno= EMFILE;
+	return -1;
+}
+
+static int sim_bind(int s, const struct sockaddr *addr, socklen_t len) {
+	SIM_SOCK *k= sim_sock(s);
+	if (k == NULL)
+		return -1;
+	if (addr->sa_family == AF_INET6)
+		k->port= ntohs(((const struct sockaddr_in6 *)addr)->sin6_port);
+	else
+		k->port= ntohs(((const struct sockaddr_in *)addr)->sin_port);
+	return 0;
+}
+
+/** Connects to the sender, after one round-trip time */
+static int sim_connect(int s, const struct sockaddr *addr, socklen_t len) {
+	SIM_SOCK *k= sim_sock(s);
+	if (k == NULL)
+		return -1;
+	if (k->type == SOCK_STREAM) {
+		long long deadline= now + prm.down.delay_ns + prm.up.delay_ns;
+		while (now < deadline)
+			sim_block(deadline);
+		sim_node()->tcp_fd= s;
+	}
+	return 0;
+}
+
+static int sim_setsockopt(int s, int level, int name, const void *val, socklen_t len) {
+	SIM_SOCK *k= sim_sock(s);
+	if (k == NULL)
+		return -1;
+	if ((level == SOL_SOCKET) && (name == SO_RCVTIMEO) && (len >= sizeof(struct timeval))) {
+		const struct timeval *tv= (const struct timeval *)val;
+		k->rcvtimeo= tv->tv_sec * 1000000000LL + tv->tv_usec * 1000LL;
+	} else if (((level == IPPROTO_IP) && (name == IP_ADD_MEMBERSHIP)) ||
+			((level == IPPROTO_IPV6) && (name == IPV6_ADD_MEMBERSHIP)))
+		k->member= 1;
+	else if (((level == IPPROTO_IP) && (name == IP_DROP_MEMBERSHIP)) ||
+			((level == IPPROTO_IPV6) && (name == IPV6_DROP_MEMBERSHIP)))
+		k->member= 0;
+	return 0;	// The other options have no effect
+}
+
+static int sim_getsockopt(int s, int level, int name, void *val, socklen_t *len) {
+	SIM_SOCK *k= sim_sock(s);
+	if (k == NULL)
+		return -1;
+#ifdef SO_MEMINFO
+	if ((level == SOL_SOCKET) && (name == SO_MEMINFO) && (*len >= SK_MEMINFO_VARS * sizeof(unsigned int))) {
+		unsigned int *mem= (unsigned int *)val;
+		memset(mem, 0, SK_MEMINFO_VARS * sizeof(unsigned int));
+		mem[SK_MEMINFO_RMEM_ALLOC]= k->queued;
+		mem[SK_MEMINFO_RCVBUF]= prm.rcvbuf;
+		mem[SK_MEMINFO_DROPS]= k->drops;
+		*len= SK_MEMINFO_VARS * sizeof(unsigned int);
+		return 0;
+	}
+#endif
+	errno= ENOPROTOOPT;
+	return -1;
+}
+
+static ssize_t sim_sendto(int s, const void *buf, size_t len, int flags, const struct sockaddr *to, socklen_t to_len) {
+	SIM_NODE *nd= sim_node();
+	SIM_SOCK *k= sim_sock(s);
+	if (k == NULL)
+		return -1;
+	if (k->type == SOCK_STREAM) {
+		// Arrives in order: every TCP segment has the same delay
+		sim_event(now + prm.up.delay_ns, EV_TCP_UP, nd - nodes, buf_new(buf, len));
+		return len;
+	}
+	stats.up_pkts++;
+	stats.up_bytes+= len;
+	if (sim_lost(&prm.up, &nd->up, &nd->rng))
+		stats.up_lost++;
+	else
+		sim_event(now + sim_delay(&prm.up, &nd->rng), EV_UDP_UP, nd - nodes, buf_new(buf, len));
+	return len;
+}
+
+static ssize_t sim_send(int s, const void *buf, size_t len, int flags) {
+	return sim_sendto(s, buf, len, flags, NULL, 0);
+}
+
+static ssize_t sim_recvfrom(int s, void *buf, size_t len, int flags, struct sockaddr *from, socklen_t *from_len) {
+	SIM_SOCK *k= sim_sock(s);
+	long long deadline;
+	int n;
+	if (k == NULL)
+		return -1;
+	deadline= sim_read_deadline(k, flags);
+	if (k->type == SOCK_STREAM) {
+		int need= (flags & MSG_WAITALL) ? (int)len : 1;
+		while ((k->rx_len < need) && ((deadline < 0) || (now < deadline)))
+			sim_block(deadline);
+		if (k->rx_len == 0) {
+			errno= EAGAIN;
+			return -1;
+		}
+		n= (k->rx_len < (int)len) ? k->rx_len : (int)len;
+		memcpy(buf, k->rx, n);
+		memmove(k->rx, k->rx + n, k->rx_len - n);
+		k->rx_len-= n;
+	} else {
+		SIM_BUF *b;
+		while ((k->head == NULL) && ((deadline < 0) || (now < deadline)))
+			sim_block(deadline);
+		if ((b= sim_dequeue(k)) == NULL) {
+			errno= EAGAIN;
+			return -1;
+		}
+		n= (b->len < (int)len) ? b->len : (int)len;
+		memcpy(buf, b->data, n);
+		buf_unref(b);
+	}
+	sim_sender_addr(k, from, from_len);
+	return n;
+}
+
+static ssize_t sim_recv(int s, void *buf, size_t len, int flags) {
+	return sim_recvfrom(s, buf, len, flags, NULL, NULL);
+}
+
+static int sim_recvmmsg(int s, struct mmsghdr *msgs, unsigned int vlen, int flags, struct timespec *timeout) {
+	SIM_SOCK *k= sim_sock(s);
+	unsigned i;
+	long long deadline;
+	if (k == NULL)
+		return -1;
+	deadline= sim_read_deadline(k, flags);
+	while ((k->head == NULL) && ((deadline < 0) || (now < deadline)))
+		sim_block(deadline);
+	for (i= 0; (i < vlen) && (k->head != NULL); i++) {
+		SIM_BUF *b= sim_dequeue(k);
+		struct msghdr *h= &msgs[i].msg_hdr;
+		int off= 0, j;
+		for (j= 0; (j < (int)h->msg_iovlen) && (off < b->len); j++) {
+			int c= b->len - off;
+			if (c > (int)h->msg_iov[j].iov_len)
+				c= h->msg_iov[j].iov_len;
+			memcpy(h->msg_iov[j].iov_base, b->data + off, c);
+			off+= c;
+		}
+		msgs[i].msg_len= off;
+		sim_sender_addr(k, (struct sockaddr *)h->msg_name, &h->msg_namelen);
+		buf_unref(b);
+	}
+	if (i == 0) {
+		errno= EAGAIN;
+		return -1;
+	}
+	return i;
+}
+
+static int sim_select(int n, fd_set *rd, fd_set *wr, fd_set *ex, struct timeval *timeout) {
+	SIM_NODE *nd= sim_node();
+	long long deadline= (timeout != NULL) ? now + timeout->tv_sec * 1000000000LL + timeout->tv_usec * 1000LL : -1;
+	fd_set in;
+	int cnt, fd;
+	if (nd == NULL) {
+		errno= EBADF;
+		return -1;
+	}
+	if (rd != NULL)
+		in= *rd;
+	else
+		FD_ZERO(&in);
+	for (;;) {
+		cnt= 0;
+		if (rd != NULL)
+			FD_ZERO(rd);
+		// The real descriptors in the set (e.g. the wake pipe) are never ready
+		for (fd= SIM_FD0; (fd < n) && (fd < SIM_FD0 + SIM_MAX_FDS); fd++) {
+			SIM_SOCK *k= &nd->socks[fd - SIM_FD0];
+			if (FD_ISSET(fd, &in) && k->used && sim_readable(k)) {
+				FD_SET(fd, rd);
+				cnt++;
+			}
+		}
+		if ((cnt > 0) || ((deadline >= 0) && (now >= deadline)))
+			break;
+		sim_block(deadline);
+	}
+	if (wr != NULL)
+		FD_ZERO(wr);
+	if (ex != NULL)
+		FD_ZERO(ex);
+	if (timeout != NULL)
+		sim_remaining(deadline, timeout);
+	return cnt;
+}
+
+static int sim_poll(struct pollfd *fds, nfds_t n, int timeout) {
+	SIM_NODE *nd= sim_node();
+	long long deadline= (timeout >= 0) ? now + timeout * 1000000LL : -1;
+	nfds_t i;
+	int cnt;
+	for (;;) {
+		cnt= 0;
+		for (i= 0; i < n; i++) {
+			SIM_SOCK *k;
+			fds[i].revents= 0;
+			if ((nd == NULL) || (fds[i].fd < SIM_FD0) || (fds[i].fd >= SIM_FD0 + SIM_MAX_FDS))
+				continue;
+			k= &nd->socks[fds[i].fd - SIM_FD0];
+			if (!k->used)
+				fds[i].revents= POLLNVAL;
+			else if ((fds[i].events & POLLIN) && sim_readable(k))
+				fds[i].revents= POLLIN;
+			if (fds[i].revents)
+				cnt++;
+		}
+		if ((cnt > 0) || ((deadline >= 0) && (now >= deadline)))
+			return cnt;
+		sim_block(deadline);
+	}
+}
+
+static int sim_close(int s) {
+	SIM_NODE *nd= sim_node();
+	SIM_SOCK *k= sim_sock(s);
+	SIM_BUF *b;
+	if (k == NULL)
+		return -1;
+	if (nd->tcp_fd == s) {
+		sim_event(now + prm.up.delay_ns, EV_TCP_CLOSE, nd - nodes, NULL);
+		nd->tcp_fd= -1;
+	}
+	while ((b= sim_dequeue(k)) != NULL)
+		buf_unref(b);
+	free(k->rx);
+	memset(k, 0, sizeof(SIM_SOCK));
+	return 0;
+}
+
+static int sim_clock_gettime(clockid_t clk, struct timespec *ts) {
+	long long t= now + ((clk == CLOCK_REALTIME) ? SIM_EPOCH_S * 1000000000LL : 0);
+	ts->tv_sec= t / 1000000000LL;
+	ts->tv_nsec= t % 1000000000LL;
+	return 0;
+}
+
+static int sim_gettimeofday(struct timeval *tv, struct timezone *tz) {
+	tv->tv_sec= SIM_EPOCH_S + now / 1000000000LL;
+	tv->tv_usec= (now % 1000000000LL) / 1000;
+	return 0;
+}
+
+/** Create an engine thread of the running node; it runs when it gets the baton */
+static int sim_thread_create(pthread_t *tid, const pthread_attr_t *attr, void *(*fn)(void *), void *arg) {
+	SIM_NODE *nd= sim_node();
+	SIM_THREAD *th;
+	pthread_attr_t a;
+	int res;
+	if (nd == NULL)
+		return EPERM;
+	if ((th= th_free) != NULL)
+		th_free= th->next;
+	else {
+		th= (SIM_THREAD *)calloc(1, sizeof(SIM_THREAD));
+		if (th == NULL)
+			return ENOMEM;
+		pthread_cond_init(&th->cv, NULL);
+	}
+	th->run= 0;
+	th->node= nd - nodes;
+	th->fn= fn;
+	th->arg= arg;
+	// Nobody joins the engine threads in the simulation
+	pthread_attr_init(&a);
+	pthread_attr_setdetachstate(&a, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&a, SIM_STACK);
+	res= pthread_create(tid, &a, sim_thread_main, th);
+	pthread_attr_destroy(&a);
+	if (res) {
+		th->next= th_free;
+		th_free= th;
+		return res;
+	}
+	th->state= TH_RUNNABLE;
+	sim_runnable(th);
+	return 0;
+}
+
+const TRANSPORT_OPS simnet_transport= {
+	.socket= sim_socket,
+	.bind= sim_bind,
+	.connect= sim_connect,
+	.setsockopt= sim_setsockopt,
+	.getsockopt= sim_getsockopt,
+	.send= sim_send,
+	.recv= sim_recv,
+	.sendto= sim_sendto,
+	.recvfrom= sim_recvfrom,
+	.recvmmsg= sim_recvmmsg,
+	.select= sim_select,
+	.poll= sim_poll,
+	.close= sim_close,
+	.clock_gettime= sim_clock_gettime,
+	.gettimeofday= sim_gettimeofday,
+	.thread_create= sim_thread_create
+};
+
+
+/* Network */
+
+/** Queue datagram 'b' in the member sockets of node 'node' bound to 'port' */
+static void sim_deliver(int node, SIM_BUF *b, int port) {
+	SIM_NODE *nd= &nodes[node];
+	int i, queued= 0, dropped= 0;
+	for (i= 0; i < SIM_MAX_FDS; i++) {
+		SIM_SOCK *k= &nd->socks[i];
+		if (!k->used || !k->member || (k->type != SOCK_DGRAM) || (k->port != port))
+			continue;
+		if (k->queued + b->len > prm.rcvbuf) {
+			k->drops++;
+			dropped= 1;
+			continue;
+		}
+		SIM_PKT *p= (SIM_PKT *)malloc(sizeof(SIM_PKT));
+		assert(p != NULL);
+		b->refs++;
+		p->b= b;
+		p->next= NULL;
+		if (k->tail != NULL)
+			k->tail->next= p;
+		else
+			k->head= p;
+		k->tail= p;
+		k->queued+= b->len;
+		queued= 1;
+	}
+	if (queued) {
+		sim_wake_node(nd);
+		if (snd.fate != NULL)
+			snd.fate(node, b->data, b->len, 1);
+	} else if (dropped) {
+		stats.sock_drops++;
+		if (snd.fate != NULL)
+			snd.fate(node, b->data, b->len, 0);
+	}
+}
+
+/** TRUE if node 'nd' has a member socket bound to 'port' */
+static int sim_member(const SIM_NODE *nd, int port) {
+	int i;
+	for (i= 0; i < SIM_MAX_FDS; i++) {
+		if (nd->socks[i].used && nd->socks[i].member && (nd->socks[i].port == port))
+			return 1;
+	}
+	return 0;
+}
+
+/** Process event 'e' */
+static void sim_dispatch(SIM_EVT *e) {
+	SIM_NODE *nd= &nodes[e->node];
+	switch (e->type) {
+	case EV_START:
+		start_node= e->node;
+		e->start(e->node);
+		start_node= -1;
+		break;
+	case EV_TIMER:
+		e->fn(e->arg);
+		break;
+	case EV_WAKE:
+		sim_runnable(e->th);
+		break;
+	case EV_MCAST:
+		sim_deliver(e->node, e->b, e->port);
+		buf_unref(e->b);
+		break;
+	case EV_TCP_DOWN:
+		if (nd->tcp_fd >= 0) {
+			SIM_SOCK *k= &nd->socks[nd->tcp_fd - SIM_FD0];
+			if (k->rx_len + e->b->len > k->rx_size) {
+				k->rx_size= k->rx_len + e->b->len + 256;
+				k->rx= (unsigned char *)realloc(k->rx, k->rx_size);
+				assert(k->rx != NULL);
+			}
+			memcpy(k->rx + k->rx_len, e->b->data, e->b->len);
+			k->rx_len+= e->b->len;
+			sim_wake_node(nd);
+		}
+		buf_unref(e->b);
+		break;
+	case EV_TCP_UP:
+		if (snd.tcp_data != NULL)
+			snd.tcp_data(e->node, e->b->data, e->b->len);
+		buf_unref(e->b);
+		break;
+	case EV_TCP_CLOSE:
+		if (snd.tcp_close != NULL)
+			snd.tcp_close(e->node);
+		break;
+	case EV_UDP_UP:
+		if (snd.udp != NULL)
+			snd.udp(e->node, e->b->data, e->b->len);
+		buf_unref(e->b);
+		break;
+	}
+}
+
+
+/* Interface of the simulator */
+
+/** Create 'n' nodes; the sender handlers run in the thread that calls simnet_run */
+void simnet_init(const SIM_PARAMS *p, const SIM_SENDER *s, int n) {
+	int i;
+	prm= *p;
+	snd= *s;
+	memset(&stats, 0, sizeof(stats));
+	n_nodes= n;
+	nodes= (SIM_NODE *)calloc(n, sizeof(SIM_NODE));
+	assert(nodes != NULL);
+	for (i= 0; i < n; i++) {
+		nodes[i].tcp_fd= -1;
+		nodes[i].rng= prm.seed ^ (0x2545f4914f6cdd1dULL * (i + 1));
+	}
+}
+
+/** Call 'fn(node)' at virtual time 'at'; the threads it creates belong to 'node' */
+void simnet_start(int node, long long at, void (*fn)(int node)) {
+	SIM_EVT e;
+	assert((node >= 0) && (node < n_nodes));
+	memset(&e, 0, sizeof(e));
+	e.t= at;
+	e.type= EV_START;
+	e.node= node;
+	e.start= fn;
+	heap_push(&e);
+}
+
+/** Call 'fn(arg)' at virtual time 'at', in the sender */
+void simnet_timer(long long at, void (*fn)(void *arg), void *arg) {
+	SIM_EVT e;
+	memset(&e, 0, sizeof(e));
+	e.t= (at > now) ? at : now;
+	e.type= EV_TIMER;
+	e.fn= fn;
+	e.arg= arg;
+	heap_push(&e);
+}
+
+/** Send 'buf' to every socket of the nodes bound to 'port' and member of a group */
+void simnet_mcast(const void *buf, int len, int port) {
+	SIM_BUF *b= buf_new(buf, len);
+	int i;
+	for (i= 0; i < n_nodes; i++) {
+		SIM_NODE *nd= &nodes[i];
+		if (!sim_member(nd, port))
+			continue;	// Not in the group yet, or left it
+		stats.down_pkts++;
+		if (sim_lost(&prm.down, &nd->down, &nd->rng)) {
+			stats.down_lost++;
+			if (snd.fate != NULL)
+				snd.fate(i, b->data, len, 0);
+			continue;
+		}
+		SIM_EVT e;
+		memset(&e, 0, sizeof(e));
+		e.t= now + sim_delay(&prm.down, &nd->rng);
+		e.type= EV_MCAST;
+		e.node= i;
+		e.port= port;
+		e.b= b;
+		b->refs++;
+		heap_push(&e);
+	}
+	buf_unref(b);
+}
+
+/** Send 'buf' over the TCP connection of 'node' */
+void simnet_tcp_send(int node, const void *buf, int len) {
+	assert((node >= 0) && (node < n_nodes));
+	sim_event(now + prm.down.delay_ns, EV_TCP_DOWN, node, buf_new(buf, len));
+}
+
+/** Run the events until there are none left or the time limit */
+void simnet_run(void) {
+	SIM_EVT e;
+	SIM_THREAD *th;
+	pthread_mutex_lock(&sim_mx);
+	for (;;) {
+		// The threads run at the current time, in the order they became ready
+		while ((th= run_head) != NULL) {
+			if ((run_head= th->next) == NULL)
+				run_tail= NULL;
+			sim_give(th);
+		}
+		if ((heap_n == 0) || (heap[0].t > prm.limit_ns))
+			break;
+		heap_pop(&e);
+		if ((e.type == EV_WAKE) && ((e.th->state != TH_BLOCKED) || (e.th->gen != e.gen)))
+			continue;	// The thread woke before its timeout
+		now= e.t;
+		stats.events++;
+		sim_dispatch(&e);
+	}
+	// The threads still blocked stay blocked; the process is ending
+	pthread_mutex_unlock(&sim_mx);
+}
+
+/** Current virtual time (ns) */
+long long simnet_now(void) {
+	return now;
+}
+
+/** Node of the calling engine thread (-1 in the sender) */
+int simnet_node(void) {
+	return (self != NULL) ? self->node : start_node;
+}
+
+const SIM_STATS *simnet_stats(void) {
+	return &stats;
+}
@@ -0,0 +1,80 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * simnet.h
+ *
+ * Header file of the simulated network: a transport (transport.h) where the
+ *   receivers are nodes of one process, the time is virtual and the engine
+ *   threads run one at a time, so a run depends only on its parameters
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_SIMNET_H
+#define HAVE_SIMNET_H
+
+#include "transport.h"
+
+// Sockets of one node
+#define SIM_MAX_FDS		16
+
+// One direction of the path between the sender and each node
+typedef struct SIM_LINK {
+	double loss;			// Packet loss rate
+	double burst;			// Mean length of the loss bursts (1= independent losses)
+	long long delay_ns;		// One-way delay
+	long long jitter_ns;	// Extra delay, uniform in [0, jitter_ns[; reorders the datagrams
+} SIM_LINK;
+
+// Parameters of the simulated network
+typedef struct SIM_PARAMS {
+	SIM_LINK down;			// Multicast datagrams from the sender to each node
+	SIM_LINK up;			// Datagrams from each node to the sender (the TCP data is never lost)
+	int rcvbuf;				// Bytes queued in each UDP socket; the datagrams above are dropped
+	unsigned long long seed;	// Seed of the loss and jitter generators
+	long long limit_ns;		// Virtual time when the simulation stops
+} SIM_PARAMS;
+
+// Sender model: called by simnet_run at the virtual time of each event
+typedef struct SIM_SENDER {
+	void (*tcp_data)(int node, const unsigned char *buf, int len);	// Bytes sent by the node over TCP
+	void (*tcp_close)(int node);	// The node closed its TCP connection
+	void (*udp)(int node, const unsigned char *buf, int len);	// Datagram sent by the node
+	// Multicast datagram lost on the way to 'node' (delivered= 0) or queued in its socket (1)
+	void (*fate)(int node, const unsigned char *buf, int len, int delivered);
+} SIM_SENDER;
+
+// Counters of the simulated network
+typedef struct SIM_STATS {
+	long long down_pkts;	// Multicast datagrams sent to the nodes (one per node)
+	long long down_lost;	// ... lost in the network
+	long long sock_drops;	// ... dropped by full socket buffers
+	long long up_pkts;		// Datagrams sent by the nodes
+	long long up_lost;		// ... lost in the network
+	long long up_bytes;		// ... bytes
+	long long switches;		// Times an engine thread was run
+	long long events;		// Events processed
+} SIM_STATS;
+
+// Transport of the simulated nodes, for transport_set
+extern const TRANSPORT_OPS simnet_transport;
+
+// Create 'n_nodes' nodes; the sender handlers run in the thread that calls simnet_run
+void simnet_init(const SIM_PARAMS *p, const SIM_SENDER *s, int n_nodes);
+// Call 'fn(node)' at virtual time 'at'; the threads it creates belong to 'node'
+void simnet_start(int node, long long at, void (*fn)(int node));
+// Call 'fn(arg)' at virtual time 'at', in the sender
+void simnet_timer(long long at, void (*fn)(void *arg), void *arg);
+// Send 'buf' to every socket of the nodes bound to 'port' and member of a group
+void simnet_mcast(const void *buf, int len, int port);
+// Send 'buf' over the TCP connection of 'node'
+void simnet_tcp_send(int node, const void *buf, int len);
+// Run the events until there are none left or the time limit
+void simnet_run(void);
+// Current virtual time (ns)
+long long simnet_now(void);
+// Node of the calling engine thread (-1 in the sender)
+int simnet_node(void);
+const SIM_STATS *simnet_stats(void);
+
+#endif
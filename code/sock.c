@@ -22,10 +22,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <linux/sock_diag.h>
 #include "sock.h"
-
-// External logging function declared elsewhere
-extern void Log(const gchar *str);
+#include "engine.h"
+#include "transport.h"
 
 
 // Variables with local IP addresses
@@ -114,17 +114,17 @@ gboolean init_local_ipv4(struct in_addr *ip) {
 		if (get_local_ipv4name_using_ioctl(devicename, ip))
 			return TRUE;
 	} else {
-		Log("no device name found\n");
+		engine_log("no device name found\n");
 	}
 	if (!get_local_ipv4name_using_ifconfig(name, sizeof(name)))
 		if (gethostname(name, 256)) {
-			Log("Failed to get the machine's name\n");
+			engine_log("Failed to get the machine's name\n");
 			return FALSE;
 		}
 	printf("Local name = %s\n", name);
 	hp = gethostbyname2(name, AF_INET);
 	if (hp == 0) {
-		Log("This machine does not have an IPv4 address\n");
+		engine_log("This machine does not have an IPv4 address\n");
 		inet_pton(AF_INET, "127.0.0.1", ip);
 		return TRUE;
 	}
@@ -166,17 +166,17 @@ gboolean init_local_ipv6(struct in6_addr *ip) {
 
 	assert(ip != NULL);
 	if (devicename == NULL) {
-		Log("No network device available\n");
+		engine_log("No network device available\n");
 	}
 	if (!get_local_ipv6name_using_ifconfig(devicename, name, sizeof(name)))
 		if (gethostname(name, 256)) {
-			Log("Failed to get the machine's name\n");
+			engine_log("Failed to get the machine's name\n");
 			return FALSE;
 		}
 	printf("Local name = %s\n", name);
 	hp = gethostbyname2(name, AF_INET6);
 	if (hp == 0) {
-		Log("This machine does not have an IPv6 global address\n");
+		engine_log("This machine does not have an IPv6 global address\n");
 		inet_pton(AF_INET6, "::1", ip);
 		return TRUE;
 	}
@@ -235,17 +235,17 @@ gboolean get_IPv6(const gchar *textIP, struct in6_addr *addrv6) {
 
   assert(addrv6 != NULL);
   if (inet_pton(AF_INET, textIP, &addrv4)) {
-    Log("Invalid address: sockets IPv6 do not support IPv4 multicast addresses\n");
+    engine_log("Invalid address: sockets IPv6 do not support IPv4 multicast addresses\n");
     return FALSE;
   } else if (inet_pton(AF_INET6, textIP, addrv6)) {
     if ((textIP[0]=='f' || textIP[0]=='F') && (textIP[1]=='f' || textIP[1]=='F'))
       return TRUE;
     else {
-      Log("The IPv6 address is not multicast (it must be in the range FF01:: - FF1E::)\n");
+      engine_log("The IPv6 address is not multicast (it must be in the range FF01:: - FF1E::)\n");
       return FALSE;
     }
   } else {
-    Log("Invalid address\n");
+    engine_log("Invalid address\n");
     return FALSE;
   }
 }
@@ -258,11 +258,11 @@ gboolean get_IPv4(const gchar *textIP, struct in_addr *addrv4) {
     if (IN_MULTICAST(htonl(addrv4->s_addr)))
       return TRUE;
     else {
-      Log("The address IPv4 is not multicast (it must be in the range 224.0.0.0 - 239.255.255.255)\n");
+      engine_log("The address IPv4 is not multicast (it must be in the range 224.0.0.0 - 239.255.255.255)\n");
       return FALSE;
     }
   } else {
-    Log("Invalid address\n");
+    engine_log("Invalid address\n");
     return FALSE;
   }
 }
@@ -270,14 +270,14 @@ gboolean get_IPv4(const gchar *textIP, struct in_addr *addrv4) {
 
 // Return a static temporary string with an IPv4 address
 char *addr_ipv4(struct in_addr *addr) {
-	static char buf[16];
+	static __thread char buf[16];
 	inet_ntop(AF_INET, addr, buf, sizeof(buf));
 	return buf;
 }
 
 // Return a static temporary string with an IPv6 address
 char *addr_ipv6(struct in6_addr *addr) {
-	static char buf[100];
+	static __thread char buf[100];
 	inet_ntop(AF_INET6, addr, buf, sizeof(buf));
 	return buf;
 }
@@ -290,7 +290,7 @@ int init_socket_ipv4(int dom, int porto, gboolean shared) {
 	int s;
 
 	// Create an IPv4 socket
-	s = socket(AF_INET, dom, 0);
+	s = tp.socket(AF_INET, dom, 0);
 	if (s < 0) {
 		perror("IPv4 socket creation");
 		return -1;
@@ -301,10 +301,10 @@ int init_socket_ipv4(int dom, int porto, gboolean shared) {
 		 * to the same port in the same IP address */
 		int reuse = 1;
 
-		if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *) &reuse,
+		if (tp.setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *) &reuse,
 				sizeof(reuse)) < 0) {
 			perror("IPv4 setsockopt SO_REUSEADDR failed");
-			close(s);
+			tp.close(s);
 			return -1;
 		}
 	}
@@ -313,9 +313,9 @@ int init_socket_ipv4(int dom, int porto, gboolean shared) {
 	name.sin_family = AF_INET; // IPv4 address domain
 	name.sin_addr.s_addr = INADDR_ANY; // IP local host (0.0.0.0)
 	name.sin_port = htons((short) porto); // Port number
-	if (bind(s, (struct sockaddr *) &name, sizeof(name))) {
+	if (tp.bind(s, (struct sockaddr *) &name, sizeof(name))) {
 		if (errno == EINVAL) {
-			Log("The IPv4 socket is already associated to a port\n");
+			engine_log("The IPv4 socket is already associated to a port\n");
 		}
 		perror("IPv4 port number association");
 		return -1;
@@ -331,7 +331,7 @@ int init_socket_ipv6(int dom, int port, gboolean shared) {
 	int s;
 
 	// Create an IPv6 socket
-	s = socket(AF_INET6, dom, 0);
+	s = tp.socket(AF_INET6, dom, 0);
 	if (s < 0) {
 		perror("IPv6 socket creation");
 		return -1;
@@ -342,10 +342,10 @@ int init_socket_ipv6(int dom, int port, gboolean shared) {
 		 * to the same port in the same IP address */
 		int reuse = 1;
 
-		if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *) &reuse,
+		if (tp.setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *) &reuse,
 				sizeof(reuse)) < 0) {
 			perror("IPv6 setsockopt SO_REUSEADDR failed");
-			close(s);
+			tp.close(s);
 			return -1;
 		}
 	}
@@ -355,9 +355,9 @@ int init_socket_ipv6(int dom, int port, gboolean shared) {
 	name.sin6_addr = in6addr_any; // ::
 	name.sin6_flowinfo = 0;
 	name.sin6_port = htons((short) port); // Port number
-	if (bind(s, (struct sockaddr *) &name, sizeof(name))) {
+	if (tp.bind(s, (struct sockaddr *) &name, sizeof(name))) {
 		if (errno == EINVAL) {
-			Log("The IPv6 socket is already associated to a port\n");
+			engine_log("The IPv6 socket is already associated to a port\n");
 		}
 		perror("IPv4 port number association");
 		return -1;
@@ -385,6 +385,44 @@ int get_portnumber(int s) {
 	return ntohs(name.sin6_port);
 }
 
+// Socket options missing from older C libraries
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL			46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL		69
+#endif
+
+// Ask the kernel to busy-poll the device queue for up to 'usec' microseconds on reads
+// and to prefer busy polling over interrupts (Linux >= 5.11); raising the value
+// above net.core.busy_read needs CAP_NET_ADMIN
+gboolean set_socket_busy_poll(int s, int usec) {
+	int on = 1;
+	assert(s >= 0);
+	if (tp.setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+		perror("setsockopt SO_BUSY_POLL");
+		return FALSE;
+	}
+	if (tp.setsockopt(s, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on)) < 0)
+		perror("setsockopt SO_PREFER_BUSY_POLL");
+	return TRUE;
+}
+
+// Return the number of datagrams dropped by socket 's' because its receive buffer was full,
+// from SO_MEMINFO (Linux >= 4.6); 0 if unknown
+long long get_socket_drops(int s) {
+#ifdef SO_MEMINFO
+	unsigned int mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+	if ((s < 0) || (tp.getsockopt(s, SOL_SOCKET, SO_MEMINFO, mem, &len) < 0) ||
+			(len <= SK_MEMINFO_DROPS * sizeof(mem[0])))
+		return 0;
+	return mem[SK_MEMINFO_DROPS];
+#else
+	return 0;
+#endif
+}
+
 // Read data from an IPv4 socket
 // Returns the number of byte read (<0 in case of error) and the sender's address and port
 int read_data_ipv4(int sock, char *buf, int n, struct in_addr *ip,
@@ -399,7 +437,7 @@ int read_data_ipv4(int sock, char *buf, int n, struct in_addr *ip,
 	assert(port != NULL);
 	if (sock < 0)
 		return -1;
-	if ((m = recvfrom(sock, buf, n, MSG_DONTWAIT /* non-blocking */,
+	if ((m = tp.recvfrom(sock, buf, n, MSG_DONTWAIT /* non-blocking */,
 			(struct sockaddr *) &from, &fromlen)) < 0)
 		return m;
 	*ip = from.sin_addr; // IP in network format (Big Endian)
@@ -421,7 +459,7 @@ int read_data_ipv6(int sock, char *buf, int n, struct in6_addr *ip,
 	assert(port != NULL);
 	if (sock < 0)
 		return -1;
-	if ((m = recvfrom(sock, buf, n, MSG_DONTWAIT /* non blocking */,
+	if ((m = tp.recvfrom(sock, buf, n, MSG_DONTWAIT /* non blocking */,
 			(struct sockaddr *) &from, &fromlen)) < 0)
 		return m;
 	*ip = from.sin6_addr; // IP in network format (Big Endian)
@@ -441,14 +479,14 @@ gboolean put_socket_in_mainloop(int sock, void *ptr, guint *chan_id, GIOChannel
 
 	/* create a GIO descriptor associated to an io device descriptor (socket or pipe) */
 	if ((*chan = g_io_channel_unix_new(sock)) == NULL) {
-		Log("Failed creation of IO channel\n");
+		engine_log("Failed creation of IO channel\n");
 		return FALSE;
 	}
 	/* add the GIO descriptor to the Gtk main loop, registering the callback function */
 	if (!(*chan_id
 			= g_io_add_watch(*chan, event | G_IO_NVAL | G_IO_ERR, /* read and error events */
 			callback /* callback function */, ptr /* callback function parameter's value */))) {
-		Log("Failed activation of GIO callback function\n");
+		engine_log("Failed activation of GIO callback function\n");
 		return FALSE;
 	}
 	return TRUE;
@@ -468,7 +506,7 @@ gboolean restore_socket_in_mainloop(int sock, void *ptr, guint *chan_id, GIOChan
 	if (!(*chan_id
 			= g_io_add_watch(chan, event | G_IO_NVAL | G_IO_ERR, /* read and error events */
 			callback /* callback function */, ptr /* callback function parameter's value */))) {
-		Log("Failed reactivation of GIO callback function\n");
+		engine_log("Failed reactivation of GIO callback function\n");
 		return FALSE;
 	}
 	return TRUE;
@@ -503,5 +541,5 @@ void close_socket(int sock)
 {
 	if (sock < 0)
 		return;
-	close(sock);
+	tp.close(sock);
 }
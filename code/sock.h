@@ -12,7 +12,6 @@
 #define _INCL_SOCK_H_
 
 #include <netinet/in.h>
-#include <gtk/gtk.h>
 #include <glib.h>
 
 
@@ -48,8 +47,8 @@ gboolean get_IPv4(const gchar *textIP, struct in_addr *addrv4); // Read an IPv4
 // Convert IPv4 address to the IPv6 equivalent address ::ffff:IPv4
 gboolean translate_ipv4_to_ipv6(const char *ipv4_str, struct in6_addr *ipv6);
 
-char *addr_ipv4(struct in_addr *addr);	// Return a static string with an IPv4 address contents
-char *addr_ipv6(struct in6_addr *addr);	// Return a static string with an IPv6 address contents
+char *addr_ipv4(struct in_addr *addr);	// Return a static (per-thread) string with an IPv4 address contents
+char *addr_ipv6(struct in6_addr *addr);	// Return a static (per-thread) string with an IPv6 address contents
 
 int init_socket_ipv4(int dom, int port, gboolean shared); // Initialize an IPv4 socket
 int init_socket_ipv6(int dom, int port, gboolean shared); // Initialize an IPv6 socket
@@ -58,6 +57,11 @@ int init_socket_ipv6(int dom, int port, gboolean shared); // Initialize an IPv6
 
 int get_portnumber(int s); // Return the port number associated to a socket
 
+// Ask the kernel to busy-poll the device queue for up to 'usec' microseconds on reads
+gboolean set_socket_busy_poll(int s, int usec);
+// Return the number of datagrams dropped by socket 's' because its receive buffer was full (0 if unknown)
+long long get_socket_drops(int s);
+
 // Read data from an IPv4 socket
 // Returns the number of byte read (<0 in case of error) and the sender's address and port
 int read_data_ipv4(int sock, char *buf, int n, struct in_addr *ip,
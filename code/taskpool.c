@@ -0,0 +1,271 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * taskpool.c
+ *
+ * Task pool shared by all the transfers. The receive threads only classify
+ *   the packets and queue one task per block that needs CPU work; the tasks
+ *   of a transfer go to the queue of its home thread, and a thread with an
+ *   empty queue steals the oldest task of the others. Each transfer may keep
+ *   an equal share of the queues busy: above it, or with the queues full, the
+ *   submission fails and the transfer's own thread does the work, so one
+ *   heavy transfer slows itself instead of the others
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "taskpool.h"
+
+// Queued task
+typedef struct TASK_ENTRY {
+	TASK_GROUP *g;
+	task_fn fn;
+	void *arg;
+} TASK_ENTRY;
+
+// Queue of one thread
+typedef struct TASK_QUEUE {
+	pthread_mutex_t mutex;	// Protects the circular queue; taken by the owner and by thieves
+	TASK_ENTRY e[TASK_QUEUE_LEN];
+	int head, len;
+	pthread_t tid;
+	long long run;			// Tasks run by this thread (atomic)
+	long long steals;		// ... taken from other queues (atomic)
+} TASK_QUEUE;
+
+static TASK_QUEUE *queues= NULL;
+static int n_threads= 0;
+static gboolean stopping= FALSE;	// The threads leave when no task is queued (atomic)
+static int users= 0;				// task_submit calls using 'queues' (atomic); stop waits for them
+static int next_home= 0;			// Home queue of the next group
+static int groups= 0;				// Groups with pending tasks (atomic)
+static long long depth= 0;			// Tasks queued (atomic)
+static long long max_depth= 0;
+static long long refused= 0;
+static int sleepers= 0;				// Threads waiting for tasks; protected by smutex
+static pthread_mutex_t smutex= PTHREAD_MUTEX_INITIALIZER;	// Protects start/stop and the sleep
+static pthread_cond_t scond= PTHREAD_COND_INITIALIZER;		// Signals new tasks and 'stopping'
+static int waiters= 0;				// Threads in task_group_wait (atomic)
+static pthread_mutex_t wmutex= PTHREAD_MUTEX_INITIALIZER;	// Protects the wait for idle groups
+static pthread_cond_t wcond= PTHREAD_COND_INITIALIZER;		// Signals a group whose tasks ended
+
+
+/** Take the oldest task of queue 'q'; returns FALSE if it is empty */
+static gboolean pop_task(TASK_QUEUE *q, TASK_ENTRY *e) {
+	gboolean ok= FALSE;
+	pthread_mutex_lock(&q->mutex);
+	if (q->len > 0) {
+		*e= q->e[q->head];
+		q->head= (q->head + 1) % TASK_QUEUE_LEN;
+		q->len--;
+		ok= TRUE;
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return ok;
+}
+
+
+/** The last task of a group ended: wakes task_group_wait */
+static void group_idle(void) {
+	__atomic_sub_fetch(&groups, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&waiters, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&wmutex);
+		pthread_cond_broadcast(&wcond);
+		pthread_mutex_unlock(&wmutex);
+	}
+}
+
+
+/** Pool thread: runs its own tasks, then steals, then sleeps until a task is queued */
+static void *task_thread(void *ptr) {
+	int k= (int)(long)ptr, n= n_threads, i;
+	TASK_QUEUE *own= &queues[k];
+	TASK_ENTRY e;
+
+	for (;;) {
+		gboolean got= pop_task(own, &e);
+		for (i= 1; !got && (i < n); i++) {
+			if ((got= pop_task(&queues[(k + i) % n], &e)))
+				__atomic_add_fetch(&own->steals, 1, __ATOMIC_RELAXED);
+		}
+		if (!got) {
+			pthread_mutex_lock(&smutex);
+			sleepers++;
+			while ((__atomic_load_n(&depth, __ATOMIC_ACQUIRE) == 0) && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+				pthread_cond_wait(&scond, &smutex);
+			sleepers--;
+			got= __atomic_load_n(&stopping, __ATOMIC_ACQUIRE) && (__atomic_load_n(&depth, __ATOMIC_ACQUIRE) == 0);
+			pthread_mutex_unlock(&smutex);
+			if (got)
+				return NULL;
+			continue;
+		}
+		__atomic_sub_fetch(&depth, 1, __ATOMIC_ACQ_REL);
+		e.fn(e.arg);
+		__atomic_add_fetch(&own->run, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&e.g->run, 1, __ATOMIC_RELAXED);
+		// Last use of the group: its owner may free it when 'pending' is 0
+		if (__atomic_sub_fetch(&e.g->pending, 1, __ATOMIC_SEQ_CST) == 0)
+			group_idle();
+	}
+}
+
+
+/** Start 'n' threads (0= one per online CPU) */
+gboolean taskpool_start(int n) {
+	pthread_mutex_lock(&smutex);
+	if (n_threads > 0) {
+		pthread_mutex_unlock(&smutex);
+		return TRUE;
+	}
+	if (n <= 0)
+		n= (int)sysconf(_SC_NPROCESSORS_ONLN);
+	n= (n < 1) ? 1 : (n > MAX_TASK_THREADS) ? MAX_TASK_THREADS : n;
+	if ((queues= (TASK_QUEUE *)calloc(n, sizeof(TASK_QUEUE))) == NULL) {
+		pthread_mutex_unlock(&smutex);
+		perror("TASK> calloc");
+		return FALSE;
+	}
+	__atomic_store_n(&stopping, FALSE, __ATOMIC_RELEASE);
+	// The threads read n_threads when they start; queues beyond the started ones stay empty
+	__atomic_store_n(&n_threads, n, __ATOMIC_RELEASE);
+	for (int i= 0; i < n; i++) {
+		pthread_mutex_init(&queues[i].mutex, NULL);
+		if (pthread_create(&queues[i].tid, NULL, task_thread, (void *)(long)i)) {
+			perror("TASK> pthread_create");
+			__atomic_store_n(&n_threads, i, __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&smutex);
+	return n_threads > 0;
+}
+
+
+/** Run the queued tasks and stop the threads. Transfers still running afterwards run their
+ *  tasks themselves: the submissions in progress end before the queues are freed */
+void taskpool_stop(void) {
+	int i, n;
+	__atomic_store_n(&stopping, TRUE, __ATOMIC_SEQ_CST);
+	// Not holding smutex: a submission may take it to wake a thread
+	while (__atomic_load_n(&users, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+	pthread_mutex_lock(&smutex);
+	n= n_threads;
+	pthread_cond_broadcast(&scond);
+	pthread_mutex_unlock(&smutex);
+	for (i= 0; i < n; i++)
+		pthread_join(queues[i].tid, NULL);
+	pthread_mutex_lock(&smutex);
+	__atomic_store_n(&n_threads, 0, __ATOMIC_RELEASE);
+	for (i= 0; i < n; i++)
+		pthread_mutex_destroy(&queues[i].mutex);
+	free(queues);
+	queues= NULL;
+	pthread_mutex_unlock(&smutex);
+}
+
+
+/** Number of running threads */
+int taskpool_count(void) {
+	return __atomic_load_n(&n_threads, __ATOMIC_ACQUIRE);
+}
+
+
+/** Initialize the group of a new transfer; consecutive groups get different home queues */
+void task_group_init(TASK_GROUP *g) {
+	memset(g, 0, sizeof(*g));
+	g->home= __atomic_fetch_add(&next_home, 1, __ATOMIC_RELAXED) & 0x7fffffff;
+}
+
+
+/** Queue 'fn(arg)' for group 'g'; returns FALSE if the caller must run it */
+gboolean task_submit(TASK_GROUP *g, task_fn fn, void *arg) {
+	int n, active, share;
+	long long d, m;
+	TASK_QUEUE *q;
+
+	// Reference to 'queues', taken before 'stopping' is read; taskpool_stop sets 'stopping'
+	//   before it waits for the references, so it never frees the queues under a submission
+	__atomic_add_fetch(&users, 1, __ATOMIC_SEQ_CST);
+	n= taskpool_count();
+	if ((n == 0) || __atomic_load_n(&stopping, __ATOMIC_SEQ_CST))
+		goto refuse;
+	// Equal share of the queues between the groups with pending tasks
+	active= __atomic_load_n(&groups, __ATOMIC_RELAXED);
+	share= TASK_QUEUE_LEN * n / ((active > 0) ? active : 1);
+	if (share < TASK_MIN_SHARE)
+		share= TASK_MIN_SHARE;
+	if (__atomic_load_n(&g->pending, __ATOMIC_RELAXED) >= share)
+		goto refuse;
+
+	// Counted before the task is visible, so 'pending' never goes below 0
+	if (__atomic_fetch_add(&g->pending, 1, __ATOMIC_ACQ_REL) == 0)
+		__atomic_add_fetch(&groups, 1, __ATOMIC_RELAXED);
+	q= &queues[g->home % n];
+	pthread_mutex_lock(&q->mutex);
+	if (q->len == TASK_QUEUE_LEN) {
+		pthread_mutex_unlock(&q->mutex);
+		if (__atomic_sub_fetch(&g->pending, 1, __ATOMIC_SEQ_CST) == 0)
+			group_idle();
+		goto refuse;
+	}
+	q->e[(q->head + q->len) % TASK_QUEUE_LEN]= (TASK_ENTRY){ g, fn, arg };
+	q->len++;
+	d= __atomic_add_fetch(&depth, 1, __ATOMIC_ACQ_REL);
+	pthread_mutex_unlock(&q->mutex);
+	m= __atomic_load_n(&max_depth, __ATOMIC_RELAXED);
+	while ((d > m) && !__atomic_compare_exchange_n(&max_depth, &m, d, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	// A thread that found no task checks 'depth' holding smutex before it sleeps
+	if (__atomic_load_n(&sleepers, __ATOMIC_ACQUIRE) > 0) {
+		pthread_mutex_lock(&smutex);
+		pthread_cond_signal(&scond);
+		pthread_mutex_unlock(&smutex);
+	}
+	__atomic_sub_fetch(&users, 1, __ATOMIC_SEQ_CST);
+	return TRUE;
+
+refuse:
+	__atomic_sub_fetch(&users, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&g->refused, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&refused, 1, __ATOMIC_RELAXED);
+	return FALSE;
+}
+
+
+/** Wait until the group has no tasks queued or running */
+void task_group_wait(TASK_GROUP *g) {
+	pthread_mutex_lock(&wmutex);
+	__atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+	// group_idle broadcasts holding wmutex after 'pending' reached 0, so no wakeup is lost
+	while (__atomic_load_n(&g->pending, __ATOMIC_SEQ_CST) > 0)
+		pthread_cond_wait(&wcond, &wmutex);
+	__atomic_sub_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&wmutex);
+}
+
+
+/** Read the counters of the pool */
+void taskpool_stats(TASKPOOL_STATS *s) {
+	int i;
+	memset(s, 0, sizeof(*s));
+	pthread_mutex_lock(&smutex);
+	s->threads= n_threads;
+	for (i= 0; i < n_threads; i++) {
+		s->run+= __atomic_load_n(&queues[i].run, __ATOMIC_RELAXED);
+		s->steals+= __atomic_load_n(&queues[i].steals, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&smutex);
+	s->groups= __atomic_load_n(&groups, __ATOMIC_RELAXED);
+	s->depth= __atomic_load_n(&depth, __ATOMIC_RELAXED);
+	s->max_depth= __atomic_load_n(&max_depth, __ATOMIC_RELAXED);
+	s->refused= __atomic_load_n(&refused, __ATOMIC_RELAXED);
+}
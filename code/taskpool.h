@@ -0,0 +1,66 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * taskpool.h
+ *
+ * Header file of the task pool: threads that run the per-block work of all
+ *   the transfers (decompression, then the block write). Each thread has its
+ *   own queue and steals from the others when it is empty
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_TASKPOOL_H
+#define HAVE_TASKPOOL_H
+
+#include <glib.h>
+#include <pthread.h>
+
+// Maximum number of pool threads
+#define MAX_TASK_THREADS	64
+// Tasks in the queue of each thread
+#define TASK_QUEUE_LEN		1024
+// Tasks one group may always queue, even when many groups share the pool
+#define TASK_MIN_SHARE		16
+
+// Task: 'fn(arg)'
+typedef void (*task_fn)(void *arg);
+
+// Tasks of one transfer; the pool keeps each group within its share of the queues
+typedef struct TASK_GROUP {
+	int home;				// Queue where the group's tasks go; the other threads steal them
+	int pending;			// Tasks queued or running (atomic)
+	long long run;			// Tasks run by the pool (atomic)
+	long long refused;		// Tasks refused, run by the caller (atomic)
+} TASK_GROUP;
+
+// Counters of the pool
+typedef struct TASKPOOL_STATS {
+	int threads;			// Running threads
+	int groups;				// Groups with pending tasks
+	long long depth;		// Tasks queued now
+	long long max_depth;	// Most tasks queued at one time
+	long long run;			// Tasks run
+	long long steals;		// Tasks taken from the queue of another thread
+	long long refused;		// Tasks refused (pool off, queue full or group above its share)
+} TASKPOOL_STATS;
+
+// Start 'n' threads (0= one per online CPU); does nothing if running
+gboolean taskpool_start(int n);
+// Run the queued tasks and stop the threads
+void taskpool_stop(void);
+// Number of running threads
+int taskpool_count(void);
+
+// Initialize the group of a new transfer
+void task_group_init(TASK_GROUP *g);
+// Queue 'fn(arg)' for group 'g'; returns FALSE when the pool is off, the queue is full or
+//   the group is above its share, and the caller then runs the work itself
+gboolean task_submit(TASK_GROUP *g, task_fn fn, void *arg);
+// Wait until the group has no tasks queued or running
+void task_group_wait(TASK_GROUP *g);
+
+// Read the counters of the pool
+void taskpool_stats(TASKPOOL_STATS *s);
+
+#endif
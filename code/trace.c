@@ -0,0 +1,119 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * trace.c
+ *
+ * Event tracer. The ring of each thread is a shared mapping of its trace
+ *   file, so recording an event is a clock read and a store, and the kernel
+ *   writes the pages back. Only the owner thread writes to its ring. When
+ *   the ring wraps, the oldest events are overwritten; when tracing ends,
+ *   a file that did not wrap is cut to the events recorded.
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+__thread TRACE_RING *trace_ring= NULL;
+
+
+/** Current CLOCK_MONOTONIC time, in ns */
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/** Start tracing the calling thread to file 'path', with room for 'cap' events; returns 0 on error */
+int trace_begin(const char *path, uint64_t cap, unsigned thread, int block_size,
+		int64_t n_blocks, const char *fname) {
+	TRACE_RING *r;
+	size_t len= sizeof(TRACE_HDR) + cap * sizeof(TRACE_EVT);
+	void *p;
+
+	if (trace_ring != NULL)
+		trace_end();
+	if ((cap == 0) || ((r= (TRACE_RING *)malloc(sizeof(TRACE_RING))) == NULL))
+		return 0;
+	if ((r->fd= open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror("TRC> open");
+		free(r);
+		return 0;
+	}
+	if ((ftruncate(r->fd, len) < 0) ||
+			((p= mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0)) == MAP_FAILED)) {
+		perror("TRC> ftruncate/mmap");
+		close(r->fd);
+		unlink(path);
+		free(r);
+		return 0;
+	}
+	r->hdr= (TRACE_HDR *)p;
+	r->evts= (TRACE_EVT *)(r->hdr + 1);
+	r->cap= cap;
+	memcpy(r->hdr->magic, TRACE_MAGIC, sizeof(r->hdr->magic));
+	r->hdr->version= TRACE_VERSION;
+	r->hdr->evt_size= sizeof(TRACE_EVT);
+	r->hdr->capacity= cap;
+	r->hdr->head= 0;
+	r->hdr->t0= now_ns();
+	r->hdr->thread= thread;
+	r->hdr->block_size= block_size;
+	r->hdr->n_blocks= n_blocks;
+	strncpy(r->hdr->fname, fname, sizeof(r->hdr->fname) - 1);
+	r->hdr->fname[sizeof(r->hdr->fname) - 1]= '\0';
+	trace_ring= r;
+	return 1;
+}
+
+
+/** Record an event in the calling thread's ring */
+void trace_record(unsigned type, int64_t a, uint32_t b) {
+	TRACE_RING *r= trace_ring;
+	uint64_t h= r->hdr->head;
+	TRACE_EVT *e= &r->evts[h % r->cap];
+	e->ts= now_ns();
+	e->a= a;
+	e->b= b;
+	e->type= type;
+	// A reader of a live file sees complete events up to 'head'
+	__atomic_store_n(&r->hdr->head, h + 1, __ATOMIC_RELEASE);
+}
+
+
+/** Stop tracing the calling thread; the file keeps the recorded events */
+void trace_end(void) {
+	TRACE_RING *r= trace_ring;
+	if (r == NULL)
+		return;
+	trace_ring= NULL;
+	uint64_t head= r->hdr->head;
+	munmap(r->hdr, sizeof(TRACE_HDR) + r->cap * sizeof(TRACE_EVT));
+	if (head < r->cap) {
+		// Did not wrap: keep only the recorded events
+		if (ftruncate(r->fd, sizeof(TRACE_HDR) + head * sizeof(TRACE_EVT)) < 0)
+			perror("TRC> ftruncate");
+	}
+	close(r->fd);
+	free(r);
+}
+
+
+/** Lock 'm', recording the wait when it is held by another thread */
+void trace_mutex_lock(pthread_mutex_t *m) {
+	if ((trace_ring == NULL) || (pthread_mutex_trylock(m) != 0)) {
+		uint64_t t0= (trace_ring != NULL) ? now_ns() : 0;
+		pthread_mutex_lock(m);
+		if (trace_ring != NULL)
+			trace_record(TR_LOCK_WAIT, now_ns() - t0, 0);
+	}
+}
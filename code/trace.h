@@ -0,0 +1,79 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * trace.h
+ *
+ * Header file of the event tracer: each receiving thread records timestamped
+ *   events in its own ring, mapped from a trace file. The file format is
+ *   also read by the offline analyser (fmtrace.c)
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_TRACE_H
+#define HAVE_TRACE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// File signature and version
+#define TRACE_MAGIC		"FMTRACE1"
+#define TRACE_VERSION	1
+
+/* Event types */
+#define TR_PKT			1	// New block received: a= seq, b= size
+#define TR_DUP			2	// Block already received: a= seq, b= size
+#define TR_INVALID		3	// Invalid DATA packet: a= seq, b= size
+#define TR_SRR			4	// SRR sent: a= first block of the window, b= window bytes
+#define TR_WRITE_BEGIN	5	// Block write started: a= seq, b= size
+#define TR_WRITE_END	6	// Block write ended: a= seq, b= size
+#define TR_LOCK_WAIT	7	// Waited for a lock: a= wait (ns), b= 0
+#define TR_STOP			8	// Session stopped: a= why (RX_*), b= 0
+
+// Trace file header
+typedef struct TRACE_HDR {
+	char magic[8];			// TRACE_MAGIC
+	uint32_t version;		// TRACE_VERSION
+	uint32_t evt_size;		// sizeof(TRACE_EVT)
+	uint64_t capacity;		// Events in the ring
+	uint64_t head;			// Events recorded; the ring keeps the last 'capacity'
+	uint64_t t0;			// Start time (CLOCK_MONOTONIC ns)
+	uint32_t thread;		// Thread index in the transfer (0= transfer thread)
+	int32_t block_size;		// Block size of the transfer
+	int64_t n_blocks;		// Blocks of the transfer
+	char fname[80];			// Requested file
+} TRACE_HDR;
+
+// Event record
+typedef struct TRACE_EVT {
+	uint64_t ts;			// CLOCK_MONOTONIC ns
+	int64_t a;				// First argument
+	uint32_t b;				// Second argument
+	uint32_t type;			// TR_*
+} TRACE_EVT;
+
+// Ring of one thread
+typedef struct TRACE_RING {
+	int fd;					// Trace file
+	TRACE_HDR *hdr;			// Mapped header, followed by the events
+	TRACE_EVT *evts;		// Mapped events
+	uint64_t cap;			// Events in the ring
+} TRACE_RING;
+
+// Ring of the calling thread; NULL when it is not tracing
+extern __thread TRACE_RING *trace_ring;
+
+// Record an event in the calling thread's ring (only a test when not tracing)
+#define TRACE(type, a, b)	do { if (trace_ring != NULL) trace_record((type), (a), (b)); } while (0)
+
+// Start tracing the calling thread to file 'path', with room for 'cap' events
+int trace_begin(const char *path, uint64_t cap, unsigned thread, int block_size,
+		int64_t n_blocks, const char *fname);
+// Record an event in the calling thread's ring
+void trace_record(unsigned type, int64_t a, uint32_t b);
+// Stop tracing the calling thread; the file keeps the recorded events
+void trace_end(void);
+// Lock 'm', recording the wait when it is held by another thread
+void trace_mutex_lock(pthread_mutex_t *m);
+
+#endif
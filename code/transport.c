@@ -0,0 +1,65 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * transport.c
+ *
+ * Transport of the engine. By default it is the system calls; the table is
+ *   a global variable, so each call costs one indirect jump
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		// recvmmsg
+#endif
+#include <unistd.h>
+#include "transport.h"
+
+/** recvmmsg takes a non-const timeout in some C libraries */
+static int sys_recvmmsg(int s, struct mmsghdr *msgs, unsigned int vlen, int flags, struct timespec *timeout) {
+	return recvmmsg(s, msgs, vlen, flags, timeout);
+}
+
+/** gettimeofday takes a void pointer in some C libraries */
+static int sys_gettimeofday(struct timeval *tv, struct timezone *tz) {
+	return gettimeofday(tv, tz);
+}
+
+// System calls
+#define SYS_TRANSPORT	{ \
+	.socket= socket, \
+	.bind= bind, \
+	.connect= connect, \
+	.setsockopt= setsockopt, \
+	.getsockopt= getsockopt, \
+	.send= send, \
+	.recv= recv, \
+	.sendto= sendto, \
+	.recvfrom= recvfrom, \
+	.recvmmsg= sys_recvmmsg, \
+	.select= select, \
+	.poll= poll, \
+	.close= close, \
+	.clock_gettime= clock_gettime, \
+	.gettimeofday= sys_gettimeofday, \
+	.thread_create= pthread_create \
+}
+
+static const TRANSPORT_OPS sys_transport= SYS_TRANSPORT;
+
+TRANSPORT_OPS tp= SYS_TRANSPORT;
+
+
+/** Use 'ops' (NULL= the system calls); must be called before any transfer starts */
+void transport_set(const TRANSPORT_OPS *ops) {
+	tp= (ops != NULL) ? *ops : sys_transport;
+}
+
+
+/** Current CLOCK_MONOTONIC time of the transport, in us */
+long long transport_monotonic_us(void) {
+	struct timespec ts;
+	tp.clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,55 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * transport.h
+ *
+ * Header file of the transport used by the engine: the socket calls, the
+ *   clock and the creation of the transfer threads go through a table of
+ *   functions, so a simulator can replace the network and the time
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_TRANSPORT_H
+#define HAVE_TRANSPORT_H
+
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+struct mmsghdr;	// Only declared by <sys/socket.h> with _GNU_SOURCE
+
+// Functions of a transport; they have the semantics of the system calls with the same names
+typedef struct TRANSPORT_OPS {
+	int (*socket)(int domain, int type, int protocol);
+	int (*bind)(int s, const struct sockaddr *addr, socklen_t len);
+	int (*connect)(int s, const struct sockaddr *addr, socklen_t len);
+	int (*setsockopt)(int s, int level, int name, const void *val, socklen_t len);
+	int (*getsockopt)(int s, int level, int name, void *val, socklen_t *len);
+	ssize_t (*send)(int s, const void *buf, size_t len, int flags);
+	ssize_t (*recv)(int s, void *buf, size_t len, int flags);
+	ssize_t (*sendto)(int s, const void *buf, size_t len, int flags, const struct sockaddr *to, socklen_t to_len);
+	ssize_t (*recvfrom)(int s, void *buf, size_t len, int flags, struct sockaddr *from, socklen_t *from_len);
+	int (*recvmmsg)(int s, struct mmsghdr *msgs, unsigned int vlen, int flags, struct timespec *timeout);
+	int (*select)(int n, fd_set *rd, fd_set *wr, fd_set *ex, struct timeval *timeout);
+	int (*poll)(struct pollfd *fds, nfds_t n, int timeout);
+	int (*close)(int s);
+	int (*clock_gettime)(clockid_t clk, struct timespec *ts);
+	int (*gettimeofday)(struct timeval *tv, struct timezone *tz);
+	// Threads running the transfers
+	int (*thread_create)(pthread_t *tid, const pthread_attr_t *attr, void *(*fn)(void *), void *arg);
+} TRANSPORT_OPS;
+
+// Transport in use; the system calls unless transport_set replaced them
+extern TRANSPORT_OPS tp;
+
+// Use 'ops' (NULL= the system calls); must be called before any transfer starts
+void transport_set(const TRANSPORT_OPS *ops);
+// Current CLOCK_MONOTONIC time of the transport, in us
+long long transport_monotonic_us(void);
+
+#endif
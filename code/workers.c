@@ -0,0 +1,264 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * workers.c
+ *
+ * Worker pool: each worker is created once, pinned to one CPU and runs the
+ *   jobs of its own queue. Jobs go to the worker with the fewest running and
+ *   queued jobs. When the CPUs are taken from the NIC's NUMA node, the workers
+ *   also prefer that node for their allocations, so the buffers and bitmasks a
+ *   transfer allocates (and first touches) in its worker are node-local.
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "workers.h"
+
+// Memory policy that prefers one node (linux/mempolicy.h)
+#define WRK_MPOL_PREFERRED	1
+
+// Queued job
+typedef struct WORKER_JOB {
+	worker_job fn;
+	worker_job drop;		// Called instead of 'fn' when the job is dropped (NULL= none)
+	void *arg;
+} WORKER_JOB;
+
+// Worker descriptor
+typedef struct WORKER {
+	pthread_t tid;			// Thread ID
+	int cpu;				// CPU where it is pinned (-1= not pinned)
+	int node;				// Preferred NUMA node (-1= none)
+	int load;				// Running and queued jobs (atomic)
+	GQueue jobs;			// Queued jobs
+	pthread_mutex_t mutex;	// Protects 'jobs' and 'stop'
+	pthread_cond_t cond;	// Signals new jobs
+	gboolean stop;			// Leave after the current job
+} WORKER;
+
+static WORKER workers[MAX_WORKERS];
+static int n_workers= 0;
+static gboolean stopped= FALSE;		// The pool is not restarted after workers_stop
+static pthread_mutex_t wmutex= PTHREAD_MUTEX_INITIALIZER;	// Serializes start/stop
+
+
+/** Read the CPU list 'str' ("0-3,8") to 'cpus'; returns the number of CPUs */
+int parse_cpu_list(const char *str, int *cpus, int max) {
+	int n= 0;
+	const char *p= str;
+	while ((p != NULL) && (*p != '\0') && (n < max)) {
+		char *end;
+		long a= strtol(p, &end, 10), b;
+		if (end == p)
+			break;
+		b= a;
+		if (*end == '-') {
+			p= end + 1;
+			b= strtol(p, &end, 10);
+			if (end == p)
+				break;
+		}
+		for (; (a <= b) && (n < max); a++)
+			cpus[n++]= (int)a;
+		p= (*end == ',') ? end + 1 : NULL;
+	}
+	return n;
+}
+
+
+/** Read the first line of the file 'path' to 'buf'; returns FALSE on error */
+static gboolean read_line(const char *path, char *buf, int len) {
+	FILE *f= fopen(path, "r");
+	if (f == NULL)
+		return FALSE;
+	gboolean ok= (fgets(buf, len, f) != NULL);
+	fclose(f);
+	return ok;
+}
+
+
+/** Return the NUMA node of interface 'dev', or -1 if unknown */
+int interface_numa_node(const char *dev) {
+	char path[128], buf[32];
+	if (dev == NULL)
+		return -1;
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", dev);
+	if (!read_line(path, buf, sizeof(buf)))
+		return -1;	// Virtual interface, or no NUMA
+	return atoi(buf);
+}
+
+
+/** Read the CPUs of NUMA node 'node'; returns the number of CPUs */
+static int node_cpus(int node, int *cpus, int max) {
+	char path[128], buf[512];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	if (!read_line(path, buf, sizeof(buf)))
+		return 0;
+	return parse_cpu_list(buf, cpus, max);
+}
+
+
+/** Pin the calling thread to 'cpu' and prefer allocations on 'node' */
+static void place_worker(WORKER *w) {
+	if (w->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+			fprintf(stderr, "WRK> failed to pin worker to CPU %d\n", w->cpu);
+	}
+#ifdef SYS_set_mempolicy
+	if ((w->node >= 0) && (w->node < 8 * (int)sizeof(unsigned long))) {
+		unsigned long mask= 1UL << w->node;
+		if (syscall(SYS_set_mempolicy, WRK_MPOL_PREFERRED, &mask, 8 * sizeof(mask)))
+			perror("WRK> set_mempolicy");
+	}
+#endif
+}
+
+
+/** Worker thread: runs the jobs of its queue */
+static void *worker_function(void *ptr) {
+	WORKER *w= (WORKER *)ptr;
+	WORKER_JOB *job;
+
+	place_worker(w);
+	for (;;) {
+		pthread_mutex_lock(&w->mutex);
+		while (!w->stop && g_queue_is_empty(&w->jobs))
+			pthread_cond_wait(&w->cond, &w->mutex);
+		if (w->stop) {
+			// workers_stop took the queued jobs
+			pthread_mutex_unlock(&w->mutex);
+			break;
+		}
+		job= (WORKER_JOB *)g_queue_pop_head(&w->jobs);
+		pthread_mutex_unlock(&w->mutex);
+
+		job->fn(job->arg);
+		free(job);
+		__atomic_sub_fetch(&w->load, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+
+/** Start 'n' workers, pinned to the CPUs in the list 'cpus' ("0-3,8"); when 'cpus'
+ *  is NULL, to the CPUs of the NUMA node of interface 'dev' (NULL= any CPU) */
+gboolean workers_start(int n, const char *cpus, const char *dev) {
+	static int cpu_list[MAX_WORKER_CPUS];
+	int n_cpus= 0, node= -1, i;
+
+	if ((n <= 0) || (n > MAX_WORKERS)) {
+		fprintf(stderr, "WRK> invalid number of workers (%d)\n", n);
+		return FALSE;
+	}
+	pthread_mutex_lock(&wmutex);
+	if ((n_workers > 0) || stopped) {
+		pthread_mutex_unlock(&wmutex);
+		return (n_workers > 0);	// Already running, or stopped for good
+	}
+	if (cpus != NULL) {
+		n_cpus= parse_cpu_list(cpus, cpu_list, MAX_WORKER_CPUS);
+	} else if ((node= interface_numa_node(dev)) >= 0) {
+		n_cpus= node_cpus(node, cpu_list, MAX_WORKER_CPUS);
+	}
+	for (i= 0; i < n; i++) {
+		WORKER *w= &workers[i];
+		w->cpu= (n_cpus > 0) ? cpu_list[i % n_cpus] : -1;
+		w->node= node;
+		w->load= 0;
+		w->stop= FALSE;
+		g_queue_init(&w->jobs);
+		pthread_mutex_init(&w->mutex, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		if (pthread_create(&w->tid, NULL, worker_function, w)) {
+			perror("WRK> pthread_create");
+			break;
+		}
+		pthread_detach(w->tid);
+	}
+	__atomic_store_n(&n_workers, i, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&wmutex);
+	fprintf(stdout, "WRK> %d workers started (NUMA node %d, %d CPUs)\n", n_workers, node, n_cpus);
+	return (n_workers > 0);
+}
+
+
+/** Queue job 'fn(arg)' in the least-loaded worker; if workers_stop drops it, 'drop(arg)' is
+ *  called instead. Returns FALSE if the pool is not running */
+gboolean workers_submit(worker_job fn, worker_job drop, void *arg) {
+	int i, best= 0;
+	int n= __atomic_load_n(&n_workers, __ATOMIC_ACQUIRE);
+
+	if (n <= 0)
+		return FALSE;
+	for (i= 1; i < n; i++) {
+		if (__atomic_load_n(&workers[i].load, __ATOMIC_RELAXED) <
+				__atomic_load_n(&workers[best].load, __ATOMIC_RELAXED))
+			best= i;
+	}
+	WORKER_JOB *job= (WORKER_JOB *)malloc(sizeof(WORKER_JOB));
+	if (job == NULL)
+		return FALSE;
+	job->fn= fn;
+	job->drop= drop;
+	job->arg= arg;
+	WORKER *w= &workers[best];
+	pthread_mutex_lock(&w->mutex);
+	if (w->stop) {
+		// workers_stop ran since n_workers was read
+		pthread_mutex_unlock(&w->mutex);
+		free(job);
+		return FALSE;
+	}
+	__atomic_add_fetch(&w->load, 1, __ATOMIC_RELAXED);
+	g_queue_push_tail(&w->jobs, job);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	return TRUE;
+}
+
+
+/** Number of running workers (0 if the pool was not started) */
+int workers_count(void) {
+	return __atomic_load_n(&n_workers, __ATOMIC_ACQUIRE);
+}
+
+
+/** Ask the workers to leave after their current job; the queued jobs are dropped here,
+ *  calling their 'drop' function. The workers are detached: a worker blocked in a transfer
+ *  is not waited for */
+void workers_stop(void) {
+	GQueue dropped= G_QUEUE_INIT;
+	WORKER_JOB *job;
+	int i;
+	pthread_mutex_lock(&wmutex);
+	for (i= 0; i < n_workers; i++) {
+		pthread_mutex_lock(&workers[i].mutex);
+		workers[i].stop= TRUE;
+		while ((job= (WORKER_JOB *)g_queue_pop_head(&workers[i].jobs)) != NULL)
+			g_queue_push_tail(&dropped, job);
+		pthread_cond_signal(&workers[i].cond);
+		pthread_mutex_unlock(&workers[i].mutex);
+	}
+	__atomic_store_n(&n_workers, 0, __ATOMIC_RELEASE);
+	stopped= TRUE;
+	pthread_mutex_unlock(&wmutex);
+	// Without the locks, as the drop functions may take other locks
+	while ((job= (WORKER_JOB *)g_queue_pop_head(&dropped)) != NULL) {
+		if (job->drop != NULL)
+			job->drop(job->arg);
+		free(job);
+	}
+}
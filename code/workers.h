@@ -0,0 +1,43 @@
+/*****************************************************************************\
+ * Redes Integradas de Telecomunicacoes
+ * MIEEC/MEEC/MERSIM - FCT NOVA  2025/2026
+ *
+ * workers.h
+ *
+ * Header file of the worker pool: long-lived threads, pinned to CPUs close to
+ *   the network interface, that run the file transfers
+ *
+ * @author  Luis Bernardo
+\*****************************************************************************/
+#ifndef HAVE_WORKERS_H
+#define HAVE_WORKERS_H
+
+#include <glib.h>
+#include <pthread.h>
+
+// Maximum number of workers
+#define MAX_WORKERS		64
+// Maximum number of CPUs read from a CPU list
+#define MAX_WORKER_CPUS	1024
+
+// Job run by a worker
+typedef void *(*worker_job)(void *arg);
+
+// Start 'n' workers, pinned to the CPUs in the list 'cpus' ("0-3,8"); when 'cpus'
+//   is NULL, to the CPUs of the NUMA node of interface 'dev' (NULL= any CPU)
+gboolean workers_start(int n, const char *cpus, const char *dev);
+// Queue job 'fn(arg)' in the least-loaded worker; if workers_stop drops it, 'drop(arg)' is
+//   called instead (NULL= none). Returns FALSE if the pool is not running
+gboolean workers_submit(worker_job fn, worker_job drop, void *arg);
+// Number of running workers (0 if the pool was not started)
+int workers_count(void);
+// Ask the workers to leave after their current job; queued jobs are dropped, calling
+//   their 'drop' function. The pool cannot be started again
+void workers_stop(void);
+
+// Read the CPU list 'str' ("0-3,8") to 'cpus'; returns the number of CPUs
+int parse_cpu_list(const char *str, int *cpus, int max);
+// Return the NUMA node of interface 'dev', or -1 if unknown
+int interface_numa_node(const char *dev);
+
+#endif